@@ -9,8 +9,12 @@
 #include <openssl/aes.h>
 #include <openssl/sha.h>
 #include <secp256k1.h>
+#include <atomic>
 #include <string>
 
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
 
 static secp256k1_context* secp256k1_context_sign = NULL;
 
@@ -31,11 +35,16 @@ void DecryptAES(uint256 encryptedIn, uint256 decryptionKey, uint256& output)
     AES_decrypt(encryptedIn.begin(), output.begin(), &key);
 }
 
-void ComputePreFactor(std::string strPassphrase, std::string strSalt, uint256& prefactor)
+unsigned int GetBip38Threads()
+{
+    return std::max(1U, std::min(MAX_BIP38_THREADS, boost::thread::hardware_concurrency()));
+}
+
+void ComputePreFactor(std::string strPassphrase, std::string strSalt, uint256& prefactor, unsigned int nThreads)
 {
     //passfactor is the scrypt hash of passphrase and ownersalt (NOTE this needs to handle alt cases too in the future)
     uint64_t s = uint256(ReverseEndianString(strSalt)).Get64();
-    scrypt_hash(strPassphrase.c_str(), strPassphrase.size(), BEGIN(s), strSalt.size() / 2, BEGIN(prefactor), 16384, 8, 8, 32);
+    scrypt_hash(strPassphrase.c_str(), strPassphrase.size(), BEGIN(s), strSalt.size() / 2, BEGIN(prefactor), 16384, 8, 8, 32, nThreads);
 }
 
 void ComputePassfactor(std::string ownersalt, uint256 prefactor, uint256& passfactor)
@@ -82,13 +91,13 @@ std::string AddressToBip38Hash(std::string address)
     return HexStr(addrCheck).substr(0, 8);
 }
 
-std::string BIP38_Encrypt(std::string strAddress, std::string strPassphrase, uint256 privKey)
+std::string BIP38_Encrypt(std::string strAddress, std::string strPassphrase, uint256 privKey, unsigned int nThreads)
 {
     string strAddressHash = AddressToBip38Hash(strAddress);
 
     uint512 hashed;
     uint64_t salt = uint256(ReverseEndianString(strAddressHash)).Get64();
-    scrypt_hash(strPassphrase.c_str(), strPassphrase.size(), BEGIN(salt), strAddressHash.size() / 2, BEGIN(hashed), 16384, 8, 8, 64);
+    scrypt_hash(strPassphrase.c_str(), strPassphrase.size(), BEGIN(salt), strAddressHash.size() / 2, BEGIN(hashed), 16384, 8, 8, 64, nThreads);
 
     uint256 derivedHalf1(hashed.ToString().substr(64, 64));
     uint256 derivedHalf2(hashed.ToString().substr(0, 64));
@@ -123,7 +132,7 @@ std::string BIP38_Encrypt(std::string strAddress, std::string strPassphrase, uin
     return EncodeBase58(encryptedKey.begin(), encryptedKey.begin() + 43);
 }
 
-bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint256& privKey, bool& fCompressed)
+bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint256& privKey, bool& fCompressed, unsigned int nThreads)
 {
     std::string strKey = DecodeBase58(strEncryptedKey.c_str());
 
@@ -149,7 +158,7 @@ bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint2
         uint512 hashed;
         encryptedPart1 = uint256(ReverseEndianString(strKey.substr(14, 32)));
         uint64_t salt = uint256(ReverseEndianString(strAddressHash)).Get64();
-        scrypt_hash(strPassphrase.c_str(), strPassphrase.size(), BEGIN(salt), strAddressHash.size() / 2, BEGIN(hashed), 16384, 8, 8, 64);
+        scrypt_hash(strPassphrase.c_str(), strPassphrase.size(), BEGIN(salt), strAddressHash.size() / 2, BEGIN(hashed), 16384, 8, 8, 64, nThreads);
 
         uint256 derivedHalf1(hashed.ToString().substr(64, 64));
         uint256 derivedHalf2(hashed.ToString().substr(0, 64));
@@ -178,7 +187,7 @@ bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint2
         prefactorSalt = ownersalt.substr(0, 8);
 
     uint256 prefactor;
-    ComputePreFactor(strPassphrase, prefactorSalt, prefactor);
+    ComputePreFactor(strPassphrase, prefactorSalt, prefactor, nThreads);
 
     uint256 passfactor;
     if (fLotSequence)
@@ -234,3 +243,44 @@ bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint2
 
     return strAddressHash == AddressToBip38Hash(address);
 }
+
+namespace
+{
+/** Call fn for every key of a batch; the threads share out the keys, and what is left over of them the scrypt lanes of each key */
+void ForEachBip38Key(size_t nKeys, const boost::function<void(size_t, unsigned int)>& fn)
+{
+    unsigned int nThreads = GetBip38Threads();
+    unsigned int nKeyThreads = std::max<size_t>(1, std::min<size_t>(nThreads, nKeys));
+    unsigned int nLaneThreads = std::max(1U, nThreads / nKeyThreads);
+
+    std::atomic<size_t> nNext(0);
+    auto threadKeys = [&]() {
+        RenameThread("lux-bip38");
+        for (size_t i = nNext++; i < nKeys; i = nNext++)
+            fn(i, nLaneThreads);
+    };
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < nKeyThreads; i++)
+        threads.create_thread(threadKeys);
+    threads.join_all();
+}
+}
+
+std::vector<std::string> BIP38_EncryptBatch(const std::vector<std::pair<std::string, uint256> >& vKeys, std::string strPassphrase)
+{
+    std::vector<std::string> vEncrypted(vKeys.size());
+    ForEachBip38Key(vKeys.size(), [&](size_t i, unsigned int nThreads) {
+        vEncrypted[i] = BIP38_Encrypt(vKeys[i].first, strPassphrase, vKeys[i].second, nThreads);
+    });
+    return vEncrypted;
+}
+
+std::vector<CBip38Decrypted> BIP38_DecryptBatch(std::string strPassphrase, const std::vector<std::string>& vEncryptedKeys)
+{
+    std::vector<CBip38Decrypted> vDecrypted(vEncryptedKeys.size());
+    ForEachBip38Key(vEncryptedKeys.size(), [&](size_t i, unsigned int nThreads) {
+        CBip38Decrypted& decrypted = vDecrypted[i];
+        decrypted.fValid = BIP38_Decrypt(strPassphrase, vEncryptedKeys[i], decrypted.privKey, decrypted.fCompressed, nThreads);
+    });
+    return vDecrypted;
+}
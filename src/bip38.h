@@ -6,6 +6,11 @@
 #include "uint256.h"
 
 #include <string>
+#include <utility>
+#include <vector>
+
+/** Up to how many threads derive BIP38 keys; each one needs 16MB for scrypt */
+static const unsigned int MAX_BIP38_THREADS = 8;
 
 
 /** 39 bytes - 78 characters
@@ -19,7 +24,10 @@
 
 void DecryptAES(uint256 encryptedIn, uint256 decryptionKey, uint256& output);
 
-void ComputePreFactor(std::string strPassphrase, std::string strSalt, uint256& prefactor);
+/** How many threads to derive keys on: the cores there are, up to MAX_BIP38_THREADS */
+unsigned int GetBip38Threads();
+
+void ComputePreFactor(std::string strPassphrase, std::string strSalt, uint256& prefactor, unsigned int nThreads = 1);
 
 void ComputePassfactor(std::string ownersalt, uint256 prefactor, uint256& passfactor);
 
@@ -31,8 +39,22 @@ void ComputeSeedBPass(CPubKey passpoint, std::string strAddressHash, std::string
 
 void ComputeFactorB(uint256 seedB, uint256& factorB);
 
-std::string BIP38_Encrypt(std::string strAddress, std::string strPassphrase, uint256 privKey);
-bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint256& privKey, bool& fCompressed);
+/** The scrypt of a single key runs its 8 lanes on up to nThreads threads */
+std::string BIP38_Encrypt(std::string strAddress, std::string strPassphrase, uint256 privKey, unsigned int nThreads = GetBip38Threads());
+bool BIP38_Decrypt(std::string strPassphrase, std::string strEncryptedKey, uint256& privKey, bool& fCompressed, unsigned int nThreads = GetBip38Threads());
+
+/** A key out of BIP38_DecryptBatch, fValid telling whether it could be decrypted */
+struct CBip38Decrypted {
+    uint256 privKey;
+    bool fCompressed;
+    bool fValid;
+
+    CBip38Decrypted() : fCompressed(false), fValid(false) {}
+};
+
+/** Encrypt (address, private key) pairs with one passphrase, the keys derived in parallel; same order out as in */
+std::vector<std::string> BIP38_EncryptBatch(const std::vector<std::pair<std::string, uint256> >& vKeys, std::string strPassphrase);
+std::vector<CBip38Decrypted> BIP38_DecryptBatch(std::string strPassphrase, const std::vector<std::string>& vEncryptedKeys);
 
 std::string AddressToBip38Hash(std::string address);
 
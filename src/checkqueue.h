@@ -5,7 +5,12 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "sync.h"
+
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -16,6 +21,9 @@
 template <typename T>
 class CCheckQueueControl;
 
+/** Worker queues of a CCheckQueue, threads beyond that share them */
+static const unsigned int MAX_CHECKQUEUE_WORKERS = 64;
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -25,12 +33,28 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own queue, which the master spreads the checks over
+  * as they are added. Workers take the newest checks of their own queue and
+  * when it runs dry steal the oldest half of another one, so adding and taking
+  * checks rarely contend and the checks of a transaction start as soon as it
+  * is added. The shared mutex is only taken to sleep and wake up.
+  *
+  * Checks added with AddBackground() are run by idle workers when there is
+  * nothing else to do, and their results ignored. They are used to warm
+  * caches ahead of the checks that count.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Checks of one worker
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! Mutex to sleep and wake up on, and to protect the background state
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,90 +63,148 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! CancelBackground() blocks on this until the running background checks finish
+    boost::condition_variable condBackground;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Queue 0 belongs to the master, the workers get the others in the order they start
+    std::vector<std::unique_ptr<WorkerQueue> > queues;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads started, excluding the master.
+    std::atomic<unsigned int> nWorkers;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Queue the next check added goes to
+    std::atomic<unsigned int> nNextQueue;
+
+    //! Checks in the worker queues, counted before they are queued and after they are taken.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are not anymore in queue, but still in
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Checks whose results are not needed, run when there is nothing else to do
+    std::deque<T> background;
+
+    //! Background checks queued, read without the mutex to decide whether to sleep
+    std::atomic<unsigned int> nBackgroundQueued;
+
+    //! Batches of background checks being run
+    unsigned int nBackgroundRunning;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    unsigned int QueueCount() const
+    {
+        return std::min(nWorkers.load() + 1, MAX_CHECKQUEUE_WORKERS);
+    }
+
+    /** Take a batch of checks, from the worker's own queue or stolen from another one */
+    bool Take(unsigned int nQueue, std::vector<T>& vChecks)
+    {
+        unsigned int nQueues = QueueCount();
+        for (unsigned int i = 0; i < nQueues && nQueued > 0; i++) {
+            WorkerQueue& queue = *queues[(nQueue + i) % nQueues];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            if (queue.checks.empty())
+                continue;
+            // Aim for increasingly smaller batches so all workers finish approximately
+            // simultaneously. The own queue is taken from the back and another one from
+            // the front, so the owner and the thieves meet in the middle.
+            unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.checks.size() / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                // swap jobs to the local batch vector instead of copying
+                if (i == 0) {
+                    vChecks[j].swap(queue.checks.back());
+                    queue.checks.pop_back();
+                } else {
+                    vChecks[j].swap(queue.checks.front());
+                    queue.checks.pop_front();
+                }
+            }
+            nQueued -= nNow;
+            return true;
+        }
+        return false;
+    }
+
+    /** Take a batch of background checks, counted as running until FinishBackground() */
+    bool TakeBackground(std::vector<T>& vChecks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (background.empty())
+            return false;
+        unsigned int nNow = std::min(nBatchSize, (unsigned int)background.size());
+        vChecks.resize(nNow);
+        for (unsigned int j = 0; j < nNow; j++) {
+            vChecks[j].swap(background.front());
+            background.pop_front();
+        }
+        nBackgroundQueued -= nNow;
+        nBackgroundRunning++;
+        return true;
+    }
+
+    void FinishBackground()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (--nBackgroundRunning == 0)
+            condBackground.notify_all();
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nQueue, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+            if (Take(nQueue, vChecks)) {
+                unsigned int nNow = vChecks.size();
+                // Check whether we need to do work at all
+                bool fOk = fAllOk;
+                BOOST_FOREACH (T& check, vChecks)
+                    if (fOk)
+                        fOk = check();
+                vChecks.clear();
+                if (!fOk)
+                    fAllOk = false;
+                if ((nTodo -= nNow) == 0) {
+                    // We processed the last element; inform the master he can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                continue;
+            }
+            if (!fMaster && nBackgroundQueued > 0 && TakeBackground(vChecks)) {
+                BOOST_FOREACH (T& check, vChecks)
+                    check();
+                vChecks.clear();
+                FinishBackground();
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                if (nTodo == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    fAllOk = true;
+                    // return the current status
+                    return fRet;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                // the last checks are being run by workers
+                if (nQueued == 0)
+                    condMaster.wait(lock);
+            } else if (nQueued == 0 && nBackgroundQueued == 0) {
+                condWorker.wait(lock); // wait
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
@@ -132,45 +214,77 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nWorkers(0), nNextQueue(0), nQueued(0), nTodo(0), fAllOk(true), nBackgroundQueued(0), nBackgroundRunning(0), nBatchSize(nBatchSizeIn)
+    {
+        for (unsigned int i = 0; i < MAX_CHECKQUEUE_WORKERS; i++)
+            queues.emplace_back(new WorkerQueue());
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nQueue = std::min(++nWorkers, MAX_CHECKQUEUE_WORKERS - 1);
+        Loop(nQueue);
     }
 
     //! Wait until execution finishes, and return whether all evaluations where successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
+        // spread the checks over the queues in runs, starting where the last batch ended
+        unsigned int nQueues = QueueCount();
+        unsigned int nRun = std::max<unsigned int>(1, (vChecks.size() + nQueues - 1) / nQueues);
+        for (size_t i = 0; i < vChecks.size(); i += nRun) {
+            WorkerQueue& queue = *queues[nNextQueue++ % nQueues];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (size_t j = i; j < std::min(i + nRun, vChecks.size()); j++) {
+                queue.checks.push_back(T());
+                vChecks[j].swap(queue.checks.back());
+            }
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
-    ~CCheckQueue()
+    //! Add checks for idle workers to run, whose results are ignored
+    void AddBackground(std::vector<T>& vChecks)
     {
+        if (vChecks.empty())
+            return;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_FOREACH (T& check, vChecks) {
+            background.push_back(T());
+            check.swap(background.back());
+        }
+        nBackgroundQueued += vChecks.size();
+        condWorker.notify_all();
     }
-#if 0
-    bool IsIdle()
+
+    //! Drop the background checks not started yet and wait for the running ones
+    void CancelBackground()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        background.clear();
+        nBackgroundQueued = 0;
+        while (nBackgroundRunning > 0)
+            condBackground.wait(lock);
+    }
+
+    ~CCheckQueue()
+    {
     }
-#endif
 };
 
 /** 
@@ -0,0 +1,94 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinselection.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+struct CompareEffectiveValue {
+    bool operator()(const CInputCoin& a, const CInputCoin& b) const
+    {
+        return a.nEffectiveValue > b.nEffectiveValue;
+    }
+};
+}
+
+bool SelectCoinsBnB(std::vector<CInputCoin>& vPool, const CAmount& nTargetValue, const CAmount& nCostOfChange,
+    std::vector<CInputCoin>& vSelectedRet, CAmount& nValueRet, size_t nMaxTries)
+{
+    vSelectedRet.clear();
+    nValueRet = 0;
+
+    // the largest coins first, so that too much is found early and those branches are cut
+    std::sort(vPool.begin(), vPool.end(), CompareEffectiveValue());
+
+    CAmount nAvailable = 0;
+    for (const CInputCoin& coin : vPool) {
+        if (coin.nEffectiveValue <= 0)
+            return false;
+        nAvailable += coin.nEffectiveValue;
+    }
+    if (nAvailable < nTargetValue)
+        return false;
+
+    // vfSelection[i] tells whether vPool[i] is in the branch being walked
+    std::vector<bool> vfSelection;
+    std::vector<bool> vfBest;
+    CAmount nValue = 0;
+    CAmount nBestExcess = std::numeric_limits<CAmount>::max();
+    vfSelection.reserve(vPool.size());
+
+    for (size_t nTries = 0; nTries < nMaxTries; nTries++) {
+        bool fBacktrack = false;
+        if (nValue + nAvailable < nTargetValue || nValue > nTargetValue + nCostOfChange) {
+            // cannot reach the target any more, or went over the window
+            fBacktrack = true;
+        } else if (nValue >= nTargetValue) {
+            if (nValue - nTargetValue <= nBestExcess) {
+                nBestExcess = nValue - nTargetValue;
+                vfBest = vfSelection;
+                vfBest.resize(vPool.size(), false);
+                if (nBestExcess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // back to the last coin included and try the branch without it
+            while (!vfSelection.empty() && !vfSelection.back()) {
+                vfSelection.pop_back();
+                nAvailable += vPool[vfSelection.size()].nEffectiveValue;
+            }
+            if (vfSelection.empty())
+                break; // every branch was looked at
+            vfSelection.back() = false;
+            nValue -= vPool[vfSelection.size() - 1].nEffectiveValue;
+        } else {
+            const size_t n = vfSelection.size();
+            nAvailable -= vPool[n].nEffectiveValue;
+            // including a coin worth the same as the one just left out gives a branch already seen
+            if (n > 0 && !vfSelection.back() && vPool[n].nEffectiveValue == vPool[n - 1].nEffectiveValue) {
+                vfSelection.push_back(false);
+            } else {
+                vfSelection.push_back(true);
+                nValue += vPool[n].nEffectiveValue;
+            }
+        }
+    }
+
+    if (vfBest.empty())
+        return false;
+
+    for (size_t i = 0; i < vPool.size(); i++) {
+        if (vfBest[i]) {
+            vSelectedRet.push_back(vPool[i]);
+            nValueRet += vPool[i].nValue;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSELECTION_H
+#define BITCOIN_COINSELECTION_H
+
+#include "amount.h"
+
+#include <utility>
+#include <vector>
+
+class CWalletTx;
+
+//! Size of an input spending a pay to pubkey hash output with a compressed key
+static const size_t INPUT_SIZE_P2PKH = 148;
+//! Size of a pay to pubkey hash change output
+static const size_t CHANGE_OUTPUT_SIZE = 34;
+//! Combinations the branch and bound search looks at before it gives up
+static const size_t BNB_TOTAL_TRIES = 100000;
+
+/** An output that can be spent, with what it is worth once the fee to spend it is paid */
+struct CInputCoin {
+    std::pair<const CWalletTx*, unsigned int> coin;
+    CAmount nValue;
+    CAmount nEffectiveValue;
+
+    CInputCoin(const CWalletTx* pwtx, unsigned int n, CAmount nValueIn, CAmount nInputFee)
+        : coin(pwtx, n), nValue(nValueIn), nEffectiveValue(nValueIn - nInputFee) {}
+};
+
+/** What the wallet needs to look for a selection that leaves no change */
+struct CCoinSelectionParams {
+    //! Fee rate the inputs are paid at
+    CFeeRate feeRate;
+    //! Payees plus the fee of the transaction without its inputs
+    CAmount nTargetValue;
+    //! Fee of a change output and of spending it later, the most a selection may go over
+    CAmount nCostOfChange;
+
+    CCoinSelectionParams(const CFeeRate& feeRateIn, CAmount nTargetValueIn)
+        : feeRate(feeRateIn), nTargetValue(nTargetValueIn),
+          nCostOfChange(feeRateIn.GetFee(CHANGE_OUTPUT_SIZE) + feeRateIn.GetFee(INPUT_SIZE_P2PKH)) {}
+};
+
+/**
+ * Depth first search for the coins whose effective values add up to between
+ * nTargetValue and nTargetValue + nCostOfChange, so that the transaction needs
+ * no change output. Of the matches found it keeps the one with the least
+ * excess. vPool is sorted by effective value, largest first; its coins must be
+ * worth more than their fee. Gives up after nMaxTries steps.
+ */
+bool SelectCoinsBnB(std::vector<CInputCoin>& vPool, const CAmount& nTargetValue, const CAmount& nCostOfChange,
+    std::vector<CInputCoin>& vSelectedRet, CAmount& nValueRet, size_t nMaxTries = BNB_TOTAL_TRIES);
+
+#endif // BITCOIN_COINSELECTION_H
@@ -0,0 +1,134 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	cpp-ethereum is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with cpp-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file LRUCache.h
+ * @date 2018
+ */
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <libdevcore/Guards.h>
+
+namespace dev
+{
+
+/**
+ * @brief Thread-safe least recently used cache, bounded by the total cost of its entries.
+ * Meant for values that never change for a key (e.g. trie nodes by hash), so entries
+ * never need to be invalidated. Counts hits and misses.
+ */
+template <class Key, class Value, class Hasher = std::hash<Key>>
+class LRUCache
+{
+public:
+	struct Stats
+	{
+		size_t entries;
+		size_t cost;
+		size_t maxCost;
+		uint64_t hits;
+		uint64_t misses;
+	};
+
+	explicit LRUCache(size_t _maxCost): m_maxCost(_maxCost) {}
+
+	bool get(Key const& _key, Value& o_value)
+	{
+		Guard l(x_cache);
+		auto it = m_index.find(_key);
+		if (it == m_index.end())
+		{
+			++m_misses;
+			return false;
+		}
+		++m_hits;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		o_value = it->second->value;
+		return true;
+	}
+
+	void insert(Key const& _key, Value const& _value, size_t _cost)
+	{
+		Guard l(x_cache);
+		if (_cost > m_maxCost)
+			return;
+		auto it = m_index.find(_key);
+		if (it != m_index.end())
+		{
+			m_cost -= it->second->cost;
+			m_entries.erase(it->second);
+			m_index.erase(it);
+		}
+		m_entries.push_front(Entry{_key, _value, _cost});
+		m_index[_key] = m_entries.begin();
+		m_cost += _cost;
+		evict();
+	}
+
+	void erase(Key const& _key)
+	{
+		Guard l(x_cache);
+		auto it = m_index.find(_key);
+		if (it == m_index.end())
+			return;
+		m_cost -= it->second->cost;
+		m_entries.erase(it->second);
+		m_index.erase(it);
+	}
+
+	void setMaxCost(size_t _maxCost)
+	{
+		Guard l(x_cache);
+		m_maxCost = _maxCost;
+		evict();
+	}
+
+	Stats stats() const
+	{
+		Guard l(x_cache);
+		return Stats{m_index.size(), m_cost, m_maxCost, m_hits, m_misses};
+	}
+
+private:
+	struct Entry
+	{
+		Key key;
+		Value value;
+		size_t cost;
+	};
+
+	void evict()
+	{
+		while (m_cost > m_maxCost && !m_entries.empty())
+		{
+			m_cost -= m_entries.back().cost;
+			m_index.erase(m_entries.back().key);
+			m_entries.pop_back();
+		}
+	}
+
+	mutable Mutex x_cache;
+	std::list<Entry> m_entries;
+	std::unordered_map<Key, typename std::list<Entry>::iterator, Hasher> m_index;
+	size_t m_cost = 0;
+	size_t m_maxCost;
+	uint64_t m_hits = 0;
+	uint64_t m_misses = 0;
+};
+
+}
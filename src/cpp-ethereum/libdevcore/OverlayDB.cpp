@@ -45,10 +45,15 @@ class WriteBatchNoter: public ldb::WriteBatch::Handler
 };
 
 void OverlayDB::commit()
+{
+	ldb::WriteBatch batch;
+	commit(batch);
+}
+
+void OverlayDB::commit(ldb::WriteBatch& batch)
 {
 	if (m_db)
 	{
-		ldb::WriteBatch batch;
 //		cnote << "Committing nodes to disk DB:";
 #if DEV_GUARDED_DB
 		DEV_READ_GUARDED(x_this)
@@ -91,10 +96,23 @@ void OverlayDB::commit()
 		{
 			m_aux.clear();
 			m_main.clear();
+			m_kills.clear();
 		}
 	}
 }
 
+std::vector<std::pair<h256, unsigned>> OverlayDB::pendingInserts() const
+{
+#if DEV_GUARDED_DB
+	ReadGuard l(x_this);
+#endif
+	std::vector<std::pair<h256, unsigned>> ret;
+	for (auto const& i: m_main)
+		if (i.second.second)
+			ret.push_back(make_pair(i.first, i.second.second));
+	return ret;
+}
+
 bytes OverlayDB::lookupAux(h256 const& _h) const
 {
 	bytes ret = MemoryDB::lookupAux(_h);
@@ -115,13 +133,28 @@ void OverlayDB::rollback()
 	WriteGuard l(x_this);
 #endif
 	m_main.clear();
+	m_kills.clear();
+}
+
+/// Bookkeeping bytes of a node cache entry besides the node itself.
+static const size_t c_nodeCacheOverhead = 96;
+static const size_t c_defaultNodeCacheSize = 64 * 1024 * 1024;
+
+OverlayDB::NodeCache& OverlayDB::nodeCache()
+{
+	static NodeCache cache(c_defaultNodeCacheSize);
+	return cache;
 }
 
 std::string OverlayDB::lookup(h256 const& _h) const
 {
 	std::string ret = MemoryDB::lookup(_h);
-	if (ret.empty() && m_db)
+	if (ret.empty() && m_db && !nodeCache().get(_h, ret))
+	{
 		m_db->Get(m_readOptions, ldb::Slice((char const*)_h.data(), 32), &ret);
+		if (!ret.empty())
+			nodeCache().insert(_h, ret, ret.size() + c_nodeCacheOverhead);
+	}
 	return ret;
 }
 
@@ -129,10 +162,7 @@ bool OverlayDB::exists(h256 const& _h) const
 {
 	if (MemoryDB::exists(_h))
 		return true;
-	std::string ret;
-	if (m_db)
-		m_db->Get(m_readOptions, ldb::Slice((char const*)_h.data(), 32), &ret);
-	return !ret.empty();
+	return !lookup(_h).empty();
 }
 
 void OverlayDB::kill(h256 const& _h)
@@ -147,6 +177,8 @@ void OverlayDB::kill(h256 const& _h)
 		// empty storage tries.
 		if (ret.empty() && _h != EmptyTrie)
 			cnote << "Decreasing DB node ref count below zero with no DB node. Probably have a corrupt Trie." << _h;
+		else if (m_trackKills && _h != EmptyTrie)
+			m_kills.push_back(_h);
 
 		// TODO: for 1.1: ref-counted triedb.
 	}
@@ -161,6 +193,7 @@ bool OverlayDB::deepkill(h256 const& _h)
 	kill(_h);
 
 	//kill in overlayDB
+	nodeCache().erase(_h);
 	ldb::Status s = m_db->Delete(m_writeOptions, ldb::Slice((char const*)_h.data(), 32));
 	if (s.ok())
 		return true;
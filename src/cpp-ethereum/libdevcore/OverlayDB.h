@@ -26,6 +26,7 @@
 #include <libdevcore/Common.h>
 #include <libdevcore/Log.h>
 #include <libdevcore/MemoryDB.h>
+#include <libdevcore/LRUCache.h>
 
 namespace dev
 {
@@ -39,8 +40,17 @@ public:
 	ldb::DB* db() const { return m_db.get(); }
 
 	void commit();
+	/// Like commit() but writes the nodes in one go together with the entries already in @a _batch.
+	void commit(ldb::WriteBatch& _batch);
 	void rollback();
 
+	/// Record nodes on disk that lose a reference, as needed by a reference-counting pruner.
+	void setTrackKills(bool _track) { m_trackKills = _track; }
+	/// Nodes that gained references since the last commit, with the number of references gained.
+	std::vector<std::pair<h256, unsigned>> pendingInserts() const;
+	/// Nodes on disk that lost a reference since the last commit, once per lost reference.
+	h256s const& pendingKills() const { return m_kills; }
+
 	std::string lookup(h256 const& _h) const;
 	bool exists(h256 const& _h) const;
 	void kill(h256 const& _h);
@@ -48,6 +58,10 @@ public:
 
 	bytes lookupAux(h256 const& _h) const;
 
+	using NodeCache = LRUCache<h256, std::string>;
+	/// Nodes read from disk by any OverlayDB, keyed by their hash. Must be told about nodes deleted from disk.
+	static NodeCache& nodeCache();
+
 private:
 	using MemoryDB::clear;
 
@@ -55,6 +69,9 @@ private:
 
 	ldb::ReadOptions m_readOptions;
 	ldb::WriteOptions m_writeOptions;
+
+	bool m_trackKills = false;
+	h256s m_kills;
 };
 
 }
@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include "RLP.h"
 #include "picosha2.h"
 using namespace std;
@@ -63,16 +64,6 @@ decsha3(512)
 /******** The Keccak-f[1600] permutation ********/
 
 /*** Constants. ***/
-static const uint8_t rho[24] = \
-  { 1,  3,   6, 10, 15, 21,
-	28, 36, 45, 55,  2, 14,
-	27, 41, 56,  8, 25, 43,
-	62, 18, 39, 61, 20, 44};
-static const uint8_t pi[24] = \
-  {10,  7, 11, 17, 18, 3,
-	5, 16,  8, 21, 24, 4,
-   15, 23, 19, 13, 12, 2,
-   20, 14, 22,  9, 6,  1};
 static const uint64_t RC[24] = \
   {1ULL, 0x8082ULL, 0x800000000000808aULL, 0x8000000080008000ULL,
    0x808bULL, 0x80000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
@@ -81,84 +72,140 @@ static const uint64_t RC[24] = \
    0x8000000000008002ULL, 0x8000000000000080ULL, 0x800aULL, 0x800000008000000aULL,
    0x8000000080008081ULL, 0x8000000000008080ULL, 0x80000001ULL, 0x8000000080008008ULL};
 
-/*** Helper macros to unroll the permutation. ***/
-#define rol(x, s) (((x) << s) | ((x) >> (64 - s)))
-#define REPEAT6(e) e e e e e e
-#define REPEAT24(e) REPEAT6(e e e e)
-#define REPEAT5(e) e e e e e
-#define FOR5(v, s, e) \
-  v = 0;            \
-  REPEAT5(e; v += s;)
-
-/*** Keccak-f[1600] ***/
-static inline void keccakf(void* state) {
-  uint64_t* a = (uint64_t*)state;
-  uint64_t b[5] = {0};
-  uint64_t t = 0;
-  uint8_t x, y;
+/*** One round, fully unrolled. ***/
+// The lanes are A[x + 5 * y]. It is written in terms of the lane operations
+// XOR, XOR5, ROL, CHI(a, b, c) = a ^ (~b & c) and RC_LANE, which every backend
+// defines for its lane type, plain 64-bit words or one word of several states
+// in a SIMD register. B, C and D are temporaries of the lane type.
+#define KECCAK_ROUND(A, rc) \
+	C[0] = XOR5(A[0], A[5], A[10], A[15], A[20]); C[1] = XOR5(A[1], A[6], A[11], A[16], A[21]); \
+	C[2] = XOR5(A[2], A[7], A[12], A[17], A[22]); C[3] = XOR5(A[3], A[8], A[13], A[18], A[23]); \
+	C[4] = XOR5(A[4], A[9], A[14], A[19], A[24]); \
+	D[0] = XOR(C[4], ROL(C[1], 1)); D[1] = XOR(C[0], ROL(C[2], 1)); D[2] = XOR(C[1], ROL(C[3], 1)); \
+	D[3] = XOR(C[2], ROL(C[4], 1)); D[4] = XOR(C[3], ROL(C[0], 1)); \
+	/* Theta, rho and pi */ \
+	B[0] = XOR(A[0], D[0]); B[10] = ROL(XOR(A[1], D[1]), 1); B[20] = ROL(XOR(A[2], D[2]), 62); \
+	B[5] = ROL(XOR(A[3], D[3]), 28); B[15] = ROL(XOR(A[4], D[4]), 27); \
+	B[16] = ROL(XOR(A[5], D[0]), 36); B[1] = ROL(XOR(A[6], D[1]), 44); B[11] = ROL(XOR(A[7], D[2]), 6); \
+	B[21] = ROL(XOR(A[8], D[3]), 55); B[6] = ROL(XOR(A[9], D[4]), 20); \
+	B[7] = ROL(XOR(A[10], D[0]), 3); B[17] = ROL(XOR(A[11], D[1]), 10); B[2] = ROL(XOR(A[12], D[2]), 43); \
+	B[12] = ROL(XOR(A[13], D[3]), 25); B[22] = ROL(XOR(A[14], D[4]), 39); \
+	B[23] = ROL(XOR(A[15], D[0]), 41); B[8] = ROL(XOR(A[16], D[1]), 45); B[18] = ROL(XOR(A[17], D[2]), 15); \
+	B[3] = ROL(XOR(A[18], D[3]), 21); B[13] = ROL(XOR(A[19], D[4]), 8); \
+	B[14] = ROL(XOR(A[20], D[0]), 18); B[24] = ROL(XOR(A[21], D[1]), 2); B[9] = ROL(XOR(A[22], D[2]), 61); \
+	B[19] = ROL(XOR(A[23], D[3]), 56); B[4] = ROL(XOR(A[24], D[4]), 14); \
+	/* Chi */ \
+	A[0] = CHI(B[0], B[1], B[2]); A[1] = CHI(B[1], B[2], B[3]); A[2] = CHI(B[2], B[3], B[4]); \
+	A[3] = CHI(B[3], B[4], B[0]); A[4] = CHI(B[4], B[0], B[1]); \
+	A[5] = CHI(B[5], B[6], B[7]); A[6] = CHI(B[6], B[7], B[8]); A[7] = CHI(B[7], B[8], B[9]); \
+	A[8] = CHI(B[8], B[9], B[5]); A[9] = CHI(B[9], B[5], B[6]); \
+	A[10] = CHI(B[10], B[11], B[12]); A[11] = CHI(B[11], B[12], B[13]); A[12] = CHI(B[12], B[13], B[14]); \
+	A[13] = CHI(B[13], B[14], B[10]); A[14] = CHI(B[14], B[10], B[11]); \
+	A[15] = CHI(B[15], B[16], B[17]); A[16] = CHI(B[16], B[17], B[18]); A[17] = CHI(B[17], B[18], B[19]); \
+	A[18] = CHI(B[18], B[19], B[15]); A[19] = CHI(B[19], B[15], B[16]); \
+	A[20] = CHI(B[20], B[21], B[22]); A[21] = CHI(B[21], B[22], B[23]); A[22] = CHI(B[22], B[23], B[24]); \
+	A[23] = CHI(B[23], B[24], B[20]); A[24] = CHI(B[24], B[20], B[21]); \
+	/* Iota */ \
+	A[0] = XOR(A[0], RC_LANE(rc));
 
+/*** Keccak-f[1600] on one state of 64-bit lanes ***/
+#define XOR(a, b) ((a) ^ (b))
+#define XOR5(a, b, c, d, e) ((a) ^ (b) ^ (c) ^ (d) ^ (e))
+#define ROL(a, s) rol64((a), (s))
+#define CHI(a, b, c) ((a) ^ (~(b) & (c)))
+#define RC_LANE(rc) (rc)
+
+static inline uint64_t rol64(uint64_t x, unsigned s) { return (x << s) | (x >> (64 - s)); }
+
+static void keccakf(uint64_t* state) {
+  uint64_t A[25], B[25], C[5], D[5];
+  memcpy(A, state, sizeof(A));
   for (int i = 0; i < 24; i++) {
-	// Theta
-	FOR5(x, 1,
-		 b[x] = 0;
-		 FOR5(y, 5,
-			  b[x] ^= a[x + y]; ))
-	FOR5(x, 1,
-		 FOR5(y, 5,
-			  a[y + x] ^= b[(x + 4) % 5] ^ rol(b[(x + 1) % 5], 1); ))
-	// Rho and pi
-	t = a[1];
-	x = 0;
-	REPEAT24(b[0] = a[pi[x]];
-			 a[pi[x]] = rol(t, rho[x]);
-			 t = b[0];
-			 x++; )
-	// Chi
-	FOR5(y,
-	   5,
-	   FOR5(x, 1,
-			b[x] = a[y + x];)
-	   FOR5(x, 1,
-			a[y + x] = b[x] ^ ((~b[(x + 1) % 5]) & b[(x + 2) % 5]); ))
-	// Iota
-	a[0] ^= RC[i];
+	KECCAK_ROUND(A, RC[i])
   }
+  memcpy(state, A, sizeof(A));
 }
 
-/******** The FIPS202-defined functions. ********/
+#undef XOR
+#undef XOR5
+#undef ROL
+#undef CHI
+#undef RC_LANE
 
-/*** Some helper macros. ***/
+/*** Keccak-f[1600] on 4 and 8 states side by side, lane i of state w at state[W * i + w] ***/
+// Compiled for AVX2 and AVX-512 whatever the target, the CPU is checked before they run.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define KECCAK_X86 1
+#include <immintrin.h>
 
-#define _(S) do { S } while (0)
-#define FOR(i, ST, L, S) \
-  _(for (size_t i = 0; i < L; i += ST) { S; })
-#define mkapply_ds(NAME, S)                                          \
-  static inline void NAME(uint8_t* dst,                              \
-						  const uint8_t* src,                        \
-						  size_t len) {                              \
-	FOR(i, 1, len, S);                                               \
-  }
-#define mkapply_sd(NAME, S)                                          \
-  static inline void NAME(const uint8_t* src,                        \
-						  uint8_t* dst,                              \
-						  size_t len) {                              \
-	FOR(i, 1, len, S);                                               \
+#define XOR(a, b) _mm256_xor_si256((a), (b))
+#define XOR5(a, b, c, d, e) XOR(XOR(XOR(a, b), XOR(c, d)), e)
+#define ROL(a, s) _mm256_or_si256(_mm256_slli_epi64((a), (s)), _mm256_srli_epi64((a), 64 - (s)))
+#define CHI(a, b, c) XOR((a), _mm256_andnot_si256((b), (c)))
+#define RC_LANE(rc) _mm256_set1_epi64x((long long)(rc))
+
+__attribute__((target("avx2")))
+static void keccakfx4(uint64_t* state) {
+  __m256i A[25], B[25], C[5], D[5];
+  for (int i = 0; i < 25; i++)
+	A[i] = _mm256_load_si256((__m256i const*)(state + 4 * i));
+  for (int i = 0; i < 24; i++) {
+	KECCAK_ROUND(A, RC[i])
   }
+  for (int i = 0; i < 25; i++)
+	_mm256_store_si256((__m256i*)(state + 4 * i), A[i]);
+}
 
-mkapply_ds(xorin, dst[i] ^= src[i])  // xorin
-mkapply_sd(setout, dst[i] = src[i])  // setout
+#undef XOR
+#undef XOR5
+#undef ROL
+#undef CHI
+#undef RC_LANE
 
-#define P keccakf
-#define Plen 200
+// ternary logic 0x96 is a ^ b ^ c, 0xd2 is a ^ (~b & c)
+#define XOR(a, b) _mm512_xor_si512((a), (b))
+#define XOR5(a, b, c, d, e) _mm512_ternarylogic_epi64(_mm512_ternarylogic_epi64((a), (b), (c), 0x96), (d), (e), 0x96)
+#define ROL(a, s) _mm512_rol_epi64((a), (s))
+#define CHI(a, b, c) _mm512_ternarylogic_epi64((a), (b), (c), 0xd2)
+#define RC_LANE(rc) _mm512_set1_epi64((long long)(rc))
 
-// Fold P*F over the full blocks of an input.
-#define foldP(I, L, F) \
-  while (L >= rate) {  \
-	F(a, I, rate);     \
-	P(a);              \
-	I += rate;         \
-	L -= rate;         \
+__attribute__((target("avx512f")))
+static void keccakfx8(uint64_t* state) {
+  __m512i A[25], B[25], C[5], D[5];
+  for (int i = 0; i < 25; i++)
+	A[i] = _mm512_load_si512((void const*)(state + 8 * i));
+  for (int i = 0; i < 24; i++) {
+	KECCAK_ROUND(A, RC[i])
   }
+  for (int i = 0; i < 25; i++)
+	_mm512_store_si512((void*)(state + 8 * i), A[i]);
+}
+
+#undef XOR
+#undef XOR5
+#undef ROL
+#undef CHI
+#undef RC_LANE
+#endif
+
+#undef KECCAK_ROUND
+
+/******** The FIPS202-defined functions. ********/
+
+// Lanes are read and written as little-endian words, like the state always was.
+static inline uint64_t load64(const uint8_t* src) {
+  uint64_t lane;
+  memcpy(&lane, src, 8);
+  return lane;
+}
+
+// Xor a block of rate bytes into lanes stride apart.
+static inline void xorin(uint64_t* a, size_t stride, const uint8_t* src, size_t rate) {
+  for (size_t i = 0; i < rate / 8; i++)
+	a[i * stride] ^= load64(src + 8 * i);
+}
+
+#define Plen 200
 
 /** The sponge-based hash construction. **/
 static inline int hash(uint8_t* out, size_t outlen,
@@ -167,23 +214,80 @@ static inline int hash(uint8_t* out, size_t outlen,
   if ((out == NULL) || ((in == NULL) && inlen != 0) || (rate >= Plen)) {
 	return -1;
   }
-  uint8_t a[Plen] = {0};
+  uint64_t a[25] = {0};
   // Absorb input.
-  foldP(in, inlen, xorin);
-  // Xor in the DS and pad frame.
-  a[inlen] ^= delim;
-  a[rate - 1] ^= 0x80;
-  // Xor in the last block.
-  xorin(a, in, inlen);
+  while (inlen >= rate) {
+	xorin(a, 1, in, rate);
+	keccakf(a);
+	in += rate;
+	inlen -= rate;
+  }
+  // Xor in the last block with the DS and pad frame.
+  uint8_t last[Plen] = {0};
+  if (inlen)
+	memcpy(last, in, inlen);
+  last[inlen] ^= delim;
+  last[rate - 1] ^= 0x80;
+  xorin(a, 1, last, rate);
   // Apply P
-  P(a);
+  keccakf(a);
   // Squeeze output.
-  foldP(out, outlen, setout);
-  setout(a, out, outlen);
+  while (outlen >= rate) {
+	memcpy(out, a, rate);
+	keccakf(a);
+	out += rate;
+	outlen -= rate;
+  }
+  memcpy(out, a, outlen);
   memset(a, 0, 200);
   return 0;
 }
 
+#ifdef KECCAK_X86
+/** Keccak-256 of W inputs at once, the states stepping together until the longest input is absorbed. **/
+template <unsigned W>
+static void keccak256xN(void (*permute)(uint64_t*), bytesConstRef const* in, h256* out) {
+  size_t const rate = 136;
+  alignas(64) uint64_t a[25 * W] = {0};
+  size_t blocks[W];
+  size_t maxBlocks = 0;
+  for (unsigned w = 0; w < W; w++) {
+	blocks[w] = in[w].size() / rate + 1;
+	maxBlocks = std::max(maxBlocks, blocks[w]);
+  }
+  for (size_t k = 0; k < maxBlocks; k++) {
+	for (unsigned w = 0; w < W; w++) {
+	  if (k + 1 < blocks[w]) {
+		xorin(a + w, W, in[w].data() + k * rate, rate);
+	  } else if (k + 1 == blocks[w]) {
+		uint8_t last[rate] = {0};
+		size_t inlen = in[w].size() - k * rate;
+		if (inlen)
+		  memcpy(last, in[w].data() + k * rate, inlen);
+		last[inlen] ^= 0x01;
+		last[rate - 1] ^= 0x80;
+		xorin(a + w, W, last, rate);
+	  }
+	}
+	permute(a);
+	// the states of inputs already absorbed keep being permuted, they are not used anymore
+	for (unsigned w = 0; w < W; w++)
+	  if (k + 1 == blocks[w])
+		for (unsigned i = 0; i < 4; i++)
+		  memcpy(out[w].data() + 8 * i, &a[W * i + w], 8);
+  }
+}
+
+static unsigned detectWidth() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+	return 8;
+  if (__builtin_cpu_supports("avx2"))
+	return 4;
+  return 1;
+}
+#endif
+
 /*** Helper macros to define SHA3 and SHAKE instances. ***/
 #define defshake(bits)                                            \
   int shake##bits(uint8_t* out, size_t outlen,                    \
@@ -213,12 +317,40 @@ defsha3(512)
 
 bool sha3(bytesConstRef _input, bytesRef o_output)
 {
-	// FIXME: What with unaligned memory?
 	if (o_output.size() != 32)
 		return false;
 	keccak::sha3_256(o_output.data(), 32, _input.data(), _input.size());
-//	keccak::keccak(ret.data(), 32, (uint64_t const*)_input.data(), _input.size());
 	return true;
 }
 
+unsigned sha3MaxWidth()
+{
+#ifdef KECCAK_X86
+	static unsigned const c_width = keccak::detectWidth();
+	return c_width;
+#else
+	return 1;
+#endif
+}
+
+void sha3(bytesConstRef const* _inputs, size_t _count, h256* o_outputs, unsigned _maxWidth)
+{
+	size_t i = 0;
+#ifdef KECCAK_X86
+	unsigned width = sha3MaxWidth();
+	if (_maxWidth && _maxWidth < width)
+		width = _maxWidth;
+	if (width >= 8)
+		for (; i + 8 <= _count; i += 8)
+			keccak::keccak256xN<8>(keccak::keccakfx8, _inputs + i, o_outputs + i);
+	if (width >= 4)
+		for (; i + 4 <= _count; i += 4)
+			keccak::keccak256xN<4>(keccak::keccakfx4, _inputs + i, o_outputs + i);
+#else
+	(void)_maxWidth;
+#endif
+	for (; i < _count; i++)
+		sha3(_inputs[i], o_outputs[i].ref());
+}
+
 }
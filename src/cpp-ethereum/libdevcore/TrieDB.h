@@ -334,6 +334,11 @@ public:
 	void insert(KeyType _k, bytes const& _value) { insert(_k, bytesConstRef(&_value)); }
 	void remove(KeyType _k) { Generic::remove(bytesConstRef((byte const*)&_k, sizeof(KeyType))); }
 
+	/// For tries that hash their keys, the same with the key already hashed.
+	void insert(KeyType _k, h256 const& _hashedKey, bytesConstRef _value) { Generic::insert(bytesConstRef((byte const*)&_k, sizeof(KeyType)), _hashedKey, _value); }
+	void insert(KeyType _k, h256 const& _hashedKey, bytes const& _value) { insert(_k, _hashedKey, bytesConstRef(&_value)); }
+	void remove(KeyType _k, h256 const& _hashedKey) { Generic::remove(bytesConstRef((byte const*)&_k, sizeof(KeyType)), _hashedKey); }
+
 	class iterator: public Generic::iterator
 	{
 	public:
@@ -395,6 +400,10 @@ public:
 	void insert(bytesConstRef _key, bytesConstRef _value) { Super::insert(sha3(_key), _value); }
 	void remove(bytesConstRef _key) { Super::remove(sha3(_key)); }
 
+	/// Same as above when the caller already has sha3(_key), from hashing several keys at once.
+	void insert(bytesConstRef, h256 const& _hashedKey, bytesConstRef _value) { Super::insert(_hashedKey, _value); }
+	void remove(bytesConstRef, h256 const& _hashedKey) { Super::remove(_hashedKey); }
+
 	// empty from the PoV of the iterator interface; still need a basic iterator impl though.
 	class iterator
 	{
@@ -443,14 +452,18 @@ public:
 
 	std::string at(bytesConstRef _key) const { return Super::at(sha3(_key)); }
 	bool contains(bytesConstRef _key) { return Super::contains(sha3(_key)); }
-	void insert(bytesConstRef _key, bytesConstRef _value)
+	void insert(bytesConstRef _key, bytesConstRef _value) { insert(_key, sha3(_key), _value); }
+
+	void remove(bytesConstRef _key) { Super::remove(sha3(_key)); }
+
+	/// Same as above when the caller already has sha3(_key), from hashing several keys at once.
+	void insert(bytesConstRef _key, h256 const& _hashedKey, bytesConstRef _value)
 	{
-		h256 hash = sha3(_key);
-		Super::insert(hash, _value);
-		Super::db()->insertAux(hash, _key);
+		Super::insert(_hashedKey, _value);
+		Super::db()->insertAux(_hashedKey, _key);
 	}
 
-	void remove(bytesConstRef _key) { Super::remove(sha3(_key)); }
+	void remove(bytesConstRef, h256 const& _hashedKey) { Super::remove(_hashedKey); }
 
 	// iterates over <key, value> pairs
 	class iterator: public GenericTrieDB<_DB>::iterator
@@ -497,6 +497,8 @@ void Executive::finalize()
 		m_res->excepted = m_excepted; // TODO: m_except is used only in ExtVM::call
 		m_res->newAddress = m_newAddress;
 		m_res->gasRefunded = m_ext ? m_ext->sub.refunds : 0;
+		if (m_ext)
+			m_res->suicides = m_ext->sub.suicides;
 	}
 }
 
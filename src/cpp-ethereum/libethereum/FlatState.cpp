@@ -0,0 +1,272 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	cpp-ethereum is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with cpp-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file FlatState.cpp
+ * @date 2018
+ */
+
+#include "FlatState.h"
+#include <libdevcore/Exceptions.h>
+#include <libdevcore/Log.h>
+#include <libdevcore/RLP.h>
+#include <libdevcore/TrieDB.h>
+using namespace std;
+using namespace dev;
+using namespace dev::eth;
+
+namespace
+{
+
+// Trie nodes use their 32 byte hash as key and aux entries 33 bytes, the index keys
+// have other sizes so a prefix scan can never hit a node.
+char const c_accountPrefix[] = "fa";
+char const c_storagePrefix[] = "fs";
+char const c_undoPrefix[] = "fu";
+string const c_rootKey = "flatroot";
+size_t const c_accountKeySize = 2 + 32;
+size_t const c_storageKeySize = 2 + 32 + 32;
+size_t const c_undoKeySize = 2 + 4;
+size_t const c_generateBatchSize = 10000;
+
+string accountKey(h256 const& _address)
+{
+	return string(c_accountPrefix, 2) + string((char const*)_address.data(), 32);
+}
+
+string storageKey(h256 const& _address, h256 const& _slot)
+{
+	return accountKey(_address).replace(0, 2, c_storagePrefix, 2) + string((char const*)_slot.data(), 32);
+}
+
+string undoKey(unsigned _number)
+{
+	string key(c_undoPrefix, 2);
+	for (int i = 3; i >= 0; i--)
+		key.push_back(char((_number >> (8 * i)) & 0xff));
+	return key;
+}
+
+bool hasPrefix(ldb::Slice const& _key, string const& _prefix, size_t _size)
+{
+	return _key.size() == _size && _key.starts_with(_prefix);
+}
+
+}
+
+void FlatState::Diff::wipe(h256 const& _address)
+{
+	wiped.insert(_address);
+	for (auto it = storage.lower_bound(make_pair(_address, h256())); it != storage.end() && it->first.first == _address;)
+		it = storage.erase(it);
+}
+
+bool FlatState::View::account(h256 const& _address, string& o_value) const
+{
+	ldb::ReadOptions o;
+	o.snapshot = snapshot.get();
+	return db.db()->Get(o, accountKey(_address), &o_value).ok();
+}
+
+string FlatState::View::storage(h256 const& _address, h256 const& _slot) const
+{
+	ldb::ReadOptions o;
+	o.snapshot = snapshot.get();
+	string ret;
+	db.db()->Get(o, storageKey(_address, _slot), &ret);
+	return ret;
+}
+
+FlatState::FlatState(OverlayDB const& _db):
+	m_db(_db)
+{
+}
+
+shared_ptr<FlatState::View const> FlatState::view() const
+{
+	Guard l(x_view);
+	return m_view;
+}
+
+void FlatState::setRoot(h256 const& _root)
+{
+	ldb::DB* db = m_db.db();
+	auto v = make_shared<View>();
+	v->root = _root;
+	v->db = m_db;
+	v->snapshot = shared_ptr<ldb::Snapshot const>(db->GetSnapshot(), [db](ldb::Snapshot const* _s) { db->ReleaseSnapshot(_s); });
+	Guard l(x_view);
+	m_view = v;
+}
+
+void FlatState::writeBatch(ldb::WriteBatch& _batch)
+{
+	ldb::Status s = m_db.db()->Write(ldb::WriteOptions(), &_batch);
+	if (!s.ok())
+		BOOST_THROW_EXCEPTION(FailedInvariant() << errinfo_comment("Flat state write failed: " + s.ToString()));
+	_batch.Clear();
+}
+
+void FlatState::open(h256 const& _root)
+{
+	string value;
+	if (m_db.db()->Get(ldb::ReadOptions(), c_rootKey, &value).ok() && RLP(value)[0].toHash<h256>() == _root)
+	{
+		setRoot(_root);
+		return;
+	}
+	wipeIndex();
+	generate(_root);
+	setRoot(_root);
+}
+
+void FlatState::wipeIndex()
+{
+	ldb::WriteBatch batch;
+	batch.Delete(c_rootKey);
+	size_t count = 0;
+	unique_ptr<ldb::Iterator> it(m_db.db()->NewIterator(ldb::ReadOptions()));
+	for (it->Seek(ldb::Slice(c_accountPrefix, 1)); it->Valid() && it->key().starts_with(ldb::Slice(c_accountPrefix, 1)); it->Next())
+	{
+		ldb::Slice key = it->key();
+		if (hasPrefix(key, c_accountPrefix, c_accountKeySize) || hasPrefix(key, c_storagePrefix, c_storageKeySize) || hasPrefix(key, c_undoPrefix, c_undoKeySize))
+		{
+			batch.Delete(key);
+			if (++count % c_generateBatchSize == 0)
+				writeBatch(batch);
+		}
+	}
+	writeBatch(batch);
+}
+
+void FlatState::generate(h256 const& _root)
+{
+	cnote << "Building flat state index at" << _root;
+	ldb::WriteBatch batch;
+	size_t count = 0;
+	GenericTrieDB<OverlayDB> accounts(&m_db, _root);
+	for (auto it = accounts.begin(); it != accounts.end(); ++it)
+	{
+		auto leaf = *it;
+		h256 address(leaf.first);
+		batch.Put(accountKey(address), ldb::Slice((char const*)leaf.second.data(), leaf.second.size()));
+
+		h256 storageRoot = RLP(leaf.second)[2].toHash<h256>();
+		if (storageRoot != EmptyTrie)
+		{
+			GenericTrieDB<OverlayDB> storage(&m_db, storageRoot);
+			for (auto sit = storage.begin(); sit != storage.end(); ++sit)
+			{
+				auto slot = *sit;
+				batch.Put(storageKey(address, h256(slot.first)), ldb::Slice((char const*)slot.second.data(), slot.second.size()));
+				if (++count % c_generateBatchSize == 0)
+					writeBatch(batch);
+			}
+		}
+		if (++count % c_generateBatchSize == 0)
+			writeBatch(batch);
+	}
+	RLPStream root(2);
+	root << _root << 0;
+	batch.Put(c_rootKey, ldb::Slice((char const*)root.out().data(), root.out().size()));
+	writeBatch(batch);
+	cnote << "Flat state index built with" << count << "entries";
+}
+
+void FlatState::write(Diff const& _diff, h256 const& _root, unsigned _number, ldb::WriteBatch& _batch)
+{
+	ldb::DB* db = m_db.db();
+	// previous values, applied in reverse order to undo the block
+	vector<pair<string, pair<bool, string>>> undo;
+	auto record = [&](string const& _key)
+	{
+		string old;
+		bool existed = db->Get(ldb::ReadOptions(), _key, &old).ok();
+		undo.push_back(make_pair(_key, make_pair(existed, old)));
+	};
+
+	for (h256 const& address: _diff.wiped)
+	{
+		string prefix = storageKey(address, h256()).substr(0, c_accountKeySize);
+		unique_ptr<ldb::Iterator> it(db->NewIterator(ldb::ReadOptions()));
+		for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next())
+			if (it->key().size() == c_storageKeySize)
+			{
+				undo.push_back(make_pair(it->key().ToString(), make_pair(true, it->value().ToString())));
+				_batch.Delete(it->key());
+			}
+	}
+	for (auto const& i: _diff.accounts)
+	{
+		string key = accountKey(i.first);
+		record(key);
+		if (i.second.empty())
+			_batch.Delete(key);
+		else
+			_batch.Put(key, i.second);
+	}
+	for (auto const& i: _diff.storage)
+	{
+		string key = storageKey(i.first.first, i.first.second);
+		record(key);
+		if (i.second.empty())
+			_batch.Delete(key);
+		else
+			_batch.Put(key, i.second);
+	}
+
+	RLPStream s;
+	s.appendList(undo.size());
+	for (auto const& i: undo)
+		s.appendList(3) << i.first << (unsigned)i.second.first << i.second.second;
+	_batch.Put(undoKey(_number), ldb::Slice((char const*)s.out().data(), s.out().size()));
+	if (_number >= c_undoDepth)
+		_batch.Delete(undoKey(_number - c_undoDepth));
+
+	RLPStream root(2);
+	root << _root << _number;
+	_batch.Put(c_rootKey, ldb::Slice((char const*)root.out().data(), root.out().size()));
+}
+
+void FlatState::committed(h256 const& _root)
+{
+	setRoot(_root);
+}
+
+bool FlatState::disconnect(unsigned _number, h256 const& _parentRoot)
+{
+	string value;
+	if (!m_db.db()->Get(ldb::ReadOptions(), undoKey(_number), &value).ok())
+		return false;
+
+	ldb::WriteBatch batch;
+	RLP undo(value);
+	for (size_t i = undo.itemCount(); i-- > 0;)
+	{
+		string key = undo[i][0].toString();
+		if (undo[i][1].toInt<unsigned>())
+			batch.Put(key, undo[i][2].toString());
+		else
+			batch.Delete(key);
+	}
+	batch.Delete(undoKey(_number));
+
+	RLPStream root(2);
+	root << _parentRoot << (_number ? _number - 1 : 0);
+	batch.Put(c_rootKey, ldb::Slice((char const*)root.out().data(), root.out().size()));
+	writeBatch(batch);
+	setRoot(_parentRoot);
+	return true;
+}
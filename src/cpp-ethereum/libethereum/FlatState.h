@@ -0,0 +1,113 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	cpp-ethereum is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with cpp-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file FlatState.h
+ * @date 2018
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <libdevcore/Common.h>
+#include <libdevcore/FixedHash.h>
+#include <libdevcore/Guards.h>
+#include <libdevcore/OverlayDB.h>
+
+namespace dev
+{
+namespace eth
+{
+
+/**
+ * @brief Flat index of the leaves of the account trie and of every storage trie at one state root.
+ *
+ * Accounts are kept under their hashed address and storage slots under the hashed address
+ * followed by the hashed slot, with the same encoded values as in the tries, in the database
+ * of the state trie. A read is a single lookup instead of a walk down the trie. The tries stay
+ * the source of truth: the index is only used by states at its root and is rebuilt from the
+ * trie when it is found at any other root.
+ *
+ * Changes are applied a block at a time together with an undo record, and the undo records
+ * of the last c_undoDepth blocks are kept to follow the state back on a reorg.
+ */
+class FlatState
+{
+public:
+	/// Changes to the index since its root, in the order they have to be applied.
+	struct Diff
+	{
+		/// Encoded accounts by hashed address, empty if deleted.
+		std::map<h256, std::string> accounts;
+		/// Addresses whose storage slots are all dropped before the slots below are applied.
+		std::set<h256> wiped;
+		/// Encoded values by hashed address and hashed slot, empty if deleted.
+		std::map<std::pair<h256, h256>, std::string> storage;
+
+		bool empty() const { return accounts.empty() && wiped.empty() && storage.empty(); }
+		void clear() { accounts.clear(); wiped.clear(); storage.clear(); }
+		void wipe(h256 const& _address);
+	};
+
+	/// Consistent read-only view of the index at one root.
+	struct View
+	{
+		h256 root;
+		/// Keeps the database open for as long as the snapshot is held.
+		OverlayDB db;
+		std::shared_ptr<ldb::Snapshot const> snapshot;
+
+		/// @returns false if the account does not exist.
+		bool account(h256 const& _address, std::string& o_value) const;
+		/// @returns the encoded value, empty if the slot is zero.
+		std::string storage(h256 const& _address, h256 const& _slot) const;
+	};
+
+	explicit FlatState(OverlayDB const& _db);
+
+	/// Bring the index to @a _root, rebuilding it from the tries if it is anywhere else.
+	void open(h256 const& _root);
+
+	std::shared_ptr<View const> view() const;
+
+	/// Stage @a _diff, which moves the index to @a _root at block @a _number, into @a _batch.
+	void write(Diff const& _diff, h256 const& _root, unsigned _number, ldb::WriteBatch& _batch);
+
+	/// To be called once the batch given to write() has been written.
+	void committed(h256 const& _root);
+
+	/// Undo block @a _number, moving the index back to @a _parentRoot.
+	/// @returns false if its undo record is gone, the index is then left at its root.
+	bool disconnect(unsigned _number, h256 const& _parentRoot);
+
+	/// Number of blocks that can be disconnected.
+	static const unsigned c_undoDepth = 1024;
+
+private:
+	void generate(h256 const& _root);
+	void wipeIndex();
+	void writeBatch(ldb::WriteBatch& _batch);
+	void setRoot(h256 const& _root);
+
+	OverlayDB m_db;
+
+	mutable Mutex x_view;
+	std::shared_ptr<View const> m_view;
+};
+
+}
+}
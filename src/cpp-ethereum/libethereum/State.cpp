@@ -67,6 +67,11 @@ State::State(State const& _s):
 	m_cache(_s.m_cache),
 	m_unchangedCacheEntries(_s.m_unchangedCacheEntries),
 	m_nonExistingAccountsCache(_s.m_nonExistingAccountsCache),
+	m_accountData(_s.m_accountData),
+	m_flat(_s.m_flat),
+	m_flatView(_s.m_flatView),
+	m_flatDiff(_s.m_flatDiff),
+	m_flatTracking(_s.m_flatTracking),
 	m_touched(_s.m_touched),
 	m_accountStartNonce(_s.m_accountStartNonce)
 {}
@@ -114,6 +119,8 @@ OverlayDB State::openDB(std::string const& _basePath, h256 const& _genesisHash,
 
 void State::populateFrom(AccountMap const& _map)
 {
+	m_accountData.clear();
+	m_flatTracking = false;
 	eth::commit(_map, m_state);
 	commit(State::CommitBehaviour::KeepEmptyAccounts);
 }
@@ -150,11 +157,39 @@ State& State::operator=(State const& _s)
 	m_cache = _s.m_cache;
 	m_unchangedCacheEntries = _s.m_unchangedCacheEntries;
 	m_nonExistingAccountsCache = _s.m_nonExistingAccountsCache;
+	m_accountData = _s.m_accountData;
+	m_flat = _s.m_flat;
+	m_flatView = _s.m_flatView;
+	m_flatDiff = _s.m_flatDiff;
+	m_flatTracking = _s.m_flatTracking;
 	m_touched = _s.m_touched;
 	m_accountStartNonce = _s.m_accountStartNonce;
 	return *this;
 }
 
+namespace
+{
+/// Most encoded accounts a state keeps between roots.
+const size_t c_maxAccountData = 20000;
+/// Bookkeeping bytes of a storage cache entry.
+const size_t c_storageCacheEntryCost = 160;
+const size_t c_defaultStorageCacheSize = 16 * 1024 * 1024;
+
+std::atomic<uint64_t> s_accountDataHits{0};
+std::atomic<uint64_t> s_accountDataMisses{0};
+}
+
+State::StorageCache& State::storageCache()
+{
+	static StorageCache cache(c_defaultStorageCacheSize);
+	return cache;
+}
+
+std::pair<uint64_t, uint64_t> State::accountCacheStats()
+{
+	return std::make_pair(s_accountDataHits.load(), s_accountDataMisses.load());
+}
+
 Account const* State::account(Address const& _a) const
 {
 	return const_cast<State*>(this)->account(_a);
@@ -170,7 +205,26 @@ Account* State::account(Address const& _addr)
 		return nullptr;
 
 	// Populate basic info.
-	string stateBack = m_state.at(_addr);
+	string stateBack;
+	auto dit = m_accountData.find(_addr);
+	if (dit != m_accountData.end())
+	{
+		++s_accountDataHits;
+		stateBack = dit->second;
+	}
+	else
+	{
+		++s_accountDataMisses;
+		stateBack = m_flatTracking ? flatAccount(sha3(_addr)) : m_state.at(_addr);
+		if (!stateBack.empty())
+		{
+			if (m_accountData.size() >= c_maxAccountData)
+				m_accountData.clear();
+			m_accountData.emplace(_addr, stateBack);
+		}
+	}
+	if (m_readLog)
+		m_readLog->emplace(_addr, stateBack);
 	if (stateBack.empty())
 	{
 		m_nonExistingAccountsCache.insert(_addr);
@@ -211,7 +265,29 @@ void State::commit(CommitBehaviour _commitBehaviour)
 {
 	if (_commitBehaviour == CommitBehaviour::RemoveEmptyAccounts)
 		removeEmptyAccounts();
+	std::vector<Address> flatChanged;
+	for (auto const& i: m_cache)
+		if (i.second.isDirty())
+		{
+			m_accountData.erase(i.first);
+			if (!m_flatTracking)
+				continue;
+			h256 hashed = sha3(i.first);
+			if (!i.second.isAlive() || i.second.baseRoot() == EmptyTrie)
+			{
+				// a killed or recreated account loses the slots of its previous incarnation
+				string previous = flatAccount(hashed);
+				if (!previous.empty() && RLP(previous)[2].toHash<h256>() != EmptyTrie)
+					m_flatDiff.wipe(hashed);
+			}
+			if (i.second.isAlive())
+				for (auto const& j: i.second.storageOverlay())
+					m_flatDiff.storage[make_pair(hashed, sha3(h256(j.first)))] = j.second ? asString(rlp(j.second)) : string();
+			flatChanged.push_back(i.first);
+		}
 	m_touched += dev::eth::commit(m_cache, m_state);
+	for (Address const& a: flatChanged)
+		m_flatDiff.accounts[sha3(a)] = m_state.at(a);
 	m_changeLog.clear();
 	m_cache.clear();
 	m_unchangedCacheEntries.clear();
@@ -238,8 +314,56 @@ void State::setRoot(h256 const& _r)
 	m_cache.clear();
 	m_unchangedCacheEntries.clear();
 	m_nonExistingAccountsCache.clear();
+	m_accountData.clear();
 //	m_touched.clear();
 	m_state.setRoot(_r);
+	resetFlat(_r);
+}
+
+void State::setFlatState(std::shared_ptr<FlatState> const& _flat)
+{
+	m_flat = _flat;
+	resetFlat(m_state.root());
+}
+
+void State::resetFlat(h256 const& _root)
+{
+	m_flatDiff.clear();
+	m_flatView = m_flat ? m_flat->view() : nullptr;
+	m_flatTracking = m_flatView && m_flatView->root == _root;
+}
+
+string State::encodedAccount(Address const& _addr) const
+{
+	if (m_nonExistingAccountsCache.count(_addr))
+		return string();
+	auto it = m_accountData.find(_addr);
+	if (it != m_accountData.end())
+		return it->second;
+	return m_flatTracking ? flatAccount(sha3(_addr)) : m_state.at(_addr);
+}
+
+string State::flatAccount(h256 const& _hashedAddress) const
+{
+	auto it = m_flatDiff.accounts.find(_hashedAddress);
+	if (it != m_flatDiff.accounts.end())
+		return it->second;
+	string ret;
+	m_flatView->account(_hashedAddress, ret);
+	return ret;
+}
+
+string State::flatStorage(h256 const& _hashedAddress, h256 const& _storageRoot, u256 const& _key) const
+{
+	if (_storageRoot == EmptyTrie)
+		return string();
+	auto slot = make_pair(_hashedAddress, sha3(h256(_key)));
+	auto it = m_flatDiff.storage.find(slot);
+	if (it != m_flatDiff.storage.end())
+		return it->second;
+	if (m_flatDiff.wiped.count(_hashedAddress))
+		return string();
+	return m_flatView->storage(slot.first, slot.second);
 }
 
 bool State::addressInUse(Address const& _id) const
@@ -358,10 +482,22 @@ u256 State::storage(Address const& _id, u256 const& _key) const
 		if (mit != a->storageOverlay().end())
 			return mit->second;
 
-		// Not in the storage cache - go to the DB.
-		SecureTrieDB<h256, OverlayDB> memdb(const_cast<OverlayDB*>(&m_db), a->baseRoot());			// promise we won't change the overlay! :)
-		string payload = memdb.at(_key);
-		u256 ret = payload.size() ? RLP(payload).toInt<u256>() : 0;
+		// Not in the storage cache - go to the shared cache, then to the DB.
+		auto slot = std::make_pair(a->baseRoot(), _key);
+		u256 ret;
+		if (!storageCache().get(slot, ret))
+		{
+			string payload;
+			if (m_flatTracking)
+				payload = flatStorage(sha3(_id), a->baseRoot(), _key);
+			else
+			{
+				SecureTrieDB<h256, OverlayDB> memdb(const_cast<OverlayDB*>(&m_db), a->baseRoot());			// promise we won't change the overlay! :)
+				payload = memdb.at(_key);
+			}
+			ret = payload.size() ? RLP(payload).toInt<u256>() : 0;
+			storageCache().insert(slot, ret, c_storageCacheEntryCost);
+		}
 		a->setStorageCache(_key, ret);
 		return ret;
 	}
@@ -30,6 +30,7 @@
 #include <libethcore/Exceptions.h>
 #include <libethcore/BlockHeader.h>
 #include <libethereum/CodeSizeCache.h>
+#include <libethereum/FlatState.h>
 #include <libethereum/GenericMiner.h>
 #include <libevm/ExtVMFace.h>
 #include "Account.h"
@@ -100,6 +101,11 @@ class SealEngineFace;
 namespace detail
 {
 
+struct StorageCacheHash
+{
+	size_t operator()(std::pair<h256, u256> const& _k) const { return std::hash<h256>()(_k.first) ^ static_cast<size_t>(_k.second); }
+};
+
 /// An atomic state changelog entry.
 struct Change
 {
@@ -195,6 +201,18 @@ public:
 	OverlayDB const& db() const { return m_db; }
 	OverlayDB& db() { return m_db; }
 
+	using StorageCache = LRUCache<std::pair<h256, u256>, u256, detail::StorageCacheHash>;
+	/// Storage slots read from disk by any state, keyed by the storage root and the slot.
+	static StorageCache& storageCache();
+
+	/// Hits and misses of the encoded accounts kept by every state between commits.
+	static std::pair<uint64_t, uint64_t> accountCacheStats();
+
+	/// Read accounts and storage through @a _flat while the state is at the index root,
+	/// and collect the changes of the commits made from there.
+	void setFlatState(std::shared_ptr<FlatState> const& _flat);
+	std::shared_ptr<FlatState> const& flatState() const { return m_flat; }
+
 	/// Populate the state from the given AccountMap. Just uses dev::eth::commit().
 	void populateFrom(AccountMap const& _map);
 
@@ -326,11 +344,30 @@ protected: // lux
 
 	void createAccount(Address const& _address, Account const&& _account);
 
+	/// Pick up the current view of the flat index, usable if the state is at @a _root.
+	void resetFlat(h256 const& _root);
+
+	/// @returns the encoded account from the flat index, empty if it does not exist.
+	std::string flatAccount(h256 const& _hashedAddress) const;
+
+	/// @returns the encoded storage value from the flat index, empty if it is zero.
+	std::string flatStorage(h256 const& _hashedAddress, h256 const& _storageRoot, u256 const& _key) const;
+
+	/// @returns the encoded account as account() would load it at the current root, empty if it does not exist.
+	/// Nothing is cached.
+	std::string encodedAccount(Address const& _addr) const;
+
 	OverlayDB m_db;								///< Our overlay for the state tree.
 	SecureTrieDB<Address, OverlayDB> m_state;	///< Our state tree, as an OverlayDB DB.
 	mutable std::unordered_map<Address, Account> m_cache;	///< Our address cache. This stores the states of each address that has (or at least might have) been changed.
 	mutable std::vector<Address> m_unchangedCacheEntries;	///< Tracks entries in m_cache that can potentially be purged if it grows too large.
 	mutable std::set<Address> m_nonExistingAccountsCache;	///< Tracks addresses that are known to not exist.
+	mutable std::unordered_map<Address, std::string> m_accountData;	///< Encoded accounts read from the trie at the current root and not committed to since.
+	std::shared_ptr<FlatState> m_flat;			///< Flat index of the tries, shared with the other states on the same database.
+	std::shared_ptr<FlatState::View const> m_flatView;
+	FlatState::Diff m_flatDiff;					///< Changes committed since the state was at the root of m_flatView.
+	bool m_flatTracking = false;				///< Whether the flat index plus m_flatDiff describe the current root.
+	std::unordered_map<Address, std::string>* m_readLog = nullptr;	///< If set, gets every account as first loaded from the trie, empty if it did not exist.
 	AddressHash m_touched;						///< Tracks all addresses touched so far.
 
 	u256 m_accountStartNonce;
@@ -344,49 +381,66 @@ std::ostream& operator<<(std::ostream& _out, State const& _s);
 template <class DB>
 AddressHash commit(AccountMap const& _cache, SecureTrieDB<Address, DB>& _state)
 {
-	AddressHash ret;
+	// the trie keys of the accounts, and below of the slots of each one, are hashed together
+	std::vector<Address> dirty;
 	for (auto const& i: _cache)
 		if (i.second.isDirty())
+			dirty.push_back(i.first);
+	std::vector<h256> hashedAddresses = sha3(dirty);
+
+	AddressHash ret;
+	for (size_t n = 0; n < dirty.size(); n++)
+	{
+		Account const& account = _cache.at(dirty[n]);
+		if (!account.isAlive())
+			_state.remove(dirty[n], hashedAddresses[n]);
+		else
 		{
-			if (!i.second.isAlive())
-				_state.remove(i.first);
+			RLPStream s(4);
+			s << account.nonce() << account.balance();
+
+			if (account.storageOverlay().empty())
+			{
+				assert(account.baseRoot());
+				s.append(account.baseRoot());
+			}
 			else
 			{
-				RLPStream s(4);
-				s << i.second.nonce() << i.second.balance();
-
-				if (i.second.storageOverlay().empty())
+				std::vector<h256> keys;
+				keys.reserve(account.storageOverlay().size());
+				for (auto const& j: account.storageOverlay())
+					keys.push_back(h256(j.first));
+				std::vector<h256> hashedKeys = sha3(keys);
+
+				SecureTrieDB<h256, DB> storageDB(_state.db(), account.baseRoot());
+				size_t k = 0;
+				for (auto const& j: account.storageOverlay())
 				{
-					assert(i.second.baseRoot());
-					s.append(i.second.baseRoot());
+					if (j.second)
+						storageDB.insert(keys[k], hashedKeys[k], rlp(j.second));
+					else
+						storageDB.remove(keys[k], hashedKeys[k]);
+					k++;
 				}
-				else
-				{
-					SecureTrieDB<h256, DB> storageDB(_state.db(), i.second.baseRoot());
-					for (auto const& j: i.second.storageOverlay())
-						if (j.second)
-							storageDB.insert(j.first, rlp(j.second));
-						else
-							storageDB.remove(j.first);
-					assert(storageDB.root());
-					s.append(storageDB.root());
-				}
-
-				if (i.second.hasNewCode())
-				{
-					h256 ch = i.second.codeHash();
-					// Store the size of the code
-					CodeSizeCache::instance().store(ch, i.second.code().size());
-					_state.db()->insert(ch, &i.second.code());
-					s << ch;
-				}
-				else
-					s << i.second.codeHash();
+				assert(storageDB.root());
+				s.append(storageDB.root());
+			}
 
-				_state.insert(i.first, &s.out());
+			if (account.hasNewCode())
+			{
+				h256 ch = account.codeHash();
+				// Store the size of the code
+				CodeSizeCache::instance().store(ch, account.code().size());
+				_state.db()->insert(ch, &account.code());
+				s << ch;
 			}
-			ret.insert(i.first);
+			else
+				s << account.codeHash();
+
+			_state.insert(dirty[n], hashedAddresses[n], &s.out());
 		}
+		ret.insert(dirty[n]);
+	}
 	return ret;
 }
 
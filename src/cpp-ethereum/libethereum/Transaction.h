@@ -76,6 +76,7 @@ struct ExecutionResult
 	u256 gasRefunded = 0;
 	unsigned depositSize = 0; 										///< Amount of code of the creation's attempted deposit.
 	u256 gasForDeposit; 											///< Amount of gas remaining for the code deposit phase.
+	std::set<Address> suicides;										///< Accounts that self destructed.
 };
 
 std::ostream& operator<<(std::ostream& _out, ExecutionResult const& _er);
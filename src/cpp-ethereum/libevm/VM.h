@@ -23,6 +23,7 @@
 
 #include <unordered_map>
 #include <libdevcore/Exceptions.h>
+#include <libdevcore/LRUCache.h>
 #include <libethcore/Common.h>
 #include <libevmcore/Instruction.h>
 #include <libdevcore/SHA3.h>
@@ -55,6 +56,18 @@ struct InstructionMetric
 };
 
 
+/**
+ * @brief Result of VM::optimize() for one code blob. Never modified once it is complete, so
+ * every execution of the same code, on any thread, can share it.
+ */
+struct AnalysedCode
+{
+	bytes code;							///< Code with synthetic ops disabled and optimized ops in place, zero padded.
+	std::vector<uint64_t> jumpDests;	///< Valid JUMPDEST positions in ascending order.
+	std::vector<uint64_t> beginSubs;
+	u256 pool[256];						///< Constants pushed by PUSHC.
+};
+
 /**
  */
 class VM: public VMFace
@@ -62,6 +75,10 @@ class VM: public VMFace
 public:
 	virtual owning_bytes_ref exec(u256& io_gas, ExtVMFace& _ext, OnOpFunc const& _onOp) override final;
 
+	using AnalysedCodeCache = LRUCache<h256, std::shared_ptr<AnalysedCode>>;
+	/// Analysed code by code hash, shared by all VMs and bounded by memory (32 MiB by default).
+	static AnalysedCodeCache& analysedCodeCache();
+
 #if EVM_JUMPS_AND_SUBS
 	// invalid code will throw an exeption
 	void validate(ExtVMFace& _ext);
@@ -97,9 +114,10 @@ private:
 	// space for memory
 	bytes m_mem;
 
-	// space for code and pointer to data
-	bytes m_codeSpace;
+	// analysed code and pointers to its data
+	std::shared_ptr<AnalysedCode> m_analysis;
 	byte* m_code = nullptr;
+	u256 const* m_pool = nullptr;
 
 	// space for stack and pointer to data
 	u256 m_stackSpace[1025];
@@ -115,9 +133,6 @@ private:
 	std::vector<size_t> m_frameSize;
 #endif
 
-	// constant pool
-	u256 m_pool[256];
-
 	// interpreter state
 	Instruction m_OP;                   // current operator
 	uint64_t    m_PC = 0;               // program counter
@@ -133,6 +148,7 @@ private:
 
 	// initialize interpreter
 	void initEntry();
+	void analyse();
 	void optimize();
 
 	// interpreter loop & switch
@@ -153,8 +169,6 @@ private:
 
 	void reportStackUse();
 
-	std::vector<uint64_t> m_beginSubs;
-	std::vector<uint64_t> m_jumpDests;
 	int64_t verifyJumpDest(u256 const& _dest, bool _throw = true);
 
 	int poolConstant(const u256&);
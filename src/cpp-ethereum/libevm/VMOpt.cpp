@@ -55,10 +55,34 @@ void VM::copyCode(int _extraBytes)
 	// _extraBytes zero bytes to allow reading virtual data at the end
 	// of the code without bounds checks.
 	auto extendedSize = m_ext->code.size() + _extraBytes;
-	m_codeSpace.reserve(extendedSize);
-	m_codeSpace = m_ext->code;
-	m_codeSpace.resize(extendedSize);
-	m_code = m_codeSpace.data();
+	m_analysis->code.reserve(extendedSize);
+	m_analysis->code = m_ext->code;
+	m_analysis->code.resize(extendedSize);
+	m_code = m_analysis->code.data();
+}
+
+VM::AnalysedCodeCache& VM::analysedCodeCache()
+{
+	static AnalysedCodeCache s_cache(32 * 1024 * 1024);
+	return s_cache;
+}
+
+void VM::analyse()
+{
+	// the hash is only unset for code that did not come from the state
+	bool cacheable = m_ext->codeHash && !m_ext->code.empty();
+	if (!cacheable || !analysedCodeCache().get(m_ext->codeHash, m_analysis))
+	{
+		m_analysis = make_shared<AnalysedCode>();
+		optimize();
+		if (cacheable)
+		{
+			size_t cost = sizeof(AnalysedCode) + m_analysis->code.size() + (m_analysis->jumpDests.size() + m_analysis->beginSubs.size()) * sizeof(uint64_t);
+			analysedCodeCache().insert(m_ext->codeHash, m_analysis, cost);
+		}
+	}
+	m_code = m_analysis->code.data();
+	m_pool = m_analysis->pool;
 }
 
 void VM::optimize()
@@ -88,7 +112,7 @@ void VM::optimize()
 
 		if (op == Instruction::JUMPDEST)
 		{
-			m_jumpDests.push_back(pc);
+			m_analysis->jumpDests.push_back(pc);
 		}
 		else if (
 			(byte)Instruction::PUSH1 <= (byte)op &&
@@ -113,7 +137,7 @@ void VM::optimize()
 		}
 		else if (op == Instruction::BEGINSUB)
 		{
-			m_beginSubs.push_back(pc);
+			m_analysis->beginSubs.push_back(pc);
 		}
 		else if (op == Instruction::BEGINDATA)
 		{
@@ -165,7 +189,7 @@ void VM::optimize()
 				}
 				return table[hash] == val;
 			}
-		} constantPool(m_pool);
+		} constantPool(m_analysis->pool);
 		#define CONST_POOL_HASH_INIT() constantPool.hashInit()
 		#define CONST_POOL_HASH_BYTE(b) constantPool.hashByte(b)
 		#define CONST_POOL_GET_HASH() constantPool.getHash()
@@ -260,7 +284,7 @@ void VM::initEntry()
 	m_bounce = &VM::interpretCases; 	
 	interpretCases(); // first call initializes jump table
 	initMetrics();
-	optimize();
+	analyse();
 }
 
 
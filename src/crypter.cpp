@@ -9,8 +9,11 @@
 #include "util.h"
 
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -184,6 +187,50 @@ bool DecryptAES256(const SecureString& sKey, const std::string& sCiphertext, con
     return true;
 }
 
+namespace
+{
+/**
+ * Call fn with every index below nCount, the indexes shared out over as many
+ * threads as there are cores; a false out of fn stops them. Used for the
+ * elliptic curve work of every key of the wallet at once.
+ */
+bool ForEachKeyParallel(size_t nCount, const boost::function<bool(size_t)>& fn)
+{
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fFailed(false);
+    auto threadKeys = [&]() {
+        for (size_t i = nNext++; i < nCount && !fFailed; i = nNext++) {
+            if (!fn(i))
+                fFailed = true;
+        }
+    };
+
+    unsigned int nThreads = std::min<size_t>(boost::thread::hardware_concurrency(), (nCount + KEYS_PER_CRYPT_THREAD - 1) / KEYS_PER_CRYPT_THREAD);
+    if (nThreads <= 1) {
+        threadKeys();
+    } else {
+        boost::thread_group threads;
+        for (unsigned int i = 0; i < nThreads; i++)
+            threads.create_thread(threadKeys);
+        threads.join_all();
+    }
+    return !fFailed;
+}
+
+/** Whether vchCryptedSecret decrypts to the private key of vchPubKey */
+bool CheckCryptedKey(const CKeyingMaterial& vMasterKey, const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret)
+{
+    CKeyingMaterial vchSecret;
+    if (!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
+        return false;
+    if (vchSecret.size() != 32)
+        return false;
+    CKey key;
+    key.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
+    return key.GetPubKey() == vchPubKey;
+}
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK(cs_KeyStore);
@@ -225,31 +272,20 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
-        bool keyPass = false;
-        bool keyFail = false;
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi) {
-            const CPubKey& vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char>& vchCryptedSecret = (*mi).second.second;
-            CKeyingMaterial vchSecret;
-            if (!DecryptSecret(vMasterKeyIn, vchCryptedSecret, vchPubKey.GetHash(), vchSecret)) {
-                keyFail = true;
-                break;
-            }
-            if (vchSecret.size() != 32) {
-                keyFail = true;
-                break;
-            }
-            CKey key;
-            key.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
-            if (key.GetPubKey() != vchPubKey) {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
+        // the first unlock checks every key, the ones after that only the first
+        std::vector<const CryptedKeyMap::value_type*> vKeys;
+        for (const CryptedKeyMap::value_type& item : mapCryptedKeys) {
+            vKeys.push_back(&item);
             if (fDecryptionThoroughlyChecked)
                 break;
         }
+        std::atomic<bool> keyPass(false);
+        bool keyFail = !ForEachKeyParallel(vKeys.size(), [&](size_t i) -> bool {
+            if (!CheckCryptedKey(vMasterKeyIn, vKeys[i]->second.first, vKeys[i]->second.second))
+                return false;
+            keyPass = true;
+            return true;
+        });
         if (keyPass && keyFail) {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.");
             //assert(false);
@@ -359,14 +395,23 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
         return false;
 
     fUseCrypto = true;
-    BOOST_FOREACH (KeyMap::value_type& mKey, mapKeys) {
-        const CKey& key = mKey.second;
-        CPubKey vchPubKey = key.GetPubKey();
-        CKeyingMaterial vchSecret(key.begin(), key.end());
-        std::vector<unsigned char> vchCryptedSecret;
-        if (!EncryptSecret(vMasterKeyIn, vchSecret, vchPubKey.GetHash(), vchCryptedSecret))
-            return false;
-        if (!AddCryptedKey(vchPubKey, vchCryptedSecret))
+
+    // the public keys and the encryption of every key in parallel, then added
+    // one after the other, as they go to the wallet's database transaction
+    std::vector<const CKey*> vKeys;
+    for (const KeyMap::value_type& mKey : mapKeys)
+        vKeys.push_back(&mKey.second);
+    std::vector<CPubKey> vPubKeys(vKeys.size());
+    std::vector<std::vector<unsigned char> > vCryptedSecrets(vKeys.size());
+    if (!ForEachKeyParallel(vKeys.size(), [&](size_t i) -> bool {
+            vPubKeys[i] = vKeys[i]->GetPubKey();
+            CKeyingMaterial vchSecret(vKeys[i]->begin(), vKeys[i]->end());
+            return EncryptSecret(vMasterKeyIn, vchSecret, vPubKeys[i].GetHash(), vCryptedSecrets[i]);
+        }))
+        return false;
+
+    for (size_t i = 0; i < vKeys.size(); i++) {
+        if (!AddCryptedKey(vPubKeys[i], vCryptedSecrets[i]))
             return false;
     }
     mapKeys.clear();
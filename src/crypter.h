@@ -13,6 +13,8 @@ class uint256;
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
+//! Keys encrypted or checked per thread at least; fewer than that are not worth a thread
+const unsigned int KEYS_PER_CRYPT_THREAD = 64;
 
 /**
  * Private key encryption is done based on a CMasterKey,
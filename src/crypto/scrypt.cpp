@@ -31,7 +31,11 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 #include <openssl/sha.h>
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <string.h>
 #include <stdint.h>
@@ -359,26 +363,40 @@ void SMix(uint8_t *B, unsigned int r, unsigned int N, void* _V, void* XY)
         le32enc_2(&B[4 * k], X[k]);
 }
 
-void scrypt(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char *output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen)
+void scrypt(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char *output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen, unsigned int nThreads)
 {
     //containers
-    void* V0 = malloc(128 * r * N + 63);
-    void* XY0 = malloc(256 * r + 64 + 63);
     void* B1 = malloc(128 * r * p + 63);
     uint8_t* B = (uint8_t *)(((uintptr_t)(B1) + 63) & ~ (uintptr_t)(63));
-    uint32_t* V = (uint32_t *)(((uintptr_t)(V0) + 63) & ~ (uintptr_t)(63));
-    uint32_t* XY = (uint32_t *)(((uintptr_t)(XY0) + 63) & ~ (uintptr_t)(63));
 
     PBKDF2_SHA256((const uint8_t *)pass, pLen, (const uint8_t *)salt, sLen, 1, B, p * 128 * r);
 
-    for(unsigned int i = 0; i < p; i++)
-    {
-        SMix(&B[i * 128 * r], r, N, V, XY);
-    }
+    // the p lanes are independent of each other: each thread mixes the next
+    // one not taken yet, in a V of its own
+    std::atomic<unsigned int> nNext(0);
+    auto mixLanes = [&]() {
+        void* V0 = malloc(128 * r * N + 63);
+        void* XY0 = malloc(256 * r + 64 + 63);
+        uint32_t* V = (uint32_t *)(((uintptr_t)(V0) + 63) & ~ (uintptr_t)(63));
+        uint32_t* XY = (uint32_t *)(((uintptr_t)(XY0) + 63) & ~ (uintptr_t)(63));
+
+        for (unsigned int i = nNext++; i < p; i = nNext++)
+        {
+            SMix(&B[i * 128 * r], r, N, V, XY);
+        }
+
+        free(V0);
+        free(XY0);
+    };
+
+    std::vector<std::thread> vThreads;
+    for (unsigned int i = 1; i < std::min(nThreads, p); i++)
+        vThreads.emplace_back(mixLanes);
+    mixLanes();
+    for (std::thread& thread : vThreads)
+        thread.join();
 
     PBKDF2_SHA256((const uint8_t *)pass, pLen, B, p * 128 * r, 1, (uint8_t *)output, dkLen);
 
-    free(V0);
-    free(XY0);
     free(B1);
 }
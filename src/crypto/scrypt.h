@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <string>
 
-void scrypt(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char *output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen);
+/** Derive dkLen bytes from pass and salt; the p lanes are mixed on up to nThreads threads, which does not change the result */
+void scrypt(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char *output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen, unsigned int nThreads = 1);
 
 #endif
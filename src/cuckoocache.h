@@ -0,0 +1,193 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Fixed size set of 256 bit digests, for caches whose entries are already salted
+ * hashes so any 32 bits of them are a good hash.
+ *
+ * Every entry can be in one of 8 slots picked by its 32 bit words. Inserting into
+ * a full set moves entries to their other slots, cuckoo style, and drops the last
+ * one moved once the walk gets too long. Each slot costs 32 bytes and a bit marking
+ * it free, so the set takes the memory it is set up with and nothing more.
+ *
+ * Lookups take no lock: slots are read word by word with atomics while inserts are
+ * serialized among themselves. A lookup racing with an insert may see a slot half
+ * overwritten, which only matches if two unrelated digests share 128 bits, so the
+ * worst that can happen is a miss. Erasing only marks a slot free.
+ */
+class CCuckooCache
+{
+private:
+    struct Slot {
+        std::atomic<uint64_t> words[4];
+    };
+
+    std::unique_ptr<Slot[]> table;
+    std::unique_ptr<std::atomic<uint8_t>[]> freeFlags;
+    uint32_t nSize;
+    unsigned int nMaxDepth;
+    std::mutex csInsert;
+
+    static uint64_t Word(const uint256& entry, int i)
+    {
+        uint64_t word;
+        memcpy(&word, entry.begin() + 8 * i, sizeof(word));
+        return word;
+    }
+
+    void Locations(const uint256& entry, uint32_t locs[8]) const
+    {
+        for (int i = 0; i < 8; i++) {
+            uint32_t h;
+            memcpy(&h, entry.begin() + 4 * i, sizeof(h));
+            locs[i] = (uint32_t)(((uint64_t)h * nSize) >> 32);
+        }
+    }
+
+    /** One free flag per entry, eight to a byte; nSize + 7 would overflow near UINT32_MAX */
+    size_t FlagBytes() const { return (size_t)nSize / 8 + ((nSize & 7) != 0); }
+
+    bool IsFree(uint32_t loc) const
+    {
+        return freeFlags[loc >> 3].load(std::memory_order_acquire) & (1 << (loc & 7));
+    }
+
+    void SetFree(uint32_t loc)
+    {
+        freeFlags[loc >> 3].fetch_or(1 << (loc & 7), std::memory_order_relaxed);
+    }
+
+    bool Matches(uint32_t loc, const uint256& entry) const
+    {
+        for (int i = 0; i < 4; i++) {
+            if (table[loc].words[i].load(std::memory_order_relaxed) != Word(entry, i))
+                return false;
+        }
+        return true;
+    }
+
+    uint256 Load(uint32_t loc) const
+    {
+        uint256 entry;
+        for (int i = 0; i < 4; i++) {
+            uint64_t word = table[loc].words[i].load(std::memory_order_relaxed);
+            memcpy(entry.begin() + 8 * i, &word, sizeof(word));
+        }
+        return entry;
+    }
+
+    /** Write entry to loc and mark it used, the words are visible before the flag */
+    void Store(uint32_t loc, const uint256& entry)
+    {
+        for (int i = 0; i < 4; i++)
+            table[loc].words[i].store(Word(entry, i), std::memory_order_relaxed);
+        freeFlags[loc >> 3].fetch_and(~(1 << (loc & 7)), std::memory_order_release);
+    }
+
+    bool StoreInFree(const uint32_t locs[8], const uint256& entry)
+    {
+        for (int i = 0; i < 8; i++) {
+            if (IsFree(locs[i])) {
+                Store(locs[i], entry);
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    CCuckooCache() : nSize(0), nMaxDepth(0) {}
+
+    /**
+     * Drop all entries and size the set to use at most nBytes, returns the number
+     * of entries it can hold. Not safe while other threads use the set.
+     */
+    size_t Setup(size_t nBytes)
+    {
+        uint64_t nEntries = std::min<uint64_t>((uint64_t)nBytes * 8 / (8 * sizeof(Slot) + 1), UINT32_MAX);
+        nSize = nEntries >= 8 ? nEntries : 0;
+        table.reset(nSize ? new Slot[nSize] : NULL);
+        freeFlags.reset(nSize ? new std::atomic<uint8_t>[FlagBytes()] : NULL);
+        for (size_t i = 0; i < FlagBytes(); i++)
+            freeFlags[i].store(0xff, std::memory_order_relaxed);
+        nMaxDepth = 1;
+        while (nMaxDepth < 32 && ((uint64_t)1 << nMaxDepth) < nSize)
+            nMaxDepth++;
+        std::atomic_thread_fence(std::memory_order_release);
+        return nSize;
+    }
+
+    /** Number of entries the set can hold */
+    size_t Size() const { return nSize; }
+
+    /** Bytes of memory the set uses */
+    size_t MemoryUsage() const { return (size_t)nSize * sizeof(Slot) + FlagBytes(); }
+
+    /** Whether entry is in the set, erasing it if found and fErase is set */
+    bool Contains(const uint256& entry, bool fErase)
+    {
+        if (!nSize)
+            return false;
+        uint32_t locs[8];
+        Locations(entry, locs);
+        for (int i = 0; i < 8; i++) {
+            if (!IsFree(locs[i]) && Matches(locs[i], entry)) {
+                if (fErase)
+                    SetFree(locs[i]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Insert(const uint256& entry)
+    {
+        if (!nSize)
+            return;
+        std::lock_guard<std::mutex> lock(csInsert);
+        uint32_t locs[8];
+        Locations(entry, locs);
+        for (int i = 0; i < 8; i++) {
+            if (!IsFree(locs[i]) && Matches(locs[i], entry))
+                return;
+        }
+        if (StoreInFree(locs, entry))
+            return;
+
+        // move an entry to the slot after the one it was in, until one has a free slot
+        uint256 moving = entry;
+        uint32_t last = locs[7];
+        for (unsigned int depth = 0; depth < nMaxDepth; depth++) {
+            uint32_t loc = locs[0];
+            for (int i = 0; i < 8; i++) {
+                if (locs[i] == last) {
+                    loc = locs[(i + 1) & 7];
+                    break;
+                }
+            }
+            uint256 evicted = Load(loc);
+            Store(loc, moving);
+            moving = evicted;
+            last = loc;
+            Locations(moving, locs);
+            if (StoreInFree(locs, moving))
+                return;
+        }
+        // the set is full, the last entry moved is dropped
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
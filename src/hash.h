@@ -369,7 +369,7 @@ inline uint256 Phi1612(const T1 pbegin, const T1 pend)
 }
 
 
-void scrypt_hash(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char* output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen);
+void scrypt_hash(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char* output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen, unsigned int nThreads = 1);
 
 /** Optimized SipHash-2-4 implementation for uint256.
  *
@@ -42,6 +42,7 @@
 #include "db.h"
 #include "wallet.h"
 #include "walletdb.h"
+#include "walletlog.h"
 #include "miner.h"
 #endif
 
@@ -72,6 +73,7 @@ CWallet* pwalletMain = NULL;
 int nWalletBackups = 10;
 #endif
 bool fFeeEstimatesInitialized = false;
+static std::atomic_bool fDumpMempoolLater(false);
 bool fRestartRequested = false; // true: restart false: shutdown
 unsigned int nMinerSleep;
 
@@ -191,6 +193,12 @@ void PrepareShutdown()
     StopNode();
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        DumpMempool();
+
+    // the blocks are connected, write out the queued executions
+    vmLog.Stop();
+
     if (fFeeEstimatesInitialized) {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
         CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
@@ -219,12 +227,17 @@ void PrepareShutdown()
         pblocktree = NULL;
 //        delete pstorageresult;
 //        pstorageresult = NULL;
+        delete pcontractregistry;
+        pcontractregistry = NULL;
+        ResetContractStateSnapshot();
         delete globalState.release();
         globalSealEngine.reset();
     }
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
+    if (pwalletMain) {
+        FlushWalletLog(pwalletMain->strWalletFile, true);
         bitdb.Flush(true);
+    }
 #endif
 
 #if ENABLE_ZMQ
@@ -343,17 +356,27 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
+    strUsage += "  -statecache=<n>        " + strprintf(_("Set contract state cache size in megabytes, for trie nodes and storage slots (default: %d)"), DEFAULT_STATE_CACHE) + "\n";
+    strUsage += "  -flatstate             " + strprintf(_("Keep a flat index of contract accounts and storage next to the state trie for faster reads (default: %u)"), DEFAULT_FLAT_STATE) + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
+    strUsage += "  -mempoolexpiry=<n>     " + strprintf(_("Do not load transactions older than <n> hours from mempool.dat (default: %u)"), DEFAULT_MEMPOOL_EXPIRY) + "\n";
+    strUsage += "  -parallelcontracts     " + strprintf(_("Execute the contract transactions of a block ahead in parallel, with as many threads as script verification, keeping the executions that do not conflict (default: %u)"), DEFAULT_PARALLEL_CONTRACTS) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -persistmempool        " + strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL) + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "luxd.pid") + "\n";
 #endif
-    strUsage += "  -record-log-opcodes    " + _("Logs all EVM LOG opcode operations to the file vmExecLogs.json") + "\n";
+    strUsage += "  -record-log-opcodes    " + _("Logs all EVM LOG opcode operations to rotating files in the vmlogs directory, see getvmlog (default: 1)") + "\n";
+    strUsage += "  -vmlogsize=<n>         " + strprintf(_("Start a new VM log file once the current one reaches <n> MiB (default: %u)"), DEFAULT_VMLOG_SIZE) + "\n";
+    strUsage += "  -vmlogrotate=<n>       " + strprintf(_("Start a new VM log file once the current one is <n> hours old (0 = by size only, default: %u)"), DEFAULT_VMLOG_ROTATE) + "\n";
+    strUsage += "  -vmprofile=<n>         " + strprintf(_("Profile the contract executions of connected blocks, timing every operation of one in <n> executions, see getvmprofile (0 = off, default: %u)"), DEFAULT_VMPROFILE) + "\n";
     strUsage += "  -prune=<n>             " + _("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex.") + " " +
                                               _("Warning: Reverting this setting requires re-downloading the entire blockchain.") + " " +
                                               _("(default: 0 = disable pruning blocks,") + " " +
                                               strprintf(_(">%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024) + "\n";
+    strUsage += "  -prunestate=<n>        " + strprintf(_("Delete contract state that is no longer reachable from the last <n> blocks, requires -reindex-chainstate to enable "
+                                              "(default: 0 = keep all state, 1 = keep %u blocks)"), DEFAULT_STATE_PRUNE_DEPTH) + "\n";
     strUsage += "  -reindex-chainstate    " + _("Rebuild chain state from the currently indexed blocks") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
 #if !defined(WIN32)
@@ -414,6 +437,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -maxtxfee=<amt>          " + strprintf(_("Maximum total fees to use in a single wallet transaction, setting too low may abort large transactions (default: %s)"), FormatMoney(maxTxFee)) + "\n";
     strUsage += "  -upgradewallet           " + _("Upgrade wallet to latest format") + " " + _("on startup") + "\n";
     strUsage += "  -wallet=<file>           " + _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat") + "\n";
+    strUsage += "  -walletarchivedepth=<n>  " + strprintf(_("Keep only a summary in memory of transactions at least <n> blocks deep whose outputs are spent as deep, 0 to keep them all (minimum: %d, default: %d)"), MIN_WALLET_ARCHIVE_DEPTH, DEFAULT_WALLET_ARCHIVE_DEPTH) + "\n";
+    strUsage += "  -walletlog               " + strprintf(_("Keep wallet transactions in an append-only log next to the wallet file instead of in it (default: %u)"), DEFAULT_WALLETLOG) + "\n";
     strUsage += "  -walletnotify=<cmd>      " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     if (mode == HMM_BITCOIN_QT)
         strUsage += "  -windowtitle=<name>  " + _("Wallet window title") + "\n";
@@ -460,7 +485,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (GetBoolArg("-help-debug", false)) {
         strUsage += "  -limitfreerelay=<n>    " + strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15) + "\n";
         strUsage += "  -relaypriority         " + strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1) + "\n";
-        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000) + "\n";
+        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> MiB (default: %u)"), DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
     }
     strUsage += "  -minrelaytxfee=<amt>   " + strprintf(_("Fees (in LUX/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())) + "\n";
     strUsage += "  -printtoconsole        " + strprintf(_("Send trace/debug info to console instead of debug.log file (default: %u)"), 0) + "\n";
@@ -637,6 +662,18 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        // don't overwrite mempool.dat with a partially loaded mempool
+        fDumpMempoolLater = !fRequestShutdown;
+    }
+}
+
+static void PeriodicDumpMempool()
+{
+    if (fDumpMempoolLater)
+        DumpMempool();
 }
 
 static bool LockDataDirectory(bool probeOnly, bool try_lock = true)
@@ -903,6 +940,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         fPruneMode = true;
     }
 
+    nStatePruneDepth = GetArg("-prunestate", 0);
+    if (nStatePruneDepth < 0) {
+        return InitError(_("Contract state pruning cannot be configured with a negative value."));
+    }
+    if (nStatePruneDepth == 1)
+        nStatePruneDepth = DEFAULT_STATE_PRUNE_DEPTH;
+    if (nStatePruneDepth && nStatePruneDepth < Params().MaxReorganizationDepth()) {
+        return InitError(strprintf(_("Contract state pruning configured below the minimum of %d blocks."), Params().MaxReorganizationDepth()));
+    }
+
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
 #endif
@@ -1032,10 +1079,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    fParallelContracts = GetBoolArg("-parallelcontracts", DEFAULT_PARALLEL_CONTRACTS);
     if (nScriptCheckThreads) {
-        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            if (fParallelContracts)
+                threadGroup.create_thread(&ThreadContractCheck);
+        }
     }
 
     if (mapArgs.count("-sporkkey")) // spork priv key
@@ -1340,6 +1392,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
     // cache size calculations
+    size_t nStateCache = std::max(GetArg("-statecache", DEFAULT_STATE_CACHE), (int64_t)1) << 20;
+    dev::OverlayDB::nodeCache().setMaxCost(nStateCache / 4 * 3);
+    dev::eth::State::storageCache().setMaxCost(nStateCache / 4);
     size_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     if (nTotalCache < (nMinDbCache << 20))
         nTotalCache = (nMinDbCache << 20); // total cache cannot be less than nMinDbCache
@@ -1371,6 +1426,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinscatcher;
                 delete pblocktree;
                 delete pstorageresult;
+                delete pcontractregistry;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
@@ -1422,12 +1478,23 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 const std::string dirLux(luxStateDir.string());
                 const dev::h256 hashDB(dev::sha3(dev::rlp("")));
                 dev::eth::BaseState existsLuxState = fStatus ? dev::eth::BaseState::PreExisting : dev::eth::BaseState::Empty;
+                if (nStatePruneDepth && (fReindex || fReindexChainState)) {
+                    // reference counts are only exact for tries rebuilt from scratch
+                    LuxState::wipeDB(dirLux, hashDB);
+                }
                 globalState = std::unique_ptr<LuxState>(new LuxState(dev::u256(0), LuxState::openDB(dirLux, hashDB, dev::WithExisting::Trust), dirLux, existsLuxState));
                 dev::eth::ChainParams cp((dev::eth::genesisInfo(dev::eth::Network::luxMainNetwork)));
                 globalSealEngine = std::unique_ptr<dev::eth::SealEngineFace>(cp.createSealEngine());
 
                 pstorageresult = new StorageResults(luxStateDir.string());
 
+                pcontractregistry = new ContractRegistry(luxStateDir.string());
+                if (fReindex || fReindexChainState || chainActive.Tip() == nullptr || chainActive.Tip()->nHeight <= Params().FirstSCBlock()) {
+                    // rebuilt together with the chain state, so it will hold every contract
+                    pcontractregistry->wipe();
+                    pcontractregistry->setComplete();
+                }
+
                 if(chainActive.Tip() != nullptr && chainActive.Tip()->nHeight > Params().FirstSCBlock()){
                     globalState->setRoot(uintToh256(chainActive.Tip()->hashStateRoot));
                     globalState->setRootUTXO(uintToh256(chainActive.Tip()->hashUTXORoot));
@@ -1439,9 +1506,24 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 globalState->db().commit();
                 globalState->dbUtxo().commit();
 
+                if (nStatePruneDepth) {
+                    bool fFreshState = chainActive.Tip() == nullptr || chainActive.Tip()->nHeight <= Params().FirstSCBlock();
+                    if (!globalState->enablePruning(nStatePruneDepth, chainActive.Height(), fFreshState)) {
+                        strLoadError = _("You need to rebuild the database using -reindex-chainstate to enable -prunestate");
+                        break;
+                    }
+                } else {
+                    globalState->disablePruning();
+                }
+
+                if (GetBoolArg("-flatstate", DEFAULT_FLAT_STATE) && !globalState->enableFlatState()) {
+                    strLoadError = _("Error building the flat contract state index");
+                    break;
+                }
+
 
                 fRecordLogOpcodes = GetBoolArg("-record-log-opcodes", true);
-                fIsVMlogFile = boost::filesystem::exists(GetDataDir() / "vmExecLogs.json");
+                vmProfiler.SetSampleRate(std::max(0, (int)GetArg("-vmprofile", DEFAULT_VMPROFILE)));
                 ///////////////////////////////////////////////////////////
 
                 // Initialize the block index (no-op if non-empty database was already loaded)
@@ -1533,6 +1615,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
 
+    if (fRecordLogOpcodes && !vmLog.Start(GetDataDir() / "vmlogs", std::max<int64_t>(GetArg("-vmlogsize", DEFAULT_VMLOG_SIZE), 1) * 1024 * 1024,
+                                          std::max<int64_t>(GetArg("-vmlogrotate", DEFAULT_VMLOG_ROTATE), 0) * 60 * 60))
+        return InitError(_("Unable to create the VM log directory"));
+
     // if prune mode, unset NODE_NETWORK and prune block files
     if (fPruneMode) {
         LogPrintf("Unsetting NODE_NETWORK on prune mode\n");
@@ -1660,8 +1746,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                         copyTo->WriteToDisk();
                     }
                 }
+                LOCK(pwalletMain->cs_wallet);
+                pwalletMain->RebuildOrdered();
             }
         }
+
+        int nArchiveDepth = GetArg("-walletarchivedepth", DEFAULT_WALLET_ARCHIVE_DEPTH);
+        if (nArchiveDepth > 0) {
+            nStart = GetTimeMillis();
+            unsigned int nArchived = pwalletMain->ArchiveTransactions(std::max(nArchiveDepth, MIN_WALLET_ARCHIVE_DEPTH));
+            LogPrintf("Archived %u wallet transactions, %u archived in all  %dms\n", nArchived, pwalletMain->GetArchived().size(), GetTimeMillis() - nStart);
+        }
     }  // (!fDisableWallet)
 #else  // ENABLE_WALLET
     LogPrintf("No wallet compiled in!\n");
@@ -1802,6 +1897,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     StartNode(threadGroup, scheduler);
 
+    if (nStatePruneDepth)
+        scheduler.scheduleEvery(PruneContractState, 1000);
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        scheduler.scheduleEvery(PeriodicDumpMempool, MEMPOOL_DUMP_INTERVAL);
+
 #ifdef ENABLE_WALLET
     // Generate coins in the background
     if (GetBoolArg("-gen", false) && pwalletMain) {
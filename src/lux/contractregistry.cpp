@@ -0,0 +1,310 @@
+#include <lux/contractregistry.h>
+#include <libdevcore/RLP.h>
+#include <leveldb/write_batch.h>
+#include <boost/filesystem.hpp>
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <memory>
+
+static const char CONTRACT_PREFIX = 'c';
+static const char ADDRESS_PREFIX = 'a';
+static const char CREATOR_PREFIX = 'o';
+static const char CODEHASH_PREFIX = 'k';
+static const char UNDO_PREFIX = 'u';
+// upper case so they never fall in the range of a prefix above
+static const std::string COMPLETE_KEY = "COMPLETE";
+static const std::string COUNT_KEY = "COUNT";
+
+static void appendBE32(std::string& key, uint32_t n){
+    for(int i = 3; i >= 0; i--)
+        key.push_back(char((n >> (8 * i)) & 0xff));
+}
+
+static uint32_t readBE32(const char* p){
+    uint32_t n = 0;
+    for(int i = 0; i < 4; i++)
+        n = (n << 8) | (unsigned char)p[i];
+    return n;
+}
+
+template <class T>
+static std::string prefixKey(char prefix, T const& _h){
+    std::string key(1, prefix);
+    key.append(reinterpret_cast<const char*>(_h.data()), T::size);
+    return key;
+}
+
+static std::string positionKey(std::string key, uint32_t height, uint32_t index){
+    appendBE32(key, height);
+    appendBE32(key, index);
+    return key;
+}
+
+static std::string undoKey(uint32_t height){
+    std::string key(1, UNDO_PREFIX);
+    appendBE32(key, height);
+    return key;
+}
+
+static void encodeContract(dev::RLPStream& s, ContractInfo const& info){
+    s.appendList(6) << info.address << info.creator << info.codeHash << uintToh256(info.txid) << info.height << info.index;
+}
+
+static ContractInfo decodeContract(dev::RLP const& r){
+    return ContractInfo{r[0].toHash<dev::Address>(), r[1].toHash<dev::Address>(), r[2].toHash<dev::h256>(),
+                        h256Touint(r[3].toHash<dev::h256>()), r[4].toInt<uint32_t>(), r[5].toInt<uint32_t>()};
+}
+
+std::string ContractCursor::ToString() const{
+    return strprintf("%u:%u", height, index);
+}
+
+bool ContractCursor::SetString(std::string const& str){
+    size_t pos = str.find(':');
+    if(pos == std::string::npos)
+        return false;
+    int32_t nHeight, nIndex;
+    if(!ParseInt32(str.substr(0, pos), &nHeight) || !ParseInt32(str.substr(pos + 1), &nIndex) || nHeight < 0 || nIndex < 0)
+        return false;
+    height = nHeight;
+    index = nIndex;
+    return true;
+}
+
+ContractRegistry::ContractRegistry(std::string const& _path) : nPendingIndex(0), nCount(0){
+    path = _path + "/contractsDB";
+    boost::filesystem::create_directories(path);
+    leveldb::Options options;
+    options.create_if_missing = true;
+    leveldb::Status status = leveldb::DB::Open(options, path, &db);
+    if(!status.ok())
+        throw std::runtime_error("Failed to open the contract registry: " + status.ToString());
+
+    std::string value;
+    if(db->Get(leveldb::ReadOptions(), COUNT_KEY, &value).ok())
+        nCount = dev::RLP(value).toInt<uint64_t>();
+}
+
+ContractRegistry::~ContractRegistry(){
+    delete db;
+    db = NULL;
+}
+
+void ContractRegistry::writeBatch(leveldb::WriteBatch& batch){
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    if(!status.ok())
+        throw std::runtime_error("Contract registry write failed: " + status.ToString());
+}
+
+void ContractRegistry::putContract(ContractInfo const& info, leveldb::WriteBatch& batch) const{
+    dev::RLPStream s;
+    encodeContract(s, info);
+    dev::bytes const& value = s.out();
+    batch.Put(positionKey(std::string(1, CONTRACT_PREFIX), info.height, info.index), leveldb::Slice(reinterpret_cast<const char*>(value.data()), value.size()));
+    batch.Put(prefixKey(ADDRESS_PREFIX, info.address), positionKey(std::string(), info.height, info.index));
+    batch.Put(positionKey(prefixKey(CREATOR_PREFIX, info.creator), info.height, info.index), leveldb::Slice());
+    batch.Put(positionKey(prefixKey(CODEHASH_PREFIX, info.codeHash), info.height, info.index), leveldb::Slice());
+}
+
+void ContractRegistry::deleteContract(ContractInfo const& info, leveldb::WriteBatch& batch) const{
+    batch.Delete(positionKey(std::string(1, CONTRACT_PREFIX), info.height, info.index));
+    batch.Delete(prefixKey(ADDRESS_PREFIX, info.address));
+    batch.Delete(positionKey(prefixKey(CREATOR_PREFIX, info.creator), info.height, info.index));
+    batch.Delete(positionKey(prefixKey(CODEHASH_PREFIX, info.codeHash), info.height, info.index));
+}
+
+bool ContractRegistry::readContract(ContractCursor const& pos, ContractInfo& info) const{
+    std::string value;
+    if(!db->Get(leveldb::ReadOptions(), positionKey(std::string(1, CONTRACT_PREFIX), pos.height, pos.index), &value).ok())
+        return false;
+    info = decodeContract(dev::RLP(value));
+    return true;
+}
+
+void ContractRegistry::addContract(dev::Address const& address, dev::Address const& creator, dev::h256 const& codeHash, uint256 const& txid, uint32_t height){
+    LOCK(cs_registry);
+    // a contract created and destroyed in the same block leaves a gap, so a later creation gets a key of its own
+    pendingAdded.push_back(ContractInfo{address, creator, codeHash, txid, height, nPendingIndex++});
+}
+
+void ContractRegistry::removeContract(dev::Address const& address){
+    LOCK(cs_registry);
+    for(auto it = pendingAdded.begin(); it != pendingAdded.end(); ++it){
+        if(it->address == address){
+            pendingAdded.erase(it);
+            return;
+        }
+    }
+    ContractInfo info;
+    if(getContract(address, info))
+        pendingRemoved.push_back(info);
+}
+
+void ContractRegistry::clearPending(){
+    LOCK(cs_registry);
+    pendingAdded.clear();
+    pendingRemoved.clear();
+    nPendingIndex = 0;
+}
+
+void ContractRegistry::commitBlock(uint32_t height){
+    LOCK(cs_registry);
+    if(pendingAdded.empty() && pendingRemoved.empty()){
+        nPendingIndex = 0;
+        return;
+    }
+
+    leveldb::WriteBatch batch;
+    for(ContractInfo const& info : pendingRemoved)
+        deleteContract(info, batch);
+    for(ContractInfo const& info : pendingAdded)
+        putContract(info, batch);
+
+    if(!pendingRemoved.empty()){
+        dev::RLPStream undo;
+        undo.appendList(pendingRemoved.size());
+        for(ContractInfo const& info : pendingRemoved)
+            encodeContract(undo, info);
+        dev::bytes const& value = undo.out();
+        batch.Put(undoKey(height), leveldb::Slice(reinterpret_cast<const char*>(value.data()), value.size()));
+    }
+
+    uint64_t nNewCount = nCount + pendingAdded.size() - pendingRemoved.size();
+    batch.Put(COUNT_KEY, dev::asString(dev::rlp(nNewCount)));
+    writeBatch(batch);
+    nCount = nNewCount;
+    pendingAdded.clear();
+    pendingRemoved.clear();
+    nPendingIndex = 0;
+}
+
+void ContractRegistry::disconnectBlock(uint32_t height){
+    LOCK(cs_registry);
+    pendingAdded.clear();
+    pendingRemoved.clear();
+    nPendingIndex = 0;
+
+    leveldb::WriteBatch batch;
+    uint64_t nNewCount = nCount;
+    bool fChanged = false;
+    std::string prefix = positionKey(std::string(1, CONTRACT_PREFIX), height, 0).substr(0, 5);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()){
+        deleteContract(decodeContract(dev::RLP(it->value().ToString())), batch);
+        nNewCount--;
+        fChanged = true;
+    }
+
+    std::string value;
+    if(db->Get(leveldb::ReadOptions(), undoKey(height), &value).ok()){
+        for(auto const& r : dev::RLP(value)){
+            putContract(decodeContract(r), batch);
+            nNewCount++;
+        }
+        batch.Delete(undoKey(height));
+        fChanged = true;
+    }
+
+    if(!fChanged)
+        return;
+    batch.Put(COUNT_KEY, dev::asString(dev::rlp(nNewCount)));
+    writeBatch(batch);
+    nCount = nNewCount;
+}
+
+bool ContractRegistry::getContract(dev::Address const& address, ContractInfo& info) const{
+    std::string value;
+    if(!db->Get(leveldb::ReadOptions(), prefixKey(ADDRESS_PREFIX, address), &value).ok() || value.size() != 8)
+        return false;
+    return readContract(ContractCursor(readBE32(value.data()), readBE32(value.data() + 4)), info);
+}
+
+std::vector<ContractInfo> ContractRegistry::listRange(std::string const& prefix, ContractCursor const& cursor, unsigned int count, ContractCursor* next) const{
+    std::vector<ContractInfo> result;
+    if(next)
+        *next = ContractCursor();
+
+    // one snapshot for the secondary keys and the records they point to
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    for(it->Seek(positionKey(prefix, cursor.height, cursor.index)); it->Valid() && it->key().starts_with(prefix); it->Next()){
+        if(it->key().size() != prefix.size() + 8)
+            continue;
+        const char* pos = it->key().data() + prefix.size();
+        ContractCursor position(readBE32(pos), readBE32(pos + 4));
+        if(result.size() == count){
+            if(next)
+                *next = position;
+            break;
+        }
+        std::string value;
+        if(prefix.size() == 1)
+            value = it->value().ToString();
+        else if(!db->Get(options, positionKey(std::string(1, CONTRACT_PREFIX), position.height, position.index), &value).ok())
+            continue;
+        result.push_back(decodeContract(dev::RLP(value)));
+    }
+    it.reset();
+    db->ReleaseSnapshot(options.snapshot);
+    return result;
+}
+
+std::vector<ContractInfo> ContractRegistry::listContracts(ContractCursor const& cursor, unsigned int count, ContractCursor* next) const{
+    return listRange(std::string(1, CONTRACT_PREFIX), cursor, count, next);
+}
+
+bool ContractRegistry::cursorAt(uint64_t n, ContractCursor& cursor) const{
+    std::string prefix(1, CONTRACT_PREFIX);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()){
+        if(it->key().size() != prefix.size() + 8)
+            continue;
+        if(n-- == 0){
+            const char* pos = it->key().data() + prefix.size();
+            cursor = ContractCursor(readBE32(pos), readBE32(pos + 4));
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<ContractInfo> ContractRegistry::listByCreator(dev::Address const& creator, ContractCursor const& cursor, unsigned int count, ContractCursor* next) const{
+    return listRange(prefixKey(CREATOR_PREFIX, creator), cursor, count, next);
+}
+
+std::vector<ContractInfo> ContractRegistry::listByCodeHash(dev::h256 const& codeHash, ContractCursor const& cursor, unsigned int count, ContractCursor* next) const{
+    return listRange(prefixKey(CODEHASH_PREFIX, codeHash), cursor, count, next);
+}
+
+uint64_t ContractRegistry::count() const{
+    LOCK(cs_registry);
+    return nCount;
+}
+
+bool ContractRegistry::isComplete() const{
+    std::string value;
+    return db->Get(leveldb::ReadOptions(), COMPLETE_KEY, &value).ok();
+}
+
+void ContractRegistry::setComplete(){
+    leveldb::Status status = db->Put(leveldb::WriteOptions(), COMPLETE_KEY, "1");
+    if(!status.ok())
+        throw std::runtime_error("Contract registry write failed: " + status.ToString());
+}
+
+void ContractRegistry::wipe(){
+    LOCK(cs_registry);
+    pendingAdded.clear();
+    pendingRemoved.clear();
+    nPendingIndex = 0;
+    LogPrintf("Wiping contract registry in %s\n", path);
+    leveldb::WriteBatch batch;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->SeekToFirst(); it->Valid(); it->Next())
+        batch.Delete(it->key());
+    it.reset();
+    writeBatch(batch);
+    nCount = 0;
+}
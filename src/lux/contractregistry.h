@@ -0,0 +1,123 @@
+#ifndef LUX_CONTRACTREGISTRY_H
+#define LUX_CONTRACTREGISTRY_H
+
+#include <uint256.h>
+#include <libdevcrypto/Common.h>
+#include <leveldb/db.h>
+#include "sync.h"
+
+#include <string>
+#include <vector>
+
+/** Default number of contracts returned by one page of the registry */
+static const unsigned int DEFAULT_CONTRACT_PAGE_SIZE = 20;
+/** Largest page of the registry returned by one call */
+static const unsigned int MAX_CONTRACT_PAGE_SIZE = 1000;
+
+struct ContractInfo{
+    dev::Address address;
+    dev::Address creator;
+    dev::h256 codeHash;
+    uint256 txid;
+    uint32_t height;
+    /** Position of the creation within its block */
+    uint32_t index;
+};
+
+/** Position in the registry, contracts are ordered by (height, index) of their creation */
+struct ContractCursor{
+    uint32_t height;
+    uint32_t index;
+
+    ContractCursor() : height(0), index(0) {}
+    ContractCursor(uint32_t _height, uint32_t _index) : height(_height), index(_index) {}
+
+    std::string ToString() const;
+    /** Parse "height:index", false if malformed */
+    bool SetString(std::string const& str);
+};
+
+/**
+ * Index of the live contracts created by top level contract transactions.
+ *
+ * Every contract is stored under the height and position of its creation, with
+ * secondary keys by address, creator and code hash, so listing in creation order
+ * or by creator or code hash is a range scan from a cursor that stays valid while
+ * contracts are added or removed. Contracts that self destruct are removed from
+ * the index, and the records removed by a block are kept to restore them if the
+ * block is disconnected.
+ *
+ * Changes made while connecting a block are kept pending until commitBlock()
+ * writes them with a single batch.
+ */
+class ContractRegistry{
+
+public:
+
+    ContractRegistry(std::string const& _path);
+    ~ContractRegistry();
+
+    void addContract(dev::Address const& address, dev::Address const& creator, dev::h256 const& codeHash, uint256 const& txid, uint32_t height);
+
+    void removeContract(dev::Address const& address);
+
+    void commitBlock(uint32_t height);
+
+    /** Drop changes made since the last commit, e.g. when the block failed to connect */
+    void clearPending();
+
+    /** Remove the contracts created at height and restore the ones removed there */
+    void disconnectBlock(uint32_t height);
+
+    bool getContract(dev::Address const& address, ContractInfo& info) const;
+
+    /** Up to count contracts from cursor on in creation order, next is set to where the following page starts */
+    std::vector<ContractInfo> listContracts(ContractCursor const& cursor, unsigned int count, ContractCursor* next) const;
+
+    /** Cursor of the contract at position n in creation order, walking the keys before it; false if there are not that many */
+    bool cursorAt(uint64_t n, ContractCursor& cursor) const;
+
+    std::vector<ContractInfo> listByCreator(dev::Address const& creator, ContractCursor const& cursor, unsigned int count, ContractCursor* next) const;
+
+    std::vector<ContractInfo> listByCodeHash(dev::h256 const& codeHash, ContractCursor const& cursor, unsigned int count, ContractCursor* next) const;
+
+    uint64_t count() const;
+
+    /** Whether the index holds every contract of the chain, false if it was created after contracts were deployed */
+    bool isComplete() const;
+
+    void setComplete();
+
+    void wipe();
+
+private:
+
+    std::vector<ContractInfo> listRange(std::string const& prefix, ContractCursor const& cursor, unsigned int count, ContractCursor* next) const;
+
+    bool readContract(ContractCursor const& pos, ContractInfo& info) const;
+
+    void putContract(ContractInfo const& info, leveldb::WriteBatch& batch) const;
+
+    void deleteContract(ContractInfo const& info, leveldb::WriteBatch& batch) const;
+
+    void writeBatch(leveldb::WriteBatch& batch);
+
+    std::string path;
+
+    leveldb::DB* db;
+
+    mutable CCriticalSection cs_registry;
+
+    /** Contracts created by the block being connected, in order */
+    std::vector<ContractInfo> pendingAdded;
+
+    /** Committed contracts removed by the block being connected */
+    std::vector<ContractInfo> pendingRemoved;
+
+    /** Position of the next creation in the block being connected, never reused within the block */
+    uint32_t nPendingIndex;
+
+    uint64_t nCount;
+};
+
+#endif // LUX_CONTRACTREGISTRY_H
@@ -1,5 +1,56 @@
 #include "luxDGP.h"
 
+CCriticalSection LuxDGP::cs_cache;
+dev::h256 LuxDGP::cacheStateRoot;
+dev::h256 LuxDGP::cacheUTXORoot;
+bool LuxDGP::cacheDgpevm = false;
+std::map<unsigned int, DGPCacheEntry> LuxDGP::cache;
+
+template <typename T>
+T LuxDGP::cached(unsigned int blockHeight, boost::optional<T> DGPCacheEntry::*field, T (LuxDGP::*read)(unsigned int)){
+    dev::h256 stateRoot = state->rootHash();
+    dev::h256 utxoRoot = state->rootHashUTXO();
+    {
+        LOCK(cs_cache);
+        if(stateRoot != cacheStateRoot || utxoRoot != cacheUTXORoot || dgpevm != cacheDgpevm){
+            cache.clear();
+            cacheStateRoot = stateRoot;
+            cacheUTXORoot = utxoRoot;
+            cacheDgpevm = dgpevm;
+        }
+        auto it = cache.find(blockHeight);
+        if(it != cache.end() && it->second.*field)
+            return *(it->second.*field);
+    }
+
+    // reading may run the DGP contract, which queries the cache again, so it happens unlocked
+    T value = (this->*read)(blockHeight);
+
+    LOCK(cs_cache);
+    if(stateRoot == cacheStateRoot && utxoRoot == cacheUTXORoot && dgpevm == cacheDgpevm){
+        if(cache.size() >= MAX_DGP_CACHE_HEIGHTS && !cache.count(blockHeight))
+            cache.clear();
+        cache[blockHeight].*field = value;
+    }
+    return value;
+}
+
+dev::eth::EVMSchedule LuxDGP::getGasSchedule(unsigned int blockHeight){
+    return cached(blockHeight, &DGPCacheEntry::gasSchedule, &LuxDGP::readGasSchedule);
+}
+
+uint32_t LuxDGP::getBlockSize(unsigned int blockHeight){
+    return cached(blockHeight, &DGPCacheEntry::blockSize, &LuxDGP::readBlockSize);
+}
+
+uint64_t LuxDGP::getMinGasPrice(unsigned int blockHeight){
+    return cached(blockHeight, &DGPCacheEntry::minGasPrice, &LuxDGP::readMinGasPrice);
+}
+
+uint64_t LuxDGP::getBlockGasLimit(unsigned int blockHeight){
+    return cached(blockHeight, &DGPCacheEntry::blockGasLimit, &LuxDGP::readBlockGasLimit);
+}
+
 void LuxDGP::initDataEIP158(){
     std::vector<uint32_t> tempData = {dev::eth::EIP158Schedule.tierStepGas[0], dev::eth::EIP158Schedule.tierStepGas[1], dev::eth::EIP158Schedule.tierStepGas[2],
                                       dev::eth::EIP158Schedule.tierStepGas[3], dev::eth::EIP158Schedule.tierStepGas[4], dev::eth::EIP158Schedule.tierStepGas[5],
@@ -31,7 +82,7 @@ bool LuxDGP::checkLimitSchedule(const std::vector<uint32_t>& defaultData, const
     return false;
 }
 
-dev::eth::EVMSchedule LuxDGP::getGasSchedule(unsigned int blockHeight){
+dev::eth::EVMSchedule LuxDGP::readGasSchedule(unsigned int blockHeight){
     clear();
     dev::eth::EVMSchedule schedule = dev::eth::EIP158Schedule;
     if(initStorages(GasScheduleDGP, blockHeight, ParseHex("26fadbe2"))){
@@ -52,7 +103,7 @@ uint64_t LuxDGP::getUint64FromDGP(unsigned int blockHeight, const dev::Address&
     return value;
 }
 
-uint32_t LuxDGP::getBlockSize(unsigned int blockHeight){
+uint32_t LuxDGP::readBlockSize(unsigned int blockHeight){
     clear();
     uint32_t result = DEFAULT_BLOCK_SIZE_DGP;
     uint32_t blockSize = getUint64FromDGP(blockHeight, BlockSizeDGP, ParseHex("92ac3c62"));
@@ -62,7 +113,7 @@ uint32_t LuxDGP::getBlockSize(unsigned int blockHeight){
     return result;
 }
 
-uint64_t LuxDGP::getMinGasPrice(unsigned int blockHeight){
+uint64_t LuxDGP::readMinGasPrice(unsigned int blockHeight){
     clear();
     uint64_t result = DEFAULT_MIN_GAS_PRICE_DGP;
     uint64_t minGasPrice = getUint64FromDGP(blockHeight, GasPriceDGP, ParseHex("3fb58819"));
@@ -72,7 +123,7 @@ uint64_t LuxDGP::getMinGasPrice(unsigned int blockHeight){
     return result;
 }
 
-uint64_t LuxDGP::getBlockGasLimit(unsigned int blockHeight){
+uint64_t LuxDGP::readBlockGasLimit(unsigned int blockHeight){
     clear();
     uint64_t result = DEFAULT_BLOCK_GAS_LIMIT_DGP;
     uint64_t blockGasLimit = getUint64FromDGP(blockHeight, BlockGasLimitDGP, ParseHex("2cc8377d"));
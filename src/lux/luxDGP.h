@@ -5,6 +5,9 @@
 #include "primitives/block.h"
 #include "main.h"
 #include "utilstrencodings.h"
+#include "sync.h"
+
+#include <boost/optional.hpp>
 
 static const dev::Address GasScheduleDGP = dev::Address("0000000000000000000000000000000000000080");
 static const dev::Address BlockSizeDGP = dev::Address("0000000000000000000000000000000000000081");
@@ -24,6 +27,17 @@ static const uint64_t MIN_BLOCK_GAS_LIMIT_DGP = 1000000;
 static const uint64_t MAX_BLOCK_GAS_LIMIT_DGP = 1000000000;
 static const uint64_t DEFAULT_BLOCK_GAS_LIMIT_DGP = 40000000;
 
+/** Most block heights kept in the parameter cache for one state root */
+static const size_t MAX_DGP_CACHE_HEIGHTS = 8;
+
+/** Governance parameters read for one block height, filled as they are queried */
+struct DGPCacheEntry{
+    boost::optional<dev::eth::EVMSchedule> gasSchedule;
+    boost::optional<uint32_t> blockSize;
+    boost::optional<uint64_t> minGasPrice;
+    boost::optional<uint64_t> blockGasLimit;
+};
+
 class LuxDGP {
     
 public:
@@ -40,6 +54,22 @@ public:
 
 private:
 
+    dev::eth::EVMSchedule readGasSchedule(unsigned int blockHeight);
+
+    uint32_t readBlockSize(unsigned int blockHeight);
+
+    uint64_t readMinGasPrice(unsigned int blockHeight);
+
+    uint64_t readBlockGasLimit(unsigned int blockHeight);
+
+    /**
+     * The answers only change with the state they are read from, so they are
+     * cached per height for the current state roots and dropped whenever the
+     * roots move (a new tip, a reorg or contract execution on the state).
+     */
+    template <typename T>
+    T cached(unsigned int blockHeight, boost::optional<T> DGPCacheEntry::*field, T (LuxDGP::*read)(unsigned int));
+
     bool initStorages(const dev::Address& addr, unsigned int blockHeight, std::vector<unsigned char> data = std::vector<unsigned char>());
 
     void initStorageDGP(const dev::Address& addr);
@@ -88,5 +118,15 @@ private:
 
     std::vector<uint32_t> dataEIP158Schedule;
 
+    static CCriticalSection cs_cache;
+
+    static dev::h256 cacheStateRoot;
+
+    static dev::h256 cacheUTXORoot;
+
+    static bool cacheDgpevm;
+
+    static std::map<unsigned int, DGPCacheEntry> cache;
+
 };
 #endif
@@ -1,4 +1,6 @@
 #include <sstream>
+#include <boost/filesystem.hpp>
+#include <leveldb/write_batch.h>
 #include <util.h>
 #include <main.h>
 #include "luxstate.h"
@@ -13,6 +15,12 @@ LuxState::LuxState(u256 const& _accountStartNonce, OverlayDB const& _db, const s
 	        stateUTXO = SecureTrieDB<Address, OverlayDB>(&dbUTXO);
 }
 
+LuxState::LuxState(u256 const& _accountStartNonce, OverlayDB const& _db, OverlayDB const& _dbUTXO, h256 const& _root, h256 const& _rootUTXO) :
+        State(_accountStartNonce, _db, BaseState::PreExisting), dbUTXO(_dbUTXO), stateUTXO(&dbUTXO) {
+    setRoot(_root);
+    setRootUTXO(_rootUTXO);
+}
+
 LuxState::LuxState() : dev::eth::State(dev::Invalid256, dev::OverlayDB(), dev::eth::BaseState::PreExisting) {
     dbUTXO = OverlayDB();
     stateUTXO = SecureTrieDB<Address, OverlayDB>(&dbUTXO);
@@ -78,9 +86,11 @@ ResultExecute LuxState::execute(EnvInfo const& _envInfo, SealEngineFace const& _
                 printfErrorLog(res.excepted);
             }
 
+            bool removeEmptyAccounts = _envInfo.number() >= _sealEngine.chainParams().u256Param("EIP158ForkBlock");
+            if(accessLog)
+                accessLog->commits.push_back(CommittedChanges{m_cache, cacheUTXO, removeEmptyAccounts});
             lux::commit(cacheUTXO, stateUTXO, m_cache);
             cacheUTXO.clear();
-            bool removeEmptyAccounts = _envInfo.number() >= _sealEngine.chainParams().u256Param("EIP158ForkBlock");
             commit(removeEmptyAccounts ? State::CommitBehaviour::RemoveEmptyAccounts : State::CommitBehaviour::KeepEmptyAccounts);
         }
     }
@@ -120,6 +130,133 @@ ResultExecute LuxState::execute(EnvInfo const& _envInfo, SealEngineFace const& _
     }
 }
 
+void LuxState::commitDB(int nHeight){
+    // the flat index moves in the same batch as the trie nodes, so the two never disagree on disk
+    leveldb::WriteBatch batch;
+    bool fFlat = m_flat && m_flatTracking;
+    if(fFlat)
+        m_flat->write(m_flatDiff, rootHash(), nHeight, batch);
+    if(pruner){
+        leveldb::WriteBatch batchUTXO;
+        pruner->commitBlock(nHeight, batch);
+        prunerUTXO->commitBlock(nHeight, batchUTXO);
+    } else {
+        db().commit(batch);
+        dbUTXO.commit();
+    }
+    if(fFlat){
+        m_flat->committed(rootHash());
+        resetFlat(rootHash());
+    }
+}
+
+bool LuxState::enableFlatState(){
+    std::shared_ptr<dev::eth::FlatState> flat = std::make_shared<dev::eth::FlatState>(db());
+    try {
+        flat->open(rootHash());
+    } catch(dev::Exception const& e){
+        LogPrintf("Failed to build the flat state index: %s\n", boost::diagnostic_information(e));
+        return false;
+    }
+    setFlatState(flat);
+    return true;
+}
+
+bool LuxState::enablePruning(unsigned int _keepBlocks, int _tipHeight, bool _fFresh){
+    if(!_fFresh && !(StatePruner::isMarked(db()) && StatePruner::isMarked(dbUTXO)))
+        return false;
+    StatePruner::setMarked(db(), true);
+    StatePruner::setMarked(dbUTXO, true);
+    pruner.reset(new StatePruner(db(), _keepBlocks, _tipHeight));
+    prunerUTXO.reset(new StatePruner(dbUTXO, _keepBlocks, _tipHeight));
+    return true;
+}
+
+void LuxState::disablePruning(){
+    // nodes written from now on are not counted, so the counts must not be trusted again
+    StatePruner::setMarked(db(), false);
+    StatePruner::setMarked(dbUTXO, false);
+    db().setTrackKills(false);
+    dbUTXO.setTrackKills(false);
+    pruner.reset();
+    prunerUTXO.reset();
+}
+
+bool LuxState::disconnectDB(int nHeight, dev::h256 const& _parentRoot){
+    if(pruner && !(pruner->disconnectBlock(nHeight) && prunerUTXO->disconnectBlock(nHeight)))
+        return false;
+    std::shared_ptr<dev::eth::FlatState::View const> view = m_flat ? m_flat->view() : nullptr;
+    if(view && view->root == rootHash() && !m_flat->disconnect(nHeight, _parentRoot))
+        LogPrintf("Flat state index cannot follow the disconnect of block %d, contract state is read from the trie until restart\n", nHeight);
+    return true;
+}
+
+bool LuxState::pruneDB(){
+    if(!pruner)
+        return false;
+    bool fMore = pruner->prune();
+    return prunerUTXO->prune() || fMore;
+}
+
+bool LuxState::pinRoot(int nHeight){
+    if(!pruner)
+        return true;
+    if(!pruner->pin(nHeight))
+        return false;
+    if(!prunerUTXO->pin(nHeight)){
+        pruner->unpin(nHeight);
+        return false;
+    }
+    return true;
+}
+
+void LuxState::unpinRoot(int nHeight){
+    if(pruner){
+        pruner->unpin(nHeight);
+        prunerUTXO->unpin(nHeight);
+    }
+}
+
+void LuxState::wipeDB(std::string const& _path, h256 const& _genesisHash){
+    // same layout as State::openDB, for the account trie and the UTXO trie
+    boost::filesystem::remove_all(_path + "/" + toHex(_genesisHash.ref().cropped(0, 4)));
+    boost::filesystem::remove_all(_path + "/luxDB");
+}
+
+void LuxState::recommitDB(){
+    // the nodes in the overlays are the ones already on disk, and already counted by the pruner
+    db().rollback();
+    dbUTXO.rollback();
+    resetFlat(rootHash());
+}
+
+void LuxState::rollbackDB(h256 const& _root, h256 const& _rootUTXO){
+    db().rollback();
+    dbUTXO.rollback();
+    setRoot(_root);
+    setRootUTXO(_rootUTXO);
+}
+
+bool LuxState::readsUnchanged(StateAccessLog const& _log) const{
+    for(auto const& i : _log.accounts)
+        if(encodedAccount(i.first) != i.second)
+            return false;
+    for(auto const& i : _log.vins)
+        if(stateUTXO.at(i.first) != i.second)
+            return false;
+    return true;
+}
+
+void LuxState::commitRecorded(CommittedChanges const& _changes){
+    // same steps as execute() after a transaction, the accounts may have been created there
+    for(auto const& i : _changes.accounts)
+        m_nonExistingAccountsCache.erase(i.first);
+    m_cache = _changes.accounts;
+    lux::commit(_changes.vins, stateUTXO, m_cache);
+    cacheUTXO.clear();
+    commit(_changes.removeEmptyAccounts ? State::CommitBehaviour::RemoveEmptyAccounts : State::CommitBehaviour::KeepEmptyAccounts);
+}
+
 std::unordered_map<dev::Address, Vin> LuxState::vins() const // temp
 {
     std::unordered_map<dev::Address, Vin> ret;
@@ -151,6 +288,8 @@ Vin* LuxState::vin(dev::Address const& _addr)
     auto it = cacheUTXO.find(_addr);
     if (it == cacheUTXO.end()){
         std::string stateBack = stateUTXO.at(_addr);
+        if (accessLog)
+            accessLog->vins.emplace(_addr, stateBack);
         if (stateBack.empty())
             return nullptr;
 
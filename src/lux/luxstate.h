@@ -7,6 +7,7 @@
 #include <uint256.h>
 #include <primitives/transaction.h>
 #include <lux/luxtransaction.h>
+#include <lux/statepruner.h>
 
 #include <libethereum/Executive.h>
 #include <libethcore/SealEngine.h>
@@ -35,6 +36,22 @@ struct ResultExecute{
     CTransaction tx;
 };
 
+/** Changes one contract transaction committed to the state, see LuxState::recordAccess */
+struct CommittedChanges{
+    std::unordered_map<dev::Address, dev::eth::Account> accounts;
+    std::unordered_map<dev::Address, Vin> vins;
+    bool removeEmptyAccounts;
+};
+
+/** What a state read from its tries and committed while recording */
+struct StateAccessLog{
+    /** Encoded accounts and UTXO entries as first read, empty if they did not exist */
+    std::unordered_map<dev::Address, std::string> accounts;
+    std::unordered_map<dev::Address, std::string> vins;
+    /** Changes of every committed transaction, in order */
+    std::vector<CommittedChanges> commits;
+};
+
 namespace lux{
     template <class DB>
     dev::AddressHash commit(std::unordered_map<dev::Address, Vin> const& _cache, dev::eth::SecureTrieDB<dev::Address, DB>& _state, std::unordered_map<dev::Address, dev::eth::Account> const& _cacheAcc)
@@ -64,6 +81,9 @@ public:
 
     LuxState(dev::u256 const& _accountStartNonce, dev::OverlayDB const& _db, const std::string& _path, dev::eth::BaseState _bs = dev::eth::BaseState::PreExisting);
 
+    /** View of the state at the given roots on copies of already open databases, for read-only calls */
+    LuxState(dev::u256 const& _accountStartNonce, dev::OverlayDB const& _db, dev::OverlayDB const& _dbUTXO, dev::h256 const& _root, dev::h256 const& _rootUTXO);
+
     ResultExecute execute(dev::eth::EnvInfo const& _envInfo, dev::eth::SealEngineFace const& _sealEngine, LuxTransaction const& _t, dev::eth::Permanence _p = dev::eth::Permanence::Committed, dev::eth::OnOpFunc const& _onOp = OnOpFunc());
 
     void setRootUTXO(dev::h256 const& _r) { cacheUTXO.clear(); stateUTXO.setRoot(_r); }
@@ -78,6 +98,47 @@ public:
 
 	dev::OverlayDB& dbUtxo() { return dbUTXO; }
 
+    /** Write the trie nodes accumulated in the overlays for the block at nHeight, one batch per database */
+    void commitDB(int nHeight);
+
+    /** Keep the roots of a block connected once before, whose trie nodes are already written, without writing them or counting their references again */
+    void recommitDB();
+
+    /** Drop the trie nodes accumulated since the last flush and go back to the given roots */
+    void rollbackDB(dev::h256 const& _root, dev::h256 const& _rootUTXO);
+
+    /** Reference count trie nodes and keep only the last _keepBlocks roots, false if the databases already hold uncounted history */
+    bool enablePruning(unsigned int _keepBlocks, int _tipHeight, bool _fFresh);
+
+    void disablePruning();
+
+    bool isPruning() const { return (bool)pruner; }
+
+    /** Serve account and storage reads from a flat index kept next to the trie, rebuilt if it is not at the current root */
+    bool enableFlatState();
+
+    /** Take back the trie nodes and flat index entries of a disconnected block, false if its parent state was already pruned */
+    bool disconnectDB(int nHeight, dev::h256 const& _parentRoot);
+
+    /** Delete trie nodes no longer reachable from the kept roots, true if more work is due */
+    bool pruneDB();
+
+    /** Keep the state at nHeight readable while it is used, false if it is already pruned */
+    bool pinRoot(int nHeight);
+
+    void unpinRoot(int nHeight);
+
+    static void wipeDB(std::string const& _path, dev::h256 const& _genesisHash);
+
+    /** Log reads from the tries and committed changes into _log, stop if null */
+    void recordAccess(StateAccessLog* _log) { accessLog = _log; m_readLog = _log ? &_log->accounts : nullptr; }
+
+    /** Whether everything in _log was read with the values it has at the current roots */
+    bool readsUnchanged(StateAccessLog const& _log) const;
+
+    /** Commit changes recorded on another state, which must have read the same values up to them */
+    void commitRecorded(CommittedChanges const& _changes);
+
     virtual ~LuxState(){}
 
     friend CondensingTX;
@@ -113,6 +174,12 @@ private:
 	dev::eth::SecureTrieDB<dev::Address, dev::OverlayDB> stateUTXO;
 
 	std::unordered_map<dev::Address, Vin> cacheUTXO;
+
+    std::unique_ptr<StatePruner> pruner;
+
+    std::unique_ptr<StatePruner> prunerUTXO;
+
+    StateAccessLog* accessLog = nullptr;
 };
 
 
@@ -121,10 +188,13 @@ struct TemporaryState{
     dev::h256 oldHashStateRoot;
     dev::h256 oldHashUTXORoot;
 
+    int nPinnedHeight;
+
     TemporaryState(std::unique_ptr<LuxState>& _globalStateRef) : 
         globalStateRef(_globalStateRef),
         oldHashStateRoot(globalStateRef->rootHash()), 
-        oldHashUTXORoot(globalStateRef->rootHashUTXO()) {}
+        oldHashUTXORoot(globalStateRef->rootHashUTXO()),
+        nPinnedHeight(-1) {}
                 
     void SetRoot(dev::h256 newHashStateRoot, dev::h256 newHashUTXORoot)
     {
@@ -132,7 +202,18 @@ struct TemporaryState{
         globalStateRef->setRootUTXO(newHashUTXORoot);
     }
 
+    /** Keep the state of nHeight from being pruned until destruction, false if it is already gone */
+    bool PinRoot(int nHeight)
+    {
+        if(!globalStateRef->pinRoot(nHeight))
+            return false;
+        nPinnedHeight = nHeight;
+        return true;
+    }
+
     ~TemporaryState(){
+        if(nPinnedHeight >= 0)
+            globalStateRef->unpinRoot(nPinnedHeight);
         globalStateRef->setRoot(oldHashStateRoot);
         globalStateRef->setRootUTXO(oldHashUTXORoot);
     }
@@ -144,6 +225,48 @@ struct TemporaryState{
 };
 
 
+/**
+ * Keeps the trie nodes written while connecting a block in the overlay databases.
+ * Commit() flushes them with a single batch per database, otherwise they are
+ * discarded together with the roots on destruction.
+ */
+struct BlockStateCommit{
+    std::unique_ptr<LuxState>& globalStateRef;
+    dev::h256 oldHashStateRoot;
+    dev::h256 oldHashUTXORoot;
+    bool fCommitted;
+
+    BlockStateCommit(std::unique_ptr<LuxState>& _globalStateRef) :
+        globalStateRef(_globalStateRef),
+        oldHashStateRoot(globalStateRef->rootHash()),
+        oldHashUTXORoot(globalStateRef->rootHashUTXO()),
+        fCommitted(false) {}
+
+    void Commit(int nHeight)
+    {
+        globalStateRef->commitDB(nHeight);
+        fCommitted = true;
+    }
+
+    /** The block was connected before, as when VerifyDB reconnects it, its state is already on disk */
+    void Recommit()
+    {
+        globalStateRef->recommitDB();
+        fCommitted = true;
+    }
+
+    ~BlockStateCommit(){
+        if(!fCommitted)
+            globalStateRef->rollbackDB(oldHashStateRoot, oldHashUTXORoot);
+    }
+    BlockStateCommit() = delete;
+    BlockStateCommit(const BlockStateCommit&) = delete;
+    BlockStateCommit& operator=(const BlockStateCommit&) = delete;
+    BlockStateCommit(BlockStateCommit&&) = delete;
+    BlockStateCommit& operator=(BlockStateCommit&&) = delete;
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 class CondensingTX{
 
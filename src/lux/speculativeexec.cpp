@@ -0,0 +1,139 @@
+#include <lux/speculativeexec.h>
+#include <libethcore/SealEngine.h>
+#include "util.h"
+
+/** Execute one contract transaction, false if its VM version is unknown; fExecuted is set if it ran on the state */
+static bool ExecuteContractTx(LuxState& state, dev::eth::EnvInfo const& envInfo, dev::eth::SealEngineFace const& sealEngine,
+                              LuxTransaction const& tx, dev::eth::Permanence type, std::vector<ResultExecute>& result, VMProfile* profile, bool& fExecuted){
+    fExecuted = false;
+    if(tx.getVersion().toRaw() != VersionVM::GetEVMDefault().toRaw()){
+        return false;
+    }
+    if(!tx.isCreation() && !state.addressInUse(tx.receiveAddress())){
+        dev::eth::ExecutionResult execRes;
+        execRes.excepted = dev::eth::TransactionException::Unknown;
+        result.push_back(ResultExecute{execRes, dev::eth::TransactionReceipt(dev::h256(), dev::u256(), dev::eth::LogEntries()), CTransaction()});
+        return true;
+    }
+    fExecuted = true;
+    if(!profile){
+        result.push_back(state.execute(envInfo, sealEngine, tx, type, OnOpFunc()));
+        return true;
+    }
+    VMExecutionProfiler execProfiler(*profile, vmProfiler.Sample());
+    result.push_back(state.execute(envInfo, sealEngine, tx, type, execProfiler.onOp()));
+    execProfiler.Finish(uint64_t(result.back().execRes.gasUsed));
+    return true;
+}
+
+bool ExecuteContractTxs(LuxState& state, dev::eth::EnvInfo const& envInfo, dev::eth::SealEngineFace const& sealEngine,
+                        std::vector<LuxTransaction> const& txs, dev::eth::Permanence type, std::vector<ResultExecute>& result, VMProfile* profile){
+    bool fOk = true;
+    for(LuxTransaction const& tx : txs){
+        bool fExecuted;
+        if(!ExecuteContractTx(state, envInfo, sealEngine, tx, type, result, profile, fExecuted)){
+            fOk = false;
+            break;
+        }
+    }
+    // the addresses to delete are collected over all transactions of the block transaction
+    sealEngine.deleteAddresses.clear();
+    return fOk;
+}
+
+/** Whether two extractions of the contract transactions of a block transaction agree */
+static bool SameContractTxs(std::vector<LuxTransaction> const& a, std::vector<LuxTransaction> const& b){
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); i++){
+        if(a[i].sender() != b[i].sender() || a[i].getHashWith() != b[i].getHashWith() || a[i].getNVout() != b[i].getNVout() ||
+           a[i].getVersion().toRaw() != b[i].getVersion().toRaw() ||
+           a[i].sha3(dev::eth::WithoutSignature) != b[i].sha3(dev::eth::WithoutSignature))
+            return false;
+    }
+    return true;
+}
+
+bool CContractCheck::operator()(){
+    exec->Speculate(exec->groups[nGroup]);
+    return true;
+}
+
+SpeculativeContractExec::SpeculativeContractExec(LuxState& _state, dev::eth::EnvInfo const& _envInfo, dev::eth::SealEngineFace const& _sealEngine, VMProfile* _profile) :
+    state(_state), envInfo(_envInfo), sealEngine(_sealEngine), profile(_profile),
+    accountStartNonce(_state.accountStartNonce()), db(_state.db()), dbUTXO(_state.dbUtxo()),
+    hashStateRoot(_state.rootHash()), hashUTXORoot(_state.rootHashUTXO()), flatState(_state.flatState()),
+    nReused(0), nReexecuted(0) {}
+
+void SpeculativeContractExec::Add(unsigned int nTx, std::vector<LuxTransaction> const& txs){
+    groupByTx[nTx] = groups.size();
+    groups.push_back(Group{nTx, txs, StateAccessLog(), std::vector<ResultExecute>(), std::vector<bool>(), std::vector<bool>(), VMProfile(), false});
+}
+
+void SpeculativeContractExec::Run(CCheckQueue<CContractCheck>* pqueue){
+    if(!pqueue){
+        for(Group& group : groups)
+            Speculate(group);
+        return;
+    }
+    std::vector<CContractCheck> vChecks;
+    vChecks.reserve(groups.size());
+    for(size_t i = 0; i < groups.size(); i++)
+        vChecks.push_back(CContractCheck(this, i));
+    CCheckQueueControl<CContractCheck> control(pqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+void SpeculativeContractExec::Speculate(Group& group) const{
+    // the seal engine collects addresses while executing, so every view needs its own
+    std::unique_ptr<dev::eth::SealEngineFace> engine(dev::eth::SealEngineRegistrar::create(sealEngine.chainParams()));
+    engine->setLuxSchedule(sealEngine.getLuxSchedule());
+
+    LuxState view(accountStartNonce, db, dbUTXO, hashStateRoot, hashUTXORoot);
+    if(flatState)
+        view.setFlatState(flatState);
+    view.recordAccess(&group.log);
+
+    group.fOk = true;
+    try {
+        for(LuxTransaction const& tx : group.txs){
+            size_t nCommits = group.log.commits.size();
+            bool fExecuted;
+            if(!ExecuteContractTx(view, envInfo, *engine, tx, dev::eth::Permanence::Committed, group.result, profile ? &group.profile : NULL, fExecuted)){
+                group.fOk = false;
+                break;
+            }
+            group.executed.push_back(fExecuted);
+            group.committed.push_back(group.log.commits.size() > nCommits);
+        }
+    } catch(...){
+        // executed again in order, where the error is handled like it always was
+        group.fOk = false;
+    }
+}
+
+bool SpeculativeContractExec::Execute(unsigned int nTx, std::vector<LuxTransaction> const& txs, std::vector<ResultExecute>& result){
+    std::map<unsigned int, size_t>::iterator it = groupByTx.find(nTx);
+    if(it != groupByTx.end()){
+        Group& group = groups[it->second];
+        if(group.fOk && SameContractTxs(group.txs, txs) && state.readsUnchanged(group.log)){
+            size_t nCommit = 0;
+            for(size_t k = 0; k < group.result.size(); k++){
+                ResultExecute& res = group.result[k];
+                if(group.committed[k])
+                    state.commitRecorded(group.log.commits[nCommit++]);
+                // the receipt has the root the state got to, not the one of the view
+                if(group.executed[k])
+                    res.txRec = dev::eth::TransactionReceipt(state.rootHash(), res.txRec.gasUsed(), res.txRec.log());
+                result.push_back(res);
+            }
+            if(profile)
+                profile->Merge(group.profile);
+            nReused++;
+            return true;
+        }
+        nReexecuted++;
+    }
+    return ExecuteContractTxs(state, envInfo, sealEngine, txs, dev::eth::Permanence::Committed, result, profile);
+}
@@ -0,0 +1,120 @@
+#ifndef LUX_SPECULATIVEEXEC_H
+#define LUX_SPECULATIVEEXEC_H
+
+#include <lux/luxstate.h>
+#include <lux/vmprofiler.h>
+#include <checkqueue.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+/** Default for -parallelcontracts */
+static const bool DEFAULT_PARALLEL_CONTRACTS = true;
+
+/**
+ * Execute the contract transactions of one block transaction in order, appending
+ * to result, false if one has an unknown VM version. The executions are added to
+ * profile if set.
+ */
+bool ExecuteContractTxs(LuxState& state, dev::eth::EnvInfo const& envInfo, dev::eth::SealEngineFace const& sealEngine,
+                        std::vector<LuxTransaction> const& txs, dev::eth::Permanence type, std::vector<ResultExecute>& result,
+                        VMProfile* profile = NULL);
+
+class SpeculativeContractExec;
+
+/** Speculative execution of the contract transactions of one block transaction, for a CCheckQueue */
+class CContractCheck{
+
+public:
+
+    CContractCheck() : exec(NULL), nGroup(0) {}
+    CContractCheck(SpeculativeContractExec* execIn, size_t nGroupIn) : exec(execIn), nGroup(nGroupIn) {}
+
+    bool operator()();
+
+    void swap(CContractCheck& check){
+        std::swap(exec, check.exec);
+        std::swap(nGroup, check.nGroup);
+    }
+
+private:
+
+    SpeculativeContractExec* exec;
+    size_t nGroup;
+};
+
+/**
+ * Optimistic parallel execution of the contract transactions of a block.
+ *
+ * The contract transactions of every block transaction are first executed
+ * together on their own view of the state at the start of the block, on the
+ * workers of a check queue, logging the accounts and UTXO entries they read from
+ * the tries and the changes they commit. The block is then connected in order as
+ * before. An execution is deterministic in the values it reads, so when one whose
+ * reads all still hold on the block state comes up, its changes are committed
+ * there as they are, while the others, which conflict with an earlier transaction
+ * of the block, are executed again. The state roots, receipts and condensing
+ * transactions are those of serial execution either way, and only the executions
+ * that are kept are added to the profile.
+ */
+class SpeculativeContractExec{
+
+public:
+
+    SpeculativeContractExec(LuxState& _state, dev::eth::EnvInfo const& _envInfo, dev::eth::SealEngineFace const& _sealEngine, VMProfile* _profile = NULL);
+
+    /** Queue the contract transactions of block transaction nTx */
+    void Add(unsigned int nTx, std::vector<LuxTransaction> const& txs);
+
+    /** Execute the queued transactions on the workers of pqueue, or here if null, and wait for them */
+    void Run(CCheckQueue<CContractCheck>* pqueue);
+
+    /** Execute the transactions of block transaction nTx on the state, taking over their speculative execution if it still holds */
+    bool Execute(unsigned int nTx, std::vector<LuxTransaction> const& txs, std::vector<ResultExecute>& result);
+
+    size_t Speculated() const { return groups.size(); }
+
+    size_t Reused() const { return nReused; }
+
+    size_t Reexecuted() const { return nReexecuted; }
+
+private:
+
+    friend class CContractCheck;
+
+    struct Group{
+        unsigned int nTx;
+        std::vector<LuxTransaction> txs;
+        StateAccessLog log;
+        std::vector<ResultExecute> result;
+        /** Per transaction, whether it ran and committed, see ExecuteContractTxs */
+        std::vector<bool> executed;
+        std::vector<bool> committed;
+        VMProfile profile;
+        bool fOk;
+    };
+
+    void Speculate(Group& group) const;
+
+    LuxState& state;
+    dev::eth::EnvInfo envInfo;
+    dev::eth::SealEngineFace const& sealEngine;
+    VMProfile* profile;
+
+    /** What the views are opened on, taken when the block starts */
+    dev::u256 accountStartNonce;
+    dev::OverlayDB db;
+    dev::OverlayDB dbUTXO;
+    dev::h256 hashStateRoot;
+    dev::h256 hashUTXORoot;
+    std::shared_ptr<dev::eth::FlatState> flatState;
+
+    std::vector<Group> groups;
+    std::map<unsigned int, size_t> groupByTx;
+
+    size_t nReused;
+    size_t nReexecuted;
+};
+
+#endif // LUX_SPECULATIVEEXEC_H
@@ -0,0 +1,190 @@
+#include <lux/statepruner.h>
+#include <libdevcore/RLP.h>
+#include <leveldb/write_batch.h>
+#include "util.h"
+
+// nodes use their 32 byte hash as key and aux entries append 255, so these never collide
+static const std::string STATE_PRUNE_MARKER = "prunestate";
+static const std::string STATE_PRUNED_HEIGHT = "prunedheight";
+static const char STATE_JOURNAL_PREFIX = 'J';
+static const unsigned char STATE_REFCOUNT_SUFFIX = 254;
+
+static std::string journalKey(int nHeight){
+    std::string key(1, STATE_JOURNAL_PREFIX);
+    for(int i = 3; i >= 0; i--)
+        key.push_back(char((uint32_t(nHeight) >> (8 * i)) & 0xff));
+    return key;
+}
+
+static std::string refCountKey(dev::h256 const& _h){
+    std::string key(reinterpret_cast<const char*>(_h.data()), dev::h256::size);
+    key.push_back(char(STATE_REFCOUNT_SUFFIX));
+    return key;
+}
+
+static leveldb::Slice nodeKey(dev::h256 const& _h){
+    return leveldb::Slice(reinterpret_cast<const char*>(_h.data()), dev::h256::size);
+}
+
+static void writeDB(leveldb::DB* db, leveldb::WriteBatch& batch){
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    if(!status.ok())
+        throw std::runtime_error("State pruning database write failed: " + status.ToString());
+}
+
+StatePruner::StatePruner(dev::OverlayDB& _overlay, unsigned int _keepBlocks, int _tipHeight) : overlay(_overlay), keepBlocks(_keepBlocks), nPrunedHeight(-1), nTipHeight(_tipHeight){
+    std::string value;
+    if(overlay.db()->Get(leveldb::ReadOptions(), STATE_PRUNED_HEIGHT, &value).ok())
+        nPrunedHeight = dev::RLP(value).toInt<unsigned int>();
+    overlay.setTrackKills(true);
+}
+
+bool StatePruner::isMarked(dev::OverlayDB const& _overlay){
+    std::string value;
+    return _overlay.db()->Get(leveldb::ReadOptions(), STATE_PRUNE_MARKER, &value).ok();
+}
+
+void StatePruner::setMarked(dev::OverlayDB const& _overlay, bool _marked){
+    leveldb::Status status = _marked ? _overlay.db()->Put(leveldb::WriteOptions(), STATE_PRUNE_MARKER, "1") :
+                                       _overlay.db()->Delete(leveldb::WriteOptions(), STATE_PRUNE_MARKER);
+    assert(status.ok());
+}
+
+unsigned int StatePruner::readRefCount(dev::h256 const& _h, std::map<dev::h256, unsigned int>& _counts) const{
+    auto it = _counts.find(_h);
+    if(it != _counts.end())
+        return it->second;
+    std::string value;
+    unsigned int count = 0;
+    if(overlay.db()->Get(leveldb::ReadOptions(), refCountKey(_h), &value).ok())
+        count = dev::RLP(value).toInt<unsigned int>();
+    _counts[_h] = count;
+    return count;
+}
+
+void StatePruner::writeRefCounts(std::map<dev::h256, unsigned int> const& _counts, leveldb::WriteBatch& _batch) const{
+    for(auto const& i : _counts){
+        dev::bytes value = dev::rlp(i.second);
+        _batch.Put(refCountKey(i.first), leveldb::Slice(reinterpret_cast<const char*>(value.data()), value.size()));
+    }
+}
+
+void StatePruner::releaseNodes(std::vector<std::pair<dev::h256, unsigned int>> const& _nodes, leveldb::WriteBatch& _batch) const{
+    std::map<dev::h256, unsigned int> counts;
+    std::set<dev::h256> dead;
+    for(auto const& i : _nodes){
+        unsigned int count = readRefCount(i.first, counts);
+        // nodes written without reference count are kept forever
+        if(count == 0)
+            continue;
+        count = count > i.second ? count - i.second : 0;
+        counts[i.first] = count;
+        if(count == 0)
+            dead.insert(i.first);
+    }
+    for(dev::h256 const& h : dead){
+        counts.erase(h);
+        dev::OverlayDB::nodeCache().erase(h);
+        _batch.Delete(nodeKey(h));
+        _batch.Delete(refCountKey(h));
+    }
+    writeRefCounts(counts, _batch);
+}
+
+bool StatePruner::readJournal(int nHeight, std::string& _value) const{
+    return overlay.db()->Get(leveldb::ReadOptions(), journalKey(nHeight), &_value).ok();
+}
+
+void StatePruner::commitBlock(int nHeight, leveldb::WriteBatch& batch){
+    LOCK(cs_pruner);
+    nTipHeight = nHeight;
+
+    std::vector<std::pair<dev::h256, unsigned>> inserts = overlay.pendingInserts();
+    dev::h256s const& kills = overlay.pendingKills();
+    if(nPrunedHeight < 0 && nHeight > 0){
+        // a fresh database has no journals below its first block
+        nPrunedHeight = nHeight - 1;
+        batch.Put(STATE_PRUNED_HEIGHT, dev::asString(dev::rlp((unsigned int)nPrunedHeight)));
+    }
+    if(!inserts.empty() || !kills.empty()){
+        std::map<dev::h256, unsigned int> counts;
+        dev::RLPStream journal(2);
+        journal.appendList(inserts.size());
+        for(auto const& i : inserts){
+            counts[i.first] = readRefCount(i.first, counts) + i.second;
+            journal.appendList(2) << i.first << i.second;
+        }
+        journal << kills;
+        writeRefCounts(counts, batch);
+
+        dev::bytes value = journal.out();
+        batch.Put(journalKey(nHeight), leveldb::Slice(reinterpret_cast<const char*>(value.data()), value.size()));
+    }
+    overlay.commit(batch);
+}
+
+bool StatePruner::disconnectBlock(int nHeight){
+    LOCK(cs_pruner);
+    if(nHeight <= nPrunedHeight)
+        return false;
+    nTipHeight = nHeight - 1;
+
+    std::string value;
+    if(!readJournal(nHeight, value))
+        return true;
+
+    std::vector<std::pair<dev::h256, unsigned int>> inserts;
+    for(auto const& i : dev::RLP(value)[0])
+        inserts.push_back(std::make_pair(i[0].toHash<dev::h256>(), i[1].toInt<unsigned int>()));
+
+    leveldb::WriteBatch batch;
+    releaseNodes(inserts, batch);
+    batch.Delete(journalKey(nHeight));
+    writeDB(overlay.db(), batch);
+    return true;
+}
+
+bool StatePruner::prune(unsigned int nMaxBlocks){
+    LOCK(cs_pruner);
+    int nLimit = nTipHeight - (int)keepBlocks;
+    if(!pinned.empty())
+        nLimit = std::min(nLimit, *pinned.begin());
+
+    for(unsigned int n = 0; n < nMaxBlocks && nPrunedHeight < nLimit; n++){
+        int nHeight = nPrunedHeight + 1;
+        leveldb::WriteBatch batch;
+
+        std::string value;
+        if(readJournal(nHeight, value)){
+            std::map<dev::h256, unsigned int> kills;
+            for(dev::h256 const& h : dev::RLP(value)[1].toVector<dev::h256>())
+                kills[h]++;
+            releaseNodes(std::vector<std::pair<dev::h256, unsigned int>>(kills.begin(), kills.end()), batch);
+            batch.Delete(journalKey(nHeight));
+        }
+        batch.Put(STATE_PRUNED_HEIGHT, dev::asString(dev::rlp((unsigned int)nHeight)));
+        writeDB(overlay.db(), batch);
+        nPrunedHeight = nHeight;
+    }
+    return nPrunedHeight < nLimit;
+}
+
+bool StatePruner::pin(int nHeight){
+    LOCK(cs_pruner);
+    if(nHeight < nPrunedHeight)
+        return false;
+    pinned.insert(nHeight);
+    return true;
+}
+
+void StatePruner::unpin(int nHeight){
+    LOCK(cs_pruner);
+    auto it = pinned.find(nHeight);
+    if(it != pinned.end())
+        pinned.erase(it);
+}
+
+int StatePruner::oldestRoot() const{
+    LOCK(cs_pruner);
+    return std::max(nPrunedHeight, 0);
+}
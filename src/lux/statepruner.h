@@ -0,0 +1,79 @@
+#ifndef LUX_STATEPRUNER_H
+#define LUX_STATEPRUNER_H
+
+#include <libdevcore/OverlayDB.h>
+#include "sync.h"
+
+#include <map>
+#include <set>
+
+/** Default number of recent block state roots kept by -prunestate */
+static const unsigned int DEFAULT_STATE_PRUNE_DEPTH = 1024;
+/** Most journals applied by one background pruning pass */
+static const unsigned int STATE_PRUNE_BATCH_BLOCKS = 16;
+
+/**
+ * Reference counts the trie nodes of one OverlayDB on disk.
+ *
+ * Every block commit adds the references of the nodes it inserted right away and
+ * journals the references it removed. The removals of a block are only applied
+ * once the block is older than the kept window (and older than every pinned root),
+ * which is when nodes dropping to zero references are deleted. Disconnecting a
+ * block within the window takes its insertions back and forgets its removals.
+ *
+ * Nodes written without a reference count (e.g. before pruning was enabled) are
+ * never deleted, so the database must be built from scratch with pruning on.
+ */
+class StatePruner{
+
+public:
+
+    StatePruner(dev::OverlayDB& _overlay, unsigned int _keepBlocks, int _tipHeight);
+
+    /** Whether the database was built with reference counts */
+    static bool isMarked(dev::OverlayDB const& _overlay);
+
+    static void setMarked(dev::OverlayDB const& _overlay, bool _marked);
+
+    /** Flush the overlay together with the reference counts and journal of the block at nHeight, and the entries already in batch */
+    void commitBlock(int nHeight, leveldb::WriteBatch& batch);
+
+    /** Take back the references added by the block at nHeight, false if its journal was already applied */
+    bool disconnectBlock(int nHeight);
+
+    /** Apply the journals of at most nMaxBlocks blocks that left the kept window, true if more are due */
+    bool prune(unsigned int nMaxBlocks = STATE_PRUNE_BATCH_BLOCKS);
+
+    /** Keep the state root of nHeight complete until unpin(), false if it is already pruned */
+    bool pin(int nHeight);
+
+    void unpin(int nHeight);
+
+    /** Oldest height whose state root is still complete */
+    int oldestRoot() const;
+
+private:
+
+    unsigned int readRefCount(dev::h256 const& _h, std::map<dev::h256, unsigned int>& _counts) const;
+
+    void writeRefCounts(std::map<dev::h256, unsigned int> const& _counts, leveldb::WriteBatch& _batch) const;
+
+    void releaseNodes(std::vector<std::pair<dev::h256, unsigned int>> const& _nodes, leveldb::WriteBatch& _batch) const;
+
+    bool readJournal(int nHeight, std::string& _value) const;
+
+    dev::OverlayDB& overlay;
+
+    const unsigned int keepBlocks;
+
+    mutable CCriticalSection cs_pruner;
+
+    /** Height of the last block whose journal was applied */
+    int nPrunedHeight;
+
+    int nTipHeight;
+
+    std::multiset<int> pinned;
+};
+
+#endif // LUX_STATEPRUNER_H
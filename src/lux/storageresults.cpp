@@ -1,7 +1,8 @@
 #include <lux/storageresults.h>
 #include <boost/filesystem.hpp>
+#include <leveldb/write_batch.h>
 
-StorageResults::StorageResults(std::string const& _path){
+StorageResults::StorageResults(std::string const& _path, size_t _cacheSize) : m_lru_size(_cacheSize){
 	path = _path + "/resultsDB";
     options.create_if_missing = true;
     int cnt = 0;
@@ -46,86 +47,173 @@ StorageResults::~StorageResults()
     db = NULL;
 }
 
+static leveldb::Slice resultKey(dev::h256 const& hashTx){
+    return leveldb::Slice(reinterpret_cast<const char*>(hashTx.data()), dev::h256::size);
+}
+
 void StorageResults::addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result){
-	m_cache_result.insert(std::make_pair(hashTx, result));
+    LOCK(cs_results);
+	m_cache_result[hashTx] = result;
+}
+
+void StorageResults::clearPendingResults(){
+    LOCK(cs_results);
+    m_cache_result.clear();
 }
 
 void StorageResults::wipeResults(){
+    LOCK(cs_results);
+    m_cache_result.clear();
+    m_lru.clear();
+    m_lru_index.clear();
     LogPrintf("Wiping LevelDB in %s\n", path);
     leveldb::Status result = leveldb::DestroyDB(path, leveldb::Options());
 }
 
 void StorageResults::deleteResults(std::vector<CTransaction> const& txs){
+    LOCK(cs_results);
+    leveldb::WriteBatch batch;
 
-    for(CTransaction tx : txs){
+    for(CTransaction const& tx : txs){
         dev::h256 hashTx = uintToh256(tx.GetHash());
         m_cache_result.erase(hashTx);
+        uncacheResult(hashTx);
 
-        std::string keyTemp = hashTx.hex();
-	    leveldb::Slice key(keyTemp);
-        leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
-        assert(status.ok());
+        batch.Delete(resultKey(hashTx));
+        // databases created before binary keys may still hold the hex key
+        batch.Delete(hashTx.hex());
     }
+
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    assert(status.ok());
 }
 
 std::vector<TransactionReceiptInfo> StorageResults::getResult(dev::h256 const& hashTx){
+    LOCK(cs_results);
     std::vector<TransactionReceiptInfo> result;
-	auto it = m_cache_result.find(hashTx);
-	if (it == m_cache_result.end()){
-		if(readResult(hashTx, result))
-			m_cache_result.insert(std::make_pair(hashTx, result));
-    } else {
-		result = it->second;
+
+	auto pending = m_cache_result.find(hashTx);
+	if (pending != m_cache_result.end())
+        return pending->second;
+
+    auto it = m_lru_index.find(hashTx);
+    if (it != m_lru_index.end()){
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return it->second->second;
     }
+
+    if(readResult(hashTx, result) || readLegacyResult(hashTx, result))
+        cacheResult(hashTx, result);
 	return result;
 }
 
 void StorageResults::commitResults(){
-    if(m_cache_result.size()){
-
-        for (auto const& i: m_cache_result){
-            std::string valueTemp;
-            std::string keyTemp = i.first.hex();
-            leveldb::Slice key(keyTemp);
-            leveldb::Status status = db->Get(leveldb::ReadOptions(), key, &valueTemp);
-
-            if(status.IsNotFound()){
-
-                TransactionReceiptInfoSerialized tris;
-
-                for(size_t j = 0; j < i.second.size(); j++){
-                    tris.blockHashes.push_back(uintToh256(i.second[j].blockHash));
-                    tris.blockNumbers.push_back(i.second[j].blockNumber);
-                    tris.transactionHashes.push_back(uintToh256(i.second[j].transactionHash));
-                    tris.transactionIndexes.push_back(i.second[j].transactionIndex);
-                    tris.senders.push_back(i.second[j].from);
-                    tris.receivers.push_back(i.second[j].to);
-                    tris.cumulativeGasUsed.push_back(dev::u256(i.second[j].cumulativeGasUsed));
-                    tris.gasUsed.push_back(dev::u256(i.second[j].gasUsed));
-                    tris.contractAddresses.push_back(i.second[j].contractAddress);
-                    tris.logs.push_back(logEntriesSerialization(i.second[j].logs));
-                    tris.excepted.push_back(uint32_t(static_cast<int>(i.second[j].excepted)));
-                }
+    LOCK(cs_results);
+    if(m_cache_result.empty())
+        return;
 
-                dev::RLPStream streamRLP(11);
-                streamRLP << tris.blockHashes << tris.blockNumbers << tris.transactionHashes << tris.transactionIndexes << tris.senders;
-                streamRLP << tris.receivers << tris.cumulativeGasUsed << tris.gasUsed << tris.contractAddresses << tris.logs << tris.excepted;
+    leveldb::WriteBatch batch;
+    for (auto const& i: m_cache_result){
+        if(i.second.empty())
+            continue;
+        dev::bytes data = encodeResult(i.second);
+        batch.Put(resultKey(i.first), leveldb::Slice(reinterpret_cast<const char*>(data.data()), data.size()));
+        cacheResult(i.first, i.second);
+    }
 
-                dev::bytes data = streamRLP.out();
-                std::string stringData(data.begin(), data.end());
-                leveldb::Slice value(stringData);
-                status = db->Put(leveldb::WriteOptions(), key, value);
-                assert(status.ok());
-            }
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    assert(status.ok());
+    m_cache_result.clear();
+}
+
+void StorageResults::cacheResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo> const& _result){
+    if(m_lru_size == 0)
+        return;
+    uncacheResult(_key);
+    m_lru.emplace_front(_key, _result);
+    m_lru_index[_key] = m_lru.begin();
+    if(m_lru_index.size() > m_lru_size){
+        m_lru_index.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+}
+
+void StorageResults::uncacheResult(dev::h256 const& _key){
+    auto it = m_lru_index.find(_key);
+    if(it != m_lru_index.end()){
+        m_lru.erase(it->second);
+        m_lru_index.erase(it);
+    }
+}
+
+dev::bytes StorageResults::encodeResult(std::vector<TransactionReceiptInfo> const& _result){
+    // all receipts of a transaction belong to the same block and transaction
+    TransactionReceiptInfo const& first = _result.front();
+
+    std::vector<dev::Address> addresses;
+    std::unordered_map<dev::Address, uint32_t> addressIndex;
+    for(TransactionReceiptInfo const& tri : _result){
+        for(dev::eth::LogEntry const& log : tri.logs){
+            if(addressIndex.emplace(log.address, addresses.size()).second)
+                addresses.push_back(log.address);
         }
-        m_cache_result.clear();
     }
+
+    dev::RLPStream streamRLP(6);
+    streamRLP << uintToh256(first.blockHash) << first.blockNumber << uintToh256(first.transactionHash) << first.transactionIndex;
+    streamRLP << addresses;
+    streamRLP.appendList(_result.size());
+    for(TransactionReceiptInfo const& tri : _result){
+        streamRLP.appendList(7);
+        streamRLP << tri.from << tri.to << dev::u256(tri.cumulativeGasUsed) << dev::u256(tri.gasUsed) << tri.contractAddress;
+        streamRLP << uint32_t(static_cast<int>(tri.excepted));
+        streamRLP.appendList(tri.logs.size());
+        for(dev::eth::LogEntry const& log : tri.logs){
+            streamRLP.appendList(3);
+            streamRLP << addressIndex[log.address] << log.topics << log.data;
+        }
+    }
+    return streamRLP.out();
+}
+
+bool StorageResults::decodeResult(std::string const& _value, std::vector<TransactionReceiptInfo>& _result){
+    dev::RLP state(_value);
+    if(!state.isList() || state.itemCount() != 6)
+        return false;
+
+    uint256 blockHash = h256Touint(state[0].toHash<dev::h256>());
+    uint32_t blockNumber = state[1].toInt<uint32_t>();
+    uint256 transactionHash = h256Touint(state[2].toHash<dev::h256>());
+    uint32_t transactionIndex = state[3].toInt<uint32_t>();
+    std::vector<dev::h160> addresses = state[4].toVector<dev::h160>();
+
+    for(auto const& receipt : state[5]){
+        dev::eth::LogEntries logs;
+        for(auto const& log : receipt[6]){
+            uint32_t index = log[0].toInt<uint32_t>();
+            if(index >= addresses.size())
+                return false;
+            logs.push_back(dev::eth::LogEntry(addresses[index], log[1].toVector<dev::h256>(), log[2].toBytes()));
+        }
+        _result.push_back(TransactionReceiptInfo{blockHash, blockNumber, transactionHash, transactionIndex, receipt[0].toHash<dev::h160>(),
+                                                 receipt[1].toHash<dev::h160>(), uint64_t(receipt[2].toInt<dev::u256>()), uint64_t(receipt[3].toInt<dev::u256>()),
+                                                 receipt[4].toHash<dev::h160>(), logs, static_cast<dev::eth::TransactionException>(receipt[5].toInt<uint32_t>())});
+    }
+    return true;
 }
 
 bool StorageResults::readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result){
+    std::string value;
+    leveldb::Status s = db->Get(leveldb::ReadOptions(), resultKey(_key), &value);
+    if(!s.ok())
+        return false;
+    return decodeResult(value, _result);
+}
+
+bool StorageResults::readLegacyResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result){
 
     std::string value;
-    std::string keyTemp = _key.hex();;
+    std::string keyTemp = _key.hex();
     leveldb::Slice key(keyTemp);
     leveldb::Status s = db->Get(leveldb::ReadOptions(), key, &value);
 
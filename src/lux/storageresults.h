@@ -2,10 +2,16 @@
 #include <primitives/transaction.h>
 #include <libethereum/State.h>
 #include <libethereum/Transaction.h>
+#include "sync.h"
 #include "util.h"
 
+#include <list>
+
 using logEntriesSerializ = std::vector<std::pair<dev::Address, std::pair<dev::h256s, dev::bytes>>>;
 
+/** Number of decoded transactions kept in the getResult() LRU */
+static const size_t DEFAULT_RESULTS_CACHE_SIZE = 10000;
+
 struct TransactionReceiptInfo{
     uint256 blockHash;
     uint32_t blockNumber;
@@ -20,6 +26,7 @@ struct TransactionReceiptInfo{
     dev::eth::TransactionException excepted;
 };
 
+/** Column-oriented layout used by databases written with hex keys, only read for compatibility */
 struct TransactionReceiptInfoSerialized{
     std::vector<dev::h256> blockHashes;
     std::vector<uint32_t> blockNumbers;
@@ -34,11 +41,19 @@ struct TransactionReceiptInfoSerialized{
     std::vector<uint32_t> excepted;
 };
 
+/**
+ * Receipt store keyed by the raw 32 bytes of the transaction hash.
+ *
+ * Results added while connecting a block are kept pending until commitResults()
+ * writes them with a single batch. Each record stores the block/transaction fields
+ * shared by all receipts of the transaction once, followed by a table of the
+ * distinct log addresses referenced by index from every log entry.
+ */
 class StorageResults{
 
 public:
 
-	StorageResults(std::string const& _path);
+	StorageResults(std::string const& _path, size_t _cacheSize = DEFAULT_RESULTS_CACHE_SIZE);
     ~StorageResults();
 
 	void addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result);
@@ -49,12 +64,25 @@ public:
 
 	void commitResults();
 
+    /** Drop results added since the last commit, e.g. when the block failed to connect */
+    void clearPendingResults();
+
     void wipeResults();
 
 private:
 
 	bool readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result);
 
+	bool readLegacyResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result);
+
+	dev::bytes encodeResult(std::vector<TransactionReceiptInfo> const& _result);
+
+	bool decodeResult(std::string const& _value, std::vector<TransactionReceiptInfo>& _result);
+
+	void cacheResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo> const& _result);
+
+	void uncacheResult(dev::h256 const& _key);
+
 	logEntriesSerializ logEntriesSerialization(dev::eth::LogEntries const& _logs);
 
 	dev::eth::LogEntries logEntriesDeserialize(logEntriesSerializ const& _logs);
@@ -65,5 +93,14 @@ private:
 
     leveldb::Options options;
 
+    CCriticalSection cs_results;
+
+    /** Results of the block being connected, not yet written */
 	std::unordered_map<dev::h256, std::vector<TransactionReceiptInfo>> m_cache_result;
+
+    /** Most recently used decoded results, front is the newest */
+    typedef std::list<std::pair<dev::h256, std::vector<TransactionReceiptInfo>>> ResultsLRU;
+    ResultsLRU m_lru;
+    std::unordered_map<dev::h256, ResultsLRU::iterator> m_lru_index;
+    size_t m_lru_size;
 };
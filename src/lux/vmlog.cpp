@@ -0,0 +1,250 @@
+#include <lux/vmlog.h>
+#include <libdevcore/RLP.h>
+#include "crypto/common.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <string.h>
+
+VMLog vmLog;
+
+static const char VMLOG_MAGIC[8] = {'L', 'U', 'X', 'V', 'M', 'L', 'O', 'G'};
+/** Records larger than this are taken for a corrupt length */
+static const uint32_t MAX_VMLOG_RECORD_SIZE = 256 * 1024 * 1024;
+
+static dev::bytes EncodeRecord(VMLogRecord const& record){
+    dev::RLPStream s(6);
+    s << uintToh256(record.txid) << uintToh256(record.hashBlock) << (uint64_t)std::max(record.nHeight, 0) <<
+         (uint64_t)std::max<int64_t>(record.nTime, 0) << record.newAddress;
+    s.appendList(record.logs.size());
+    for(dev::eth::LogEntry const& log : record.logs)
+        log.streamRLP(s);
+    return s.out();
+}
+
+static VMLogRecord DecodeRecord(dev::bytesConstRef data){
+    dev::RLP rlp(data, dev::RLP::VeryStrict);
+    if(!rlp.isList() || rlp.itemCount() != 6)
+        throw std::runtime_error("bad VM log record");
+    VMLogRecord record;
+    record.txid = h256Touint(rlp[0].toHash<dev::h256>(dev::RLP::VeryStrict));
+    record.hashBlock = h256Touint(rlp[1].toHash<dev::h256>(dev::RLP::VeryStrict));
+    record.nHeight = rlp[2].toInt<uint64_t>();
+    record.nTime = rlp[3].toInt<uint64_t>();
+    record.newAddress = rlp[4].toHash<dev::Address>(dev::RLP::VeryStrict);
+    for(dev::RLP const& log : rlp[5])
+        record.logs.push_back(dev::eth::LogEntry(log));
+    return record;
+}
+
+std::string VMLogCursor::ToString() const{
+    return strprintf("%u:%u", nFile, nOffset);
+}
+
+bool VMLogCursor::SetString(std::string const& str){
+    size_t pos = str.find(':');
+    if(pos == std::string::npos)
+        return false;
+    int32_t nFileIn;
+    int64_t nOffsetIn;
+    if(!ParseInt32(str.substr(0, pos), &nFileIn) || !ParseInt64(str.substr(pos + 1), &nOffsetIn) || nFileIn < 0 || nOffsetIn < 0)
+        return false;
+    nFile = nFileIn;
+    nOffset = nOffsetIn;
+    return true;
+}
+
+boost::filesystem::path VMLog::FilePath(uint32_t n) const{
+    return dir / strprintf("vmlog%05u.dat", n);
+}
+
+std::vector<uint32_t> VMLog::ListFiles() const{
+    std::vector<uint32_t> files;
+    boost::filesystem::path path;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        path = dir;
+    }
+    if(path.empty() || !boost::filesystem::is_directory(path))
+        return files;
+    for(boost::filesystem::directory_iterator it(path); it != boost::filesystem::directory_iterator(); ++it){
+        std::string name = it->path().filename().string();
+        int32_t n;
+        if(name.size() > 9 && name.compare(0, 5, "vmlog") == 0 && name.compare(name.size() - 4, 4, ".dat") == 0 &&
+           ParseInt32(name.substr(5, name.size() - 9), &n) && n > 0)
+            files.push_back(n);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+bool VMLog::Start(boost::filesystem::path const& _dir, uint64_t _nMaxSize, int64_t _nRotateSeconds){
+    Stop();
+    try {
+        boost::filesystem::create_directories(_dir);
+    } catch(const boost::filesystem::filesystem_error& e){
+        LogPrintf("%s: cannot create %s: %s\n", __func__, _dir.string(), e.what());
+        return false;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        dir = _dir;
+        nMaxSize = _nMaxSize;
+        nRotateSeconds = _nRotateSeconds;
+        fStop = false;
+        fRunning = true;
+    }
+    // a new file every start, the last one may end with a partial record
+    std::vector<uint32_t> files = ListFiles();
+    nFile = files.empty() ? 0 : files.back();
+    fWriteError = false;
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "vmlog", boost::function<void()>(boost::bind(&VMLog::ThreadWrite, this))));
+    return true;
+}
+
+void VMLog::Stop(){
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if(!fRunning)
+            return;
+        fStop = true;
+    }
+    condWork.notify_all();
+    thread.join();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRunning = false;
+    condSpace.notify_all();
+}
+
+bool VMLog::IsRunning() const{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fRunning;
+}
+
+void VMLog::Write(std::vector<VMLogRecord>&& records){
+    if(records.empty())
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while(fRunning && !fStop && queue.size() >= VMLOG_QUEUE_SIZE)
+            condSpace.wait(lock);
+        if(!fRunning || fStop)
+            return;
+        for(VMLogRecord& record : records)
+            queue.push_back(std::move(record));
+    }
+    condWork.notify_one();
+}
+
+void VMLog::ThreadWrite(){
+    while(true){
+        std::deque<VMLogRecord> batch;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while(queue.empty() && !fStop)
+                condWork.wait(lock);
+            if(queue.empty())
+                break;
+            batch.swap(queue);
+        }
+        condSpace.notify_all();
+        for(VMLogRecord const& record : batch)
+            Append(record);
+        if(file)
+            fflush(file);
+    }
+    Close();
+}
+
+bool VMLog::OpenNext(){
+    nFile++;
+    boost::filesystem::path path = FilePath(nFile);
+    file = fopen(path.string().c_str(), "wb");
+    if(!file || fwrite(VMLOG_MAGIC, 1, sizeof(VMLOG_MAGIC), file) != sizeof(VMLOG_MAGIC)){
+        if(!fWriteError)
+            LogPrintf("%s: cannot write %s, dropping VM log records\n", __func__, path.string());
+        fWriteError = true;
+        Close();
+        return false;
+    }
+    nFileSize = sizeof(VMLOG_MAGIC);
+    nFileStart = GetTime();
+    return true;
+}
+
+void VMLog::Close(){
+    if(file)
+        fclose(file);
+    file = NULL;
+}
+
+void VMLog::Append(VMLogRecord const& record){
+    if(file && (nFileSize >= nMaxSize || (nRotateSeconds > 0 && GetTime() - nFileStart >= nRotateSeconds)))
+        Close();
+    if(!file && !OpenNext())
+        return;
+
+    dev::bytes payload = EncodeRecord(record);
+    unsigned char len[4];
+    WriteLE32(len, payload.size());
+    if(fwrite(len, 1, sizeof(len), file) != sizeof(len) || fwrite(payload.data(), 1, payload.size(), file) != payload.size()){
+        if(!fWriteError)
+            LogPrintf("%s: cannot write %s, dropping VM log records\n", __func__, FilePath(nFile).string());
+        fWriteError = true;
+        // the rest of the file is unreadable after a partial record
+        Close();
+        return;
+    }
+    nFileSize += sizeof(len) + payload.size();
+    fWriteError = false;
+}
+
+std::vector<VMLogRecord> VMLog::Read(VMLogCursor& cursor, unsigned int count) const{
+    std::vector<VMLogRecord> records;
+    std::vector<uint32_t> files = ListFiles();
+    for(size_t i = 0; i < files.size() && records.size() < count; i++){
+        if(files[i] < cursor.nFile)
+            continue;
+        if(files[i] > cursor.nFile || cursor.nOffset < sizeof(VMLOG_MAGIC))
+            cursor = VMLogCursor(files[i], sizeof(VMLOG_MAGIC));
+
+        FILE* in = fopen(FilePath(files[i]).string().c_str(), "rb");
+        if(!in)
+            continue;
+        char magic[sizeof(VMLOG_MAGIC)];
+        bool fEnd = false;
+        if(fread(magic, 1, sizeof(magic), in) == sizeof(magic) && memcmp(magic, VMLOG_MAGIC, sizeof(magic)) == 0 &&
+           fseek(in, cursor.nOffset, SEEK_SET) == 0){
+            while(records.size() < count){
+                unsigned char len[4];
+                if(fread(len, 1, sizeof(len), in) != sizeof(len)){
+                    fEnd = true;
+                    break;
+                }
+                uint32_t nSize = ReadLE32(len);
+                if(nSize > MAX_VMLOG_RECORD_SIZE)
+                    break;
+                dev::bytes payload(nSize);
+                if(fread(payload.data(), 1, nSize, in) != nSize){
+                    fEnd = true;
+                    break;
+                }
+                try {
+                    records.push_back(DecodeRecord(dev::bytesConstRef(&payload)));
+                } catch(const std::exception&){
+                    break;
+                }
+                cursor.nOffset += sizeof(len) + nSize;
+            }
+        }
+        fclose(in);
+        // the end of the newest file may still be written, the next read continues from there
+        if(fEnd && i + 1 == files.size())
+            break;
+    }
+    return records;
+}
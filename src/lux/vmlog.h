@@ -0,0 +1,117 @@
+#ifndef LUX_VMLOG_H
+#define LUX_VMLOG_H
+
+#include <libevm/ExtVMFace.h>
+#include "uint256.h"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <stdio.h>
+#include <vector>
+
+/** Default for -vmlogsize, in MiB */
+static const unsigned int DEFAULT_VMLOG_SIZE = 128;
+/** Default for -vmlogrotate, in hours */
+static const unsigned int DEFAULT_VMLOG_ROTATE = 24;
+/** Records queued for the writer before the executions wait for it */
+static const size_t VMLOG_QUEUE_SIZE = 10000;
+/** Records getvmlog returns by default and at most */
+static const unsigned int DEFAULT_VMLOG_PAGE_SIZE = 100;
+static const unsigned int MAX_VMLOG_PAGE_SIZE = 1000;
+
+/** One contract execution as written to the VM log */
+struct VMLogRecord{
+    uint256 txid;        // null for calls outside of a transaction
+    uint256 hashBlock;   // null outside of a block
+    int nHeight;
+    int64_t nTime;
+    dev::Address newAddress;
+    dev::eth::LogEntries logs;
+
+    VMLogRecord() : nHeight(0), nTime(0) {}
+};
+
+/** Position in the VM log, a file number and the offset of a record in it */
+struct VMLogCursor{
+    uint32_t nFile;
+    uint64_t nOffset;
+
+    VMLogCursor() : nFile(0), nOffset(0) {}
+    VMLogCursor(uint32_t _nFile, uint64_t _nOffset) : nFile(_nFile), nOffset(_nOffset) {}
+
+    std::string ToString() const;
+    /** Parse "file:offset", false if malformed */
+    bool SetString(std::string const& str);
+};
+
+/**
+ * Append only log of the contract executions, see -record-log-opcodes and getvmlog.
+ *
+ * Executions queue their records and a writer thread appends them to numbered
+ * files in the log directory, starting a new file once the current one reaches
+ * its size or age limit. Each file starts with a magic and holds records of a
+ * little endian 32 bit length followed by the RLP of the record, so a record cut
+ * short by a crash is only the end of its file. The queue is bounded, when the
+ * disk cannot keep up the executions wait rather than records being lost.
+ */
+class VMLog{
+
+public:
+
+    VMLog() : fRunning(false), fStop(false), nMaxSize(0), nRotateSeconds(0), file(NULL), nFile(0), nFileSize(0), nFileStart(0), fWriteError(false) {}
+    ~VMLog() { Stop(); }
+
+    /** Start the writer on dir, with files of up to nMaxSize bytes and nRotateSeconds old, 0 for no age limit */
+    bool Start(boost::filesystem::path const& _dir, uint64_t _nMaxSize, int64_t _nRotateSeconds);
+
+    /** Write out the queued records and stop the writer */
+    void Stop();
+
+    bool IsRunning() const;
+
+    /** Queue records to be written, dropped if the writer is not running */
+    void Write(std::vector<VMLogRecord>&& records);
+
+    /**
+     * Read up to count records from cursor on, moving it past them. A null cursor
+     * starts from the oldest file. Reading stops at the end of the file being
+     * written, where the cursor picks up the records written since.
+     */
+    std::vector<VMLogRecord> Read(VMLogCursor& cursor, unsigned int count) const;
+
+    /** Numbers of the files in the log directory, oldest first */
+    std::vector<uint32_t> ListFiles() const;
+
+private:
+
+    void ThreadWrite();
+    void Append(VMLogRecord const& record);
+    bool OpenNext();
+    void Close();
+    boost::filesystem::path FilePath(uint32_t n) const;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condSpace;
+    std::deque<VMLogRecord> queue;
+    bool fRunning;
+    bool fStop;
+    boost::thread thread;
+
+    boost::filesystem::path dir;
+    uint64_t nMaxSize;
+    int64_t nRotateSeconds;
+
+    // only used by the writer thread
+    FILE* file;
+    uint32_t nFile;
+    uint64_t nFileSize;
+    int64_t nFileStart;
+    bool fWriteError;
+};
+
+extern VMLog vmLog;
+
+#endif // LUX_VMLOG_H
@@ -0,0 +1,98 @@
+#include <lux/vmprofiler.h>
+
+#include <chrono>
+
+VMProfiler vmProfiler;
+
+static int64_t GetProfileNanos(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void VMProfile::Merge(VMProfile const& profile){
+    nExecutions += profile.nExecutions;
+    nSampled += profile.nSampled;
+    nGas += profile.nGas;
+    nNanos += profile.nNanos;
+    for(size_t i = 0; i < opcodes.size(); i++)
+        opcodes[i].Add(profile.opcodes[i]);
+    for(auto const& contract : profile.contracts)
+        contracts[contract.first].Add(contract.second);
+}
+
+VMExecutionProfiler::VMExecutionProfiler(VMProfile& _profile, bool _fSampled) :
+    profile(_profile), fSampled(_fSampled), nStart(GetProfileNanos()), pOp(NULL), pContract(NULL), nLast(0) {}
+
+dev::eth::OnOpFunc VMExecutionProfiler::onOp(){
+    if(!fSampled)
+        return dev::eth::OnOpFunc();
+    return [this](uint64_t, uint64_t, dev::eth::Instruction inst, dev::bigint, dev::bigint gasCost, dev::bigint,
+                  dev::eth::VM*, dev::eth::ExtVMFace const* ext){ Op(inst, gasCost, ext); };
+}
+
+void VMExecutionProfiler::ChargeTime(int64_t nNow){
+    if(!pOp)
+        return;
+    pOp->nNanos += nNow - nLast;
+    pContract->nNanos += nNow - nLast;
+}
+
+void VMExecutionProfiler::Op(dev::eth::Instruction inst, dev::bigint const& gasCost, dev::eth::ExtVMFace const* ext){
+    int64_t nNow = GetProfileNanos();
+    ChargeTime(nNow);
+
+    // the elements of an unordered_map stay put, so the contract is only looked up when a call enters or leaves it
+    if(!pContract || ext->myAddress != contract){
+        contract = ext->myAddress;
+        pContract = &profile.contracts[contract];
+    }
+    pOp = &profile.opcodes[(uint8_t)inst];
+
+    // the VM checks the cost against the gas left before reporting it, so it fits
+    uint64_t nGas = (uint64_t)gasCost;
+    pOp->nOps++;
+    pOp->nGas += nGas;
+    pContract->nOps++;
+    pContract->nGas += nGas;
+    // the callback is not charged to the operation
+    nLast = GetProfileNanos();
+}
+
+void VMExecutionProfiler::Finish(uint64_t nGasUsed){
+    int64_t nNow = GetProfileNanos();
+    ChargeTime(nNow);
+    pOp = NULL;
+    profile.nExecutions++;
+    if(fSampled)
+        profile.nSampled++;
+    profile.nGas += nGasUsed;
+    profile.nNanos += nNow - nStart;
+}
+
+bool VMProfiler::Sample(){
+    unsigned int nRate = nSampleRate;
+    return nRate > 0 && nCounter++ % nRate == 0;
+}
+
+void VMProfiler::AddBlock(int nHeight, uint256 const& hash, VMProfile const& profile){
+    VMBlockProfile block{nHeight, hash, profile.nExecutions, profile.nSampled, profile.nGas, profile.nNanos, VMProfileStats()};
+    for(VMProfileStats const& stats : profile.opcodes)
+        block.sampled.Add(stats);
+
+    LOCK(cs_profile);
+    total.Merge(profile);
+    blocks.push_front(block);
+    if(blocks.size() > VMPROFILE_BLOCKS)
+        blocks.pop_back();
+}
+
+void VMProfiler::Get(VMProfile& totalOut, std::vector<VMBlockProfile>& recent) const{
+    LOCK(cs_profile);
+    totalOut = total;
+    recent.assign(blocks.begin(), blocks.end());
+}
+
+void VMProfiler::Reset(){
+    LOCK(cs_profile);
+    total = VMProfile();
+    blocks.clear();
+}
@@ -0,0 +1,138 @@
+#ifndef LUX_VMPROFILER_H
+#define LUX_VMPROFILER_H
+
+#include <libevm/ExtVMFace.h>
+#include "sync.h"
+#include "uint256.h"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+/** Default for -vmprofile, profiling is off */
+static const unsigned int DEFAULT_VMPROFILE = 0;
+/** Number of connected blocks the VM profiler keeps */
+static const unsigned int VMPROFILE_BLOCKS = 100;
+
+/** Operations run, gas charged and wall time spent by a part of the sampled executions */
+struct VMProfileStats{
+    uint64_t nOps;
+    uint64_t nGas;
+    uint64_t nNanos;
+
+    VMProfileStats() : nOps(0), nGas(0), nNanos(0) {}
+
+    void Add(VMProfileStats const& stats){
+        nOps += stats.nOps;
+        nGas += stats.nGas;
+        nNanos += stats.nNanos;
+    }
+};
+
+/**
+ * Profile of contract executions. Executions, gas used and time count every
+ * execution, the opcodes and contracts only the sampled ones.
+ */
+struct VMProfile{
+    uint64_t nExecutions;
+    uint64_t nSampled;
+    uint64_t nGas;
+    uint64_t nNanos;
+    std::array<VMProfileStats, 256> opcodes;
+    std::unordered_map<dev::Address, VMProfileStats> contracts;
+
+    VMProfile() : nExecutions(0), nSampled(0), nGas(0), nNanos(0) {}
+
+    void Merge(VMProfile const& profile);
+};
+
+/** Totals of the profile of one connected block */
+struct VMBlockProfile{
+    int nHeight;
+    uint256 hash;
+    uint64_t nExecutions;
+    uint64_t nSampled;
+    uint64_t nGas;
+    uint64_t nNanos;
+    VMProfileStats sampled;
+};
+
+/**
+ * Profiles one contract execution into a VMProfile, which is not locked, so each
+ * thread executing contracts needs its own. When sampled, the VM reports every
+ * operation to onOp(), which is charged the time until the next one, otherwise the
+ * VM runs without a callback and only the totals are counted.
+ */
+class VMExecutionProfiler{
+
+public:
+
+    VMExecutionProfiler(VMProfile& _profile, bool _fSampled);
+
+    /** Callback to execute with, empty if not sampled */
+    dev::eth::OnOpFunc onOp();
+
+    /** Count the execution once it returned, with the gas it used */
+    void Finish(uint64_t nGasUsed);
+
+private:
+
+    void Op(dev::eth::Instruction inst, dev::bigint const& gasCost, dev::eth::ExtVMFace const* ext);
+
+    void ChargeTime(int64_t nNow);
+
+    VMProfile& profile;
+    bool fSampled;
+    int64_t nStart;
+
+    /** The operation running and its contract, charged the time since nLast */
+    VMProfileStats* pOp;
+    VMProfileStats* pContract;
+    dev::Address contract;
+    int64_t nLast;
+};
+
+/**
+ * Aggregated contract execution profile of the connected blocks, by opcode, by
+ * contract and by block, see -vmprofile and getvmprofile. Blocks are profiled on
+ * their own and added once connected, so the executions are never locked.
+ */
+class VMProfiler{
+
+public:
+
+    VMProfiler() : nSampleRate(DEFAULT_VMPROFILE), nCounter(0) {}
+
+    /** Profile one in nRate executions by opcode and contract, 0 disables profiling */
+    void SetSampleRate(unsigned int nRate) { nSampleRate = nRate; }
+
+    unsigned int SampleRate() const { return nSampleRate; }
+
+    bool Enabled() const { return nSampleRate > 0; }
+
+    /** Whether to profile the next execution by opcode and contract */
+    bool Sample();
+
+    /** Add the profile of a connected block */
+    void AddBlock(int nHeight, uint256 const& hash, VMProfile const& profile);
+
+    /** The profile of all the blocks added and the last ones, newest first */
+    void Get(VMProfile& total, std::vector<VMBlockProfile>& recent) const;
+
+    void Reset();
+
+private:
+
+    std::atomic<unsigned int> nSampleRate;
+    std::atomic<uint64_t> nCounter;
+
+    mutable CCriticalSection cs_profile;
+    VMProfile total;
+    std::deque<VMBlockProfile> blocks;
+};
+
+extern VMProfiler vmProfiler;
+
+#endif // LUX_VMPROFILER_H
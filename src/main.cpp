@@ -91,8 +91,8 @@ static const int POS_REWARD_CHANGED_BLOCK = 300000;
 std::unique_ptr<LuxState> globalState;
 std::shared_ptr<dev::eth::SealEngineFace> globalSealEngine;
 bool fRecordLogOpcodes = false;
-bool fIsVMlogFile = false;
 bool fGettingValuesDGP = false;
+EVMTipEnvironment evmTipEnvironment;
 
 
 /** The maximum allowed size for a serialized block, in bytes (only for buffer size limits) */
@@ -133,9 +133,11 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+bool fParallelContracts = DEFAULT_PARALLEL_CONTRACTS;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fLogEvents = false;
+int nStatePruneDepth = 0;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fRequireStandard = true;
@@ -611,6 +613,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
 StorageResults *pstorageresult = NULL;
+ContractRegistry *pcontractregistry = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -994,6 +997,11 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees);
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1209,7 +1217,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         ////////////////////////////////////////////////////////////
 
         double dPriority = view.GetPriority(tx, chainActive.Height(), inChainInputValue);
-        CTxMemPoolEntry entry(MakeTransactionRef(tx), nFees, GetTime(), dPriority, chainActive.Height(), inChainInputValue, fSpendsCoinbase, nSigOpsCost,  lp, pool.HasNoInputsOf(tx),CAmount(txMinGasPrice));
+        CTxMemPoolEntry entry(MakeTransactionRef(tx), nFees, nAcceptTime, dPriority, chainActive.Height(), inChainInputValue, fSpendsCoinbase, nSigOpsCost,  lp, pool.HasNoInputsOf(tx),CAmount(txMinGasPrice));
 
         // Check that the transaction doesn't have an excessive number of
         // sigops, making it impossible to mine. Since the coinbase transaction
@@ -1755,6 +1763,28 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadIndexedBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const CBlockHeader& header)
+{
+    block.SetNull();
+
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        filein >> block;
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // the header fields and the merkle root tie the block to the index without rehashing the header
+    if (block.nVersion != header.nVersion || block.hashPrevBlock != header.hashPrevBlock || block.nTime != header.nTime ||
+        block.nBits != header.nBits || block.nNonce != header.nNonce || block.hashMerkleRoot != header.hashMerkleRoot ||
+        BlockMerkleRoot(block) != header.hashMerkleRoot)
+        return error("%s : block at %d:%u does not match its index", __func__, pos.nFile, pos.nPos);
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2216,9 +2246,14 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 //#if 0
       if (pindex->nHeight > Params().FirstSCBlock()) {
+        if (pfClean == NULL && !globalState->disconnectDB(pindex->nHeight, uintToh256(pindex->pprev->hashStateRoot)))
+            return error("DisconnectBlock() : contract state of block %d has already been pruned", pindex->nHeight - 1);
         globalState->setRoot(uintToh256(pindex->pprev->hashStateRoot)); // lux
         globalState->setRootUTXO(uintToh256(pindex->pprev->hashUTXORoot)); // lux
 
+        if (pfClean == NULL)
+            pcontractregistry->disconnectBlock(pindex->nHeight);
+
         if (pfClean == NULL && fLogEvents) {
             pstorageresult->deleteResults(block.vtx);
             //pblocktree->EraseHeightIndex(pindex->nHeight);
@@ -2266,6 +2301,204 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+/** Script verification flags of the block at pindex */
+static unsigned int GetBlockScriptFlags(const CBlock& block, const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks, when 75% of the network has upgraded:
+    if (block.nVersion >= 3 && CBlockIndex::IsSuperMajority(3, pindex->pprev, chainparams.EnforceBlockUpgradeMajority(), chainparams.GetConsensus())) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+    }
+    return flags;
+}
+
+/**
+ * Scripts of the next block to connect, checked in the background into the
+ * signature cache while the previous block is written and the next one read,
+ * so ConnectBlock finds most signatures verified. Only inputs that are already
+ * in pcoinsTip are checked, the checks point into the block and its txdata,
+ * so they are cancelled before those go, on whatever path that is.
+ */
+struct CScriptPrevalidation {
+    const CBlockIndex* pindex;
+    CBlock block;
+    std::vector<PrecomputedTransactionData> txdata;
+
+    ~CScriptPrevalidation() { scriptcheckqueue.CancelBackground(); }
+};
+
+static std::unique_ptr<CScriptPrevalidation> scriptPrevalidation;
+
+static void StopScriptPrevalidation()
+{
+    scriptPrevalidation.reset();
+}
+
+static void StartScriptPrevalidation(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    StopScriptPrevalidation();
+    if (!nScriptCheckThreads || pindex->nHeight < Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints()))
+        return;
+    std::unique_ptr<CScriptPrevalidation> prevalidation(new CScriptPrevalidation());
+    prevalidation->pindex = pindex;
+    if (!ReadBlockFromDisk(prevalidation->block, pindex, chainparams.GetConsensus()))
+        return;
+
+    unsigned int flags = GetBlockScriptFlags(prevalidation->block, pindex, chainparams);
+    std::vector<CScriptCheck> vChecks;
+    prevalidation->txdata.reserve(prevalidation->block.vtx.size());
+    for (const CTransaction& tx : prevalidation->block.vtx) {
+        prevalidation->txdata.emplace_back(tx);
+        if (tx.IsCoinBase())
+            continue;
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const COutPoint& prevout = tx.vin[i].prevout;
+            const CCoins* coins = pcoinsTip->AccessCoins(prevout.hash);
+            if (coins && coins->IsAvailable(prevout.n))
+                vChecks.push_back(CScriptCheck(*coins, tx, i, flags, true, &prevalidation->txdata.back()));
+        }
+    }
+    scriptcheckqueue.AddBackground(vChecks);
+    scriptPrevalidation = std::move(prevalidation);
+}
+
+static CCheckQueue<CContractCheck> contractcheckqueue(1);
+
+void ThreadContractCheck()
+{
+    RenameThread("lux-contractch");
+    contractcheckqueue.Thread();
+}
+
+/**
+ * The checks of the contract executions of a transaction that come before running them:
+ * gas price, limit and stipend, and the VM version.
+ */
+static bool CheckContractExecutions(const CTransaction& tx, ExtractLuxTX& resultConvertLuxTX, CAmount nTxFee, uint64_t minGasPrice, uint64_t blockGasLimit, CValidationState& state)
+{
+    if(!CheckMinGasPrice(resultConvertLuxTX.second, minGasPrice))
+        return state.DoS(100, error("ConnectBlock(): Contract execution has lower gas price than allowed"), REJECT_INVALID, "bad-tx-low-gas-price");
+
+    dev::u256 gasAllTxs = dev::u256(0);
+    //validate VM version and other ETH params before execution
+    //Reject anything unknown (could be changed later by DGP)
+    //TODO evaluate if this should be relaxed for soft-fork purposes
+    bool nonZeroVersion = false;
+    dev::u256 sumGas = dev::u256(0);
+    for(LuxTransaction& ltx : resultConvertLuxTX.first) {
+        sumGas += ltx.gas() * ltx.gasPrice();
+
+        if(sumGas > dev::u256(INT64_MAX)) {
+            return state.DoS(100, error("ConnectBlock(): Transaction's gas stipend overflows"), REJECT_INVALID, "bad-tx-gas-stipend-overflow");
+        }
+
+        if(sumGas > dev::u256(nTxFee)) {
+            return state.DoS(100, error("ConnectBlock(): Transaction fee does not cover the gas stipend"), REJECT_INVALID, "bad-txns-fee-notenough");
+        }
+
+        VersionVM v = ltx.getVersion();
+        if(v.format != 0)
+            return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown version format"), REJECT_INVALID, "bad-tx-version-format");
+        if(v.rootVM != 0) {
+            nonZeroVersion=true;
+        } else {
+            if(nonZeroVersion) {
+                //If an output is version 0, then do not allow any other versions in the same tx
+                return state.DoS(100, error("ConnectBlock(): Contract tx has mixed version 0 and non-0 VM executions"), REJECT_INVALID, "bad-tx-mixed-zero-versions");
+            }
+        }
+        if(!(v.rootVM == 0 || v.rootVM == 1))
+            return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown root VM"), REJECT_INVALID, "bad-tx-version-rootvm");
+        if(v.vmVersion != 0)
+            return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown VM version"), REJECT_INVALID, "bad-tx-version-vmversion");
+        if(v.flagOptions != 0)
+            return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown flag options"), REJECT_INVALID, "bad-tx-version-flags");
+
+        //check gas limit is not less than minimum gas limit (unless it is a no-exec tx)
+        if(ltx.gas() < MINIMUM_GAS_LIMIT && v.rootVM != 0)
+            return state.DoS(100, error("ConnectBlock(): Contract execution has lower gas limit than allowed"), REJECT_INVALID, "bad-tx-too-little-gas");
+
+        if(ltx.gas() > UINT32_MAX)
+            return state.DoS(100, error("ConnectBlock(): Contract execution can not specify greater gas limit than can fit in 32-bits"), REJECT_INVALID, "bad-tx-too-much-gas");
+
+        gasAllTxs += ltx.gas();
+        if(gasAllTxs > dev::u256(blockGasLimit))
+            return state.DoS(1, false, REJECT_INVALID, "bad-txns-gas-exceeds-blockgaslimit");
+
+        //don't allow less than DGP set minimum gas price to prevent MPoS greedy mining/spammers
+        if(v.rootVM != 0 && (uint64_t)ltx.gasPrice() < minGasPrice)
+            return state.DoS(100, error("ConnectBlock(): Contract execution has lower gas price than allowed"), REJECT_INVALID, "bad-tx-low-gas-price");
+    }
+
+    if(!nonZeroVersion){
+        //if tx is 0 version, then the tx must already have been added by a previous contract execution
+        if(!tx.HasOpSpend()){
+            return state.DoS(100, error("ConnectBlock(): Version 0 contract executions are not allowed unless created by the AAL "), REJECT_INVALID, "bad-tx-improper-version-0");
+        }
+    }
+    return true;
+}
+
+/**
+ * Execute the contract transactions of the block on the contract check threads,
+ * on the state at the start of the block, null if there is nothing to gain.
+ * A transaction that fails the checks before execution, or more gas in the block
+ * than it may use, ends the speculation: nothing runs before ConnectBlock rejects it.
+ */
+static std::unique_ptr<SpeculativeContractExec> SpeculateContracts(const CBlock& block, CCoinsViewCache& view, int nHeight, uint64_t minGasPrice, uint64_t blockGasLimit, VMProfile* profile)
+{
+    unsigned int nContractTxs = 0;
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.HasCreateOrCall() && !tx.HasOpSpend())
+            nContractTxs++;
+    }
+    if (nContractTxs < 2)
+        return nullptr;
+
+    ByteCodeExec exec(block, std::vector<LuxTransaction>(), blockGasLimit);
+    std::unique_ptr<SpeculativeContractExec> speculation(new SpeculativeContractExec(*globalState, exec.BuildEVMEnvironment(), *globalSealEngine, profile));
+
+    // senders are looked up like ConnectBlock does, on coins that follow the block
+    CCoinsViewCache viewBlock(&view);
+    CValidationState stateDummy;
+    dev::u256 gasBlock = 0;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (!tx.IsCoinBase() && !viewBlock.HaveInputs(tx))
+            break;
+        if (tx.HasCreateOrCall() && !tx.HasOpSpend()) {
+            if (!CheckSenderScript(viewBlock, tx))
+                return nullptr;
+            LuxTxConverter convert(tx, &viewBlock, &block.vtx);
+            ExtractLuxTX resultConvertLuxTX;
+            if (!convert.extractionLuxTransactions(resultConvertLuxTX))
+                return nullptr;
+            CAmount nTxFee = viewBlock.GetValueIn(tx) - tx.GetValueOut();
+            if (!CheckContractExecutions(tx, resultConvertLuxTX, nTxFee, minGasPrice, blockGasLimit, stateDummy))
+                return nullptr;
+            for (const LuxTransaction& ltx : resultConvertLuxTX.first)
+                gasBlock += ltx.gas();
+            if (gasBlock > dev::u256(blockGasLimit))
+                return nullptr;
+            speculation->Add(i, resultConvertLuxTX.first);
+        }
+        CTxUndo undoDummy;
+        UpdateCoins(tx, stateDummy, viewBlock, undoDummy, nHeight);
+    }
+    speculation->Run(&contractcheckqueue);
+    return speculation;
+}
+
 static bool IsBlockValueValid(const CBlock& block, int64_t nExpectedValue)
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
@@ -2351,7 +2584,7 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool fReconnect)
 {
     AssertLockHeld(cs_main);
 
@@ -2438,21 +2671,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && CBlockIndex::IsSuperMajority(3, pindex->pprev, chainparams.EnforceBlockUpgradeMajority(), chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-    }
+    unsigned int flags = GetBlockScriptFlags(block, pindex, chainparams);
+    bool fStrictPayToScriptHash = (flags & SCRIPT_VERIFY_P2SH) != 0;
 
     CBlockUndo blockundo;
 
@@ -2460,6 +2680,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     ///////////////////////////////////////////////////////// // lux
     std::map<dev::Address, std::pair<CHeightTxIndexKey, std::vector<uint256>>> heightIndexes;
+    // trie nodes of every contract execution stay in memory until the whole block is connected
+    BlockStateCommit blockState(globalState);
+    // a block only checked, or reconnected after it was connected before, leaves no records of its contracts
+    const bool fRecordContracts = !fJustCheck && !fReconnect;
+    // receipts and contracts left over from a block that failed to connect must not be written with this one
+    if (fLogEvents)
+        pstorageresult->clearPendingResults();
+    pcontractregistry->clearPending();
+    // blocks that are only checked are not profiled, they are usually connected afterwards
+    std::unique_ptr<VMProfile> vmProfile;
+    if (vmProfiler.Enabled() && fRecordContracts && pindex->nHeight >= Params().FirstSCBlock())
+        vmProfile.reset(new VMProfile());
+    std::unique_ptr<SpeculativeContractExec> speculation;
+    if (fParallelContracts && nScriptCheckThreads && pindex->nHeight >= Params().FirstSCBlock())
+        speculation = SpeculateContracts(block, view, pindex->nHeight, minGasPrice, blockGasLimit, vmProfile.get());
     /////////////////////////////////////////////////////////
 
     int64_t nTimeStart = GetTimeMicros();
@@ -2517,7 +2752,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
 
             std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            // a block only checked keeps the cached signatures, the one connected later evicts them
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fJustCheck, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         } else {
@@ -2542,70 +2778,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 if(!convert.extractionLuxTransactions(resultConvertLuxTX)) {
                     return state.DoS(100, error("ConnectBlock(): Contract transaction of the wrong format"), REJECT_INVALID, "bad-tx-bad-contract-format");
                 }
-                if(!CheckMinGasPrice(resultConvertLuxTX.second, minGasPrice))
-                    return state.DoS(100, error("ConnectBlock(): Contract execution has lower gas price than allowed"), REJECT_INVALID, "bad-tx-low-gas-price");
-
-                dev::u256 gasAllTxs = dev::u256(0);
-                ByteCodeExec exec(block, resultConvertLuxTX.first, blockGasLimit);
-                //validate VM version and other ETH params before execution
-                //Reject anything unknown (could be changed later by DGP)
-                //TODO evaluate if this should be relaxed for soft-fork purposes
-                bool nonZeroVersion = false;
-                dev::u256 sumGas = dev::u256(0);
                 CAmount nTxFee = view.GetValueIn(tx) - tx.GetValueOut();
-                for(LuxTransaction& ltx : resultConvertLuxTX.first) {
-                    sumGas += ltx.gas() * ltx.gasPrice();
-
-                    if(sumGas > dev::u256(INT64_MAX)) {
-                        return state.DoS(100, error("ConnectBlock(): Transaction's gas stipend overflows"), REJECT_INVALID, "bad-tx-gas-stipend-overflow");
-                    }
-
-                    if(sumGas > dev::u256(nTxFee)) {
-                        return state.DoS(100, error("ConnectBlock(): Transaction fee does not cover the gas stipend"), REJECT_INVALID, "bad-txns-fee-notenough");
-                    }
-
-                    VersionVM v = ltx.getVersion();
-                    if(v.format != 0)
-                        return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown version format"), REJECT_INVALID, "bad-tx-version-format");
-                    if(v.rootVM != 0) {
-                        nonZeroVersion=true;
-                    } else {
-                        if(nonZeroVersion) {
-                            //If an output is version 0, then do not allow any other versions in the same tx
-                            return state.DoS(100, error("ConnectBlock(): Contract tx has mixed version 0 and non-0 VM executions"), REJECT_INVALID, "bad-tx-mixed-zero-versions");
-                        }
-                    }
-                    if(!(v.rootVM == 0 || v.rootVM == 1))
-                        return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown root VM"), REJECT_INVALID, "bad-tx-version-rootvm");
-                    if(v.vmVersion != 0)
-                        return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown VM version"), REJECT_INVALID, "bad-tx-version-vmversion");
-                    if(v.flagOptions != 0)
-                        return state.DoS(100, error("ConnectBlock(): Contract execution uses unknown flag options"), REJECT_INVALID, "bad-tx-version-flags");
-
-                    //check gas limit is not less than minimum gas limit (unless it is a no-exec tx)
-                    if(ltx.gas() < MINIMUM_GAS_LIMIT && v.rootVM != 0)
-                        return state.DoS(100, error("ConnectBlock(): Contract execution has lower gas limit than allowed"), REJECT_INVALID, "bad-tx-too-little-gas");
-
-                    if(ltx.gas() > UINT32_MAX)
-                        return state.DoS(100, error("ConnectBlock(): Contract execution can not specify greater gas limit than can fit in 32-bits"), REJECT_INVALID, "bad-tx-too-much-gas");
-
-                    gasAllTxs += ltx.gas();
-                    if(gasAllTxs > dev::u256(blockGasLimit))
-                        return state.DoS(1, false, REJECT_INVALID, "bad-txns-gas-exceeds-blockgaslimit");
-
-                    //don't allow less than DGP set minimum gas price to prevent MPoS greedy mining/spammers
-                    if(v.rootVM != 0 && (uint64_t)ltx.gasPrice() < minGasPrice)
-                        return state.DoS(100, error("ConnectBlock(): Contract execution has lower gas price than allowed"), REJECT_INVALID, "bad-tx-low-gas-price");
-                }
+                if (!CheckContractExecutions(tx, resultConvertLuxTX, nTxFee, minGasPrice, blockGasLimit, state))
+                    return false;
 
-                if(!nonZeroVersion){
-                    //if tx is 0 version, then the tx must already have been added by a previous contract execution
-                    if(!tx.HasOpSpend()){
-                        return state.DoS(100, error("ConnectBlock(): Version 0 contract executions are not allowed unless created by the AAL "), REJECT_INVALID, "bad-tx-improper-version-0");
-                    }
-                }
+                ByteCodeExec exec(block, resultConvertLuxTX.first, blockGasLimit, vmProfile.get());
 
-                if(!exec.performByteCode()){
+                if(!(speculation ? exec.performByteCode(*speculation, i) : exec.performByteCode())){
                     return state.DoS(100, error("ConnectBlock(): Unknown error during contract execution"), REJECT_INVALID, "bad-tx-unknown-error");
                 }
 
@@ -2617,7 +2796,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
                 countCumulativeGasUsed += bcer.usedGas;
                 std::vector<TransactionReceiptInfo> tri;
-                if (fLogEvents && !fJustCheck)
+                if (fLogEvents && fRecordContracts)
                 {
                     for(size_t k = 0; k < resultConvertLuxTX.first.size(); k ++){
                         dev::Address key = resultExec[k].execRes.newAddress;
@@ -2643,14 +2822,27 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 for(CTransaction& t : bcer.valueTransfers){
                     checkBlock.vtx.push_back(std::move(t));
                 }
-                if(fRecordLogOpcodes && !fJustCheck){
+                if(fRecordLogOpcodes && fRecordContracts){
                     writeVMlog(resultExec, tx, block);
                 }
 
                 for(ResultExecute& re: resultExec){
-                    if(re.execRes.newAddress != dev::Address() && !fJustCheck)
+                    if(re.execRes.newAddress != dev::Address() && fRecordContracts)
                         dev::g_logPost(std::string("Address : " + re.execRes.newAddress.hex()), NULL);
                 }
+
+                if(fRecordContracts){
+                    for(size_t k = 0; k < resultConvertLuxTX.first.size(); k++){
+                        dev::eth::ExecutionResult const& execRes = resultExec[k].execRes;
+                        if(execRes.excepted != dev::eth::TransactionException::None)
+                            continue;
+                        for(dev::Address const& addr : execRes.suicides)
+                            pcontractregistry->removeContract(addr);
+                        if(resultConvertLuxTX.first[k].isCreation() && globalState->addressInUse(execRes.newAddress))
+                            pcontractregistry->addContract(execRes.newAddress, resultConvertLuxTX.first[k].from(),
+                                                           globalState->codeHash(execRes.newAddress), tx.GetHash(), pindex->nHeight);
+                    }
+                }
             }
         }
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -2675,6 +2867,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime1 = GetTimeMicros();
     nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs - 1), nTimeConnect * 0.000001);
+    if (speculation)
+        LogPrint("bench", "      - Contracts of %u transactions executed ahead, %u taken over, %u executed again\n", (unsigned)speculation->Speculated(), (unsigned)speculation->Reused(), (unsigned)speculation->Reexecuted());
 
     if (block.IsProofOfWork()) {
         auto nReward = GetProofOfWorkReward(nFees, pindex->nHeight/*pindex->pprev->nHeight*/);
@@ -2769,17 +2963,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
+    // blockState discards the execution results of a block that is only checked
     if (fJustCheck) {
-        if (pindex->nHeight > Params().FirstSCBlock()) {
-            dev::h256 prevHashStateRoot(dev::sha3(dev::rlp("")));
-            dev::h256 prevHashUTXORoot(dev::sha3(dev::rlp("")));
-            if (pindex->pprev->hashStateRoot != uint256() && pindex->pprev->hashUTXORoot != uint256()) {
-                prevHashStateRoot = uintToh256(pindex->pprev->hashStateRoot);
-                prevHashUTXORoot = uintToh256(pindex->pprev->hashUTXORoot);
-            }
-            globalState->setRoot(prevHashStateRoot);
-            globalState->setRootUTXO(prevHashUTXORoot);
-        }
+        if (fLogEvents)
+            pstorageresult->clearPendingResults();
+        pcontractregistry->clearPending();
         return true;
     }
 //////////////////////////////////////////////////////////////////
@@ -2806,6 +2994,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Error("Failed to write transaction index");
 
+    if (fReconnect) {
+        // the trie nodes are on disk and counted already, and so are the receipts and contracts
+        blockState.Recommit();
+    } else {
+        blockState.Commit(pindex->nHeight);
+        if (fLogEvents)
+            pstorageresult->commitResults();
+        pcontractregistry->commitBlock(pindex->nHeight);
+    }
+    if (vmProfile)
+        vmProfiler.AddBlock(pindex->nHeight, pindex->GetBlockHash(), *vmProfile);
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2949,9 +3149,11 @@ void PruneAndFlush() {
 }
 
 /** Update chainActive and related internal data structures. */
-void static UpdateTip(CBlockIndex* pindexNew, const CChainParams& chainParams)
+void static UpdateTip(CBlockIndex* pindexNew, const CBlock* pblock, const CChainParams& chainParams)
 {
     chainActive.SetTip(pindexNew);
+    evmTipEnvironment.SetTip(pindexNew, pblock);
+    ResetContractStateSnapshot();
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -3046,7 +3248,7 @@ static bool DisconnectTip(CValidationState& state, const CChainParams& chainpara
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
-    UpdateTip(pindexDelete->pprev, chainparams);
+    UpdateTip(pindexDelete->pprev, NULL, chainparams);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -3065,15 +3267,24 @@ static int64_t nTimePostConnect = 0;
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock)
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock, const CBlockIndex* pindexNext)
 {
     assert(pindexNew->pprev == chainActive.Tip());
     mempool.check(pcoinsTip);
     CCoinsViewCache view(pcoinsTip);
 
+    // The scripts of this block may have been checked ahead, which read it already
+    std::unique_ptr<CScriptPrevalidation> prevalidation;
+    if (scriptPrevalidation && scriptPrevalidation->pindex == pindexNew)
+        prevalidation = std::move(scriptPrevalidation);
+    else
+        StopScriptPrevalidation();
+
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
+    if (!pblock && prevalidation)
+        pblock = &prevalidation->block;
     if (!pblock) {
         if (!ReadBlockFromDisk(block, pindexNew, chainparams.GetConsensus()))
             return state.Error("Failed to read block");
@@ -3086,23 +3297,14 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
-        dev::h256 oldHashStateRoot;
-        dev::h256 oldHashUTXORoot;
-        if (pindexNew->nHeight >= chainparams.FirstSCBlock()) {
-            oldHashStateRoot = dev::h256(globalState->rootHash()); // lux
-            oldHashUTXORoot = dev::h256(globalState->rootHashUTXO()); // lux
-        }
-
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        // what is left of the checks ahead is of no use any more
+        if (prevalidation)
+            scriptcheckqueue.CancelBackground();
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
                 InvalidBlockFound(pindexNew, state);
-            if (pindexNew->nHeight >= chainparams.FirstSCBlock()) {
-                globalState->setRoot(oldHashStateRoot); // lux
-                globalState->setRootUTXO(oldHashUTXORoot); // lux
-            }
-
             return error("ConnectTip() : ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(inv.hash);
@@ -3115,6 +3317,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
 
+    // the inputs of the next block that spend earlier blocks are in pcoinsTip now
+    if (pindexNext)
+        StartScriptPrevalidation(pindexNext, chainparams);
+
     // Write the chain state to disk, if necessary. Always write to disk if this is the first of a new file.
     FlushStateMode flushMode = FLUSH_STATE_IF_NEEDED;
     if (pindexNew->pprev && (pindexNew->GetBlockPos().nFile != pindexNew->pprev->GetBlockPos().nFile))
@@ -3130,7 +3336,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight/*, txConflicted, !IsInitialBlockDownload()*/);
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
-    UpdateTip(pindexNew, chainparams);
+    UpdateTip(pindexNew, pblock, chainparams);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH (const CTransaction& tx, txConflicted) {
@@ -3345,7 +3551,8 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
         // Connect new blocks.
         BOOST_REVERSE_FOREACH (CBlockIndex* pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+            const CBlockIndex* pindexNext = pindexConnect != pindexMostWork ? pindexMostWork->GetAncestor(pindexConnect->nHeight + 1) : NULL;
+            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, pindexNext)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -4457,19 +4664,8 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
     if (block.IsProofOfStake() && !stake->CheckProof(pindexPrev, block, index.hashProofOfStake))
         return false;
 
-    dev::h256 oldHashStateRoot;
-    dev::h256 oldHashUTXORoot;
-    if (index.nHeight >= chainparams.FirstSCBlock()) {
-        oldHashStateRoot = dev::h256(globalState->rootHash()); // lux
-        oldHashUTXORoot = dev::h256(globalState->rootHashUTXO()); // lux
-    }
-    if (!ConnectBlock(block, state, &index, viewNew, chainparams, true)) {
-        if (index.nHeight >= chainparams.FirstSCBlock()) {
-            globalState->setRoot(oldHashStateRoot); // lux
-            globalState->setRootUTXO(oldHashUTXORoot); // lux
-        }
+    if (!ConnectBlock(block, state, &index, viewNew, chainparams, true))
         return false;
-    }
 
     assert(state.IsValid());
 
@@ -4913,6 +5109,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView* coinsview,
         nCheckDepth = 1000000000; // suffices until the year 19000
     if (nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
+    // blocks are disconnected back to parents whose contract state must still exist
+    if (globalState->isPruning() && nCheckDepth > nStatePruneDepth)
+        nCheckDepth = nStatePruneDepth;
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
     CCoinsViewCache coins(coinsview);
@@ -4980,20 +5179,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView* coinsview,
             if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
                 return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
 
-            dev::h256 oldHashStateRoot;
-            dev::h256 oldHashUTXORoot;
-            if (chainActive.Tip()->nHeight >= chainparams.FirstSCBlock()) {
-                oldHashStateRoot = dev::h256(globalState->rootHash());
-                oldHashUTXORoot = dev::h256(globalState->rootHashUTXO());
-            }
-
-            if (!ConnectBlock(block, state, pindex, coins, chainparams)) {
-                if (chainActive.Tip()->nHeight >= chainparams.FirstSCBlock()) {
-                    globalState->setRoot(oldHashStateRoot); // lux
-                    globalState->setRootUTXO(oldHashUTXORoot); // lux
-                }
+            if (!ConnectBlock(block, state, pindex, coins, chainparams, false, true))
                 return error("VerifyDB() : *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
         }
     } else {
         if (chainActive.Tip()->nHeight >= chainparams.FirstSCBlock()) {
@@ -6913,37 +7100,245 @@ bool CheckSenderScript(const CCoinsViewCache& view, const CTransaction& tx){
 }
 
 std::vector<ResultExecute> CallContract(const dev::Address& addrContract, std::vector<unsigned char> opcode, const dev::Address& sender, uint64_t gasLimit){
-    CBlock block;
-    CMutableTransaction tx;
-    const CChainParams& chainparams = Params();
-    CBlockIndex* pblockindex = mapBlockIndex[chainActive.Tip()->GetBlockHash()];
-    ReadBlockFromDisk(block, pblockindex, chainparams.GetConsensus());
-    block.nTime = GetAdjustedTime();
+    LuxDGP luxDGP(globalState.get(), fGettingValuesDGP);
+    uint64_t blockGasLimit = luxDGP.getBlockGasLimit(chainActive.Tip()->nHeight + 1);
 
-    if(block.IsProofOfStake())
-        block.vtx.erase(block.vtx.begin()+2,block.vtx.end());
-    else
-        block.vtx.erase(block.vtx.begin()+1,block.vtx.end());
+    if(gasLimit == 0){
+        gasLimit = blockGasLimit - 1;
+    }
+    dev::Address senderAddress = sender == dev::Address() ? dev::Address("ffffffffffffffffffffffffffffffffffffffff") : sender;
 
+    LuxTransaction callTransaction(0, 1, dev::u256(gasLimit), addrContract, opcode, dev::u256(0));
+    callTransaction.forceSender(senderAddress);
+    callTransaction.setVersion(VersionVM::GetEVMDefault());
 
-    LuxDGP luxDGP(globalState.get(), fGettingValuesDGP);
-    uint64_t blockGasLimit = luxDGP.getBlockGasLimit(chainActive.Tip()->nHeight + 1);
+    // calls run as if they were in a block on top of the tip, with the tip's author
+    std::vector<ResultExecute> result;
+    ExecuteContractTxs(*globalState, evmTipEnvironment.GetCall(chainActive.Tip(), GetAdjustedTime(), blockGasLimit), *globalSealEngine,
+                       std::vector<LuxTransaction>(1, callTransaction), dev::eth::Permanence::Reverted, result);
+    return result;
+}
+
+static CCriticalSection cs_contractSnapshot;
+static std::shared_ptr<const ContractStateSnapshot> contractSnapshot;
+
+ContractStateSnapshot::~ContractStateSnapshot(){
+    if(fPinned && globalState)
+        globalState->unpinRoot(nHeight);
+}
+
+std::unique_ptr<LuxState> ContractStateSnapshot::NewView() const{
+    std::unique_ptr<LuxState> view(new LuxState(accountStartNonce, db, dbUTXO, hashStateRoot, hashUTXORoot));
+    // only used while the index is still at the snapshot root, the pinned trie serves the rest
+    if(flatState)
+        view->setFlatState(flatState);
+    return view;
+}
+
+bool ContractStateSnapshot::AddressInUse(const dev::Address& addr) const{
+    return NewView()->addressInUse(addr);
+}
 
+std::vector<ResultExecute> ContractStateSnapshot::Call(const dev::Address& addrContract, std::vector<unsigned char> opcode, const dev::Address& sender, uint64_t gasLimit) const{
     if(gasLimit == 0){
         gasLimit = blockGasLimit - 1;
     }
     dev::Address senderAddress = sender == dev::Address() ? dev::Address("ffffffffffffffffffffffffffffffffffffffff") : sender;
-    tx.vout.push_back(CTxOut(0, CScript() << OP_DUP << OP_HASH160 << senderAddress.asBytes() << OP_EQUALVERIFY << OP_CHECKSIG));
-    block.vtx.push_back(CTransaction(tx));
 
     LuxTransaction callTransaction(0, 1, dev::u256(gasLimit), addrContract, opcode, dev::u256(0));
     callTransaction.forceSender(senderAddress);
     callTransaction.setVersion(VersionVM::GetEVMDefault());
 
+    dev::eth::EnvInfo env(envInfo);
+    env.setTimestamp(dev::u256(GetAdjustedTime()));
+
+    // the seal engine collects addresses while executing, so every call needs its own
+    std::unique_ptr<dev::eth::SealEngineFace> sealEngine(dev::eth::SealEngineRegistrar::create(chainParams));
+    sealEngine->setLuxSchedule(schedule);
+
+    std::unique_ptr<LuxState> state = NewView();
+    std::vector<ResultExecute> result;
+    if(!state->addressInUse(addrContract)){
+        dev::eth::ExecutionResult execRes;
+        execRes.excepted = dev::eth::TransactionException::Unknown;
+        result.push_back(ResultExecute{execRes, dev::eth::TransactionReceipt(dev::h256(), dev::u256(), dev::eth::LogEntries()), CTransaction()});
+    } else {
+        result.push_back(state->execute(env, *sealEngine, callTransaction, dev::eth::Permanence::Reverted, OnOpFunc()));
+    }
+    return result;
+}
+
+std::shared_ptr<const ContractStateSnapshot> GetContractStateSnapshot(){
+    {
+        LOCK(cs_contractSnapshot);
+        if(contractSnapshot)
+            return contractSnapshot;
+    }
+
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if(!pindexTip || !globalState)
+        return nullptr;
+
+    std::shared_ptr<ContractStateSnapshot> snapshot = std::make_shared<ContractStateSnapshot>();
+    snapshot->nHeight = pindexTip->nHeight;
+    snapshot->hashTip = pindexTip->GetBlockHash();
+    snapshot->hashStateRoot = globalState->rootHash();
+    snapshot->hashUTXORoot = globalState->rootHashUTXO();
+    if(!globalState->pinRoot(snapshot->nHeight))
+        return nullptr;
+    snapshot->fPinned = true;
+    snapshot->accountStartNonce = globalState->accountStartNonce();
+    snapshot->db = globalState->db();
+    snapshot->dbUTXO = globalState->dbUtxo();
+    snapshot->flatState = globalState->flatState();
+    snapshot->chainParams = globalSealEngine->chainParams();
+
+    LuxDGP luxDGP(globalState.get(), fGettingValuesDGP);
+    snapshot->schedule = luxDGP.getGasSchedule(snapshot->nHeight + 1);
+    snapshot->blockGasLimit = luxDGP.getBlockGasLimit(snapshot->nHeight + 1);
+
+    // calls run as if they were in a block on top of the tip, with the tip's author and time
+    snapshot->envInfo = evmTipEnvironment.GetCall(pindexTip, pindexTip->GetBlockTime(), snapshot->blockGasLimit);
+
+    {
+        LOCK(cs_contractSnapshot);
+        contractSnapshot = snapshot;
+    }
+    return snapshot;
+}
 
-    ByteCodeExec exec(block, std::vector<LuxTransaction>(1, callTransaction), blockGasLimit);
-    exec.performByteCode(dev::eth::Permanence::Reverted);
-    return exec.getResult();
+void ResetContractStateSnapshot(){
+    LOCK(cs_contractSnapshot);
+    contractSnapshot.reset();
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool LoadMempool(void)
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    std::vector<CTransaction> vtx;
+    std::vector<int64_t> vTime;
+    std::vector<CAmount> vMinGasPrice;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        vtx.resize(num);
+        vTime.resize(num);
+        vMinGasPrice.resize(num);
+        for (uint64_t i = 0; i < num; i++) {
+            file >> vtx[i];
+            file >> vTime[i];
+            file >> vMinGasPrice[i];
+        }
+        file >> mapDeltas;
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    // fee deltas must be known before the transactions are re-validated
+    for (const auto& i : mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.first.ToString(), i.second.first, i.second.second);
+    }
+
+    // re-validate in batches so block connection and RPC calls get cs_main in between
+    for (size_t nStart = 0; nStart < vtx.size(); nStart += MEMPOOL_LOAD_BATCH_SIZE) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return false;
+
+        LOCK(cs_main);
+        LuxDGP luxDGP(globalState.get(), fGettingValuesDGP);
+        uint64_t minGasPrice = luxDGP.getMinGasPrice(chainActive.Height() + 1);
+        for (size_t i = nStart; i < std::min(vtx.size(), nStart + MEMPOOL_LOAD_BATCH_SIZE); i++) {
+            // contract transactions priced out by the DGP would only fail after being converted
+            if (vTime[i] + nExpiryTimeout <= nNow || (vMinGasPrice[i] != 0 && (uint64_t)vMinGasPrice[i] < minGasPrice)) {
+                skipped++;
+                continue;
+            }
+            CValidationState state;
+            if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i])) {
+                count++;
+            } else if (!mempool.exists(vtx[i].GetHash())) {
+                failed++;
+            }
+        }
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    return true;
+}
+
+void DumpMempool(void)
+{
+    int64_t start = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<TxMempoolInfo> vinfo;
+
+    {
+        LOCK(mempool.cs);
+        for (const auto &i : mempool.mapDeltas) {
+            mapDeltas[i.first] = i.second;
+        }
+        vinfo = mempool.infoAll();
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vinfo.size();
+        for (const auto& i : vinfo) {
+            file << *(i.tx);
+            file << (int64_t)i.nTime;
+            file << i.nMinGasPrice;
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (mid-start)*0.000001, (last-mid)*0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
+void PruneContractState(){
+    // globalState is only replaced while loading, before the scheduler calls this
+    while(globalState->pruneDB())
+        boost::this_thread::interruption_point();
 }
 
 bool CheckMinGasPrice(std::vector<EthTransactionParams>& etps, const uint64_t& minGasPrice){
@@ -6998,91 +7393,37 @@ valtype GetSenderAddress(const CTransaction& tx, const CCoinsViewCache* coinsVie
     return valtype();
 }
 
-UniValue vmLogToJSON(const ResultExecute& execRes, const CTransaction& tx, const CBlock& block){
-    UniValue result(UniValue::VOBJ);
-    if(tx != CTransaction())
-        result.push_back(Pair("txid", tx.GetHash().GetHex()));
-    result.push_back(Pair("address", execRes.execRes.newAddress.hex()));
-
-    CBlockIndex* pindexPrev = LookupBlockIndex(block.hashPrevBlock);
-    bool usePhi2 = pindexPrev ? pindexPrev->nHeight + 1 >= Params().SwitchPhi2Block() : false;
-
-    if(block.GetHash(usePhi2) != CBlock().GetHash(usePhi2)){
-        result.push_back(Pair("time", block.GetBlockTime()));
-        result.push_back(Pair("blockhash", block.GetHash(usePhi2).GetHex()));
-        result.push_back(Pair("blockheight", chainActive.Tip()->nHeight + 1));
-    } else {
-        result.push_back(Pair("time", GetAdjustedTime()));
-        result.push_back(Pair("blockheight", chainActive.Tip()->nHeight));
-    }
-    UniValue logEntries(UniValue::VARR);
-    dev::eth::LogEntries logs = execRes.txRec.log();
-    for(dev::eth::LogEntry log : logs){
-        UniValue logEntrie(UniValue::VOBJ);
-        logEntrie.push_back(Pair("address", log.address.hex()));
-        UniValue topics(UniValue::VARR);
-        for(dev::h256 l : log.topics){
-            UniValue topicPair(UniValue::VOBJ);
-            topicPair.push_back(Pair("raw", l.hex()));
-            topics.push_back(topicPair);
-            //TODO add "pretty" field for human readable data
-        }
-        UniValue dataPair(UniValue::VOBJ);
-        dataPair.push_back(Pair("raw", HexStr(log.data)));
-        logEntrie.push_back(Pair("data", dataPair));
-        logEntrie.push_back(Pair("topics", topics));
-        logEntries.push_back(logEntrie);
-    }
-    result.push_back(Pair("entries", logEntries));
-    return result;
-}
-
 void writeVMlog(const std::vector<ResultExecute>& res, const CTransaction& tx, const CBlock& block){
-    boost::filesystem::path luxDir = GetDataDir() / "vmExecLogs.json";
-    std::stringstream ss;
-    if(fIsVMlogFile){
-        ss << ",";
-    } else {
-        std::ofstream file(luxDir.string(), std::ios::out | std::ios::app);
-        file << "{\"logs\":[]}";
-        file.close();
+    uint256 hashBlock;
+    int nHeight = chainActive.Tip()->nHeight;
+    int64_t nTime = GetAdjustedTime();
+    if(block.hashPrevBlock != uint256() || !block.vtx.empty()){
+        CBlockIndex* pindexPrev = LookupBlockIndex(block.hashPrevBlock);
+        bool usePhi2 = pindexPrev ? pindexPrev->nHeight + 1 >= Params().SwitchPhi2Block() : false;
+        hashBlock = block.GetHash(usePhi2);
+        nHeight++;
+        nTime = block.GetBlockTime();
     }
 
+    std::vector<VMLogRecord> records(res.size());
     for(size_t i = 0; i < res.size(); i++){
-        ss << vmLogToJSON(res[i], tx, block).write();
-        if(i != res.size() - 1){
-            ss << ",";
-        } else {
-            ss << "]}";
-        }
+        if(tx != CTransaction())
+            records[i].txid = tx.GetHash();
+        records[i].hashBlock = hashBlock;
+        records[i].nHeight = nHeight;
+        records[i].nTime = nTime;
+        records[i].newAddress = res[i].execRes.newAddress;
+        records[i].logs = res[i].txRec.log();
     }
-
-    std::ofstream file(luxDir.string(), std::ios::in | std::ios::out);
-    file.seekp(-2, std::ios::end);
-    file << ss.str();
-    file.close();
-    fIsVMlogFile = true;
+    vmLog.Write(std::move(records));
 }
 
 bool ByteCodeExec::performByteCode(dev::eth::Permanence type){
-    for(LuxTransaction& tx : txs){
-        //validate VM version
-        if(tx.getVersion().toRaw() != VersionVM::GetEVMDefault().toRaw()){
-            return false;
-        }
-        dev::eth::EnvInfo envInfo(BuildEVMEnvironment());
-        if(!tx.isCreation() && !globalState->addressInUse(tx.receiveAddress())){
-            dev::eth::ExecutionResult execRes;
-            execRes.excepted = dev::eth::TransactionException::Unknown;
-            result.push_back(ResultExecute{execRes, dev::eth::TransactionReceipt(dev::h256(), dev::u256(), dev::eth::LogEntries()), CTransaction()});
-            continue;
-        }
-        result.push_back(globalState->execute(envInfo, *globalSealEngine.get(), tx, type, OnOpFunc()));
-    }
-    globalState->db().commit();
-    globalState->dbUtxo().commit();
-    globalSealEngine.get()->deleteAddresses.clear();
-    return true;
+    return ExecuteContractTxs(*globalState, BuildEVMEnvironment(), *globalSealEngine.get(), txs, type, result, profile);
+}
+
+bool ByteCodeExec::performByteCode(SpeculativeContractExec& speculation, unsigned int nTx){
+    return speculation.Execute(nTx, txs, result);
 }
 
 bool ByteCodeExec::processingResults(ByteCodeExecResult& resultBCE){
@@ -7125,28 +7466,20 @@ bool ByteCodeExec::processingResults(ByteCodeExecResult& resultBCE){
 }
 
 dev::eth::EnvInfo ByteCodeExec::BuildEVMEnvironment(){
-    dev::eth::EnvInfo env;
-    CBlockIndex* tip = chainActive.Tip();
-    env.setNumber(dev::u256(tip->nHeight + 1));
+    dev::eth::EnvInfo env(evmTipEnvironment.Get(chainActive.Tip()));
     env.setTimestamp(dev::u256(block.nTime));
     env.setDifficulty(dev::u256(block.nBits));
-
-    dev::eth::LastHashes lh;
-    lh.resize(256);
-    for(int i=0;i<256;i++){
-        if(!tip)
-            break;
-        lh[i]= uintToh256(*tip->phashBlock);
-        tip = tip->pprev;
-    }
-    env.setLastHashes(std::move(lh));
     env.setGasLimit(blockGasLimit);
+    env.setAuthor(BlockAuthor(block));
+    return env;
+}
+
+dev::Address ByteCodeExec::BlockAuthor(const CBlock& block){
     if(block.IsProofOfStake()){
-        env.setAuthor(EthAddrFromScript(block.vtx[1].vout[1].scriptPubKey));
+        return EthAddrFromScript(block.vtx[1].vout[1].scriptPubKey);
     }else {
-        env.setAuthor(EthAddrFromScript(block.vtx[0].vout[0].scriptPubKey));
+        return EthAddrFromScript(block.vtx[0].vout[0].scriptPubKey);
     }
-    return env;
 }
 
 dev::Address ByteCodeExec::EthAddrFromScript(const CScript& script){
@@ -7164,6 +7497,60 @@ dev::Address ByteCodeExec::EthAddrFromScript(const CScript& script){
     return dev::Address();
 }
 
+void EVMTipEnvironment::SetTip(CBlockIndex* pindexNew, const CBlock* pblock){
+    AssertLockHeld(cs_main);
+    if(pindexNew && pindexTip && pindexNew->pprev == pindexTip){
+        ring[nNext] = uintToh256(pindexNew->GetBlockHash());
+        nNext = (nNext + 1) % ring.size();
+    } else {
+        // a disconnected tip or a new chain, walk it back
+        ring.fill(dev::h256());
+        nNext = 0;
+        CBlockIndex* pindex = pindexNew;
+        for(size_t i = ring.size(); i > 0 && pindex; i--, pindex = pindex->pprev)
+            ring[i - 1] = uintToh256(pindex->GetBlockHash());
+    }
+    pindexTip = pindexNew;
+
+    dev::eth::LastHashes lh(ring.size());
+    for(size_t i = 0; i < ring.size(); i++)
+        lh[i] = ring[(nNext + ring.size() - 1 - i) % ring.size()];
+    // set field by field, EnvInfo() leaves the gas limit uninitialized
+    env.setNumber(dev::u256(pindexTip ? pindexTip->nHeight + 1 : 0));
+    env.setAuthor(dev::Address());
+    env.setTimestamp(dev::u256(0));
+    env.setDifficulty(dev::u256(0));
+    env.setGasLimit(0);
+    env.setLastHashes(std::move(lh));
+
+    fAuthor = pblock != NULL;
+    authorTip = pblock ? ByteCodeExec::BlockAuthor(*pblock) : dev::Address();
+}
+
+const dev::eth::EnvInfo& EVMTipEnvironment::Get(CBlockIndex* pindexPrev){
+    AssertLockHeld(cs_main);
+    // the chain is loaded at startup without UpdateTip
+    if(pindexPrev != pindexTip || !pindexTip)
+        SetTip(pindexPrev, NULL);
+    return env;
+}
+
+dev::eth::EnvInfo EVMTipEnvironment::GetCall(CBlockIndex* pindexPrev, int64_t nTime, uint64_t blockGasLimit){
+    dev::eth::EnvInfo envCall(Get(pindexPrev));
+    if(!fAuthor){
+        CBlock block;
+        if(ReadBlockFromDisk(block, pindexTip, Params().GetConsensus())){
+            authorTip = ByteCodeExec::BlockAuthor(block);
+            fAuthor = true;
+        }
+    }
+    envCall.setAuthor(authorTip);
+    envCall.setTimestamp(dev::u256(nTime));
+    envCall.setDifficulty(dev::u256(pindexTip->nBits));
+    envCall.setGasLimit(blockGasLimit);
+    return envCall;
+}
+
 bool LuxTxConverter::extractionLuxTransactions(ExtractLuxTX& luxtx){
     std::vector<LuxTransaction> resultTX;
     std::vector<EthTransactionParams> resultETP;
@@ -31,6 +31,7 @@
 #include "versionbits.h"
 
 #include <algorithm>
+#include <array>
 #include <exception>
 #include <map>
 #include <set>
@@ -53,12 +54,14 @@
 #include <libethashseal/GenesisInfo.h>
 #include <script/standard.h>
 #include <lux/storageresults.h>
+#include <lux/contractregistry.h>
+#include <lux/speculativeexec.h>
+#include <lux/vmlog.h>
 ///////////////////////////////////////////
 
 extern std::unique_ptr<LuxState> globalState;
 extern std::shared_ptr<dev::eth::SealEngineFace> globalSealEngine;
 extern bool fRecordLogOpcodes;
-extern bool fIsVMlogFile;
 extern bool fGettingValuesDGP;
 
 struct EthTransactionParams;
@@ -134,12 +137,24 @@ static const unsigned int DEFAULT_BYTES_PER_SIGOP = 20;
 static const int64_t STATIC_POS_REWARD = 1 * COIN; //Constant reward 8%
 
 static const bool DEFAULT_LOGEVENTS = false;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -mempoolexpiry, expiration time for mempool.dat entries in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** How often the mempool is written to disk with -persistmempool, in milliseconds */
+static const int64_t MEMPOOL_DUMP_INTERVAL = 15 * 60 * 1000;
+/** Transactions re-validated per cs_main acquisition while loading mempool.dat */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 100;
 
 ////////////////////////////////////////////////////// lux
 static const uint64_t DEFAULT_GAS_LIMIT_OP_CREATE=2500000;
 static const uint64_t DEFAULT_GAS_LIMIT_OP_SEND=250000;
 static const CAmount DEFAULT_GAS_PRICE=0.00000040*COIN;
 static const CAmount MAX_RPC_GAS_PRICE=0.00000100*COIN;
+/** Default for -statecache, contract trie node and storage slot caches in megabytes */
+static const int64_t DEFAULT_STATE_CACHE = 80;
+/** Default for -flatstate, serve contract state reads from a flat index of the tries */
+static const bool DEFAULT_FLAT_STATE = true;
 
 static const size_t MAX_CONTRACT_VOUTS = 1000;
 
@@ -192,8 +207,12 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
+/** Whether contract transactions are executed ahead on the contract check threads */
+extern bool fParallelContracts;
 extern bool fTxIndex;
 extern bool fLogEvents;
+/** Number of block state roots kept by contract state pruning, 0 when disabled */
+extern int nStatePruneDepth;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
@@ -286,6 +305,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread executing contract transactions ahead of ConnectBlock */
+void ThreadContractCheck();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -351,6 +372,9 @@ void PruneAndFlush();
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false);
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
 
@@ -639,7 +663,7 @@ private:
     PrecomputedTransactionData *txdata;
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(NULL) {}
     CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) {}
@@ -666,6 +690,8 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, int nHeight, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block whose proof the index already checked, only making sure it is the one with header. Does not need cs_main. */
+bool ReadIndexedBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const CBlockHeader& header);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -679,8 +705,10 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocksAndReprocess(int blocks);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, const CChainParams& chainparams, bool fJustCheck = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  fReconnect is for a block connected before, as VerifyDB reconnects it: the contract state,
+ *  receipts and contract registry it wrote then are kept as they are. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, const CChainParams& chainparams, bool fJustCheck = false, bool fReconnect = false);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
@@ -800,6 +828,7 @@ extern CCoinsViewCache* pcoinsTip;
 extern CBlockTreeDB* pblocktree;
 
 extern StorageResults *pstorageresult;
+extern ContractRegistry *pcontractregistry;
 
 extern VersionBitsCache versionbitscache;
 
@@ -819,12 +848,80 @@ static const unsigned int REJECT_CONFLICT = 0x102;
 int GetSpendHeight(const CCoinsViewCache& inputs);
 
 //////////////////////////////////////////////////////// lux
+/** Execute a call on globalState as it is right now, requires cs_main */
 std::vector<ResultExecute> CallContract(const dev::Address& addrContract, std::vector<unsigned char> opcode, const dev::Address& sender = dev::Address(), uint64_t gasLimit=0);
 
+/**
+ * Read-only contract state of the active tip.
+ *
+ * Holds the tip state roots (pinned against pruning), copies of the trie databases
+ * and the execution environment of the next block. Every call gets its own LuxState
+ * view and seal engine on top of these, so calls run in parallel without cs_main.
+ */
+class ContractStateSnapshot{
+
+public:
+
+    ContractStateSnapshot() : nHeight(-1), blockGasLimit(0), fPinned(false) {}
+
+    ~ContractStateSnapshot();
+
+    bool AddressInUse(const dev::Address& addr) const;
+
+    std::vector<ResultExecute> Call(const dev::Address& addrContract, std::vector<unsigned char> opcode, const dev::Address& sender = dev::Address(), uint64_t gasLimit=0) const;
+
+    int nHeight;
+
+    uint256 hashTip;
+
+private:
+
+    friend std::shared_ptr<const ContractStateSnapshot> GetContractStateSnapshot();
+
+    std::unique_ptr<LuxState> NewView() const;
+
+    dev::h256 hashStateRoot;
+
+    dev::h256 hashUTXORoot;
+
+    dev::u256 accountStartNonce;
+
+    dev::OverlayDB db;
+
+    dev::OverlayDB dbUTXO;
+
+    std::shared_ptr<dev::eth::FlatState> flatState;
+
+    dev::eth::ChainOperationParams chainParams;
+
+    dev::eth::EVMSchedule schedule;
+
+    dev::eth::EnvInfo envInfo;
+
+    uint64_t blockGasLimit;
+
+    bool fPinned;
+};
+
+/** Snapshot of the active tip, taken under cs_main on first use after the tip changed */
+std::shared_ptr<const ContractStateSnapshot> GetContractStateSnapshot();
+
+/** Drop the current snapshot, running calls keep theirs until they finish */
+void ResetContractStateSnapshot();
+
 bool CheckSenderScript(const CCoinsViewCache& view, const CTransaction& tx);
 
 bool CheckMinGasPrice(std::vector<EthTransactionParams>& etps, const uint64_t& minGasPrice);
 
+/** Delete contract state that left the -prunestate window, run periodically by the scheduler */
+void PruneContractState();
+
+/** Dump the mempool to disk. */
+void DumpMempool();
+
+/** Load the mempool from disk, re-validating it in batches of MEMPOOL_LOAD_BATCH_SIZE. */
+bool LoadMempool();
+
 struct ByteCodeExecResult;
 
 void EnforceContractVoutLimit(ByteCodeExecResult& bcer, ByteCodeExecResult& bcerOut, const dev::h256& oldHashLuxRoot,
@@ -883,19 +980,25 @@ class ByteCodeExec {
 
 public:
 
-    ByteCodeExec(const CBlock& _block, std::vector<LuxTransaction> _txs, const uint64_t _blockGasLimit) : txs(_txs), block(_block), blockGasLimit(_blockGasLimit) {}
+    ByteCodeExec(const CBlock& _block, std::vector<LuxTransaction> _txs, const uint64_t _blockGasLimit, VMProfile* _profile = NULL) : txs(_txs), block(_block), blockGasLimit(_blockGasLimit), profile(_profile) {}
 
     bool performByteCode(dev::eth::Permanence type = dev::eth::Permanence::Committed);
 
+    /** Same as performByteCode() for block transaction nTx, reusing its speculative execution where it holds */
+    bool performByteCode(SpeculativeContractExec& speculation, unsigned int nTx);
+
     bool processingResults(ByteCodeExecResult& result);
 
     std::vector<ResultExecute>& getResult(){ return result; }
 
-private:
-
     dev::eth::EnvInfo BuildEVMEnvironment();
 
-    dev::Address EthAddrFromScript(const CScript& scriptIn);
+    /** Address of the staker or miner of a block */
+    static dev::Address BlockAuthor(const CBlock& block);
+
+private:
+
+    static dev::Address EthAddrFromScript(const CScript& scriptIn);
 
     std::vector<LuxTransaction> txs;
 
@@ -905,7 +1008,48 @@ private:
 
     const uint64_t blockGasLimit;
 
+    /** Where the executions are profiled, if set */
+    VMProfile* profile;
+
 };
+
+/**
+ * Execution environment of a block on top of the active tip. The hashes of the
+ * last 256 blocks are kept in a ring that UpdateTip advances one block at a time,
+ * and an environment with them and the block number is prebuilt for each tip, so
+ * executions only set the fields of their own block. The author of the tip is kept
+ * for calls. Requires cs_main.
+ */
+class EVMTipEnvironment{
+
+public:
+
+    EVMTipEnvironment() : pindexTip(NULL), nNext(0), fAuthor(false) { env.setGasLimit(0); }
+
+    /** Follow the active chain to pindexNew, pblock is its block if at hand */
+    void SetTip(CBlockIndex* pindexNew, const CBlock* pblock);
+
+    /** Number and last hashes of a block on top of pindexPrev, the active tip */
+    const dev::eth::EnvInfo& Get(CBlockIndex* pindexPrev);
+
+    /** Environment of a call on top of pindexPrev at nTime, with the author and difficulty of the tip */
+    dev::eth::EnvInfo GetCall(CBlockIndex* pindexPrev, int64_t nTime, uint64_t blockGasLimit);
+
+private:
+
+    CBlockIndex* pindexTip;
+
+    /** Hashes of the last blocks, the tip at nNext - 1 and zero below the genesis */
+    std::array<dev::h256, 256> ring;
+    size_t nNext;
+
+    dev::eth::EnvInfo env;
+
+    dev::Address authorTip;
+    bool fAuthor;
+};
+
+extern EVMTipEnvironment evmTipEnvironment;
 ////////////////////////////////////////////////////////
 
 
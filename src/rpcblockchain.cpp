@@ -13,8 +13,13 @@
 #include "sync.h"
 #include "util.h"
 
+#include <libevm/VM.h>
+#include <libevmcore/Instruction.h>
+
 #include <stdint.h>
 
+#include <boost/assign/list_of.hpp>
+
 #include "univalue/univalue.h"
 
 using namespace std;
@@ -413,8 +418,11 @@ UniValue getstorage(const UniValue& params, bool fHelp)
             if((blockNum < 0 && blockNum != -1) || blockNum > chainActive.Height())
                 throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
 
-            if(blockNum != -1)
+            if(blockNum != -1) {
+                if(!ts.PinRoot(blockNum))
+                    throw JSONRPCError(RPC_INVALID_PARAMS, "State of this block has been pruned (see -prunestate)");
                 ts.SetRoot(uintToh256(chainActive[blockNum]->hashStateRoot), uintToh256(chainActive[blockNum]->hashUTXORoot));
+            }
                 
         } else {
             throw JSONRPCError(RPC_INVALID_PARAMS, "Incorrect block number");
@@ -462,14 +470,20 @@ UniValue listcontracts(const UniValue& params, bool fHelp)
                 throw std::runtime_error(
                                 "listcontracts (start maxDisplay)\n"
                                 "\nArgument:\n"
-                                "1. start     (numeric or string, optional) The starting account index, default 1\n"
+                                "1. start     (numeric or string, optional) The starting account index, default 1, or the \"height:index\" cursor\n"
+                                "             of the first contract, as searchcontracts returns in \"next\", which is found without going over the ones before it\n"
                                 "2. maxDisplay       (numeric or string, optional) Max accounts to list, default 20\n"
                 );
 
         LOCK(cs_main);
 
+        ContractCursor cursor;
+        bool fCursor = params.size() > 0 && params[0].isStr();
+        if (fCursor && (!pcontractregistry->isComplete() || !cursor.SetString(params[0].get_str())))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start cursor");
+
         int start=1;
-        if (params.size() > 0){
+        if (params.size() > 0 && !fCursor){
                 start = params[0].get_int();
                 if (start<= 0)
                         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid start, min=1");
@@ -484,6 +498,23 @@ UniValue listcontracts(const UniValue& params, bool fHelp)
 
         UniValue result(UniValue::VOBJ);
 
+        if (pcontractregistry->isComplete()) {
+                // creation order, so an index keeps pointing at the same contract as the chain grows
+                if (!fCursor) {
+                        int contractsCount = (int)pcontractregistry->count();
+                        if (contractsCount>0 && start > contractsCount)
+                                throw JSONRPCError(RPC_TYPE_ERROR, "start greater than max index "+ itostr(contractsCount));
+                        if (!pcontractregistry->cursorAt(start - 1, cursor))
+                                return result;
+                }
+
+                // the page is read from its first key on, the contracts before it are not loaded
+                std::vector<ContractInfo> contracts = pcontractregistry->listContracts(cursor, maxDisplay, NULL);
+                for (ContractInfo const& info : contracts)
+                        result.push_back(Pair(info.address.hex(),ValueFromAmount(CAmount(globalState->balance(info.address)))));
+                return result;
+        }
+
         auto map = globalState->addresses();
         int contractsCount=(int)map.size();
 
@@ -502,6 +533,346 @@ UniValue listcontracts(const UniValue& params, bool fHelp)
         return result;
 }
 
+UniValue searchcontracts(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 3)
+        throw std::runtime_error(
+            "searchcontracts ( \"cursor\" count {\"creator\":\"address\",\"codehash\":\"hash\"} )\n"
+            "\nLists live contracts in creation order from the contract registry, one page at a time.\n"
+            "\nArguments:\n"
+            "1. \"cursor\"     (string, optional) Position to start from, the \"next\" field of the previous page, default from the first contract\n"
+            "2. count        (numeric, optional, default=" + itostr(DEFAULT_CONTRACT_PAGE_SIZE) + ") Max contracts to list, at most " + itostr(MAX_CONTRACT_PAGE_SIZE) + "\n"
+            "3. filter       (object, optional) Only list the contracts of one creator or with one code hash\n"
+            "    {\n"
+            "      \"creator\": \"address\"   (string, optional) Hex address of the creator\n"
+            "      \"codehash\": \"hash\"     (string, optional) Hash of the contract code\n"
+            "    }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"contracts\": [\n"
+            "    {\n"
+            "      \"address\": \"address\",   (string) Contract address\n"
+            "      \"creator\": \"address\",   (string) Sender of the creating transaction\n"
+            "      \"codehash\": \"hash\",     (string) Hash of the contract code\n"
+            "      \"txid\": \"hash\",         (string) Creating transaction\n"
+            "      \"height\": n            (numeric) Height of the creating block\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"next\": \"cursor\"          (string) Cursor of the following page, null after the last page\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("searchcontracts", "") + HelpExampleCli("searchcontracts", "\"125000:0\" 100") +
+            HelpExampleRpc("searchcontracts", "\"\", 20, {\"creator\":\"d2a1fa6f6f87db3ae4a0f1ed6a4c2dcb1e0cf2f0\"}"));
+
+    if (!pcontractregistry->isComplete())
+        throw JSONRPCError(RPC_MISC_ERROR, "Contract registry is incomplete, restart with -reindex-chainstate to build it");
+
+    ContractCursor cursor;
+    if (params.size() > 0 && !params[0].get_str().empty() && !cursor.SetString(params[0].get_str()))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+
+    unsigned int count = DEFAULT_CONTRACT_PAGE_SIZE;
+    if (params.size() > 1) {
+        int nCount = params[1].get_int();
+        if (nCount <= 0 || nCount > (int)MAX_CONTRACT_PAGE_SIZE)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count");
+        count = nCount;
+    }
+
+    ContractCursor next;
+    std::vector<ContractInfo> contracts;
+    if (params.size() > 2) {
+        UniValue filter = params[2].get_obj();
+        RPCTypeCheckObj(filter, boost::assign::map_list_of("creator", UniValue::VSTR)("codehash", UniValue::VSTR), true);
+        if (filter.exists("creator") == filter.exists("codehash"))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Filter must have one of creator or codehash");
+        if (filter.exists("creator")) {
+            std::string strCreator = filter["creator"].get_str();
+            if (strCreator.size() != 40 || !CheckHex(strCreator))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Incorrect creator address");
+            contracts = pcontractregistry->listByCreator(dev::Address(strCreator), cursor, count, &next);
+        } else {
+            uint256 codeHash = ParseHashO(filter, "codehash");
+            contracts = pcontractregistry->listByCodeHash(uintToh256(codeHash), cursor, count, &next);
+        }
+    } else {
+        contracts = pcontractregistry->listContracts(cursor, count, &next);
+    }
+
+    UniValue list(UniValue::VARR);
+    for (ContractInfo const& info : contracts) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", info.address.hex()));
+        entry.push_back(Pair("creator", info.creator.hex()));
+        entry.push_back(Pair("codehash", info.codeHash.hex()));
+        entry.push_back(Pair("txid", info.txid.GetHex()));
+        entry.push_back(Pair("height", (int64_t)info.height));
+        list.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("contracts", list));
+    result.push_back(Pair("next", contracts.size() == count && (next.height || next.index) ? UniValue(next.ToString()) : NullUniValue));
+    return result;
+}
+
+template <class Stats>
+static UniValue cacheStatsToJSON(const Stats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)stats.entries));
+    ret.push_back(Pair("bytes", (int64_t)stats.cost));
+    ret.push_back(Pair("maxbytes", (int64_t)stats.maxCost));
+    ret.push_back(Pair("hits", (int64_t)stats.hits));
+    ret.push_back(Pair("misses", (int64_t)stats.misses));
+    return ret;
+}
+
+UniValue getstatecacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getstatecacheinfo\n"
+            "\nReturns the hit rates of the contract state caches.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"trienodes\": {              (object) Trie nodes shared by all states\n"
+            "    \"entries\": xxxxx           (numeric) Cached nodes\n"
+            "    \"bytes\": xxxxx             (numeric) Estimated memory used\n"
+            "    \"maxbytes\": xxxxx          (numeric) Memory limit\n"
+            "    \"hits\": xxxxx              (numeric) Lookups answered from the cache\n"
+            "    \"misses\": xxxxx            (numeric) Lookups that read the database\n"
+            "  },\n"
+            "  \"storage\": {...},           (object) Storage slots, same fields as trienodes\n"
+            "  \"code\": {...},              (object) Analysed contract code shared by all VMs, same fields as trienodes\n"
+            "  \"accounts\": {              (object) Accounts kept by each state between commits\n"
+            "    \"hits\": xxxxx              (numeric) Lookups answered from the cache\n"
+            "    \"misses\": xxxxx            (numeric) Lookups that read the trie\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getstatecacheinfo", "") + HelpExampleRpc("getstatecacheinfo", ""));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("trienodes", cacheStatsToJSON(dev::OverlayDB::nodeCache().stats())));
+    ret.push_back(Pair("storage", cacheStatsToJSON(dev::eth::State::storageCache().stats())));
+    ret.push_back(Pair("code", cacheStatsToJSON(dev::eth::VM::analysedCodeCache().stats())));
+
+    std::pair<uint64_t, uint64_t> accounts = dev::eth::State::accountCacheStats();
+    UniValue accountStats(UniValue::VOBJ);
+    accountStats.push_back(Pair("hits", (int64_t)accounts.first));
+    accountStats.push_back(Pair("misses", (int64_t)accounts.second));
+    ret.push_back(Pair("accounts", accountStats));
+
+    return ret;
+}
+
+static UniValue vmProfileStatsToJSON(const VMProfileStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("ops", (int64_t)stats.nOps));
+    ret.push_back(Pair("gas", (int64_t)stats.nGas));
+    ret.push_back(Pair("time", (int64_t)(stats.nNanos / 1000)));
+    return ret;
+}
+
+UniValue getvmprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw std::runtime_error(
+            "getvmprofile ( count reset )\n"
+            "\nReturns the profile of the contract executions of the blocks connected since startup, see -vmprofile.\n"
+            "Executions, gas used and time count every execution, the opcodes and contracts only the sampled ones.\n"
+            "The gas of an operation is what it is charged, for a call including the gas it passes on.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, optional, default=20) Max contracts and blocks to list\n"
+            "2. reset        (boolean, optional, default=false) Clear the profile after returning it\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"samplerate\": n,           (numeric) One in how many executions is sampled, 0 if profiling is off\n"
+            "  \"executions\": n,           (numeric) Contract executions\n"
+            "  \"sampled\": n,              (numeric) Executions profiled by opcode and contract\n"
+            "  \"gasused\": n,              (numeric) Gas used by the executions\n"
+            "  \"time\": n,                 (numeric) Wall time of the executions in microseconds\n"
+            "  \"opcodes\": [               (array) Opcodes run by the sampled executions, most time first\n"
+            "    {\n"
+            "      \"opcode\": \"name\",       (string) Opcode\n"
+            "      \"ops\": n,              (numeric) Times it ran\n"
+            "      \"gas\": n,              (numeric) Gas it was charged\n"
+            "      \"time\": n              (numeric) Wall time in microseconds\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"contracts\": [             (array) Contracts whose code the sampled executions ran, most time first\n"
+            "    {\n"
+            "      \"address\": \"address\",   (string) Contract address\n"
+            "      \"ops\": n, \"gas\": n, \"time\": n   (numeric) Same as for opcodes\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"blocks\": [                (array) Last connected blocks, newest first\n"
+            "    {\n"
+            "      \"height\": n,           (numeric) Block height\n"
+            "      \"hash\": \"hash\",        (string) Block hash\n"
+            "      \"executions\": n, \"sampled\": n, \"gasused\": n, \"time\": n   (numeric) Same as above for the block\n"
+            "      \"sampledops\": n,       (numeric) Operations run by the sampled executions\n"
+            "      \"sampledtime\": n       (numeric) Wall time of those operations in microseconds\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getvmprofile", "") + HelpExampleCli("getvmprofile", "50 true") + HelpExampleRpc("getvmprofile", "20, false"));
+
+    size_t count = 20;
+    if (params.size() > 0) {
+        int nCount = params[0].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count");
+        count = nCount;
+    }
+
+    VMProfile total;
+    std::vector<VMBlockProfile> blocks;
+    vmProfiler.Get(total, blocks);
+    if (params.size() > 1 && params[1].get_bool())
+        vmProfiler.Reset();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("samplerate", (int64_t)vmProfiler.SampleRate()));
+    ret.push_back(Pair("executions", (int64_t)total.nExecutions));
+    ret.push_back(Pair("sampled", (int64_t)total.nSampled));
+    ret.push_back(Pair("gasused", (int64_t)total.nGas));
+    ret.push_back(Pair("time", (int64_t)(total.nNanos / 1000)));
+
+    std::vector<std::pair<uint64_t, size_t> > vOpcodes;
+    for (size_t i = 0; i < total.opcodes.size(); i++) {
+        if (total.opcodes[i].nOps)
+            vOpcodes.push_back(std::make_pair(total.opcodes[i].nNanos, i));
+    }
+    std::sort(vOpcodes.rbegin(), vOpcodes.rend());
+    UniValue opcodes(UniValue::VARR);
+    for (const std::pair<uint64_t, size_t>& item : vOpcodes) {
+        std::string strName = dev::eth::instructionInfo((dev::eth::Instruction)item.second).name;
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("opcode", strName.empty() ? strprintf("0x%02x", item.second) : strName));
+        entry.pushKVs(vmProfileStatsToJSON(total.opcodes[item.second]));
+        opcodes.push_back(entry);
+    }
+    ret.push_back(Pair("opcodes", opcodes));
+
+    std::vector<std::pair<uint64_t, dev::Address> > vContracts;
+    for (const auto& contract : total.contracts)
+        vContracts.push_back(std::make_pair(contract.second.nNanos, contract.first));
+    std::sort(vContracts.rbegin(), vContracts.rend());
+    UniValue contracts(UniValue::VARR);
+    for (size_t i = 0; i < vContracts.size() && i < count; i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", vContracts[i].second.hex()));
+        entry.pushKVs(vmProfileStatsToJSON(total.contracts[vContracts[i].second]));
+        contracts.push_back(entry);
+    }
+    ret.push_back(Pair("contracts", contracts));
+
+    UniValue list(UniValue::VARR);
+    for (size_t i = 0; i < blocks.size() && i < count; i++) {
+        const VMBlockProfile& block = blocks[i];
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("height", block.nHeight));
+        entry.push_back(Pair("hash", block.hash.GetHex()));
+        entry.push_back(Pair("executions", (int64_t)block.nExecutions));
+        entry.push_back(Pair("sampled", (int64_t)block.nSampled));
+        entry.push_back(Pair("gasused", (int64_t)block.nGas));
+        entry.push_back(Pair("time", (int64_t)(block.nNanos / 1000)));
+        entry.push_back(Pair("sampledops", (int64_t)block.sampled.nOps));
+        entry.push_back(Pair("sampledtime", (int64_t)(block.sampled.nNanos / 1000)));
+        list.push_back(entry);
+    }
+    ret.push_back(Pair("blocks", list));
+
+    return ret;
+}
+
+UniValue getvmlog(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw std::runtime_error(
+            "getvmlog ( \"cursor\" count )\n"
+            "\nReturns the contract executions written to the VM log, see -record-log-opcodes, oldest first.\n"
+            "\nArguments:\n"
+            "1. \"cursor\"     (string, optional) Position to start from, the \"next\" field of the previous page, default from the oldest log file\n"
+            "2. count        (numeric, optional, default=" + itostr(DEFAULT_VMLOG_PAGE_SIZE) + ") Max executions to return, at most " + itostr(MAX_VMLOG_PAGE_SIZE) + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"logs\": [\n"
+            "    {\n"
+            "      \"txid\": \"hash\",          (string, optional) Transaction of the execution, not set for calls\n"
+            "      \"address\": \"address\",    (string) Address of the contract created by the execution\n"
+            "      \"time\": n,               (numeric) Time of the block, or of the call\n"
+            "      \"blockhash\": \"hash\",     (string, optional) Block of the execution, not set for calls\n"
+            "      \"blockheight\": n,        (numeric) Height of the block, or of the tip for calls\n"
+            "      \"entries\": [             (array) Logs of the execution\n"
+            "        {\n"
+            "          \"address\": \"address\",           (string) Contract that logged\n"
+            "          \"data\": {\"raw\": \"hex\"},         (object) Data of the log\n"
+            "          \"topics\": [{\"raw\": \"hex\"}, ...] (array) Topics of the log\n"
+            "        }, ...\n"
+            "      ]\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"next\": \"cursor\"          (string) Cursor after the last execution returned, null if the log is empty\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getvmlog", "") + HelpExampleCli("getvmlog", "\"3:1048576\" 1000") + HelpExampleRpc("getvmlog", "\"\", 100"));
+
+    if (!vmLog.IsRunning())
+        throw JSONRPCError(RPC_MISC_ERROR, "VM log is disabled, see -record-log-opcodes");
+
+    VMLogCursor cursor;
+    if (params.size() > 0 && !params[0].get_str().empty() && !cursor.SetString(params[0].get_str()))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+
+    unsigned int count = DEFAULT_VMLOG_PAGE_SIZE;
+    if (params.size() > 1) {
+        int nCount = params[1].get_int();
+        if (nCount <= 0 || nCount > (int)MAX_VMLOG_PAGE_SIZE)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count");
+        count = nCount;
+    }
+
+    UniValue logs(UniValue::VARR);
+    for (VMLogRecord const& record : vmLog.Read(cursor, count)) {
+        UniValue entry(UniValue::VOBJ);
+        if (!record.txid.IsNull())
+            entry.push_back(Pair("txid", record.txid.GetHex()));
+        entry.push_back(Pair("address", record.newAddress.hex()));
+        entry.push_back(Pair("time", record.nTime));
+        if (!record.hashBlock.IsNull())
+            entry.push_back(Pair("blockhash", record.hashBlock.GetHex()));
+        entry.push_back(Pair("blockheight", record.nHeight));
+        UniValue entries(UniValue::VARR);
+        for (dev::eth::LogEntry const& log : record.logs) {
+            UniValue logEntry(UniValue::VOBJ);
+            logEntry.push_back(Pair("address", log.address.hex()));
+            UniValue topics(UniValue::VARR);
+            for (dev::h256 const& topic : log.topics) {
+                UniValue topicPair(UniValue::VOBJ);
+                topicPair.push_back(Pair("raw", topic.hex()));
+                topics.push_back(topicPair);
+            }
+            UniValue dataPair(UniValue::VOBJ);
+            dataPair.push_back(Pair("raw", HexStr(log.data)));
+            logEntry.push_back(Pair("data", dataPair));
+            logEntry.push_back(Pair("topics", topics));
+            entries.push_back(logEntry);
+        }
+        entry.push_back(Pair("entries", entries));
+        logs.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("logs", logs));
+    result.push_back(Pair("next", cursor.nFile ? UniValue(cursor.ToString()) : NullUniValue));
+    return result;
+}
+
 UniValue pruneblockchain(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
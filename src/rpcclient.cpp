@@ -149,6 +149,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "reservebalance", 1, "amount"},
     { "listcontracts", 0, "start" },
     { "listcontracts", 1, "maxDisplay" },
+    { "searchcontracts", 1, "count" },
+    { "searchcontracts", 2, "filter" },
+    { "getvmprofile", 0, "count" },
+    { "getvmprofile", 1, "reset" },
+    { "getvmlog", 1, "count" },
     { "getstorage", 2, "index" },
     { "getstorage", 1, "blockNum" },
     // Echo with conversion (For testing only)
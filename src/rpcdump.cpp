@@ -97,9 +97,8 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
             "\nImport using a label and without rescan\n" + HelpExampleCli("importprivkey", "\"mykey\" \"testing\" false") +
             "\nAs a JSON-RPC call\n" + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", false"));
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
+    if (pwalletMain->fScanningWallet)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning, wait for it to finish");
 
     string strSecret = params[0].get_str();
     string strLabel = "";
@@ -122,7 +121,12 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     CPubKey pubkey = key.GetPubKey();
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
+    CBlockIndex* pindexRescan;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
         pwalletMain->MarkDirty();
         // We don't know which corresponding address will be used; label them all
         for (const auto& dest : GetAllDestinationsForKey(pubkey)) {
@@ -141,12 +145,13 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
         pwalletMain->LearnAllRelatedScripts(pubkey);
-
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        }
+        pindexRescan = chainActive.Genesis();
     }
 
+    // the rescan takes cs_main and the wallet lock a chunk of blocks at a time, RPC goes on meanwhile
+    if (fRescan && pwalletMain->ScanForWalletTransactions(pindexRescan, true) < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is already rescanning, the key is added but its history is not scanned, rescan once it finishes");
+
     return NullUniValue;
 }
 
@@ -167,7 +172,8 @@ UniValue importaddress(const UniValue& params, bool fHelp)
             "\nImport using a label without rescan\n" + HelpExampleCli("importaddress", "\"myaddress\" \"testing\" false") +
             "\nAs a JSON-RPC call\n" + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false"));
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    if (pwalletMain->fScanningWallet)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning, wait for it to finish");
 
     CScript script;
 
@@ -190,7 +196,10 @@ UniValue importaddress(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fRescan = params[2].get_bool();
 
+    CBlockIndex* pindexRescan;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
         if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
             throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
@@ -206,11 +215,13 @@ UniValue importaddress(const UniValue& params, bool fHelp)
 
         if (!pwalletMain->AddWatchOnly(script))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
+        pindexRescan = chainActive.Genesis();
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+    if (fRescan) {
+        if (pwalletMain->ScanForWalletTransactions(pindexRescan, true) < 0)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is already rescanning, the address is added but its history is not scanned, rescan once it finishes");
+        pwalletMain->ReacceptWalletTransactions();
     }
 
     return NullUniValue;
@@ -305,11 +316,13 @@ UniValue importwallet(const UniValue& params, bool fHelp)
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
+    bool fScanned = pwalletMain->ScanForWalletTransactions(pindex) >= 0;
     pwalletMain->MarkDirty();
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
+    if (!fScanned)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is already rescanning, the keys are added but their history is not scanned, rescan once it finishes");
 
     return NullUniValue;
 }
@@ -418,73 +431,172 @@ UniValue dumpwallet(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+/**
+ * The strings of a BIP38 parameter given as an array, or as a string holding a JSON
+ * array the way lux-cli passes it; false for a single address or key.
+ */
+static bool GetBip38Batch(const UniValue& param, vector<string>& vItems)
+{
+    UniValue array = param;
+    if (param.isStr()) {
+        if (param.get_str().empty() || param.get_str()[0] != '[')
+            return false;
+        if (!array.read(param.get_str()) || !array.isArray())
+            throw JSONRPCError(RPC_TYPE_ERROR, "Expected an array of strings");
+    }
+    if (!array.isArray())
+        return false;
+    for (unsigned int i = 0; i < array.size(); i++)
+        vItems.push_back(array[i].get_str());
+    return true;
+}
+
 UniValue bip38encrypt(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 2)
         throw runtime_error(
-            "bip38encrypt \"luxaddress\"\n"
-            "\nEncrypts a private key corresponding to 'luxaddress'.\n"
+            "bip38encrypt \"luxaddress\"|[\"luxaddress\",...] \"passphrase\"\n"
+            "\nEncrypts a private key corresponding to 'luxaddress', or the keys of an array of addresses\n"
+            "with the same passphrase, their keys derived in parallel.\n"
             "\nArguments:\n"
-            "1. \"luxaddress\"   (string, required) The lux address for the private key (you must hold the key already)\n"
+            "1. \"luxaddress\"   (string or array, required) The lux address for the private key (you must hold the key already)\n"
             "2. \"passphrase\"   (string, required) The passphrase you want the private key to be encrypted with - Valid special chars: !#$%&'()*+,-./:;<=>?`{|}~ \n"
             "\nResult:\n"
-            "\"key\"                (string) The encrypted private key\n"
-            "\nExamples:\n");
+            "\"key\"                (string) The encrypted private key, an array of them for an array of addresses\n"
+            "\nExamples:\n" +
+            HelpExampleCli("bip38encrypt", "\"myaddress\" \"mypassphrase\"") +
+            HelpExampleCli("bip38encrypt", "\"[\\\"myaddress\\\",\\\"myotheraddress\\\"]\" \"mypassphrase\""));
+
+    vector<string> vAddresses;
+    bool fBatch = GetBip38Batch(params[0], vAddresses);
+    if (!fBatch)
+        vAddresses.push_back(params[0].get_str());
+    string strPassphrase = params[1].get_str();
+
+    vector<pair<string, uint256> > vKeys;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        BOOST_FOREACH (const string& strAddress, vAddresses) {
+            CTxDestination dest = DecodeDestination(strAddress);
+            if (!IsValidDestination(dest))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid LUX address: " + strAddress);
+            const CKeyID *keyID = boost::get<CKeyID>(&dest);
+            if (!keyID)
+                throw JSONRPCError(RPC_TYPE_ERROR, "Address does not refer to a key: " + strAddress);
+            CKey vchSecret;
+            if (!pwalletMain->GetKey(*keyID, vchSecret))
+                throw JSONRPCError(RPC_WALLET_ERROR, "Private key for address " + strAddress + " is not known");
+            vKeys.push_back(make_pair(strAddress, vchSecret.GetPrivKey_256()));
+        }
+    }
+
+    // the key derivation takes a while, the wallet is not held up for it
+    vector<string> vEncrypted = BIP38_EncryptBatch(vKeys, strPassphrase);
+
+    UniValue results(UniValue::VARR);
+    for (size_t i = 0; i < vKeys.size(); i++) {
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("Addess", vKeys[i].first));
+        result.push_back(Pair("Encrypted Key", vEncrypted[i]));
+        if (!fBatch)
+            return result;
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+/** bip38decrypt of an array of keys: the ones that fail are reported, the others imported */
+static UniValue bip38decryptbatch(const string& strPassphrase, const vector<string>& vEncryptedKeys)
+{
+    // the key derivation takes a while, the wallet is not held up for it
+    vector<CBip38Decrypted> vDecrypted = BIP38_DecryptBatch(strPassphrase, vEncryptedKeys);
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
-    string strAddress = params[0].get_str();
-    string strPassphrase = params[1].get_str();
-
-    CTxDestination dest = DecodeDestination(strAddress);
-    if (!IsValidDestination(dest))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid LUX address");
-    const CKeyID *keyID = boost::get<CKeyID>(&dest);
-    if (!keyID)
-        throw JSONRPCError(RPC_TYPE_ERROR, "Address does not refer to a key");
-    CKey vchSecret;
-    if (!pwalletMain->GetKey(*keyID, vchSecret))
-        throw JSONRPCError(RPC_WALLET_ERROR, "Private key for address " + strAddress + " is not known");
+    UniValue results(UniValue::VARR);
+    bool fAdded = false;
+    for (size_t i = 0; i < vEncryptedKeys.size(); i++) {
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("encryptedkey", vEncryptedKeys[i]));
+        CKey key;
+        if (vDecrypted[i].fValid)
+            key.Set(vDecrypted[i].privKey.begin(), vDecrypted[i].privKey.end(), vDecrypted[i].fCompressed);
+        if (!key.IsValid()) {
+            result.push_back(Pair("error", vDecrypted[i].fValid ? "Private Key Not Valid" : "Failed To Decrypt"));
+            results.push_back(result);
+            continue;
+        }
 
-    uint256 privKey = vchSecret.GetPrivKey_256();
-    string encryptedOut = BIP38_Encrypt(strAddress, strPassphrase, privKey);
+        CPubKey pubkey = key.GetPubKey();
+        assert(key.VerifyPubKey(pubkey));
+        CKeyID vchAddress = pubkey.GetID();
+        result.push_back(Pair("privatekey", HexStr(vDecrypted[i].privKey)));
+        result.push_back(Pair("Address", EncodeDestination(vchAddress)));
+        pwalletMain->SetAddressBook(vchAddress, "", "receive");
+        if (pwalletMain->HaveKey(vchAddress)) {
+            result.push_back(Pair("error", "Key already held by wallet"));
+        } else {
+            pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
+            if (pwalletMain->AddKeyPubKey(key, pubkey))
+                fAdded = true;
+            else
+                result.push_back(Pair("error", "Error adding key to wallet"));
+        }
+        results.push_back(result);
+    }
 
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("Addess", strAddress));
-    result.push_back(Pair("Encrypted Key", encryptedOut));
+    if (fAdded) {
+        pwalletMain->MarkDirty();
+        // whenever a key is imported, we need to scan the whole chain, once for all of them
+        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+        if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true) < 0)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is already rescanning, the keys are added but their history is not scanned, rescan once it finishes");
+    }
 
-    return result;
+    return results;
 }
 
 UniValue bip38decrypt(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 2)
         throw runtime_error(
-            "bip38decrypt \"luxaddress\"\n"
-            "\nDecrypts and then imports password protected private key.\n"
+            "bip38decrypt \"passphrase\" \"encryptedkey\"|[\"encryptedkey\",...]\n"
+            "\nDecrypts and then imports password protected private key, or an array of them encrypted\n"
+            "with the same passphrase, their keys derived in parallel and the chain rescanned once.\n"
             "\nArguments:\n"
             "1. \"passphrase\"   (string, required) The passphrase you want the private key to be encrypted with\n"
-            "2. \"encryptedkey\"   (string, required) The encrypted private key\n"
+            "2. \"encryptedkey\"   (string or array, required) The encrypted private key\n"
 
             "\nResult:\n"
-            "\"key\"                (string) The decrypted private key\n"
-            "\nExamples:\n");
-
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
+            "\"key\"                (string) The decrypted private key. For an array, an array of them, each with\n"
+            "                     \"encryptedkey\" and an \"error\" if it could not be decrypted or imported\n"
+            "\nExamples:\n" +
+            HelpExampleCli("bip38decrypt", "\"mypassphrase\" \"myencryptedkey\"") +
+            HelpExampleCli("bip38decrypt", "\"mypassphrase\" \"[\\\"myencryptedkey\\\",\\\"myotherencryptedkey\\\"]\""));
 
     /** Collect private key and passphrase **/
     string strPassphrase = params[0].get_str();
+    vector<string> vEncryptedKeys;
+    if (GetBip38Batch(params[1], vEncryptedKeys))
+        return bip38decryptbatch(strPassphrase, vEncryptedKeys);
     string strKey = params[1].get_str();
 
+    // the key derivation takes a while, the wallet is not held up for it
     uint256 privKey;
     bool fCompressed;
     if (!BIP38_Decrypt(strPassphrase, strKey, privKey, fCompressed))
         throw JSONRPCError(RPC_WALLET_ERROR, "Failed To Decrypt");
 
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("privatekey", HexStr(privKey)));
 
@@ -514,7 +626,8 @@ UniValue bip38decrypt(const UniValue& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true) < 0)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is already rescanning, the key is added but its history is not scanned, rescan once it finishes");
     }
 
     return result;
@@ -309,6 +309,10 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getstorage", &getstorage,true, true, false },
         {"blockchain", "callcontract", &callcontract,true, true, false },
         {"blockchain", "listcontracts", &listcontracts,true, true, false },
+        {"blockchain", "searchcontracts", &searchcontracts,true, true, false },
+        {"blockchain", "getstatecacheinfo", &getstatecacheinfo,true, true, false },
+        {"blockchain", "getvmprofile", &getvmprofile,true, true, false },
+        {"blockchain", "getvmlog", &getvmlog,true, true, false },
         {"blockchain", "createcontract", &createcontract,true, true, false },
         {"blockchain", "sendtocontract", &sendtocontract,true, true, false },
         {"blockchain", "pruneblockchain", &pruneblockchain,true, true, false },
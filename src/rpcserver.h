@@ -350,6 +350,10 @@ extern UniValue masternode(const UniValue& params, bool fHelp);
 
 extern UniValue getstorage(const UniValue& params, bool fHelp);
 extern UniValue listcontracts(const UniValue& params, bool fHelp);
+extern UniValue searchcontracts(const UniValue& params, bool fHelp);
+extern UniValue getstatecacheinfo(const UniValue& params, bool fHelp);
+extern UniValue getvmprofile(const UniValue& params, bool fHelp);
+extern UniValue getvmlog(const UniValue& params, bool fHelp);
 extern UniValue pruneblockchain(const UniValue& params, bool fHelp);
 
 // in rest.cpp
@@ -563,6 +563,12 @@ UniValue signmessage(const UniValue& params, bool fHelp)
     return EncodeBase64(&vchSig[0], vchSig.size());
 }
 
+//! Depth of an archived transaction, from its place in the height index
+static int GetArchivedDepth(const CWalletTxSummary& summary)
+{
+    return summary.nHeightIndexed < 0 ? 0 : chainActive.Height() - summary.nHeightIndexed + 1;
+}
+
 UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -608,6 +614,13 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
     }
+    BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTxSummary) & item, pwalletMain->GetArchived()) {
+        if (GetArchivedDepth(item.second) < nMinDepth)
+            continue;
+        BOOST_FOREACH (const CTxOut& txout, item.second.vMine)
+            if (txout.scriptPubKey == scriptPubKey)
+                nAmount += txout.nValue;
+    }
 
     return ValueFromAmount(nAmount);
 }
@@ -656,6 +669,15 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
                     nAmount += txout.nValue;
         }
     }
+    BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTxSummary) & item, pwalletMain->GetArchived()) {
+        if (GetArchivedDepth(item.second) < nMinDepth)
+            continue;
+        BOOST_FOREACH (const CTxOut& txout, item.second.vMine) {
+            CTxDestination address;
+            if (ExtractDestination(txout.scriptPubKey, address) && IsMine(*pwalletMain, address) && setAddress.count(address))
+                nAmount += txout.nValue;
+        }
+    }
 
     return (double)nAmount / (double)COIN;
 }
@@ -678,6 +700,27 @@ CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMi
         nBalance -= nSent + nFee;
     }
 
+    // and archived ones, from their summaries
+    BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTxSummary) & item, pwalletMain->GetArchived()) {
+        const CWalletTxAmounts& amounts = item.second.GetAmounts(filter);
+        if (item.second.strSentAccount == strAccount)
+            nBalance -= amounts.nSent + amounts.nFee;
+        if (GetArchivedDepth(item.second) < nMinDepth)
+            continue;
+        BOOST_FOREACH (const CTxOut& txout, amounts.vReceived) {
+            CTxDestination address;
+            if (!ExtractDestination(txout.scriptPubKey, address))
+                address = CNoDestination();
+            map<CTxDestination, CAddressBookData>::const_iterator mi = pwalletMain->mapAddressBook.find(address);
+            if (mi != pwalletMain->mapAddressBook.end()) {
+                if (mi->second.name == strAccount)
+                    nBalance += txout.nValue;
+            } else if (strAccount.empty()) {
+                nBalance += txout.nValue;
+            }
+        }
+    }
+
     // Tally internal accounting entries
     nBalance += walletdb.GetAccountCreditDebit(strAccount);
 
@@ -750,6 +793,14 @@ UniValue getbalance(const UniValue& params, bool fHelp)
                 nBalance -= s.amount;
             nBalance -= allFee;
         }
+        BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTxSummary) & item, pwalletMain->GetArchived()) {
+            const CWalletTxAmounts& amounts = item.second.GetAmounts(filter);
+            if (GetArchivedDepth(item.second) >= nMinDepth) {
+                BOOST_FOREACH (const CTxOut& txout, amounts.vReceived)
+                    nBalance += txout.nValue;
+            }
+            nBalance -= amounts.nSent + amounts.nFee;
+        }
         return ValueFromAmount(nBalance);
     }
 
@@ -818,7 +869,7 @@ UniValue movecmd(const UniValue& params, bool fHelp)
     debit.nTime = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment = strComment;
-    walletdb.WriteAccountingEntry(debit);
+    pwalletMain->AddAccountingEntry(debit, walletdb);
 
     // Credit
     CAccountingEntry credit;
@@ -828,7 +879,7 @@ UniValue movecmd(const UniValue& params, bool fHelp)
     credit.nTime = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment = strComment;
-    walletdb.WriteAccountingEntry(credit);
+    pwalletMain->AddAccountingEntry(credit, walletdb);
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
@@ -1103,6 +1154,29 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
                 item.fIsWatchonly = true;
         }
     }
+    BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTxSummary) & entry, pwalletMain->GetArchived()) {
+        int nDepth = GetArchivedDepth(entry.second);
+        if (nDepth < nMinDepth)
+            continue;
+
+        BOOST_FOREACH (const CTxOut& txout, entry.second.vMine) {
+            CTxDestination address;
+            if (!ExtractDestination(txout.scriptPubKey, address))
+                continue;
+
+            isminefilter mine = IsMine(*pwalletMain, address);
+            if (!(mine & filter))
+                continue;
+
+            tallyitem& item = mapTally[address];
+            item.nAmount += txout.nValue;
+            item.nConf = min(item.nConf, nDepth);
+            item.nBCConf = min(item.nBCConf, nDepth);
+            item.txids.push_back(entry.first);
+            if (mine & ISMINE_WATCH_ONLY)
+                item.fIsWatchonly = true;
+        }
+    }
 
     // Reply
     UniValue ret(UniValue::VARR);
@@ -1405,15 +1479,16 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VARR);
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
 
     // iterate backwards until we have nCount items to return:
     for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
-        CWalletTx* const pwtx = (*it).second.first;
+        const CWallet::TxEntry& entry = (*it).second;
+        // archived transactions are read back in their place in the order
+        const CWalletTx* const pwtx = entry.phashArchived ? pwalletMain->GetWalletTx(*entry.phashArchived) : entry.pwtx;
         if (pwtx != 0)
             ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-        CAccountingEntry* const pacentry = (*it).second.second;
+        CAccountingEntry* const pacentry = entry.pacentry;
         if (pacentry != 0)
             AcentryToJSON(*pacentry, strAccount, ret);
 
@@ -1503,10 +1578,23 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
             if (nImmatureCredit > 0) immatureBalances[wtx.strFromAccount] += nImmatureCredit;
         }
     }
+    BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTxSummary) & item, pwalletMain->GetArchived()) {
+        const CWalletTxAmounts& amounts = item.second.GetAmounts(includeWatchonly);
+        mapAccountBalances[item.second.strSentAccount] -= amounts.nSent + amounts.nFee;
+        if (GetArchivedDepth(item.second) < nMinDepth)
+            continue;
+        BOOST_FOREACH (const CTxOut& txout, amounts.vReceived) {
+            CTxDestination address;
+            if (!ExtractDestination(txout.scriptPubKey, address))
+                address = CNoDestination();
+            if (pwalletMain->mapAddressBook.count(address))
+                mapAccountBalances[pwalletMain->mapAddressBook[address].name] += txout.nValue;
+            else
+                mapAccountBalances[""] += txout.nValue;
+        }
+    }
 
-    list<CAccountingEntry> acentries;
-    CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
-    BOOST_FOREACH (const CAccountingEntry& entry, acentries)
+    BOOST_FOREACH (const CAccountingEntry& entry, pwalletMain->laccentries)
         mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
 
     UniValue ret(UniValue::VOBJ);
@@ -1587,11 +1675,18 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++) {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain(false) < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+    // only what is in the blocks after it, or not in the chain at all, archived transactions read back from disk
+    const CWallet::TxHeights& txByHeight = pwalletMain->wtxByHeight;
+    CWallet::TxHeights::const_iterator itBegin = depth <= 0 ? txByHeight.begin() : txByHeight.upper_bound(pindex->nHeight);
+    std::vector<CWallet::TxEntry> vSince;
+    for (CWallet::TxHeights::const_iterator it = txByHeight.begin(); it != itBegin && it->first < 0; ++it)
+        vSince.push_back(it->second);
+    for (CWallet::TxHeights::const_iterator it = itBegin; it != txByHeight.end(); ++it)
+        vSince.push_back(it->second);
+    BOOST_FOREACH (const CWallet::TxEntry& entry, vSince) {
+        const CWalletTx* pwtx = entry.phashArchived ? pwalletMain->GetWalletTx(*entry.phashArchived) : entry.pwtx;
+        if (pwtx && (depth == -1 || pwtx->GetDepthInMainChain(false) < depth))
+            ListTransactions(*pwtx, "*", 0, true, transactions, filter);
     }
 
     CBlockIndex* pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
@@ -1663,38 +1758,32 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
     bool shouldWaitConf = params.size() > 2 && waitconf > 0;
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
-        if (!pwalletMain->mapWallet.count(hash))
+        if (!pwalletMain->GetWalletTx(hash))
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
     }
 
-    CWalletTx* _wtx = NULL;
+    // a copy taken under the lock, archived ones included, read back from disk
+    CWalletTx wtx;
 
     // avoid long-poll if API caller does not specify waitconf
-    if (!shouldWaitConf) {
+    while (true) {
         {
             LOCK2(cs_main, pwalletMain->cs_wallet);
-            _wtx = &pwalletMain->mapWallet[hash];
-        }
+            const CWalletTx* pwtx = pwalletMain->GetWalletTx(hash);
+            if (!pwtx)
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error: Transaction left the wallet or could not be read back");
 
-    } else {
-        while (true) {
-            {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                _wtx = &pwalletMain->mapWallet[hash];
-
-                if (_wtx->GetDepthInMainChain() >= waitconf) {
-                    break;
-                }
+            if (!shouldWaitConf || pwtx->GetDepthInMainChain() >= waitconf) {
+                wtx = *pwtx;
+                break;
             }
+        }
 
-            if (!IsRPCRunning()) {
-                return NullUniValue;
-            }
+        if (!IsRPCRunning()) {
+            return NullUniValue;
         }
     }
 
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
-
     CAmount nCredit = wtx.GetCredit(filter);
     CAmount nDebit = wtx.GetDebit(filter);
     CAmount nNet = nCredit - nDebit;
@@ -2114,6 +2203,11 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"keypoololdest\": xxxxxx,    (numeric) the timestamp (seconds since GMT epoch) of the oldest pre-generated key in the key pool\n"
             "  \"keypoolsize\": xxxx,        (numeric) how many new keys are pre-generated\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
+            "  \"scanning\":                 (json object) the rescan being run, or false if none\n"
+            "    {\n"
+            "      \"duration\": xxxx,         (numeric) seconds it has been running\n"
+            "      \"progress\": x.xxxx,       (numeric) how far it got, from 0 to 1\n"
+            "    }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getwalletinfo", "") + HelpExampleRpc("getwalletinfo", ""));
@@ -2123,7 +2217,7 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("walletversion", pwalletMain->GetVersion()));
     obj.push_back(Pair("balance", ValueFromAmount(pwalletMain->GetBalance())));
-    obj.push_back(Pair("txcount", (int)pwalletMain->mapWallet.size()));
+    obj.push_back(Pair("txcount", (int)(pwalletMain->mapWallet.size() + pwalletMain->GetArchived().size())));
     obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
     obj.push_back(Pair("keypoolsize", (int)pwalletMain->GetKeyPoolSize()));
     if (pwalletMain->IsCrypted())
@@ -2132,6 +2226,14 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
 #else
     obj.push_back(Pair("unlocked_until", (boost::int64_t)nWalletUnlockTime));
 #endif
+    if (pwalletMain->fScanningWallet) {
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", (GetTimeMillis() - pwalletMain->nScanningStartTime) / 1000));
+        scanning.push_back(Pair("progress", pwalletMain->dScanningProgress.load()));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
@@ -2496,12 +2598,15 @@ UniValue callcontract(const UniValue& params, bool fHelp)
                 "4. gasLimit             (string, optional) The gas limit for executing the contract\n"
         );
 
-    if (chainActive.Height() < Params().FirstSCBlock()) {
+    // calls run on a snapshot of the tip, without cs_main
+    std::shared_ptr<const ContractStateSnapshot> snapshot = GetContractStateSnapshot();
+    if (!snapshot)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Contract state is not available");
+
+    if (snapshot->nHeight < Params().FirstSCBlock()) {
         throw JSONRPCError(RPC_VERIFY_ERROR, "Smart contracts hardfork is not active yet. Activation block number - " + std::to_string(Params().FirstSCBlock()));
     }
 
-    LOCK(cs_main);
-
     std::string strAddr = params[0].get_str();
     std::string data = params[1].get_str();
 
@@ -2512,7 +2617,7 @@ UniValue callcontract(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Incorrect address");
 
     dev::Address addrAccount(strAddr);
-    if(!globalState->addressInUse(addrAccount))
+    if(!snapshot->AddressInUse(addrAccount))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address does not exist");
 
     dev::Address senderAddress;
@@ -2533,9 +2638,11 @@ UniValue callcontract(const UniValue& params, bool fHelp)
     }
 
 
-    std::vector<ResultExecute> execResults = CallContract(addrAccount, ParseHex(data), senderAddress, gasLimit);
+    std::vector<ResultExecute> execResults = snapshot->Call(addrAccount, ParseHex(data), senderAddress, gasLimit);
 
     if(fRecordLogOpcodes){
+        // the height is that of the active chain
+        LOCK(cs_main);
         writeVMlog(execResults);
     }
 
@@ -26,6 +26,14 @@ GetResults(CWalletDB& walletdb, std::map<CAmount, CAccountingEntry>& results)
     {
         results[ae.nOrderPos] = ae;
     }
+
+    // the index listtransactions reads follows the new order
+    BOOST_CHECK_EQUAL(pwalletMain->wtxOrdered.size(), pwalletMain->mapWallet.size() + aes.size());
+    BOOST_FOREACH(const CWallet::TxItems::value_type& item, pwalletMain->wtxOrdered)
+    {
+        const int64_t nOrderPos = item.second.pwtx ? item.second.pwtx->nOrderPos : item.second.pacentry->nOrderPos;
+        BOOST_CHECK_EQUAL(item.first, nOrderPos);
+    }
 }
 
 BOOST_AUTO_TEST_CASE(acc_orderupgrade)
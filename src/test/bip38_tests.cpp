@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bip38.h"
+#include "base58.h"
+#include "key.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(bip38_tests)
+
+BOOST_AUTO_TEST_CASE(bip38_batch_roundtrip)
+{
+    const std::string strPassphrase = "TestingOneTwoThree";
+    std::vector<std::pair<std::string, uint256> > vKeys;
+    for (int i = 0; i < 4; i++) {
+        CKey key;
+        key.MakeNewKey(false);
+        vKeys.push_back(std::make_pair(EncodeDestination(key.GetPubKey().GetID()), key.GetPrivKey_256()));
+    }
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<std::string> vEncrypted = BIP38_EncryptBatch(vKeys, strPassphrase);
+    BOOST_TEST_MESSAGE(vKeys.size() << " keys encrypted on " << GetBip38Threads() << " threads: " << (GetTimeMicros() - nStart) / 1000 << "ms");
+    BOOST_REQUIRE_EQUAL(vEncrypted.size(), vKeys.size());
+
+    // the same as one at a time, whether the scrypt lanes run in parallel or not
+    BOOST_CHECK_EQUAL(vEncrypted[0], BIP38_Encrypt(vKeys[0].first, strPassphrase, vKeys[0].second, 1));
+    BOOST_CHECK_EQUAL(vEncrypted[1], BIP38_Encrypt(vKeys[1].first, strPassphrase, vKeys[1].second));
+
+    // a wrong key in between does not get in the way of the others
+    std::vector<std::string> vToDecrypt = vEncrypted;
+    vToDecrypt.insert(vToDecrypt.begin() + 2, "not a key");
+    std::vector<CBip38Decrypted> vDecrypted = BIP38_DecryptBatch(strPassphrase, vToDecrypt);
+    BOOST_REQUIRE_EQUAL(vDecrypted.size(), vToDecrypt.size());
+    BOOST_CHECK(!vDecrypted[2].fValid);
+    vDecrypted.erase(vDecrypted.begin() + 2);
+    for (size_t i = 0; i < vKeys.size(); i++) {
+        BOOST_CHECK(vDecrypted[i].fValid);
+        BOOST_CHECK(vDecrypted[i].privKey == vKeys[i].second);
+    }
+
+    uint256 privKey;
+    bool fCompressed;
+    BOOST_CHECK(BIP38_Decrypt(strPassphrase, vEncrypted[3], privKey, fCompressed, 1));
+    BOOST_CHECK(privKey == vKeys[3].second);
+
+    BOOST_CHECK(BIP38_EncryptBatch(std::vector<std::pair<std::string, uint256> >(), strPassphrase).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,187 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "crypto/sha256.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/*
+ * The work stealing check queue: every check runs once, a failure anywhere
+ * fails the batch, background checks never delay the master and can be
+ * cancelled, and the time to check synthetic blocks of many inputs, added one
+ * transaction at a time like ConnectBlock does, reported with
+ * --log_level=message.
+ */
+
+namespace
+{
+
+std::atomic<unsigned int> nChecked(0);
+
+/** Check that counts itself and fails if told to */
+struct CountingCheck {
+    bool fOk;
+
+    CountingCheck() : fOk(true) {}
+    explicit CountingCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nChecked++;
+        return fOk;
+    }
+
+    void swap(CountingCheck& check) { std::swap(fOk, check.fOk); }
+};
+
+/** Check costing about as much as a signature verification */
+struct HashingCheck {
+    unsigned int nRounds;
+
+    HashingCheck() : nRounds(0) {}
+    explicit HashingCheck(unsigned int nRoundsIn) : nRounds(nRoundsIn) {}
+
+    bool operator()()
+    {
+        unsigned char hash[CSHA256::OUTPUT_SIZE] = {};
+        for (unsigned int i = 0; i < nRounds; i++)
+            CSHA256().Write(hash, sizeof(hash)).Finalize(hash);
+        return true;
+    }
+
+    void swap(HashingCheck& check) { std::swap(nRounds, check.nRounds); }
+};
+
+template <typename T>
+struct Workers {
+    CCheckQueue<T>& queue;
+    boost::thread_group threads;
+
+    Workers(CCheckQueue<T>& queueIn, int nThreads) : queue(queueIn)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CCheckQueue<T>::Thread, &queue));
+    }
+
+    ~Workers()
+    {
+        threads.interrupt_all();
+        threads.join_all();
+    }
+};
+
+/** Check a block of nInputs inputs in transactions of 1 to 8 inputs, returns the microseconds it took */
+int64_t checkBlock(CCheckQueue<HashingCheck>* pqueue, unsigned int nInputs, unsigned int nRounds)
+{
+    int64_t nStart = GetTimeMicros();
+    CCheckQueueControl<HashingCheck> control(pqueue);
+    for (unsigned int nAdded = 0, nTx = 0; nAdded < nInputs; nTx++) {
+        unsigned int nTxInputs = std::min(1 + nTx % 8, nInputs - nAdded);
+        std::vector<HashingCheck> vChecks(nTxInputs, HashingCheck(nRounds));
+        if (pqueue) {
+            control.Add(vChecks);
+        } else {
+            for (HashingCheck& check : vChecks)
+                check();
+        }
+        nAdded += nTxInputs;
+    }
+    BOOST_CHECK(control.Wait());
+    return GetTimeMicros() - nStart;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_checked)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    Workers<CountingCheck> workers(queue, 3);
+    for (unsigned int nChecks : {0, 1, 7, 100, 1000, 5000}) {
+        nChecked = 0;
+        CCheckQueueControl<CountingCheck> control(&queue);
+        for (unsigned int nAdded = 0; nAdded < nChecks; nAdded += 10) {
+            std::vector<CountingCheck> vChecks(std::min(10U, nChecks - nAdded));
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nChecked.load(), nChecks);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    Workers<CountingCheck> workers(queue, 3);
+    for (unsigned int nFail : {0, 499, 999}) {
+        CCheckQueueControl<CountingCheck> control(&queue);
+        for (unsigned int i = 0; i < 1000; i++) {
+            std::vector<CountingCheck> vChecks(1, CountingCheck(i != nFail));
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(!control.Wait());
+    }
+    // the next batch starts over
+    CCheckQueueControl<CountingCheck> control(&queue);
+    std::vector<CountingCheck> vChecks(100);
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_background)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    Workers<CountingCheck> workers(queue, 2);
+
+    // background checks run on the workers, failures do not count
+    nChecked = 0;
+    std::vector<CountingCheck> vBackground(200, CountingCheck(false));
+    queue.AddBackground(vBackground);
+    for (int i = 0; i < 1000 && nChecked < 200; i++)
+        MilliSleep(1);
+    BOOST_CHECK_EQUAL(nChecked.load(), 200U);
+    {
+        CCheckQueueControl<CountingCheck> control(&queue);
+        std::vector<CountingCheck> vChecks(100);
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+
+    // the master does not wait for them, and cancelling drops the rest
+    std::vector<HashingCheck> vSlow(100000, HashingCheck(100));
+    CCheckQueue<HashingCheck> slowQueue(16);
+    Workers<HashingCheck> slowWorkers(slowQueue, 2);
+    slowQueue.AddBackground(vSlow);
+    {
+        CCheckQueueControl<HashingCheck> control(&slowQueue);
+        std::vector<HashingCheck> vChecks(10, HashingCheck(1));
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+    int64_t nStart = GetTimeMillis();
+    slowQueue.CancelBackground();
+    BOOST_CHECK(GetTimeMillis() - nStart < 5000);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_many_inputs)
+{
+    unsigned int nThreads = std::max(2U, std::min(8U, boost::thread::hardware_concurrency()));
+    CCheckQueue<HashingCheck> queue(128);
+    Workers<HashingCheck> workers(queue, nThreads - 1);
+    for (unsigned int nInputs : {1000, 10000}) {
+        int64_t nSerial = checkBlock(NULL, nInputs, 100);
+        int64_t nQueued = checkBlock(&queue, nInputs, 100);
+        int64_t nCheap = checkBlock(&queue, nInputs, 0);
+        BOOST_TEST_MESSAGE(strprintf("%u inputs: %.1fms serial, %.1fms on %u threads, %.2fus queue overhead per input",
+            nInputs, nSerial * 0.001, nQueued * 0.001, nThreads, (double)nCheap / nInputs));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,188 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinselection.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+/*
+ * Branch and bound finds the selection with the least excess inside the window
+ * whenever there is one, and gives up within its budget on the pools of long
+ * running staking wallets: thousands of rewards of nearly the same value.
+ */
+
+namespace
+{
+
+void AddCoin(std::vector<CInputCoin>& vPool, CAmount nValue, CAmount nInputFee = 0)
+{
+    vPool.push_back(CInputCoin(NULL, vPool.size(), nValue, nInputFee));
+}
+
+CAmount SumEffective(const std::vector<CInputCoin>& vCoins)
+{
+    CAmount nTotal = 0;
+    for (const CInputCoin& coin : vCoins)
+        nTotal += coin.nEffectiveValue;
+    return nTotal;
+}
+
+/** The least excess of any subset inside the window, or -1 */
+CAmount BestExcess(const std::vector<CInputCoin>& vPool, CAmount nTarget, CAmount nCostOfChange)
+{
+    CAmount nBest = -1;
+    for (unsigned int nMask = 1; nMask < (1U << vPool.size()); nMask++) {
+        CAmount nTotal = 0;
+        for (size_t i = 0; i < vPool.size(); i++) {
+            if (nMask & (1U << i))
+                nTotal += vPool[i].nEffectiveValue;
+        }
+        if (nTotal >= nTarget && nTotal <= nTarget + nCostOfChange && (nBest < 0 || nTotal - nTarget < nBest))
+            nBest = nTotal - nTarget;
+    }
+    return nBest;
+}
+
+/** Rewards of a staking wallet: a stake of nStake split up, plus the rewards it earned */
+std::vector<CInputCoin> StakingPool(int nRewards, CAmount nStake, CAmount nInputFee)
+{
+    std::vector<CInputCoin> vPool;
+    for (int i = 0; i < nRewards; i++)
+        AddCoin(vPool, COIN + GetRand(COIN / 100), nInputFee);
+    for (int i = 0; i < 20; i++)
+        AddCoin(vPool, nStake / 20 + GetRand(COIN), nInputFee);
+    return vPool;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(coinselection_tests)
+
+BOOST_AUTO_TEST_CASE(bnb_exact_match)
+{
+    std::vector<CInputCoin> vPool;
+    AddCoin(vPool, 1 * CENT);
+    AddCoin(vPool, 2 * CENT);
+    AddCoin(vPool, 3 * CENT);
+    AddCoin(vPool, 4 * CENT);
+
+    std::vector<CInputCoin> vSelected;
+    CAmount nValue;
+    BOOST_CHECK(SelectCoinsBnB(vPool, 1 * CENT, CENT / 2, vSelected, nValue));
+    BOOST_CHECK_EQUAL(vSelected.size(), 1U);
+    BOOST_CHECK_EQUAL(nValue, 1 * CENT);
+
+    BOOST_CHECK(SelectCoinsBnB(vPool, 5 * CENT, CENT / 2, vSelected, nValue));
+    BOOST_CHECK_EQUAL(nValue, 5 * CENT);
+
+    BOOST_CHECK(SelectCoinsBnB(vPool, 10 * CENT, CENT / 2, vSelected, nValue));
+    BOOST_CHECK_EQUAL(vSelected.size(), 4U);
+    BOOST_CHECK_EQUAL(nValue, 10 * CENT);
+
+    // more than there is, or nothing inside the window
+    BOOST_CHECK(!SelectCoinsBnB(vPool, 11 * CENT, CENT / 2, vSelected, nValue));
+    BOOST_CHECK(vSelected.empty());
+    BOOST_CHECK(!SelectCoinsBnB(vPool, CENT / 2, CENT / 4, vSelected, nValue));
+
+    // the window lets the excess go to the fee
+    BOOST_CHECK(SelectCoinsBnB(vPool, CENT / 2, CENT / 2, vSelected, nValue));
+    BOOST_CHECK_EQUAL(nValue, 1 * CENT);
+}
+
+BOOST_AUTO_TEST_CASE(bnb_effective_value)
+{
+    // the fee of each input comes out of its value
+    std::vector<CInputCoin> vPool;
+    AddCoin(vPool, 1 * CENT + 100, 100);
+    AddCoin(vPool, 2 * CENT + 100, 100);
+    AddCoin(vPool, 4 * CENT + 100, 100);
+
+    std::vector<CInputCoin> vSelected;
+    CAmount nValue;
+    BOOST_CHECK(SelectCoinsBnB(vPool, 3 * CENT, 0, vSelected, nValue));
+    BOOST_CHECK_EQUAL(vSelected.size(), 2U);
+    BOOST_CHECK_EQUAL(SumEffective(vSelected), 3 * CENT);
+    BOOST_CHECK_EQUAL(nValue, 3 * CENT + 200);
+
+    // a coin not worth its fee is not something to search with
+    AddCoin(vPool, 100, 100);
+    BOOST_CHECK(!SelectCoinsBnB(vPool, 3 * CENT, 0, vSelected, nValue));
+}
+
+BOOST_AUTO_TEST_CASE(bnb_least_excess)
+{
+    for (int nRun = 0; nRun < 200; nRun++) {
+        std::vector<CInputCoin> vPool;
+        int nCoins = 1 + GetRand(12);
+        for (int i = 0; i < nCoins; i++)
+            AddCoin(vPool, 1 + GetRand(GetRand(2) ? 1000 : 50));
+        CAmount nTarget = 1 + GetRand(SumEffective(vPool) + 100);
+        CAmount nCostOfChange = GetRand(20);
+
+        CAmount nBest = BestExcess(vPool, nTarget, nCostOfChange);
+        std::vector<CInputCoin> vSelected;
+        CAmount nValue;
+        bool fFound = SelectCoinsBnB(vPool, nTarget, nCostOfChange, vSelected, nValue);
+        BOOST_CHECK_EQUAL(fFound, nBest >= 0);
+        if (fFound) {
+            BOOST_CHECK_EQUAL(nValue, SumEffective(vSelected));
+            BOOST_CHECK_EQUAL(nValue - nTarget, nBest);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bnb_budget)
+{
+    // only even values, an odd target is never matched: the search must stop on its own
+    std::vector<CInputCoin> vPool;
+    for (int i = 0; i < 100; i++)
+        AddCoin(vPool, 2 * (COIN + i));
+    std::vector<CInputCoin> vSelected;
+    CAmount nValue;
+    int64_t nStart = GetTimeMicros();
+    BOOST_CHECK(!SelectCoinsBnB(vPool, 41 * COIN + 1, 0, vSelected, nValue));
+    BOOST_TEST_MESSAGE("no match among 100 coins: " << (GetTimeMicros() - nStart) << "us");
+
+    // a budget too small to get anywhere
+    BOOST_CHECK(!SelectCoinsBnB(vPool, 4 * COIN + 2, 0, vSelected, nValue, 1));
+}
+
+BOOST_AUTO_TEST_CASE(bnb_staking_wallets)
+{
+    // fee rate of 10000 satoshis per kB
+    const CFeeRate feeRate(10000);
+    const CAmount nInputFee = feeRate.GetFee(INPUT_SIZE_P2PKH);
+    const CAmount nCostOfChange = CCoinSelectionParams(feeRate, 0).nCostOfChange;
+
+    for (int nRewards : {1000, 10000, 50000}) {
+        std::vector<CInputCoin> vPool = StakingPool(nRewards, 100000 * COIN, nInputFee);
+        // the two largest stake coins together are always a match, and the first one looked at
+        std::vector<CAmount> vStakes;
+        for (int i = nRewards; i < (int)vPool.size(); i++)
+            vStakes.push_back(vPool[i].nEffectiveValue);
+        std::sort(vStakes.rbegin(), vStakes.rend());
+        const CAmount nStakes = vStakes[0] + vStakes[1];
+        int nFound = 0;
+        int64_t nStart = GetTimeMicros();
+        for (CAmount nTarget : {COIN / 2, 10 * COIN + 12345, 777 * COIN, 12000 * COIN + 1, nStakes}) {
+            std::vector<CInputCoin> vSelected;
+            CAmount nValue;
+            if (SelectCoinsBnB(vPool, nTarget, nCostOfChange, vSelected, nValue)) {
+                nFound++;
+                BOOST_CHECK(SumEffective(vSelected) >= nTarget);
+                BOOST_CHECK(SumEffective(vSelected) <= nTarget + nCostOfChange);
+                BOOST_CHECK_EQUAL(nValue, SumEffective(vSelected) + (CAmount)vSelected.size() * nInputFee);
+            }
+        }
+        BOOST_CHECK(nFound >= 1);
+        BOOST_TEST_MESSAGE(nRewards << " rewards: " << nFound << " of 5 targets without change in "
+                                    << (GetTimeMicros() - nStart) / 1000 << "ms");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/scrypt.h"
 #include "random.h"
 #include "utilstrencodings.h"
 
@@ -282,4 +283,24 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+static void TestScrypt(const std::string& strPass, const std::string& strSalt, unsigned int N, unsigned int r, unsigned int p, const std::string& hexout)
+{
+    std::vector<unsigned char> out = ParseHex(hexout);
+    // the lanes mixed on one thread or several, the result is the same
+    for (unsigned int nThreads : {1, 3, 16}) {
+        std::vector<unsigned char> gen(out.size());
+        scrypt(strPass.data(), strPass.size(), strSalt.data(), strSalt.size(), (char*)&gen[0], N, r, p, gen.size(), nThreads);
+        BOOST_CHECK(out == gen);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_testvectors)
+{
+    // RFC 7914
+    TestScrypt("password", "NaCl", 1024, 8, 16,
+               "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+    TestScrypt("pleaseletmein", "SodiumChloride", 16384, 8, 1,
+               "7023bdcb3afd7348461c06cd81fd38ebfda8fbba904f8e3ea9b543f6545da1f2d5432955613f0fcf62d49705242a9af9e61e85dc0d651e40dfcf017b45575887");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+
+#include <atomic>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/*
+ * The cuckoo cache behind the signature cache: entries are found until the set
+ * is full, a full set keeps most of what fits, erased entries make room, and
+ * lookups run while another thread inserts.
+ */
+
+namespace
+{
+
+std::vector<uint256> randomEntries(size_t count)
+{
+    std::vector<uint256> entries(count);
+    for (uint256& entry : entries)
+        entry = GetRandHash();
+    return entries;
+}
+
+double hitRate(CCuckooCache& cache, const std::vector<uint256>& entries)
+{
+    size_t nHits = 0;
+    for (const uint256& entry : entries)
+        nHits += cache.Contains(entry, false);
+    return (double)nHits / entries.size();
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(cuckoocache_tests)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_sizing)
+{
+    CCuckooCache cache;
+    BOOST_CHECK_EQUAL(cache.Setup(0), 0U);
+    cache.Insert(GetRandHash());
+    BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+
+    size_t nEntries = cache.Setup(1 << 20);
+    BOOST_CHECK(nEntries > 32000 && nEntries < 33000);
+    BOOST_CHECK(cache.MemoryUsage() <= (1 << 20));
+    BOOST_CHECK(cache.MemoryUsage() > (1 << 20) - 64);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hits)
+{
+    CCuckooCache cache;
+    size_t nEntries = cache.Setup(1 << 20);
+
+    // half full, everything is found and nothing else is
+    std::vector<uint256> entries = randomEntries(nEntries / 2);
+    for (const uint256& entry : entries)
+        cache.Insert(entry);
+    BOOST_CHECK_EQUAL(hitRate(cache, entries), 1.0);
+    BOOST_CHECK_EQUAL(hitRate(cache, randomEntries(1000)), 0.0);
+
+    // twice as many as fit, most of the space is used
+    std::vector<uint256> more = randomEntries(nEntries * 2);
+    for (const uint256& entry : more)
+        cache.Insert(entry);
+    double rate = hitRate(cache, more);
+    BOOST_CHECK_MESSAGE(rate > 0.35, "hit rate " << rate);
+
+    // erased entries are gone and make room
+    std::vector<uint256> erased(more.end() - 1000, more.end());
+    size_t nErased = 0;
+    for (const uint256& entry : erased)
+        nErased += cache.Contains(entry, true);
+    BOOST_CHECK(nErased > 400);
+    BOOST_CHECK_EQUAL(hitRate(cache, erased), 0.0);
+    std::vector<uint256> fresh = randomEntries(nErased);
+    for (const uint256& entry : fresh)
+        cache.Insert(entry);
+    BOOST_CHECK(hitRate(cache, fresh) > 0.9);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_concurrent)
+{
+    CCuckooCache cache;
+    size_t nEntries = cache.Setup(1 << 20);
+    std::vector<uint256> kept = randomEntries(nEntries / 4);
+    for (const uint256& entry : kept)
+        cache.Insert(entry);
+
+    // readers never see entries that were not inserted while the writer fills the set
+    std::vector<uint256> absent = randomEntries(10000);
+    std::vector<uint256> inserted = randomEntries(nEntries);
+    std::atomic<size_t> nFalseHits(0);
+    boost::thread_group readers;
+    for (int i = 0; i < 3; i++) {
+        readers.create_thread([&]() {
+            for (int pass = 0; pass < 5; pass++) {
+                for (const uint256& entry : absent)
+                    nFalseHits += cache.Contains(entry, false);
+            }
+        });
+    }
+    for (const uint256& entry : inserted)
+        cache.Insert(entry);
+    readers.join_all();
+    BOOST_CHECK_EQUAL(nFalseHits.load(), 0U);
+    BOOST_CHECK(hitRate(cache, inserted) > 0.5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,239 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "util.h"
+#include "utiltime.h"
+
+#include <libevm/VM.h>
+#include <libevm/ExtVMFace.h>
+#include <libevmcore/Instruction.h>
+
+#include <map>
+#include <boost/test/unit_test.hpp>
+
+using namespace dev;
+using namespace dev::eth;
+
+/*
+ * Microbenchmarks of the EVM interpreter on typical contract workloads. Every
+ * program is run the given number of times on a fresh VM, like the calls of a
+ * block, once with the analysed code cache disabled and once with it enabled.
+ * Timings are reported with --log_level=message.
+ */
+
+namespace
+{
+
+class Assembler
+{
+public:
+    Assembler& op(Instruction _op) { code.push_back((byte)_op); return *this; }
+
+    Assembler& push(u256 const& _value)
+    {
+        bytes data = toCompactBigEndian(_value, 1);
+        code.push_back((byte)Instruction::PUSH1 + data.size() - 1);
+        code += data;
+        return *this;
+    }
+
+    /// Push the position of a label, resolved by build()
+    Assembler& pushLabel(std::string const& _label)
+    {
+        code.push_back((byte)Instruction::PUSH2);
+        fixups.push_back(std::make_pair(code.size(), _label));
+        code.resize(code.size() + 2);
+        return *this;
+    }
+
+    Assembler& label(std::string const& _label)
+    {
+        labels[_label] = code.size();
+        return op(Instruction::JUMPDEST);
+    }
+
+    bytes build()
+    {
+        for (auto const& i: fixups)
+        {
+            size_t dest = labels.at(i.second);
+            code[i.first] = byte(dest >> 8);
+            code[i.first + 1] = byte(dest);
+        }
+        return code;
+    }
+
+private:
+    bytes code;
+    std::map<std::string, size_t> labels;
+    std::vector<std::pair<size_t, std::string>> fixups;
+};
+
+class BenchExtVM: public ExtVMFace
+{
+public:
+    BenchExtVM(EnvInfo const& _envInfo, bytes const& _code, bytesConstRef _data):
+        ExtVMFace(_envInfo, asAddress(0xc0de), asAddress(0xca11e4), asAddress(0xca11e4), 0, 1, _data, _code, sha3(_code), 0) {}
+
+    u256 store(u256 _n) override
+    {
+        auto it = storage.find(_n);
+        return it == storage.end() ? 0 : it->second;
+    }
+
+    void setStore(u256 _n, u256 _v) override { storage[_n] = _v; }
+
+    boost::optional<owning_bytes_ref> call(CallParameters&) override { return boost::none; }
+
+    EVMSchedule const& evmSchedule() const override { return EIP158Schedule; }
+
+    std::map<u256, u256> storage;
+};
+
+h256 balanceSlot(Address const& _a)
+{
+    return sha3(h256(fromAddress(_a)));
+}
+
+/// Token transfer of calldata[32..64) to calldata[0..32) with balances at sha3(address)
+bytes transferCode()
+{
+    Assembler a;
+    a.op(Instruction::CALLER).push(0).op(Instruction::MSTORE);
+    a.push(32).push(0).op(Instruction::SHA3);
+    a.op(Instruction::DUP1).op(Instruction::SLOAD);
+    a.push(32).op(Instruction::CALLDATALOAD);
+    a.op(Instruction::DUP1).op(Instruction::DUP3).op(Instruction::LT).pushLabel("fail").op(Instruction::JUMPI);
+    a.op(Instruction::SWAP1).op(Instruction::SUB).op(Instruction::SWAP1).op(Instruction::SSTORE);
+    a.push(0).op(Instruction::CALLDATALOAD).push(0).op(Instruction::MSTORE);
+    a.push(32).push(0).op(Instruction::SHA3);
+    a.op(Instruction::DUP1).op(Instruction::SLOAD);
+    a.push(32).op(Instruction::CALLDATALOAD).op(Instruction::ADD);
+    a.op(Instruction::SWAP1).op(Instruction::SSTORE);
+    a.push(32).op(Instruction::CALLDATALOAD).push(0).op(Instruction::MSTORE);
+    a.push(0).op(Instruction::CALLDATALOAD).op(Instruction::CALLER).push(u256(sha3("Transfer(address,address,uint256)")));
+    a.push(32).push(0).op(Instruction::LOG3);
+    a.op(Instruction::STOP);
+    a.label("fail").op(Instruction::STOP);
+    return a.build();
+}
+
+/// Counts down from _n, calling _body with the counter on top of the stack
+template <class Body>
+bytes loopCode(unsigned _n, Body const& _body)
+{
+    Assembler a;
+    a.push(_n);
+    a.label("loop");
+    a.op(Instruction::DUP1).op(Instruction::ISZERO).pushLabel("end").op(Instruction::JUMPI);
+    _body(a);
+    a.push(1).op(Instruction::SWAP1).op(Instruction::SUB);
+    a.pushLabel("loop").op(Instruction::JUMP);
+    a.label("end").op(Instruction::STOP);
+    return a.build();
+}
+
+bytes storageLoopCode(unsigned _n)
+{
+    return loopCode(_n, [](Assembler& a) {
+        a.op(Instruction::DUP1).op(Instruction::DUP1).op(Instruction::SSTORE);
+        a.op(Instruction::DUP1).op(Instruction::SLOAD).op(Instruction::POP);
+    });
+}
+
+bytes sha3LoopCode(unsigned _n)
+{
+    return loopCode(_n, [](Assembler& a) {
+        a.push(32).push(0).op(Instruction::SHA3).push(0).op(Instruction::MSTORE);
+    });
+}
+
+struct BenchResult
+{
+    u256 gasLeft;
+    std::map<u256, u256> storage;
+    size_t logs;
+};
+
+BenchResult run(bytes const& _code, bytes const& _data, std::map<u256, u256> const& _storage)
+{
+    EnvInfo envInfo;
+    BenchExtVM ext(envInfo, _code, bytesConstRef(&_data));
+    ext.storage = _storage;
+    u256 gas = 10000000;
+    VM vm;
+    vm.exec(gas, ext, OnOpFunc());
+    return BenchResult{gas, ext.storage, ext.sub.logs.size()};
+}
+
+/// Run _code _runs times without and with the code cache, the results must match
+void bench(std::string const& _name, bytes const& _code, bytes const& _data, std::map<u256, u256> const& _storage, unsigned _runs)
+{
+    VM::AnalysedCodeCache& cache = VM::analysedCodeCache();
+    size_t maxCost = cache.stats().maxCost;
+
+    cache.setMaxCost(0);
+    BenchResult uncached = run(_code, _data, _storage);
+    int64_t nStart = GetTimeMicros();
+    for (unsigned i = 1; i < _runs; i++)
+        run(_code, _data, _storage);
+    int64_t nUncached = GetTimeMicros() - nStart;
+
+    cache.setMaxCost(maxCost);
+    uint64_t nHits = cache.stats().hits;
+    BenchResult cached = run(_code, _data, _storage);
+    nStart = GetTimeMicros();
+    for (unsigned i = 1; i < _runs; i++)
+        run(_code, _data, _storage);
+    int64_t nCached = GetTimeMicros() - nStart;
+
+    BOOST_CHECK(uncached.gasLeft == cached.gasLeft);
+    BOOST_CHECK(uncached.storage == cached.storage);
+    BOOST_CHECK_EQUAL(uncached.logs, cached.logs);
+    BOOST_CHECK_EQUAL(cache.stats().hits - nHits, _runs - 1);
+
+    BOOST_TEST_MESSAGE(strprintf("%s: %u runs, %.2fus/run uncached, %.2fus/run cached, %u gas/run", _name, _runs,
+                                 (double)nUncached / (_runs - 1), (double)nCached / (_runs - 1), (unsigned)(10000000 - cached.gasLeft)));
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(evm_tests)
+
+BOOST_AUTO_TEST_CASE(evm_transfer)
+{
+    Address to = asAddress(0x70);
+    std::map<u256, u256> storage;
+    storage[u256(balanceSlot(asAddress(0xca11e4)))] = 1000;
+
+    bytes data = h256(fromAddress(to)).asBytes() + h256(u256(250)).asBytes();
+    BenchResult result = run(transferCode(), data, storage);
+    BOOST_CHECK(result.storage[u256(balanceSlot(asAddress(0xca11e4)))] == 750);
+    BOOST_CHECK(result.storage[u256(balanceSlot(to))] == 250);
+    BOOST_CHECK_EQUAL(result.logs, 1U);
+
+    // insufficient balance leaves the balances alone
+    data = h256(fromAddress(to)).asBytes() + h256(u256(2000)).asBytes();
+    result = run(transferCode(), data, storage);
+    BOOST_CHECK(result.storage == storage);
+    BOOST_CHECK_EQUAL(result.logs, 0U);
+
+    bench("transfer", transferCode(), h256(fromAddress(to)).asBytes() + h256(u256(1)).asBytes(), storage, 2000);
+}
+
+BOOST_AUTO_TEST_CASE(evm_storage_loop)
+{
+    BenchResult result = run(storageLoopCode(100), bytes(), std::map<u256, u256>());
+    BOOST_CHECK_EQUAL(result.storage.size(), 100U);
+    BOOST_CHECK(result.storage[42] == 42);
+
+    bench("storage loop", storageLoopCode(100), bytes(), std::map<u256, u256>(), 200);
+}
+
+BOOST_AUTO_TEST_CASE(evm_sha3_loop)
+{
+    bench("sha3 loop", sha3LoopCode(1000), bytes(), std::map<u256, u256>(), 200);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
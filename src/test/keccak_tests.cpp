@@ -0,0 +1,146 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "util.h"
+#include "utiltime.h"
+
+#include <libdevcore/SHA3.h>
+
+#include <algorithm>
+#include <boost/test/unit_test.hpp>
+
+using namespace dev;
+
+/*
+ * Keccak-256 as used by the EVM and the state tries: known answers around the
+ * block size of 136 bytes, the hashes of several inputs at once against the
+ * hashes one at a time for every width the CPU supports, and the throughput of
+ * both. Timings are reported with --log_level=message.
+ */
+
+namespace
+{
+
+struct KeccakVector
+{
+    size_t size;
+    const char* hash;
+};
+
+/// Hashes of size bytes (i * 31 + 7) mod 256
+const KeccakVector c_vectors[] = {
+    {1, "ee2a4bc7db81da2b7164e56b3649b1e2a09c58c455b15dabddd9146c7582cebc"},
+    {31, "e26887732fb2b99d9de7c6198e8af62233e786b072008f63e51bc0e005007891"},
+    {32, "dc7b69b8512dce347cacd51f7cff541905fdb5fabb71b37dc6b271c152bc8efc"},
+    {33, "108e7db8488b7bcca75b5d38a306f7b55241e61daeff200f73d5db0e3e480f52"},
+    {64, "cef50cf47c1d754b090843530a064892786476fdd9afb5216f5efce9928faf12"},
+    {100, "b73c9de45d2fd9c9655cfdce9160cd36d83ec99b2c124c788a67adeb044897a1"},
+    {135, "adee8145bb33dc0320ad44945eeeb391e4668f0f7c69ccbbf6550a7cba245e52"},
+    {136, "eaccfc5aa7bf6bf1941809ef7cc9ee6a2fa306a7dd1de3f2e8504849b0a5e3c4"},
+    {137, "ea0e0b9657469f0b4f53604f1068ab4bd4a5e7b0a458d24a78f1fe2ec7bd4db0"},
+    {200, "af34d36e1e9eb18df4a79a5a8304300700d164014a5d6400438116dfc1d9db28"},
+    {271, "407871b419dca15e033dd9777154af2116326a7849eacadbc46b1618055ee0a2"},
+    {272, "c62d6a60780d4e03408834062e58004a549cff1c7487c0b9a130810621b0fcae"},
+    {273, "b47ca693c8d675afa3b0b644da6dc96613f07c6f8971f9a0077ed6b7c994561d"},
+    {1000, "c77d9bffcae9f0984e6dff7eea63cc14cad5f367f791e27b08a1953f192f30a5"},
+};
+
+bytes pattern(size_t _size)
+{
+    bytes ret(_size);
+    for (size_t i = 0; i < _size; i++)
+        ret[i] = byte(i * 31 + 7);
+    return ret;
+}
+
+std::vector<unsigned> widths()
+{
+    std::vector<unsigned> ret;
+    for (unsigned width = 1; width <= sha3MaxWidth(); width *= 2)
+        ret.push_back(width);
+    return ret;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(keccak_tests)
+
+BOOST_AUTO_TEST_CASE(keccak_vectors)
+{
+    BOOST_CHECK_EQUAL(sha3(bytes()).hex(), "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470");
+    BOOST_CHECK_EQUAL(sha3(std::string("abc")).hex(), "4e03657aea45a94fc7d47ba826c8d667c0d1e6e33a64a036ec44f58fa12d6c45");
+    BOOST_CHECK_EQUAL(sha3(bytes(1000000, 'a')).hex(), "fadae6b49f129bbb812be8407b7b2894f34aecf6dbd1f9b0f0c7e9853098fc96");
+    for (KeccakVector const& v: c_vectors)
+        BOOST_CHECK_MESSAGE(sha3(pattern(v.size)).hex() == v.hash, "size " << v.size);
+    BOOST_CHECK(EmptySHA3 == sha3(bytesConstRef()));
+}
+
+BOOST_AUTO_TEST_CASE(keccak_batch)
+{
+    // every size up to three blocks, in batches that end with part of a width
+    std::vector<bytes> inputs;
+    for (size_t size = 0; size <= 3 * 136 + 1; size++)
+        inputs.push_back(pattern(size));
+    std::vector<bytesConstRef> refs;
+    std::vector<h256> expected;
+    for (bytes const& input: inputs)
+    {
+        refs.push_back(bytesConstRef(&input));
+        expected.push_back(sha3(input));
+    }
+
+    for (unsigned width: widths())
+    {
+        std::vector<h256> hashes(refs.size());
+        sha3(refs.data(), refs.size(), hashes.data(), width);
+        for (size_t i = 0; i < refs.size(); i++)
+            BOOST_CHECK_MESSAGE(hashes[i] == expected[i], "width " << width << " size " << refs[i].size());
+
+        // lengths that differ within a batch
+        std::vector<bytesConstRef> mixed(refs.rbegin(), refs.rend());
+        std::reverse(mixed.begin() + 3, mixed.end() - 5);
+        sha3(mixed.data(), mixed.size(), hashes.data(), width);
+        for (size_t i = 0; i < mixed.size(); i++)
+            BOOST_CHECK(hashes[i] == expected[mixed[i].size()]);
+    }
+
+    std::vector<h256> keys;
+    for (unsigned i = 0; i < 37; i++)
+        keys.push_back(h256(u256(i)));
+    std::vector<h256> hashedKeys = sha3(keys);
+    BOOST_REQUIRE_EQUAL(hashedKeys.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        BOOST_CHECK(hashedKeys[i] == sha3(keys[i]));
+}
+
+BOOST_AUTO_TEST_CASE(keccak_throughput)
+{
+    for (size_t size: {20, 32, 136, 532})
+    {
+        std::vector<bytes> inputs(4096, pattern(size));
+        std::vector<bytesConstRef> refs;
+        for (bytes const& input: inputs)
+            refs.push_back(bytesConstRef(&input));
+        std::vector<h256> hashes(refs.size());
+
+        int64_t nStart = GetTimeMicros();
+        for (size_t i = 0; i < refs.size(); i++)
+            hashes[i] = sha3(refs[i]);
+        int64_t nSingle = GetTimeMicros() - nStart;
+        std::string strResult = strprintf("%u byte inputs: %.1f MB/s one at a time", size, (double)size * refs.size() / std::max<int64_t>(nSingle, 1));
+
+        for (unsigned width: widths())
+        {
+            std::vector<h256> batch(refs.size());
+            nStart = GetTimeMicros();
+            sha3(refs.data(), refs.size(), batch.data(), width);
+            int64_t nBatch = GetTimeMicros() - nStart;
+            BOOST_CHECK(batch == hashes);
+            strResult += strprintf(", %.1f MB/s %u wide", (double)size * refs.size() / std::max<int64_t>(nBatch, 1), width);
+        }
+        BOOST_TEST_MESSAGE(strResult);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,171 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/ripemd160.h"
+#include "crypto/sha256.h"
+#include "util.h"
+
+#include <lux/speculativeexec.h>
+#include <libethashseal/Ethash.h>
+#include <libethashseal/GenesisInfo.h>
+#include <libethereum/ChainParams.h>
+#include <libevm/VM.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace dev;
+using namespace dev::eth;
+
+/*
+ * Determinism of the speculative execution of contract transactions: the same
+ * block transactions are executed in order on one state and ahead in parallel on
+ * another, which must end up with the same roots, results, receipts and
+ * condensing transactions.
+ */
+
+namespace
+{
+
+/** Runtime code adding one to slot 0 and logging, behind init code returning it */
+bytes counterCode()
+{
+    bytes runtime = fromHex("60005460010160005560006000a000");
+    bytes init = fromHex("60") + bytes(1, (byte)runtime.size()) + fromHex("600c600039") + fromHex("60") + bytes(1, (byte)runtime.size()) + fromHex("6000f3");
+    BOOST_REQUIRE_EQUAL(init.size(), 12U);
+    return init + runtime;
+}
+
+/** Address of the contract created by output nVout of hashTx, as LuxState does */
+Address contractAddress(h256 const& hashTx, uint32_t nVout)
+{
+    uint256 hash(h256Touint(hashTx));
+    std::vector<unsigned char> data(hash.begin(), hash.end());
+    data.insert(data.end(), (unsigned char*)&nVout, (unsigned char*)&nVout + sizeof(nVout));
+    unsigned char sha[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data.data(), data.size()).Finalize(sha);
+    std::vector<unsigned char> ripemd(CRIPEMD160::OUTPUT_SIZE);
+    CRIPEMD160().Write(sha, sizeof(sha)).Finalize(ripemd.data());
+    return Address(ripemd);
+}
+
+LuxTransaction contractTx(unsigned int nSender, h256 const& hashTx, Address const& to, u256 const& value, bytes const& data, u256 const& gas = 100000)
+{
+    LuxTransaction tx = to ? LuxTransaction(value, 1, gas, to, data, 0) : LuxTransaction(value, 1, gas, data, 0);
+    tx.forceSender(asAddress(0x5e00 + nSender));
+    tx.setHashWith(hashTx);
+    tx.setNVout(0);
+    tx.setVersion(VersionVM::GetEVMDefault());
+    return tx;
+}
+
+h256 txHash(unsigned int n)
+{
+    return sha3(h256(u256(n)));
+}
+
+void checkSameResults(std::vector<ResultExecute> const& serial, std::vector<ResultExecute> const& parallel)
+{
+    BOOST_REQUIRE_EQUAL(serial.size(), parallel.size());
+    for (size_t i = 0; i < serial.size(); i++)
+    {
+        BOOST_CHECK(serial[i].execRes.excepted == parallel[i].execRes.excepted);
+        BOOST_CHECK(serial[i].execRes.gasUsed == parallel[i].execRes.gasUsed);
+        BOOST_CHECK(serial[i].execRes.newAddress == parallel[i].execRes.newAddress);
+        BOOST_CHECK(serial[i].txRec.rlp() == parallel[i].txRec.rlp());
+        BOOST_CHECK(serial[i].tx.GetHash() == parallel[i].tx.GetHash());
+    }
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(speculativeexec_tests)
+
+BOOST_AUTO_TEST_CASE(speculative_matches_serial)
+{
+    Ethash::init();
+    ChainParams cp((genesisInfo(Network::luxMainNetwork)));
+    std::unique_ptr<SealEngineFace> sealEngine(cp.createSealEngine());
+    sealEngine->setLuxSchedule(EIP158Schedule);
+
+    boost::filesystem::path path = GetDataDir() / "speculativeexec";
+    boost::filesystem::create_directories(path);
+    h256 const hashDB(sha3(rlp("")));
+    LuxState serial(0, LuxState::openDB(path.string(), hashDB, WithExisting::Kill), path.string(), BaseState::Empty);
+    serial.setRoot(sha3(rlp("")));
+    serial.setRootUTXO(sha3(rlp("")));
+
+    EnvInfo envInfo;
+    envInfo.setNumber(1000);
+    envInfo.setTimestamp(1500000000);
+    envInfo.setGasLimit(40000000);
+    envInfo.setAuthor(asAddress(0xa07));
+
+    // counters A, B, C, E, F and G, committed like a previous block
+    std::vector<Address> counters;
+    for (unsigned int i = 0; i < 6; i++)
+    {
+        std::vector<ResultExecute> result;
+        BOOST_REQUIRE(ExecuteContractTxs(serial, envInfo, *sealEngine, {contractTx(i, txHash(i), Address(), 0, counterCode())}, Permanence::Committed, result));
+        BOOST_REQUIRE(result[0].execRes.excepted == TransactionException::None);
+        counters.push_back(result[0].execRes.newAddress);
+    }
+    serial.db().commit();
+    serial.dbUtxo().commit();
+    LuxState parallel(0, serial.db(), serial.dbUtxo(), serial.rootHash(), serial.rootHashUTXO());
+
+    Address const a = counters[0], b = counters[1], c = counters[2], e = counters[3], f = counters[4], g = counters[5];
+    Address const d = contractAddress(txHash(105), 0);
+    std::vector<std::vector<LuxTransaction>> block = {
+        {contractTx(100, txHash(100), a, 0, bytes())},
+        {contractTx(101, txHash(101), b, 0, bytes())},
+        // A again, conflicts with the first
+        {contractTx(102, txHash(102), a, 0, bytes())},
+        // value sent to C needs condensing transactions, the second one conflicts
+        {contractTx(103, txHash(103), c, 1000, bytes())},
+        {contractTx(104, txHash(104), c, 500, bytes())},
+        // D does not exist at the start of the block, so its call conflicts with its creation
+        {contractTx(105, txHash(105), Address(), 0, counterCode())},
+        {contractTx(106, txHash(106), d, 0, bytes())},
+        // two executions in one block transaction
+        {contractTx(107, txHash(107), e, 0, bytes()), contractTx(107, txHash(107), f, 0, bytes())},
+        {contractTx(108, txHash(108), asAddress(0xdead), 0, bytes())},
+        // out of gas
+        {contractTx(109, txHash(109), g, 0, bytes(), 22000)},
+    };
+
+    std::vector<std::vector<ResultExecute>> serialResults(block.size());
+    for (size_t i = 0; i < block.size(); i++)
+        BOOST_REQUIRE(ExecuteContractTxs(serial, envInfo, *sealEngine, block[i], Permanence::Committed, serialResults[i]));
+
+    CCheckQueue<CContractCheck> queue(1);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CContractCheck>::Thread, &queue));
+
+    SpeculativeContractExec speculation(parallel, envInfo, *sealEngine);
+    for (size_t i = 0; i < block.size(); i++)
+        speculation.Add(i, block[i]);
+    speculation.Run(&queue);
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    for (size_t i = 0; i < block.size(); i++)
+    {
+        std::vector<ResultExecute> result;
+        BOOST_REQUIRE(speculation.Execute(i, block[i], result));
+        checkSameResults(serialResults[i], result);
+    }
+    BOOST_CHECK(serial.rootHash() == parallel.rootHash());
+    BOOST_CHECK(serial.rootHashUTXO() == parallel.rootHashUTXO());
+
+    BOOST_CHECK(serialResults[3][0].tx != CTransaction());
+    BOOST_CHECK(serialResults[6][0].execRes.excepted == TransactionException::None);
+    BOOST_CHECK(serialResults[9][0].execRes.excepted != TransactionException::None);
+    BOOST_CHECK_EQUAL(speculation.Reexecuted(), 3U);
+    BOOST_CHECK_EQUAL(speculation.Reused(), block.size() - 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,8 +4,10 @@
 
 #define BOOST_TEST_MODULE Lux Test Suite
 
+#include "key.h"
 #include "main.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -25,16 +27,19 @@ extern bool fPrintToConsole;
 extern void noui_connect();
 
 struct TestingSetup {
+    ECCVerifyHandle globalVerifyHandle;
     CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
 
     TestingSetup() {
         SetupEnvironment();
+        ECC_Start();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
         noui_connect();
+        InitSignatureCache();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
@@ -72,6 +77,7 @@ struct TestingSetup {
         bitdb.Flush(true);
 #endif
         boost::filesystem::remove_all(pathTemp);
+        ECC_Stop();
     }
 };
 
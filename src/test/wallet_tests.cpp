@@ -4,6 +4,12 @@
 
 #include "wallet.h"
 
+#include "base58.h"
+#include "main.h"
+#include "random.h"
+#include "rpcserver.h"
+#include "script/standard.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -23,6 +29,8 @@ using namespace std;
 
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
+extern CWallet* pwalletMain;
+
 BOOST_AUTO_TEST_SUITE(wallet_tests)
 
 static CWallet wallet;
@@ -305,4 +313,279 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+// The unspent index behind AvailableCoins: the coins found through it are the ones
+// a walk of mapWallet finds, as the chain and the keys change.
+
+//! A transaction spending vPrevout, or a made up outpoint, with one output per value to scriptPubKey
+static CMutableTransaction MakeTx(const vector<COutPoint>& vPrevout, const CScript& scriptPubKey, const vector<CAmount>& vValue)
+{
+    CMutableTransaction tx;
+    if (vPrevout.empty())
+        tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    BOOST_FOREACH (const COutPoint& prevout, vPrevout)
+        tx.vin.push_back(CTxIn(prevout));
+    BOOST_FOREACH (const CAmount& nValue, vValue)
+        tx.vout.push_back(CTxOut(nValue, scriptPubKey));
+    return tx;
+}
+
+//! Put wtx alone in a new block on top of the active chain, the block's merkle root is wtx
+static void ConnectInNewBlock(CWalletTx& wtx)
+{
+    CBlockIndex* pindex = new CBlockIndex();
+    pindex->pprev = chainActive.Tip();
+    pindex->nHeight = chainActive.Height() + 1;
+    pindex->hashMerkleRoot = wtx.GetHash();
+    pindex->phashBlock = &mapBlockIndex.insert(make_pair(GetRandHash(), pindex)).first->first;
+    chainActive.SetTip(pindex);
+    wtx.hashBlock = pindex->GetBlockHash();
+    wtx.nIndex = 0;
+}
+
+//! Take the tip out of the active chain and the block index
+static void DisconnectTip()
+{
+    CBlockIndex* pindex = chainActive.Tip();
+    chainActive.SetTip(pindex->pprev);
+    mapBlockIndex.erase(pindex->GetBlockHash());
+    delete pindex;
+}
+
+static set<COutPoint> AvailableOutPoints(const CWallet& wallet, AvailableCoinsType nCoinType = ALL_COINS)
+{
+    vector<COutput> vAvailable;
+    wallet.AvailableCoins(vAvailable, true, NULL, false, nCoinType);
+    set<COutPoint> setOutPoints;
+    BOOST_FOREACH (const COutput& out, vAvailable)
+        setOutPoints.insert(COutPoint(out.tx->GetHash(), out.i));
+    return setOutPoints;
+}
+
+//! What AvailableCoins returned when it walked all of mapWallet
+static set<COutPoint> ScanOutPoints(const CWallet& wallet)
+{
+    set<COutPoint> setOutPoints;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        if (!CheckFinalTx(wtx) || !wtx.IsTrusted())
+            continue;
+        if ((wtx.IsCoinBase() || wtx.IsCoinStake()) && wtx.GetBlocksToMaturity() > 0)
+            continue;
+        if (wtx.GetDepthInMainChain(false) == 0 && !wtx.InMempool())
+            continue;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            if (!wallet.IsSpent(it->first, i) && wallet.IsMine(wtx.vout[i]) != ISMINE_NO &&
+                !wallet.IsLockedCoin(it->first, i) && wtx.vout[i].nValue > 0)
+                setOutPoints.insert(COutPoint(it->first, i));
+        }
+    }
+    return setOutPoints;
+}
+
+static CScript NewWalletScript(CWallet& wallet)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    return GetScriptForDestination(key.GetPubKey().GetID());
+}
+
+static CScript NewOtherScript()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    return GetScriptForDestination(key.GetPubKey().GetID());
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_disconnect)
+{
+    CWallet wallet("wallet_unspent_disconnect.dat");
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    LOCK2(cs_main, wallet.cs_wallet);
+    const int nHeight = chainActive.Height();
+
+    CWalletTx wtxFund(&wallet, MakeTx(vector<COutPoint>(), NewWalletScript(wallet), vector<CAmount>(1, 3 * COIN)));
+    ConnectInNewBlock(wtxFund);
+    BOOST_CHECK(wallet.AddToWallet(wtxFund));
+    const COutPoint coin(wtxFund.GetHash(), 0);
+    BOOST_CHECK(AvailableOutPoints(wallet).count(coin));
+
+    // spent in a block the coin is gone
+    CMutableTransaction txSpend = MakeTx(vector<COutPoint>(1, coin), NewOtherScript(), vector<CAmount>(1, 2 * COIN));
+    CWalletTx wtxSpend(&wallet, txSpend);
+    ConnectInNewBlock(wtxSpend);
+    BOOST_CHECK(wallet.AddToWallet(wtxSpend));
+    BOOST_CHECK(!AvailableOutPoints(wallet).count(coin));
+    BOOST_CHECK(AvailableOutPoints(wallet) == ScanOutPoints(wallet));
+
+    // and back once that block is disconnected and the spend goes through the wallet again
+    DisconnectTip();
+    wallet.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK(AvailableOutPoints(wallet).count(coin));
+    BOOST_CHECK(AvailableOutPoints(wallet) == ScanOutPoints(wallet));
+
+    DisconnectTip();
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight);
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_denominations)
+{
+    CWallet wallet("wallet_unspent_denominations.dat");
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    LOCK2(cs_main, wallet.cs_wallet);
+    const vector<int64_t> vDenominationsBefore = darkSendDenominations;
+
+    vector<CAmount> vValue;
+    vValue.push_back(7 * COIN + 1);
+    vValue.push_back(5 * COIN + 3);
+    CWalletTx wtxFund(&wallet, MakeTx(vector<COutPoint>(), NewWalletScript(wallet), vValue));
+    ConnectInNewBlock(wtxFund);
+    BOOST_CHECK(wallet.AddToWallet(wtxFund));
+    const COutPoint coinDenominated(wtxFund.GetHash(), 0), coinOther(wtxFund.GetHash(), 1);
+    BOOST_CHECK(AvailableOutPoints(wallet, ONLY_DENOMINATED).empty());
+    BOOST_CHECK(AvailableOutPoints(wallet, ONLY_NONDENOMINATED).count(coinDenominated));
+
+    // new denominations sort the indexed coins again
+    darkSendDenominations.push_back(7 * COIN + 1);
+    set<COutPoint> setDenominated = AvailableOutPoints(wallet, ONLY_DENOMINATED);
+    BOOST_CHECK_EQUAL(setDenominated.size(), 1U);
+    BOOST_CHECK(setDenominated.count(coinDenominated));
+    set<COutPoint> setOther = AvailableOutPoints(wallet, ONLY_NONDENOMINATED);
+    BOOST_CHECK(setOther.count(coinOther));
+    BOOST_CHECK(!setOther.count(coinDenominated));
+
+    darkSendDenominations = vDenominationsBefore;
+    BOOST_CHECK(AvailableOutPoints(wallet, ONLY_DENOMINATED).empty());
+    DisconnectTip();
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_import)
+{
+    CWallet wallet("wallet_unspent_import.dat");
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    // a transaction to a key the wallet is yet to hold
+    CKey key;
+    key.MakeNewKey(true);
+    CWalletTx wtxFund(&wallet, MakeTx(vector<COutPoint>(), GetScriptForDestination(key.GetPubKey().GetID()), vector<CAmount>(1, 4 * COIN)));
+    ConnectInNewBlock(wtxFund);
+    BOOST_CHECK(wallet.AddToWallet(wtxFund));
+    const COutPoint coin(wtxFund.GetHash(), 0);
+    BOOST_CHECK(!AvailableOutPoints(wallet).count(coin));
+
+    // importing the key has the index built again
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    BOOST_CHECK(AvailableOutPoints(wallet).count(coin));
+    DisconnectTip();
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_matches_scan)
+{
+    CWallet wallet("wallet_unspent_scan.dat");
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    LOCK2(cs_main, wallet.cs_wallet);
+    const int nHeight = chainActive.Height();
+    const CScript scriptMine = NewWalletScript(wallet), scriptOther = NewOtherScript();
+
+    vector<CWalletTx> vFund;
+    for (int i = 0; i < 6; i++) {
+        vector<CAmount> vValue;
+        for (int j = 0; j <= i; j++)
+            vValue.push_back((i * 10 + j + 1) * CENT);
+        CMutableTransaction tx = MakeTx(vector<COutPoint>(), scriptMine, vValue);
+        // an output that is not ours next to ours
+        tx.vout.push_back(CTxOut(COIN, scriptOther));
+        CWalletTx wtx(&wallet, tx);
+        ConnectInNewBlock(wtx);
+        BOOST_CHECK(wallet.AddToWallet(wtx));
+        vFund.push_back(wtx);
+    }
+
+    // spent in a block
+    CWalletTx wtxSpend(&wallet, MakeTx(vector<COutPoint>(1, COutPoint(vFund[1].GetHash(), 0)), scriptOther, vector<CAmount>(1, CENT)));
+    ConnectInNewBlock(wtxSpend);
+    BOOST_CHECK(wallet.AddToWallet(wtxSpend));
+    // spent by a transaction neither in a block nor in the mempool, so not spent
+    CWalletTx wtxLost(&wallet, MakeTx(vector<COutPoint>(1, COutPoint(vFund[2].GetHash(), 1)), scriptOther, vector<CAmount>(1, CENT)));
+    BOOST_CHECK(wallet.AddToWallet(wtxLost));
+    // locked
+    COutPoint locked(vFund[3].GetHash(), 2);
+    wallet.LockCoin(locked);
+    // not in a block and not in the mempool
+    CWalletTx wtxUnconfirmed(&wallet, MakeTx(vector<COutPoint>(), scriptMine, vector<CAmount>(1, COIN)));
+    BOOST_CHECK(wallet.AddToWallet(wtxUnconfirmed));
+
+    set<COutPoint> setAvailable = AvailableOutPoints(wallet);
+    BOOST_CHECK_EQUAL(setAvailable.size(), 21U - 1 - 1);
+    BOOST_CHECK(setAvailable == ScanOutPoints(wallet));
+    BOOST_CHECK(!setAvailable.count(COutPoint(vFund[1].GetHash(), 0)));
+    BOOST_CHECK(setAvailable.count(COutPoint(vFund[2].GetHash(), 1)));
+    BOOST_CHECK(!setAvailable.count(locked));
+    BOOST_CHECK(!setAvailable.count(COutPoint(wtxUnconfirmed.GetHash(), 0)));
+
+    while (chainActive.Height() > nHeight)
+        DisconnectTip();
+}
+
+// Archived transactions still count in the balances, through their summaries.
+
+static CAmount CallBalance(UniValue (*method)(const UniValue&, bool), const string& strParam = "")
+{
+    UniValue params(UniValue::VARR);
+    if (!strParam.empty())
+        params.push_back(strParam);
+    return AmountFromValue(method(params, false));
+}
+
+BOOST_AUTO_TEST_CASE(archived_balance)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    const int nHeight = chainActive.Height();
+
+    // received to an account, sent on with change, and the change spent again
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    BOOST_CHECK(pwalletMain->SetAddressBook(key.GetPubKey().GetID(), "archive", "receive"));
+    const string strAddress = EncodeDestination(key.GetPubKey().GetID());
+    CWalletTx wtxFund(pwalletMain, MakeTx(vector<COutPoint>(), GetScriptForDestination(key.GetPubKey().GetID()), vector<CAmount>(1, 5 * COIN)));
+    ConnectInNewBlock(wtxFund);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxFund));
+
+    CMutableTransaction txSpend = MakeTx(vector<COutPoint>(1, COutPoint(wtxFund.GetHash(), 0)), NewOtherScript(), vector<CAmount>(1, 2 * COIN));
+    txSpend.vout.push_back(CTxOut(290 * CENT, NewWalletScript(*pwalletMain)));
+    CWalletTx wtxSpend(pwalletMain, txSpend);
+    ConnectInNewBlock(wtxSpend);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxSpend));
+
+    CWalletTx wtxChange(pwalletMain, MakeTx(vector<COutPoint>(1, COutPoint(wtxSpend.GetHash(), 1)), NewWalletScript(*pwalletMain), vector<CAmount>(1, 280 * CENT)));
+    ConnectInNewBlock(wtxChange);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxChange));
+
+    const CAmount nBalance = CallBalance(getbalance);
+    BOOST_CHECK_EQUAL(CallBalance(getbalance, "*"), nBalance);
+    const CAmount nAccount = CallBalance(getbalance, "archive");
+    BOOST_CHECK_EQUAL(nAccount, 5 * COIN);
+    BOOST_CHECK_EQUAL(CallBalance(getreceivedbyaddress, strAddress), 5 * COIN);
+
+    // the fund and the spend go, the change they led to stays
+    BOOST_CHECK_EQUAL(pwalletMain->ArchiveTransactions(1), 2U);
+    BOOST_CHECK(pwalletMain->IsArchived(wtxFund.GetHash()));
+    BOOST_CHECK(pwalletMain->IsArchived(wtxSpend.GetHash()));
+    BOOST_CHECK(!pwalletMain->IsArchived(wtxChange.GetHash()));
+
+    BOOST_CHECK_EQUAL(CallBalance(getbalance), nBalance);
+    BOOST_CHECK_EQUAL(CallBalance(getbalance, "*"), nBalance);
+    BOOST_CHECK_EQUAL(CallBalance(getbalance, "archive"), nAccount);
+    BOOST_CHECK_EQUAL(CallBalance(getreceivedbyaddress, strAddress), 5 * COIN);
+
+    while (chainActive.Height() > nHeight)
+        DisconnectTip();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,292 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "walletlog.h"
+#include "crypto/common.h"
+#include "random.h"
+#include "tinyformat.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+struct WalletLogSetup {
+    boost::filesystem::path pathDir;
+
+    WalletLogSetup()
+    {
+        pathDir = GetTempPath() / strprintf("test_walletlog_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+        boost::filesystem::create_directories(pathDir);
+    }
+    ~WalletLogSetup()
+    {
+        boost::filesystem::remove_all(pathDir);
+    }
+};
+
+bool CollectRecord(std::map<int, std::string>& mapOut, std::vector<int>& vOrder, CLogRecordReader& key, CLogRecordReader& value)
+{
+    int n;
+    std::string str;
+    key >> n;
+    value >> str;
+    mapOut[n] = str;
+    vOrder.push_back(n);
+    return true;
+}
+
+std::map<int, std::string> LoadAll(CWalletLog& log, std::vector<int>* pvOrder = NULL)
+{
+    std::map<int, std::string> mapOut;
+    std::vector<int> vOrder;
+    BOOST_CHECK(log.Load(boost::bind(CollectRecord, boost::ref(mapOut), boost::ref(vOrder), _1, _2)));
+    if (pvOrder)
+        *pvOrder = vOrder;
+    return mapOut;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(walletlog_tests, WalletLogSetup)
+
+BOOST_AUTO_TEST_CASE(walletlog_write_erase_reopen)
+{
+    boost::filesystem::path path = pathDir / "wallet.dat.log";
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open());
+        BOOST_CHECK(log.Write(1, std::string("one")));
+        BOOST_CHECK(log.Write(2, std::string("two")));
+        BOOST_CHECK(log.Write(3, std::string("three")));
+        BOOST_CHECK(log.Write(1, std::string("uno")));
+        BOOST_CHECK(log.Erase(2));
+        BOOST_CHECK(log.Exists(1));
+        BOOST_CHECK(!log.Exists(2));
+        BOOST_CHECK_EQUAL(log.GetCount(), 2U);
+        BOOST_CHECK(log.Flush());
+    }
+
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open());
+    std::vector<int> vOrder;
+    std::map<int, std::string> mapRead = LoadAll(log, &vOrder);
+    BOOST_CHECK_EQUAL(mapRead.size(), 2U);
+    BOOST_CHECK_EQUAL(mapRead[1], "uno");
+    BOOST_CHECK_EQUAL(mapRead[3], "three");
+    // in the order of their last write
+    BOOST_CHECK_EQUAL(vOrder.size(), 2U);
+    BOOST_CHECK_EQUAL(vOrder[0], 3);
+    BOOST_CHECK_EQUAL(vOrder[1], 1);
+
+    // one record at a time, as archived transactions are read back
+    std::string strValue;
+    BOOST_CHECK(log.Read(3, strValue));
+    BOOST_CHECK_EQUAL(strValue, "three");
+    BOOST_CHECK(!log.Read(2, strValue));
+
+    // what is written after reopening goes on the end
+    BOOST_CHECK(log.Write(2, std::string("deux")));
+    log.Close();
+    BOOST_CHECK(log.Open());
+    BOOST_CHECK_EQUAL(LoadAll(log)[2], "deux");
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_torn_write)
+{
+    boost::filesystem::path path = pathDir / "wallet.dat.log";
+    uint64_t nGood;
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open());
+        for (int i = 0; i < 10; i++)
+            BOOST_CHECK(log.Write(i, strprintf("value %d", i)));
+        nGood = log.GetFileSize();
+        BOOST_CHECK(log.Write(10, std::string(1000, 'x')));
+    }
+
+    // the last write only made it halfway to the disk
+    boost::filesystem::resize_file(path, nGood + 500);
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open());
+        BOOST_CHECK_EQUAL(log.GetCount(), 10U);
+        BOOST_CHECK_EQUAL(log.GetFileSize(), nGood);
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nGood);
+        BOOST_CHECK(!log.Exists(10));
+        BOOST_CHECK(log.Write(10, std::string("again")));
+    }
+
+    // a record that does not match its checksum ends the log as well
+    {
+        FILE* file = fopen(path.string().c_str(), "r+b");
+        BOOST_REQUIRE(file);
+        fseek(file, -2, SEEK_END);
+        fputc('!', file);
+        fclose(file);
+    }
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open());
+    std::map<int, std::string> mapRead = LoadAll(log);
+    BOOST_CHECK_EQUAL(mapRead.size(), 10U);
+    BOOST_CHECK_EQUAL(mapRead[9], "value 9");
+
+    // not a log at all
+    log.Close();
+    boost::filesystem::path pathBad = pathDir / "bad.log";
+    FILE* file = fopen(pathBad.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    fputs("not a wallet log", file);
+    fclose(file);
+    CWalletLog logBad(pathBad);
+    BOOST_CHECK(!logBad.Open());
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_damaged_inside)
+{
+    boost::filesystem::path path = pathDir / "wallet.dat.log";
+    uint64_t nGood;
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open());
+        for (int i = 0; i < 5; i++)
+            BOOST_CHECK(log.Write(i, strprintf("value %d", i)));
+        nGood = log.GetFileSize();
+        for (int i = 5; i < 10; i++)
+            BOOST_CHECK(log.Write(i, strprintf("value %d", i)));
+        BOOST_CHECK(!log.IsDamaged());
+    }
+    const uint64_t nSize = boost::filesystem::file_size(path);
+
+    // a bad byte in the sixth record, with good records after it
+    {
+        FILE* file = fopen(path.string().c_str(), "r+b");
+        BOOST_REQUIRE(file);
+        fseek(file, nGood + 20, SEEK_SET);
+        fputc('!', file);
+        fclose(file);
+    }
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open());
+    BOOST_CHECK(log.IsDamaged());
+    BOOST_CHECK_EQUAL(log.GetCount(), 5U);
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nGood);
+
+    // the damaged file is kept next to the log
+    int nCopies = 0;
+    for (boost::filesystem::directory_iterator it(pathDir); it != boost::filesystem::directory_iterator(); ++it) {
+        const std::string strName = it->path().filename().string();
+        if (strName.compare(0, path.filename().string().size(), path.filename().string()) == 0 &&
+            strName.size() > 4 && strName.compare(strName.size() - 4, 4, ".bad") == 0) {
+            BOOST_CHECK_EQUAL(boost::filesystem::file_size(it->path()), nSize);
+            nCopies++;
+        }
+    }
+    BOOST_CHECK_EQUAL(nCopies, 1);
+
+    log.Close();
+    BOOST_CHECK(log.Open());
+    BOOST_CHECK(!log.IsDamaged());
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_damaged_length)
+{
+    boost::filesystem::path path = pathDir / "wallet.dat.log";
+    uint64_t nGood;
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open());
+        for (int i = 0; i < 5; i++)
+            BOOST_CHECK(log.Write(i, strprintf("value %d", i)));
+        nGood = log.GetFileSize();
+        for (int i = 5; i < 10; i++)
+            BOOST_CHECK(log.Write(i, strprintf("value %d", i)));
+    }
+
+    // the value size of the sixth record points past the end of the file, like a torn write would
+    {
+        FILE* file = fopen(path.string().c_str(), "r+b");
+        BOOST_REQUIRE(file);
+        fseek(file, nGood + 4, SEEK_SET);
+        unsigned char size[4];
+        WriteLE32(size, 100000);
+        fwrite(size, 1, sizeof(size), file);
+        fclose(file);
+    }
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open());
+    BOOST_CHECK(log.IsDamaged());
+    BOOST_CHECK_EQUAL(log.GetCount(), 5U);
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nGood);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_compact_and_copy)
+{
+    boost::filesystem::path path = pathDir / "wallet.dat.log";
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open());
+    // rewrite the same transactions over and over, like their confirmations do
+    const std::string strValue(1000, 'v');
+    for (int nRound = 0; nRound < 20; nRound++) {
+        for (int i = 0; i < 100; i++)
+            BOOST_CHECK(log.Write(i, strprintf("%d %d ", nRound, i) + strValue));
+    }
+    for (int i = 0; i < 100; i += 2)
+        BOOST_CHECK(log.Erase(i));
+    BOOST_CHECK(log.NeedsCompaction());
+
+    uint64_t nBefore = log.GetFileSize();
+    BOOST_CHECK(log.Compact());
+    BOOST_CHECK(!log.NeedsCompaction());
+    BOOST_CHECK(log.GetFileSize() < nBefore / 10);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), log.GetFileSize());
+    BOOST_CHECK_EQUAL(log.GetCount(), 50U);
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".new"));
+
+    // still good for writes, and for reading back after a restart
+    BOOST_CHECK(log.Write(0, std::string("zero")));
+    log.Close();
+    BOOST_CHECK(log.Open());
+    std::map<int, std::string> mapRead = LoadAll(log);
+    BOOST_CHECK_EQUAL(mapRead.size(), 51U);
+    BOOST_CHECK_EQUAL(mapRead[0], "zero");
+    BOOST_CHECK_EQUAL(mapRead[99], "19 99 " + strValue);
+
+    // a backup holds the live records only
+    boost::filesystem::path pathCopy = pathDir / "backup.dat.log";
+    BOOST_CHECK(log.CopyTo(pathCopy));
+    CWalletLog logCopy(pathCopy);
+    BOOST_CHECK(logCopy.Open());
+    BOOST_CHECK(LoadAll(logCopy) == mapRead);
+    BOOST_CHECK_EQUAL(logCopy.GetFileSize(), log.GetFileSize());
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_throughput)
+{
+    // a large wallet: 20000 transactions of about 500 bytes
+    const int nRecords = 20000;
+    const std::string strValue(500, 't');
+    boost::filesystem::path path = pathDir / "wallet.dat.log";
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(log.Open());
+        int64_t nStart = GetTimeMicros();
+        for (int i = 0; i < nRecords; i++)
+            BOOST_CHECK(log.Write(i, strValue));
+        BOOST_CHECK(log.Flush());
+        BOOST_TEST_MESSAGE(nRecords << " appends: " << (GetTimeMicros() - nStart) / 1000 << "ms");
+    }
+
+    int64_t nStart = GetTimeMicros();
+    CWalletLog log(path);
+    BOOST_CHECK(log.Open());
+    BOOST_CHECK_EQUAL(LoadAll(log).size(), (size_t)nRecords);
+    BOOST_TEST_MESSAGE("open and load of " << nRecords << " records: " << (GetTimeMicros() - nStart) / 1000 << "ms");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -385,6 +385,9 @@ struct TxMempoolInfo
 
     /** The fee delta. */
     int64_t nFeeDelta;
+
+    /** The minimum gas price among the contract outputs, 0 for non-contract transactions. */
+    CAmount nMinGasPrice;
 };
 
 /** Reason why a transaction was removed from the mempool,
@@ -8,6 +8,7 @@
 #include "wallet.h"
 
 #include "base58.h"
+#include "bloom.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
 #include "consensus/validation.h"
@@ -84,10 +85,183 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
     LOCK(cs_wallet);
     std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
     if (it == mapWallet.end())
-        return NULL;
+        return GetArchivedTx(hash);
     return &(it->second);
 }
 
+const CWalletTx* CWallet::GetArchivedTx(const uint256& hash) const
+{
+    AssertLockHeld(cs_wallet);
+    if (!fFileBacked || !mapArchived.count(hash))
+        return NULL;
+
+    std::map<uint256, ArchiveCache::iterator>::const_iterator mi = mapArchiveCache.find(hash);
+    if (mi != mapArchiveCache.end()) {
+        listArchiveCache.splice(listArchiveCache.begin(), listArchiveCache, mi->second);
+        return &mi->second->second;
+    }
+
+    CWalletTx wtx;
+    if (!CWalletDB(strWalletFile).ReadTx(hash, wtx)) {
+        LogPrintf("%s : cannot read archived transaction %s\n", __func__, hash.ToString());
+        return NULL;
+    }
+    wtx.BindWallet(const_cast<CWallet*>(this));
+    listArchiveCache.push_front(std::make_pair(hash, wtx));
+    mapArchiveCache[hash] = listArchiveCache.begin();
+    if (listArchiveCache.size() > WALLET_ARCHIVE_CACHE_SIZE) {
+        mapArchiveCache.erase(listArchiveCache.back().first);
+        listArchiveCache.pop_back();
+    }
+    return &listArchiveCache.front().second;
+}
+
+//! Whether an output of tx to us is not spent, an archived transaction with one has to come back
+bool CWallet::HasUnspentOutput(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        if (IsMine(tx.vout[i]) != ISMINE_NO && !IsSpent(tx.GetHash(), i))
+            return true;
+    }
+    return false;
+}
+
+//! Move an archived transaction back into mapWallet, as it was when archived
+bool CWallet::UnarchiveTransaction(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, CWalletTxSummary>::iterator it = mapArchived.find(hash);
+    if (it == mapArchived.end())
+        return false;
+
+    CWalletTx wtx;
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.ReadTx(hash, wtx))
+        return error("%s : cannot read archived transaction %s", __func__, hash.ToString());
+    if (!walletdb.EraseTxSummary(hash))
+        return error("%s : cannot erase the summary of %s", __func__, hash.ToString());
+
+    std::map<uint256, ArchiveCache::iterator>::iterator mi = mapArchiveCache.find(hash);
+    if (mi != mapArchiveCache.end()) {
+        listArchiveCache.erase(mi->second);
+        mapArchiveCache.erase(mi);
+    }
+    RemoveFromOrdered(it->first, it->second);
+    mapArchived.erase(it);
+
+    // what it spends is in mapTxSpends already
+    wtx.BindWallet(this);
+    CWalletTx& wtxIn = mapWallet.insert(make_pair(hash, wtx)).first->second;
+    AddToOrdered(wtxIn);
+    fUnspentDirty = true;
+    LogPrintf("%s : %s is back in the wallet\n", __func__, hash.ToString());
+    return true;
+}
+
+bool CWallet::IsArchived(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    return mapArchived.count(hash) != 0;
+}
+
+void CWallet::LoadArchived(const uint256& hash, const CWalletTxSummary& summary)
+{
+    LOCK(cs_wallet);
+    std::map<uint256, CWalletTxSummary>::iterator it = mapArchived.find(hash);
+    if (it == mapArchived.end())
+        it = mapArchived.insert(make_pair(hash, CWalletTxSummary())).first;
+    else
+        RemoveFromOrdered(it->first, it->second);
+    it->second = summary;
+    AddToOrdered(it->first, it->second);
+    // no SyncMetaData, there is no record in memory to copy metadata to or from
+    BOOST_FOREACH (const COutPoint& outpoint, summary.vSpent)
+        mapTxSpends.insert(make_pair(outpoint, hash));
+}
+
+//! What GetAmounts gives for wtx, kept once it is archived
+static void GetArchivedAmounts(const CWalletTx& wtx, const isminefilter& filter, string& strSentAccount, CWalletTxAmounts& amounts)
+{
+    list<COutputEntry> listReceived, listSent;
+    wtx.GetAmounts(listReceived, listSent, amounts.nFee, strSentAccount, filter);
+    BOOST_FOREACH (const COutputEntry& r, listReceived)
+        amounts.vReceived.push_back(wtx.vout[r.vout]);
+    BOOST_FOREACH (const COutputEntry& s, listSent)
+        amounts.nSent += s.amount;
+}
+
+unsigned int CWallet::ArchiveTransactions(int nDepth)
+{
+    LOCK2(cs_main, cs_wallet);
+    if (!fFileBacked)
+        return 0;
+
+    std::vector<uint256> vArchive;
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        if (wtx.GetDepthInMainChain() < nDepth)
+            continue;
+        // every output of ours spent by a transaction as deep, or archived already
+        bool fArchive = true;
+        for (unsigned int i = 0; i < wtx.vout.size() && fArchive; i++) {
+            if (IsMine(wtx.vout[i]) == ISMINE_NO)
+                continue;
+            fArchive = false;
+            pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(it->first, i));
+            for (TxSpends::const_iterator sit = range.first; sit != range.second && !fArchive; ++sit) {
+                std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(sit->second);
+                fArchive = mapArchived.count(sit->second) || (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= nDepth);
+            }
+        }
+        if (fArchive)
+            vArchive.push_back(it->first);
+    }
+    if (vArchive.empty())
+        return 0;
+
+    std::vector<CWalletTxSummary> vSummary;
+    vSummary.reserve(vArchive.size());
+    BOOST_FOREACH (const uint256& hash, vArchive) {
+        const CWalletTx& wtx = mapWallet[hash];
+        CWalletTxSummary summary;
+        summary.hashBlock = wtx.hashBlock;
+        summary.nOrderPos = wtx.nOrderPos;
+        BOOST_FOREACH (const CTxIn& txin, wtx.vin)
+            summary.vSpent.push_back(txin.prevout);
+        if (!wtx.IsCoinBase()) {
+            BOOST_FOREACH (const CTxOut& txout, wtx.vout)
+                if (IsMine(txout) != ISMINE_NO)
+                    summary.vMine.push_back(txout);
+        }
+        GetArchivedAmounts(wtx, ISMINE_SPENDABLE, summary.strSentAccount, summary.amountsSpendable);
+        GetArchivedAmounts(wtx, ISMINE_ALL, summary.strSentAccount, summary.amountsAll);
+        vSummary.push_back(summary);
+    }
+
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.TxnBegin())
+        return 0;
+    for (size_t i = 0; i < vArchive.size(); i++) {
+        if (!walletdb.WriteTxSummary(vArchive[i], vSummary[i])) {
+            walletdb.TxnAbort();
+            return 0;
+        }
+    }
+    if (!walletdb.TxnCommit())
+        return 0;
+
+    // the records stay where they are, what spends them stays in mapTxSpends
+    for (size_t i = 0; i < vArchive.size(); i++) {
+        RemoveFromOrdered(mapWallet[vArchive[i]]);
+        mapWallet.erase(vArchive[i]);
+        std::map<uint256, CWalletTxSummary>::iterator it = mapArchived.insert(make_pair(vArchive[i], vSummary[i])).first;
+        AddToOrdered(it->first, it->second);
+    }
+    fUnspentDirty = true;
+    return vArchive.size();
+}
+
 CPubKey CWallet::GenerateNewKey()
 {
     AssertLockHeld(cs_wallet);                                 // mapKeyMetadata
@@ -110,8 +284,11 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
+    // a key made just now cannot own any output of the wallet yet
+    bool fWasDirty = fUnspentDirty;
     if (!AddKeyPubKey(secret, pubkey))
         throw std::runtime_error("CWallet::GenerateNewKey() : AddKey failed");
+    fUnspentDirty = fWasDirty;
     return pubkey;
 }
 
@@ -126,6 +303,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey& pubkey)
     script = GetScriptForDestination(pubkey.GetID());
     if (HaveWatchOnly(script))
         RemoveWatchOnly(script);
+    fUnspentDirty = true;
 
     if (!fFileBacked)
         return true;
@@ -173,6 +351,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    fUnspentDirty = true;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript.begin(), redeemScript.end()), redeemScript);
@@ -198,6 +377,7 @@ bool CWallet::AddWatchOnly(const CScript& dest)
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
+    fUnspentDirty = true;
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
         return true;
@@ -376,6 +556,8 @@ void CWallet::SyncMetaData(pair<TxSpends::iterator, TxSpends::iterator> range)
     const CWalletTx* copyFrom = NULL;
     for (TxSpends::iterator it = range.first; it != range.second; ++it) {
         const uint256& hash = it->second;
+        if (!mapWallet.count(hash))
+            continue; // archived
         int n = mapWallet[hash].nOrderPos;
         if (n < nMinOrderPos) {
             nMinOrderPos = n;
@@ -383,8 +565,12 @@ void CWallet::SyncMetaData(pair<TxSpends::iterator, TxSpends::iterator> range)
         }
     }
     // Now copy data from copyFrom to rest:
+    if (!copyFrom)
+        return;
     for (TxSpends::iterator it = range.first; it != range.second; ++it) {
         const uint256& hash = it->second;
+        if (!mapWallet.count(hash))
+            continue;
         CWalletTx* copyTo = &mapWallet[hash];
         if (copyFrom == copyTo) continue;
         copyTo->mapValue = copyFrom->mapValue;
@@ -414,6 +600,8 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
         std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0)
             return true; // Spent
+        if (mapArchived.count(wtxid))
+            return true; // Spent deep in the chain
     }
     return false;
 }
@@ -439,6 +627,100 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+CWallet::UnspentKind CWallet::GetUnspentKind(CAmount nValue) const
+{
+    if (IsDenominatedAmount(nValue))
+        return UNSPENT_DENOMINATED;
+    if (IsCollateralAmount(nValue))
+        return UNSPENT_COLLATERAL;
+    return UNSPENT_OTHER;
+}
+
+void CWallet::AddToUnspent(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentDirty)
+        return;
+
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (wtx.vout[i].nValue > 0 && IsMine(wtx.vout[i]) != ISMINE_NO)
+            setUnspent[GetUnspentKind(wtx.vout[i].nValue)].insert(COutPoint(hash, i));
+    }
+
+    // the spends of a transaction that was disconnected or conflicted may be coins again
+    if (wtx.IsCoinBase())
+        return;
+    BOOST_FOREACH (const CTxIn& txin, wtx.vin) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi == mapWallet.end() || txin.prevout.n >= mi->second.vout.size())
+            continue;
+        const CTxOut& prevout = mi->second.vout[txin.prevout.n];
+        if (prevout.nValue > 0 && IsMine(prevout) != ISMINE_NO)
+            setUnspent[GetUnspentKind(prevout.nValue)].insert(txin.prevout);
+    }
+}
+
+void CWallet::PruneUnspent(const COutPoint& outpoint) const
+{
+    AssertLockHeld(cs_wallet);
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    if (mi == mapWallet.end()) {
+        for (int nKind = 0; nKind < UNSPENT_KINDS; nKind++)
+            setUnspent[nKind].erase(outpoint);
+        return;
+    }
+
+    // only a spend in a block is final enough, unconfirmed ones can still be conflicted
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+        map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) > 0) {
+            if (outpoint.n < mi->second.vout.size())
+                setUnspent[GetUnspentKind(mi->second.vout[outpoint.n].nValue)].erase(outpoint);
+            return;
+        }
+    }
+}
+
+/**
+ * The indexed outputs that can be of the given coin type, in mapWallet order.
+ */
+std::vector<COutPoint> CWallet::GetUnspentOutPoints(AvailableCoinsType nCoinType) const
+{
+    AssertLockHeld(cs_wallet);
+    // the denominations are only known once init has set them
+    if (fUnspentDirty || nUnspentDenominations != darkSendDenominations.size()) {
+        for (int nKind = 0; nKind < UNSPENT_KINDS; nKind++)
+            setUnspent[nKind].clear();
+        fUnspentDirty = false;
+        nUnspentDenominations = darkSendDenominations.size();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            AddToUnspent(it->second);
+        int64_t nPruned = 0;
+        for (int nKind = 0; nKind < UNSPENT_KINDS; nKind++) {
+            std::vector<COutPoint> vOutPoints(setUnspent[nKind].begin(), setUnspent[nKind].end());
+            BOOST_FOREACH (const COutPoint& outpoint, vOutPoints)
+                PruneUnspent(outpoint);
+            nPruned += vOutPoints.size() - setUnspent[nKind].size();
+        }
+        LogPrint("coinselection", "%s : indexed %d outputs, %d spent\n", __func__,
+            setUnspent[UNSPENT_DENOMINATED].size() + setUnspent[UNSPENT_COLLATERAL].size() + setUnspent[UNSPENT_OTHER].size(), nPruned);
+    }
+
+    std::vector<COutPoint> vOutPoints;
+    for (int nKind = 0; nKind < UNSPENT_KINDS; nKind++) {
+        if (nCoinType == ONLY_DENOMINATED && nKind != UNSPENT_DENOMINATED)
+            continue;
+        if ((nCoinType == ONLY_NONDENOMINATED || nCoinType == ONLY_NONDENOMINATED_NOTMN) && nKind != UNSPENT_OTHER)
+            continue;
+        size_t nMiddle = vOutPoints.size();
+        vOutPoints.insert(vOutPoints.end(), setUnspent[nKind].begin(), setUnspent[nKind].end());
+        std::inplace_merge(vOutPoints.begin(), vOutPoints.begin() + nMiddle, vOutPoints.end());
+    }
+    return vOutPoints;
+}
+
 bool CWallet::GetVinAndKeysFromOutput(COutput out, CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet)
 {
     // wait for reindex and/or import to finish
@@ -609,27 +891,91 @@ bool CWallet::GetAccountDestination(CTxDestination &dest, std::string strAccount
     return true;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+//! Height of hashBlock in the active chain, -1 outside it
+static int GetIndexedHeight(const uint256& hashBlock)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndex* pindex = mi == mapBlockIndex.end() ? NULL : mi->second;
+    return (pindex && chainActive.Contains(pindex)) ? pindex->nHeight : -1;
+}
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+void CWallet::AddToOrdered(CWalletTx& wtx)
+{
+    wtxOrdered.insert(make_pair(wtx.nOrderPos, TxEntry(&wtx, (CAccountingEntry*)0)));
+    wtx.nHeightIndexed = GetIndexedHeight(wtx.hashBlock);
+    wtxByHeight.insert(make_pair(wtx.nHeightIndexed, TxEntry(&wtx, (CAccountingEntry*)0)));
+}
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
-    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-        CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+void CWallet::RemoveFromOrdered(CWalletTx& wtx)
+{
+    pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(wtx.nOrderPos);
+    for (TxItems::iterator it = range.first; it != range.second; ++it) {
+        if (it->second.pwtx == &wtx) {
+            wtxOrdered.erase(it);
+            break;
+        }
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH (CAccountingEntry& entry, acentries) {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    pair<TxHeights::iterator, TxHeights::iterator> rangeHeight = wtxByHeight.equal_range(wtx.nHeightIndexed);
+    for (TxHeights::iterator it = rangeHeight.first; it != rangeHeight.second; ++it) {
+        if (it->second.pwtx == &wtx) {
+            wtxByHeight.erase(it);
+            break;
+        }
     }
+}
 
-    return txOrdered;
+void CWallet::AddToOrdered(const uint256& hash, CWalletTxSummary& summary)
+{
+    wtxOrdered.insert(make_pair(summary.nOrderPos, TxEntry((CWalletTx*)0, (CAccountingEntry*)0, &hash)));
+    summary.nHeightIndexed = GetIndexedHeight(summary.hashBlock);
+    wtxByHeight.insert(make_pair(summary.nHeightIndexed, TxEntry((CWalletTx*)0, (CAccountingEntry*)0, &hash)));
+}
+
+void CWallet::RemoveFromOrdered(const uint256& hash, CWalletTxSummary& summary)
+{
+    pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(summary.nOrderPos);
+    for (TxItems::iterator it = range.first; it != range.second; ++it) {
+        if (it->second.phashArchived && *it->second.phashArchived == hash) {
+            wtxOrdered.erase(it);
+            break;
+        }
+    }
+    pair<TxHeights::iterator, TxHeights::iterator> rangeHeight = wtxByHeight.equal_range(summary.nHeightIndexed);
+    for (TxHeights::iterator it = rangeHeight.first; it != rangeHeight.second; ++it) {
+        if (it->second.phashArchived && *it->second.phashArchived == hash) {
+            wtxByHeight.erase(it);
+            break;
+        }
+    }
+}
+
+void CWallet::LoadAccountingEntry(const CAccountingEntry& acentry)
+{
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxEntry((CWalletTx*)0, &entry)));
+}
+
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
+{
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
+    LOCK(cs_wallet);
+    LoadAccountingEntry(acentry);
+    return true;
+}
+
+void CWallet::RebuildOrdered()
+{
+    AssertLockHeld(cs_wallet);
+    wtxOrdered.clear();
+    wtxByHeight.clear();
+    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        AddToOrdered(it->second);
+    for (map<uint256, CWalletTxSummary>::iterator it = mapArchived.begin(); it != mapArchived.end(); ++it)
+        AddToOrdered(it->first, it->second);
+    BOOST_FOREACH (CAccountingEntry& entry, laccentries)
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxEntry((CWalletTx*)0, &entry)));
 }
 
 void CWallet::MarkDirty()
@@ -647,9 +993,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, bool fFl
     uint256 hash = wtxIn.GetHash();
 
     if (fFromLoadWallet) {
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+            RemoveFromOrdered(mi->second);
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
+        AddToUnspent(mapWallet[hash]);
+        AddToOrdered(mapWallet[hash]);
     } else {
         LOCK(cs_wallet);
         // Inserts only if not already there, returns tx inserted or tx found
@@ -669,13 +1020,12 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, bool fFl
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
-                            CWalletTx* const pwtx = (*it).second.first;
-                            if (pwtx == &wtx)
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it) {
+                            const TxEntry& entry = (*it).second;
+                            const CWalletTx* const pwtx = entry.phashArchived ? GetArchivedTx(*entry.phashArchived) : entry.pwtx;
+                            if (pwtx == &wtx || (entry.phashArchived && !pwtx))
                                 continue;
-                            CAccountingEntry* const pacentry = (*it).second.second;
+                            CAccountingEntry* const pacentry = entry.pacentry;
                             int64_t nSmartTime;
                             if (pwtx) {
                                 nSmartTime = pwtx->nTimeSmart;
@@ -704,6 +1054,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, bool fFl
 
         bool fUpdated = false;
         if (!fInsertedNew) {
+            // taken out and put back below, its block may have joined or left the chain
+            RemoveFromOrdered(wtx);
             // Merge
             if (wtxIn.hashBlock != 0 && wtxIn.hashBlock != wtx.hashBlock) {
                 wtx.hashBlock = wtxIn.hashBlock;
@@ -729,6 +1081,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, bool fFl
             }
         }
 
+        AddToUnspent(wtx);
+        AddToOrdered(wtx);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -763,6 +1118,13 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 {
     {
         AssertLockHeld(cs_wallet);
+        std::map<uint256, CWalletTxSummary>::const_iterator ait = mapArchived.find(tx.GetHash());
+        if (ait != mapArchived.end()) {
+            // still buried where it was archived, with all of its outputs to us spent
+            const bool fMoved = !pblock || pblock->GetHash() != ait->second.hashBlock;
+            if (!fUpdate || (!fMoved && !HasUnspentOutput(tx)) || !UnarchiveTransaction(tx.GetHash()))
+                return false;
+        }
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
         if (fExisted || IsMine(tx) || IsFromMe(tx)) {
@@ -786,6 +1148,11 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     // available of the outputs it spends. So force those to be
     // recomputed, also:
     BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+        if (mapArchived.count(txin.prevout.hash)) {
+            const CWalletTx* pprev = GetArchivedTx(txin.prevout.hash);
+            if (pprev && HasUnspentOutput(*pprev))
+                UnarchiveTransaction(txin.prevout.hash);
+        }
         if (mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
     }
@@ -797,8 +1164,12 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            RemoveFromOrdered(mi->second);
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -808,9 +1179,9 @@ isminetype CWallet::IsMine(const CTxIn& txin) const
 {
     {
         LOCK(cs_wallet);
-        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
-        if (mi != mapWallet.end()) {
-            const CWalletTx& prev = (*mi).second;
+        const CWalletTx* pprev = GetWalletTx(txin.prevout.hash);
+        if (pprev) {
+            const CWalletTx& prev = *pprev;
             if (txin.prevout.n < prev.vout.size())
                 return IsMine(prev.vout[txin.prevout.n]);
         }
@@ -822,9 +1193,9 @@ CAmount CWallet::GetDebit(const CTxIn& txin, const isminefilter& filter) const
 {
     {
         LOCK(cs_wallet);
-        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
-        if (mi != mapWallet.end()) {
-            const CWalletTx& prev = (*mi).second;
+        const CWalletTx* pprev = GetWalletTx(txin.prevout.hash);
+        if (pprev) {
+            const CWalletTx& prev = *pprev;
             if (txin.prevout.n < prev.vout.size())
                 if (IsMine(prev.vout[txin.prevout.n]) & filter)
                     return prev.vout[txin.prevout.n].nValue;
@@ -924,9 +1295,9 @@ bool CWallet::IsDenominated(const CTxIn& txin) const
 {
     {
         LOCK(cs_wallet);
-        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
-        if (mi != mapWallet.end()) {
-            const CWalletTx& prev = (*mi).second;
+        const CWalletTx* pprev = GetWalletTx(txin.prevout.hash);
+        if (pprev) {
+            const CWalletTx& prev = *pprev;
             if (txin.prevout.n < prev.vout.size()) return IsDenominatedAmount(prev.vout[txin.prevout.n].nValue);
         }
     }
@@ -1100,6 +1471,108 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+namespace
+{
+/**
+ * What an output must hold to possibly be the wallet's: the id of one of its keys
+ * or scripts, pushed as is or as a public key, or the whole of a watch only script.
+ * A bloom filter turns most outputs away before the exact sets are looked at.
+ */
+class CRescanFilter
+{
+private:
+    CBloomFilter bloom;
+    std::set<uint160> setIds;
+    std::set<CScript> setWatchOnly;
+
+    bool HaveId(const uint160& id) const
+    {
+        return bloom.contains(std::vector<unsigned char>(id.begin(), id.end())) && setIds.count(id);
+    }
+
+public:
+    CRescanFilter(const std::set<uint160>& setIdsIn, const std::set<CScript>& setWatchOnlyIn) :
+        bloom(std::max<size_t>(setIdsIn.size(), 1), 0.001, GetRand(std::numeric_limits<unsigned int>::max()), BLOOM_UPDATE_NONE),
+        setIds(setIdsIn), setWatchOnly(setWatchOnlyIn)
+    {
+        for (const uint160& id : setIds)
+            bloom.insert(std::vector<unsigned char>(id.begin(), id.end()));
+    }
+
+    /** False only if IsMine of the output is sure to be ISMINE_NO */
+    bool IsRelevant(const CTxOut& txout) const
+    {
+        const CScript& script = txout.scriptPubKey;
+        if (!setWatchOnly.empty() && setWatchOnly.count(script))
+            return true;
+        int nWitnessVersion;
+        std::vector<unsigned char> vchProgram;
+        if (script.IsWitnessProgram(nWitnessVersion, vchProgram) && HaveId(CScriptID(script)))
+            return true;
+        opcodetype opcode;
+        std::vector<unsigned char> vch;
+        for (CScript::const_iterator pc = script.begin(); script.GetOp(pc, opcode, vch);) {
+            if (vch.size() == 20 && HaveId(uint160(vch)))
+                return true;
+            if ((vch.size() == CPubKey::COMPRESSED_PUBLIC_KEY_SIZE || vch.size() == CPubKey::PUBLIC_KEY_SIZE) && HaveId(CPubKey(vch).GetID()))
+                return true;
+        }
+        return false;
+    }
+};
+
+/** Blocks of a rescan, read and filtered by a few threads while the wallet takes the ones before them */
+class CRescanChunk
+{
+public:
+    struct Entry {
+        CBlockIndex* pindex;
+        CDiskBlockPos pos;
+        CBlockHeader header;
+        CBlock block;
+        //! Per transaction, whether any of its outputs may be the wallet's
+        std::vector<bool> vRelevant;
+        bool fRead;
+    };
+
+    std::vector<Entry> vEntries;
+
+    CRescanChunk(std::shared_ptr<const CRescanFilter> filterIn) : filter(filterIn), nNext(0) {}
+    ~CRescanChunk() { Wait(); }
+
+    void Start(unsigned int nThreads)
+    {
+        for (unsigned int i = 0; i < std::min<size_t>(nThreads, vEntries.size()); i++)
+            threads.create_thread(boost::bind(&CRescanChunk::ThreadRead, this));
+    }
+
+    void Wait() { threads.join_all(); }
+
+private:
+    std::shared_ptr<const CRescanFilter> filter;
+    std::atomic<size_t> nNext;
+    boost::thread_group threads;
+
+    void ThreadRead()
+    {
+        RenameThread("lux-rescan");
+        for (size_t i = nNext++; i < vEntries.size(); i = nNext++) {
+            Entry& entry = vEntries[i];
+            entry.fRead = ReadIndexedBlockFromDisk(entry.block, entry.pos, entry.header);
+            entry.vRelevant.assign(entry.block.vtx.size(), false);
+            for (size_t j = 0; j < entry.block.vtx.size(); j++) {
+                for (const CTxOut& txout : entry.block.vtx[j].vout) {
+                    if (filter->IsRelevant(txout)) {
+                        entry.vRelevant[j] = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+};
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1107,40 +1580,107 @@ bool CWalletTx::WriteToDisk()
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    bool fExpected = false;
+    if (!fScanningWallet.compare_exchange_strong(fExpected, true)) {
+        LogPrintf("%s: the wallet is already being rescanned\n", __func__);
+        return -1;
+    }
+    struct ScanningReset {
+        std::atomic<bool>& fScanning;
+        ~ScanningReset() { fScanning = false; }
+    } scanningReset{fScanningWallet};
+    nScanningStartTime = GetTimeMillis();
+    dScanningProgress = 0;
+
     const CChainParams& chainParams = Params();
     int ret = 0;
     int64_t nNow = GetTime();
+    unsigned int nThreads = std::max(1U, std::min(MAX_RESCAN_THREADS, boost::thread::hardware_concurrency()));
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
-        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_main);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+    }
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+
+    // the blocks from pindexFirst on, with what the outputs are matched against, reading in the background
+    auto startChunk = [&](CBlockIndex* pindexFirst) {
+        std::set<uint160> setIds;
+        std::set<CScript> setWatch;
+        {
+            LOCK2(cs_wallet, cs_KeyStore);
+            for (const CKeyID& keyID : GetKeys())
+                setIds.insert(keyID);
+            for (const auto& script : mapScripts)
+                setIds.insert(script.first);
+            setWatch = setWatchOnly;
+        }
+        std::unique_ptr<CRescanChunk> chunk(new CRescanChunk(std::make_shared<CRescanFilter>(setIds, setWatch)));
+        {
+            LOCK(cs_main);
+            for (CBlockIndex* p = pindexFirst; p && chunk->vEntries.size() < RESCAN_CHUNK_BLOCKS; p = chainActive.Next(p)) {
+                CRescanChunk::Entry entry;
+                entry.pindex = p;
+                entry.pos = p->GetBlockPos();
+                entry.header = p->GetBlockHeader();
+                entry.fRead = false;
+                chunk->vEntries.push_back(std::move(entry));
+            }
+        }
+        chunk->Start(nThreads);
+        return chunk;
+    };
+
+    std::unique_ptr<CRescanChunk> chunk = startChunk(pindex);
+    while (!chunk->vEntries.empty()) {
+        chunk->Wait();
+        std::unique_ptr<CRescanChunk> next;
+        {
+            LOCK(cs_main);
+            CBlockIndex* pindexLast = chunk->vEntries.back().pindex;
+            pindex = chainActive.Contains(pindexLast) ? chainActive.Next(pindexLast) : chainActive.Next(chainActive.FindFork(pindexLast));
+        }
+        next = startChunk(pindex);
+
+        LOCK2(cs_main, cs_wallet);
+        for (CRescanChunk::Entry& entry : chunk->vEntries) {
+            // reorganized away while it was read, the next chunk starts from the fork
+            if (!chainActive.Contains(entry.pindex)) {
+                next.reset();
+                next = startChunk(chainActive.Next(chainActive.FindFork(entry.pindex)));
+                break;
+            }
+            if (entry.pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
+                dScanningProgress = (Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), entry.pindex, false) - dProgressStart) / (dProgressTip - dProgressStart);
+                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanningProgress * 100))));
+            }
+
+            for (size_t i = 0; i < entry.block.vtx.size(); i++) {
+                // the outputs were matched while reading, what it spends or whether it is known can only be told now
+                const CTransaction& tx = entry.block.vtx[i];
+                bool fCandidate = entry.vRelevant[i] || mapWallet.count(tx.GetHash());
+                for (size_t j = 0; j < tx.vin.size() && !fCandidate; j++)
+                    fCandidate = mapWallet.count(tx.vin[j].prevout.hash);
+                if (fCandidate && AddToWalletIfInvolvingMe(tx, &entry.block, fUpdate))
                     ret++;
             }
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                LogPrintf("Still rescanning. At block %d. Progress=%f\n", entry.pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), entry.pindex));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        chunk = std::move(next);
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1520,55 +2060,75 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+        uint256 hashLast;
+        const CWalletTx* pcoin = NULL;
+        int nDepth = 0;
+        BOOST_FOREACH (const COutPoint& outpoint, GetUnspentOutPoints(nCoinType)) {
+            const uint256& wtxid = outpoint.hash;
+            const unsigned int i = outpoint.n;
+
+            // the outputs of a transaction are next to each other, check it once for all of them
+            if (wtxid != hashLast) {
+                hashLast = wtxid;
+                pcoin = NULL;
+                map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+                if (it == mapWallet.end())
+                    continue;
+                const CWalletTx* ptx = &(*it).second;
 
-            if (!CheckFinalTx(*pcoin))
-                continue;
+                if (!CheckFinalTx(*ptx))
+                    continue;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+                if (fOnlyConfirmed && !ptx->IsTrusted())
+                    continue;
 
-            if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+                if ((ptx->IsCoinBase() || ptx->IsCoinStake()) && ptx->GetBlocksToMaturity() > 0)
+                    continue;
+
+                nDepth = ptx->GetDepthInMainChain(false);
+                // do not use IX for inputs that have less then 6 blockchain confirmations
+                if (fUseIX && nDepth < 6)
+                    continue;
 
-            const int nDepth = pcoin->GetDepthInMainChain(false);
-            // do not use IX for inputs that have less then 6 blockchain confirmations
-            if (fUseIX && nDepth < 6)
+                // We should not consider coins which aren't at least in our mempool
+                // It's possible for these to be conflicted via ancestors which we may never be able to detect
+                if (nDepth == 0 && !ptx->InMempool())
+                    continue;
+
+                pcoin = ptx;
+            }
+            if (pcoin == NULL || i >= pcoin->vout.size())
                 continue;
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
+            bool found = false;
+            if (nCoinType == ONLY_DENOMINATED) {
+                //should make this a vector
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if (nCoinType == ONLY_NONDENOMINATED || nCoinType == ONLY_NONDENOMINATED_NOTMN) {
+                // Do not use collateral or denominated amounts.
+                found = !IsCollateralAmount(pcoin->vout[i].nValue);
+                if (found) found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if (found && nCoinType == ONLY_NONDENOMINATED_NOTMN) // do not use Hot MN funds
+                    found = (pcoin->vout[i].nValue != GetMNCollateral(chainActive.Tip()->nHeight) * COIN);
+            } else {
+                found = true;
+            }
+            if (!found) continue;
+
+            if (IsSpent(wtxid, i)) {
+                PruneUnspent(outpoint);
                 continue;
+            }
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if (nCoinType == ONLY_DENOMINATED) {
-                    //should make this a vector
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if (nCoinType == ONLY_NONDENOMINATED || nCoinType == ONLY_NONDENOMINATED_NOTMN) {
-                    // Do not use collateral or denominated amounts.
-                    found = !IsCollateralAmount(pcoin->vout[i].nValue);
-                    if (found) found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if (found && nCoinType == ONLY_NONDENOMINATED_NOTMN) // do not use Hot MN funds
-                        found = (pcoin->vout[i].nValue != GetMNCollateral(chainActive.Tip()->nHeight) * COIN);
-                } else {
-                    found = true;
-                }
-                if (!found) continue;
-
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (mine && !(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i))) {
-                    COutput output(pcoin, i, nDepth, mine);
-#                   if defined(DEBUG_DUMP_STAKING_INFO)&&defined(DEBUG_DUMP_AvailableCoins_Coin)
-                    DEBUG_DUMP_AvailableCoins_Coin();
-#                   endif
-                    vCoins.push_back(output);
-                }
+            isminetype mine = IsMine(pcoin->vout[i]);
+            if (mine != ISMINE_NO &&
+                !IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue > 0 &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i))) {
+                COutput output(pcoin, i, nDepth, mine);
+#               if defined(DEBUG_DUMP_STAKING_INFO)&&defined(DEBUG_DUMP_AvailableCoins_Coin)
+                DEBUG_DUMP_AvailableCoins_Coin();
+#               endif
+                vCoins.push_back(output);
             }
         }
     }
@@ -1580,52 +2140,70 @@ void CWallet::AvailableCoinsMN(vector<COutput>& vCoins, bool fOnlyConfirmed, con
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+        uint256 hashLast;
+        const CWalletTx* pcoin = NULL;
+        int nDepth = 0;
+        BOOST_FOREACH (const COutPoint& outpoint, GetUnspentOutPoints(coin_type)) {
+            const uint256& wtxid = outpoint.hash;
+            const unsigned int i = outpoint.n;
+
+            if (wtxid != hashLast) {
+                hashLast = wtxid;
+                pcoin = NULL;
+                map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+                if (it == mapWallet.end())
+                    continue;
+                const CWalletTx* ptx = &(*it).second;
 
-            if (!IsFinalTx(*pcoin))
-                continue;
+                if (!IsFinalTx(*ptx))
+                    continue;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+                if (fOnlyConfirmed && !ptx->IsTrusted())
+                    continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+                if (ptx->IsCoinBase() && ptx->GetBlocksToMaturity() > 0)
+                    continue;
 
-            if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+                if (ptx->IsCoinStake() && ptx->GetBlocksToMaturity() > 0)
+                    continue;
 
-            const int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth <= 0) // LuxNOTE: coincontrol fix / ignore 0 confirm
-                continue;
+                nDepth = ptx->GetDepthInMainChain();
+                if (nDepth <= 0) // LuxNOTE: coincontrol fix / ignore 0 confirm
+                    continue;
 
-            // do not use IX for inputs that have less then 6 blockchain confirmations
-            if (useIX && nDepth < 6)
-                continue;
+                // do not use IX for inputs that have less then 6 blockchain confirmations
+                if (useIX && nDepth < 6)
+                    continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if(coin_type == ONLY_DENOMINATED) {
-                    //should make this a vector
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if(coin_type == ONLY_NONDENOMINATED || coin_type == ONLY_NONDENOMINATED_NOTMN) {
-                    found = true;
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if(found && coin_type == ONLY_NONDENOMINATED_NOTMN) found = (pcoin->vout[i].nValue != GetMNCollateral(chainActive.Tip()->nHeight)*COIN); // do not use MN funds
-                } else {
-                    found = true;
-                }
-                if(!found) continue;
+                pcoin = ptx;
+            }
+            if (pcoin == NULL || i >= pcoin->vout.size())
+                continue;
 
-                bool mine = IsMine(pcoin->vout[i]);
+            bool found = false;
+            if(coin_type == ONLY_DENOMINATED) {
+                //should make this a vector
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if(coin_type == ONLY_NONDENOMINATED || coin_type == ONLY_NONDENOMINATED_NOTMN) {
+                found = true;
+                if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if(found && coin_type == ONLY_NONDENOMINATED_NOTMN) found = (pcoin->vout[i].nValue != GetMNCollateral(chainActive.Tip()->nHeight)*COIN); // do not use MN funds
+            } else {
+                found = true;
+            }
+            if(!found) continue;
 
-                if (!(IsSpent(wtxid, i)) &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                    vCoins.push_back(COutput(pcoin, i, nDepth, mine));
+            if (IsSpent(wtxid, i)) {
+                PruneUnspent(outpoint);
+                continue;
             }
+
+            bool mine = IsMine(pcoin->vout[i]);
+
+            if (!IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue > 0 &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
+                vCoins.push_back(COutput(pcoin, i, nDepth, mine));
         }
     }
 }
@@ -1650,7 +2228,7 @@ map<CTxDestination, vector<COutput> > CWallet::AvailableCoinsByAddress(bool fCon
     return mapCoins;
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
 
@@ -1723,10 +2301,41 @@ bool CWallet::MintableCoins()
     return false;
 }
 
-bool CWallet::SelectCoinsMinConf(const std::string &account, const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+bool CWallet::SelectCoinsMinConf(const std::string &account, const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinSelectionParams* pParams, bool* pfChangeless) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
+    if (pfChangeless)
+        *pfChangeless = false;
+
+    if (pParams) {
+        // coins that add up to the target once their own inputs are paid for, with no change left
+        const CAmount nInputFee = pParams->feeRate.GetFee(INPUT_SIZE_P2PKH);
+        vector<CInputCoin> vPool;
+        vPool.reserve(vCoins.size());
+        BOOST_FOREACH (const COutput& output, vCoins) {
+            if (!output.fSpendable)
+                continue;
+            const CWalletTx* pcoin = output.tx;
+            if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+                continue;
+            CAmount n = pcoin->vout[output.i].nValue;
+            // leave mixed coins and those not worth their fee alone
+            if (IsDenominatedAmount(n) || n <= nInputFee)
+                continue;
+            vPool.push_back(CInputCoin(pcoin, output.i, n, nInputFee));
+        }
+
+        vector<CInputCoin> vSelected;
+        if (SelectCoinsBnB(vPool, pParams->nTargetValue, pParams->nCostOfChange, vSelected, nValueRet)) {
+            BOOST_FOREACH (const CInputCoin& coin, vSelected)
+                setCoinsRet.insert(coin.coin);
+            if (pfChangeless)
+                *pfChangeless = true;
+            LogPrint("selectcoins", "%s : %d coins for %s without change\n", __func__, vSelected.size(), FormatMoney(nValueRet));
+            return true;
+        }
+    }
 
     // List of values less than target
     pair<CAmount, pair<const CWalletTx*, unsigned int> > coinLowestLarger;
@@ -1830,8 +2439,11 @@ bool CWallet::SelectCoinsMinConf(const std::string &account, const CAmount& nTar
     return true;
 }
 
-bool CWallet::SelectCoins(const std::string &account, const CAmount& nTargetValue, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, AvailableCoinsType coin_type, bool useIX) const
+bool CWallet::SelectCoins(const std::string &account, const CAmount& nTargetValue, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, AvailableCoinsType coin_type, bool useIX, const CCoinSelectionParams* pParams, bool* pfChangeless) const
 {
+    if (pfChangeless)
+        *pfChangeless = false;
+
     // Note: this function should never be used for "always free" tx types like dstx
 
     vector<COutput> vCoins;
@@ -1892,9 +2504,9 @@ bool CWallet::SelectCoins(const std::string &account, const CAmount& nTargetValu
         return (nValueRet >= nTargetValue);
     }
 
-    return (SelectCoinsMinConf(account, nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-            SelectCoinsMinConf(account, nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-            (bSpendZeroConfChange && SelectCoinsMinConf(account, nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet)));
+    return (SelectCoinsMinConf(account, nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet, pParams, pfChangeless) ||
+            SelectCoinsMinConf(account, nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet, pParams, pfChangeless) ||
+            (bSpendZeroConfChange && SelectCoinsMinConf(account, nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet, pParams, pfChangeless)));
 }
 
 struct CompareByPriority {
@@ -2259,6 +2871,9 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, CAmount> >& vecSend,
         {
             nFeeRet = 0;
             if (nFeePay > 0) nFeeRet = nFeePay;
+            // first look for coins that need no change, each paying for its own input at this rate
+            const CFeeRate feeRate(GetMinimumFee(1000, nTxConfirmTarget, mempool));
+            bool fUseBnB = nFeePay <= 0 && coin_type != ONLY_DENOMINATED && !(coinControl && coinControl->HasSelected());
             while (true) {
                 txNew.vin.clear();
                 txNew.vout.clear();
@@ -2300,7 +2915,10 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, CAmount> >& vecSend,
                 set<pair<const CWalletTx*, unsigned int> > setCoins;
                 CAmount nValueIn = 0;
 
-                if (!SelectCoins(wtxNew.strFromAccount, nTotalValue, setCoins, nValueIn, coinControl, coin_type, useIX)) {
+                CCoinSelectionParams selectionParams(feeRate, nValue + nGasFee + feeRate.GetFee(::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION)));
+                bool fChangeless = false;
+
+                if (!SelectCoins(wtxNew.strFromAccount, nTotalValue, setCoins, nValueIn, coinControl, coin_type, useIX, fUseBnB ? &selectionParams : NULL, &fChangeless)) {
                     if (coin_type == ALL_COINS) {
                         strFailReason = _("Insufficient funds.");
                     } else if (coin_type == ONLY_NONDENOMINATED) {
@@ -2337,6 +2955,12 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, CAmount> >& vecSend,
 
                 CAmount nChange = nValueIn - nValue - nFeeRet;
 
+                // what is over the payees goes to the fee, that is what the coins were picked for
+                if (fChangeless) {
+                    nFeeRet = nValueIn - nValue;
+                    nChange = 0;
+                }
+
                 //over pay for denominated transactions
                 if (coin_type == ONLY_DENOMINATED) {
                     nFeeRet += nChange;
@@ -2474,6 +3098,8 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, CAmount> >& vecSend,
 
                 // Include more fee and try again.
                 nFeeRet = nFeeNeeded;
+                // coins without change did not cover it, the next pass picks with change
+                fUseBnB = false;
                 continue;
             }
         }
@@ -10,6 +10,7 @@
 
 #include "amount.h"
 #include "base58.h"
+#include "coinselection.h"
 #include "crypter.h"
 #include "key.h"
 #include "keystore.h"
@@ -25,6 +26,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <list>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -65,6 +67,15 @@ static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 static const bool DEFAULT_ZERO_BALANCE_ADDRESS_TOKEN = true;
 
 static const bool DEFAULT_NOT_USE_CHANGE_ADDRESS = false;
+//! Blocks a rescan reads ahead at a time, and the most threads reading them
+static const unsigned int RESCAN_CHUNK_BLOCKS = 200;
+static const unsigned int MAX_RESCAN_THREADS = 4;
+//! Default for -walletarchivedepth, 0 keeps every transaction in memory
+static const int DEFAULT_WALLET_ARCHIVE_DEPTH = 0;
+//! Least -walletarchivedepth taken, transactions that deep are not reorganized away
+static const int MIN_WALLET_ARCHIVE_DEPTH = 100;
+//! Archived transactions kept in memory once read back from disk
+static const size_t WALLET_ARCHIVE_CACHE_SIZE = 1000;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -247,6 +258,71 @@ public:
     bool IsTransactionLockTimedOut() const;
 };
 
+/** What GetAmounts gave for an archived transaction under one filter, to tally balances with */
+class CWalletTxAmounts
+{
+public:
+    //! The outputs it paid us that were not change, and what it sent and paid in fees
+    std::vector<CTxOut> vReceived;
+    CAmount nSent;
+    CAmount nFee;
+
+    CWalletTxAmounts() : nSent(0), nFee(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(vReceived);
+        READWRITE(nSent);
+        READWRITE(nFee);
+    }
+};
+
+/**
+ * What stays in memory of an archived wallet transaction: one buried deep in
+ * the chain whose outputs to us are all spent by transactions as deep. Its
+ * record stays on disk and is read back when it is asked for.
+ */
+class CWalletTxSummary
+{
+public:
+    //! Where it is in the chain and in the wallet's order, for listing it in its place
+    uint256 hashBlock;
+    int64_t nOrderPos;
+    //! What it spends, so that those outputs stay spent
+    std::vector<COutPoint> vSpent;
+    //! What the balance and received tallies count of it: its outputs to us, none
+    //! for a coinbase, the account it was sent from and its amounts by filter
+    std::vector<CTxOut> vMine;
+    std::string strSentAccount;
+    CWalletTxAmounts amountsSpendable;
+    CWalletTxAmounts amountsAll;
+    int nHeightIndexed; //! key in CWallet::wtxByHeight, not stored
+
+    CWalletTxSummary() : nOrderPos(-1), nHeightIndexed(-1) {}
+
+    const CWalletTxAmounts& GetAmounts(const isminefilter& filter) const
+    {
+        return (filter & ISMINE_WATCH_ONLY) ? amountsAll : amountsSpendable;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(nOrderPos);
+        READWRITE(vSpent);
+        READWRITE(vMine);
+        READWRITE(strSentAccount);
+        READWRITE(amountsSpendable);
+        READWRITE(amountsAll);
+    }
+};
+
 /**
 * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
 * and provides the ability to create new transactions.
@@ -270,7 +346,7 @@ class CWallet : public CCryptoKeyStore, public CValidationInterface
     * all coins from coinControl are selected; Never select unconfirmed coins
     * if they are not ours
     */
-    bool SelectCoins(const std::string &account, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl = NULL, AvailableCoinsType coin_type = ALL_COINS, bool useIX = true) const;
+    bool SelectCoins(const std::string &account, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl = NULL, AvailableCoinsType coin_type = ALL_COINS, bool useIX = true, const CCoinSelectionParams* pParams = NULL, bool* pfChangeless = NULL) const;
 
     /**
      * Used to keep track of spent outpoints, and
@@ -284,6 +360,41 @@ class CWallet : public CCryptoKeyStore, public CValidationInterface
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Outputs of wallet transactions that are ours and not spent by a transaction
+     * in the chain, by the kind of amount they hold, so that AvailableCoins walks
+     * the coins left to spend instead of the whole history. Entries are checked
+     * again when read. A reorg that undoes a spend goes through AddToWallet with
+     * the spending transaction, which puts its inputs back. Rebuilt from
+     * mapWallet when keys or scripts are added.
+     */
+    enum UnspentKind { UNSPENT_DENOMINATED, UNSPENT_COLLATERAL, UNSPENT_OTHER, UNSPENT_KINDS };
+    mutable std::set<COutPoint> setUnspent[UNSPENT_KINDS];
+    mutable std::atomic<bool> fUnspentDirty;
+    mutable size_t nUnspentDenominations;
+    UnspentKind GetUnspentKind(CAmount nValue) const;
+    void AddToUnspent(const CWalletTx& wtx) const;
+    void PruneUnspent(const COutPoint& outpoint) const;
+    std::vector<COutPoint> GetUnspentOutPoints(AvailableCoinsType nCoinType) const;
+
+    /**
+     * Transactions moved out of mapWallet by ArchiveTransactions, and the last
+     * of them read back from disk, most recently used at the front of the list.
+     */
+    std::map<uint256, CWalletTxSummary> mapArchived;
+    typedef std::list<std::pair<uint256, CWalletTx> > ArchiveCache;
+    mutable ArchiveCache listArchiveCache;
+    mutable std::map<uint256, ArchiveCache::iterator> mapArchiveCache;
+    const CWalletTx* GetArchivedTx(const uint256& hash) const;
+    bool HasUnspentOutput(const CTransaction& tx) const;
+    bool UnarchiveTransaction(const uint256& hash);
+
+    void AddToOrdered(CWalletTx& wtx);
+    void RemoveFromOrdered(CWalletTx& wtx);
+    //! The same for an archived transaction, hash has to be its key in mapArchived
+    void AddToOrdered(const uint256& hash, CWalletTxSummary& summary);
+    void RemoveFromOrdered(const uint256& hash, CWalletTxSummary& summary);
+
 public:
     bool MintableCoins();
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const;
@@ -361,6 +472,11 @@ public:
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        fScanningWallet = false;
+        nScanningStartTime = 0;
+        dScanningProgress = 0;
+        fUnspentDirty = true;
+        nUnspentDenominations = 0;
         fWalletUnlockAnonymizeOnly = false;
 
         //MultiSend
@@ -403,12 +519,30 @@ public:
 
     int64_t nTimeFirstKey;
 
+    //! Set while ScanForWalletTransactions runs, with when it started and how far it got
+    std::atomic<bool> fScanningWallet;
+    std::atomic<int64_t> nScanningStartTime;
+    std::atomic<double> dScanningProgress;
+
     std::map<uint256, CTokenInfo> mapToken;
 
     std::map<uint256, CTokenTx> mapTokenTx;
 
+    /**
+     * A transaction of the wallet, archived ones included. The pointer to an
+     * archived one is good until WALLET_ARCHIVE_CACHE_SIZE others are read.
+     */
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
+    bool IsArchived(const uint256& hash) const;
+    const std::map<uint256, CWalletTxSummary>& GetArchived() const { return mapArchived; }
+    void LoadArchived(const uint256& hash, const CWalletTxSummary& summary);
+    /**
+     * Move the transactions at least nDepth deep whose outputs to us are spent
+     * by transactions as deep out of mapWallet, returns how many.
+     */
+    unsigned int ArchiveTransactions(int nDepth);
+
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf)
     {
@@ -419,7 +553,12 @@ public:
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed = true, const CCoinControl* coinControl = NULL, bool fIncludeZeroValue = false, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false) const;
     void AvailableCoinsMN(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = false) const;
     std::map<CTxDestination, std::vector<COutput> > AvailableCoinsByAddress(bool fConfirmed = true, CAmount maxCoinValue = 0);
-    bool SelectCoinsMinConf(const std::string &account, const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    /**
+     * Select coins of at least nTargetValue among those with enough confirmations.
+     * With pParams, first look for coins that need no change output at the fee
+     * rate given (see SelectCoinsBnB); *pfChangeless tells whether they were found.
+     */
+    bool SelectCoinsMinConf(const std::string &account, const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinSelectionParams* pParams = NULL, bool* pfChangeless = NULL) const;
 
     /// Get 1000DASH output and keys which can be used for the Masternode
     bool GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, std::string strTxHash = "", std::string strOutputIndex = "");
@@ -498,21 +637,45 @@ public:
     int64_t IncOrderPosNext(CWalletDB* pwalletdb = NULL);
     bool GetAccountDestination(CTxDestination &dest, std::string strAccount, bool bForceNew = false);
 
-    typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
-    typedef std::multimap<int64_t, TxPair> TxItems;
+    //! One of a transaction in mapWallet, an accounting entry or an archived transaction
+    struct TxEntry {
+        CWalletTx* pwtx;
+        CAccountingEntry* pacentry;
+        const uint256* phashArchived; //! key in mapArchived, read back with GetWalletTx
+
+        TxEntry(CWalletTx* pwtxIn, CAccountingEntry* pacentryIn, const uint256* phashArchivedIn = NULL)
+            : pwtx(pwtxIn), pacentry(pacentryIn), phashArchived(phashArchivedIn) {}
+    };
+    typedef std::multimap<int64_t, TxEntry> TxItems;
+    typedef std::multimap<int, TxEntry> TxHeights;
 
     /**
-     * Get the wallet's activity log
-     * @return multimap of ordered transactions and accounting entries
-     * @warning Returned pointers are *only* valid within the scope of passed acentries
+     * The wallet's activity log, transactions and accounting entries by nOrderPos,
+     * and its transactions by the height of their block in the active chain, -1
+     * for the ones outside it. Archived transactions keep their place in both.
+     * Kept up to date as transactions are added, so that listtransactions reads
+     * a page from the end and listsinceblock only the blocks after the one asked for.
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    TxItems wtxOrdered;
+    TxHeights wtxByHeight;
+    std::list<CAccountingEntry> laccentries;
+
+    void LoadAccountingEntry(const CAccountingEntry& acentry);
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
+    //! Index everything again, once nOrderPos changed
+    void RebuildOrdered();
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false, bool fFlushOnClose=true);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
+    /**
+     * Add the transactions of the active chain from pindexStart on that involve the wallet,
+     * returns how many, or -1 if another scan is running. Blocks are read and their outputs
+     * matched against the wallet keys by a few threads ahead of the wallet, which only
+     * locks cs_main and cs_wallet to take each chunk of blocks.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
@@ -827,6 +990,7 @@ public:
     int64_t nOrderPos; //! position in ordered transaction list
 
     // memory only
+    int nHeightIndexed; //! key in CWallet::wtxByHeight, -1 while not in the active chain
     mutable bool fDebitCached;
     mutable bool fCreditCached;
     mutable bool fImmatureCreditCached;
@@ -886,6 +1050,7 @@ public:
         nTimeSmart = 0;
         fFromMe = false;
         strFromAccount.clear();
+        nHeightIndexed = -1;
         fDebitCached = false;
         fCreditCached = false;
         fImmatureCreditCached = false;
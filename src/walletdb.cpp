@@ -15,12 +15,14 @@
 #include "util.h"
 #include "utiltime.h"
 #include "wallet.h"
+#include "walletlog.h"
 #include "stake.h"
 #include "main.h"
 #include <atomic>
 
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
@@ -31,6 +33,70 @@ using namespace std;
 static std::atomic<unsigned int> nWalletDBUpdateCounter;
 static uint64_t nAccountingEntryNumber = 0;
 
+//
+// Wallet logs: the transactions of a wallet file kept next to it (-walletlog)
+//
+
+static CCriticalSection cs_walletlogs;
+//! The open log of each wallet file, or NULL for the ones without
+static map<string, boost::shared_ptr<CWalletLog> > mapWalletLogs;
+
+CWalletLog* GetWalletLog(const string& strFile)
+{
+    LOCK(cs_walletlogs);
+    map<string, boost::shared_ptr<CWalletLog> >::iterator it = mapWalletLogs.find(strFile);
+    if (it != mapWalletLogs.end())
+        return it->second.get();
+
+    // a log left from an earlier run is read even without -walletlog, LoadWallet moves it back
+    boost::shared_ptr<CWalletLog> plog;
+    filesystem::path path = GetDataDir() / (strFile + ".log");
+    if (!bitdb.IsMock() && (GetBoolArg("-walletlog", DEFAULT_WALLETLOG) || filesystem::exists(path))) {
+        plog.reset(new CWalletLog(path));
+        if (!plog->Open()) {
+            LogPrintf("%s : cannot open %s, keeping transactions in %s\n", __func__, path.string(), strFile);
+            plog.reset();
+        }
+    }
+    mapWalletLogs[strFile] = plog;
+    return plog.get();
+}
+
+//! A log that is on disk but could not be opened: its transactions are not in the wallet file
+static bool IsWalletLogUnreadable(const string& strFile, const CWalletLog* plog)
+{
+    return !plog && !bitdb.IsMock() && filesystem::exists(GetDataDir() / (strFile + ".log"));
+}
+
+static void RemoveWalletLog(const string& strFile)
+{
+    LOCK(cs_walletlogs);
+    map<string, boost::shared_ptr<CWalletLog> >::iterator it = mapWalletLogs.find(strFile);
+    if (it == mapWalletLogs.end() || !it->second)
+        return;
+    filesystem::path path = it->second->GetPath();
+    it->second->Close();
+    it->second.reset();
+    filesystem::remove(path);
+}
+
+void FlushWalletLog(const string& strFile, bool fShutdown)
+{
+    CWalletLog* plog;
+    {
+        LOCK(cs_walletlogs);
+        map<string, boost::shared_ptr<CWalletLog> >::iterator it = mapWalletLogs.find(strFile);
+        if (it == mapWalletLogs.end() || !it->second)
+            return;
+        plog = it->second.get();
+    }
+    if (!fShutdown && plog->NeedsCompaction())
+        plog->Compact();
+    plog->Flush();
+    if (fShutdown)
+        plog->Close();
+}
+
 //
 // CWalletDB
 //
@@ -61,18 +127,44 @@ bool CWalletDB::ErasePurpose(const string& strPurpose)
     return Erase(make_pair(string("purpose"), strPurpose));
 }
 
+bool CWalletDB::ReadTx(uint256 hash, CWalletTx& wtx)
+{
+    CWalletLog* plog = GetWalletLog(strFile);
+    if (plog && plog->Read(std::make_pair(std::string("tx"), hash), wtx))
+        return true;
+    return Read(std::make_pair(std::string("tx"), hash), wtx);
+}
+
 bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
 {
     nWalletDBUpdated++;
+    CWalletLog* plog = GetWalletLog(strFile);
+    if (plog)
+        return plog->Write(std::make_pair(std::string("tx"), hash), wtx);
     return Write(std::make_pair(std::string("tx"), hash), wtx);
 }
 
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdated++;
+    CWalletLog* plog = GetWalletLog(strFile);
+    if (plog && !plog->Erase(std::make_pair(std::string("tx"), hash)))
+        return false;
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteTxSummary(uint256 hash, const CWalletTxSummary& summary)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("txsum"), hash), summary);
+}
+
+bool CWalletDB::EraseTxSummary(uint256 hash)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("txsum"), hash));
+}
+
 bool CWalletDB::WriteLuxNodeConfig(std::string sAlias, const CLuxNodeConfig& nodeConfig)
 {
     nWalletDBUpdated++;
@@ -403,6 +495,11 @@ DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
     }
     WriteOrderPosNext(nOrderPosNext);
 
+    // the entries in memory still have their old order
+    pwallet->laccentries.clear();
+    ListAccountCreditDebit("*", pwallet->laccentries);
+    pwallet->RebuildOrdered();
+
     return DB_LOAD_OK;
 }
 
@@ -441,6 +538,8 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    vector<uint256> vTxInDb;
+    vector<uint256> vTxInLog;
 
     CWalletScanState()
     {
@@ -451,6 +550,80 @@ public:
     }
 };
 
+template <typename Stream>
+static bool ReadWalletTx(CWallet* pwallet, const uint256& hash, Stream& ssValue, CWalletScanState& wss, string& strErr)
+{
+    CWalletTx wtx;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
+        if (!ssValue.empty()) {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        } else {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        wss.vWalletUpgrade.push_back(hash);
+    }
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true);
+    return true;
+}
+
+static bool ReadLogRecord(CWallet* pwallet, CWalletScanState& wss, bool& fNoncriticalErrors, CLogRecordReader& key, CLogRecordReader& value)
+{
+    string strErr;
+    try {
+        string strType;
+        key >> strType;
+        if (strType == "tx") {
+            uint256 hash;
+            key >> hash;
+            if (pwallet->IsArchived(hash) || ReadWalletTx(pwallet, hash, value, wss, strErr))
+                wss.vTxInLog.push_back(hash);
+            else {
+                fNoncriticalErrors = true;
+                SoftSetBoolArg("-rescan", true);
+            }
+        }
+    } catch (...) {
+        // same as a bad transaction record in the database
+        fNoncriticalErrors = true;
+        SoftSetBoolArg("-rescan", true);
+    }
+    if (!strErr.empty())
+        LogPrintf("%s\n", strErr);
+    return true;
+}
+
+static bool FindLogTx(vector<uint256>& vTxHash, vector<CWalletTx>& vWtx, CLogRecordReader& key, CLogRecordReader& value)
+{
+    string strType;
+    key >> strType;
+    if (strType == "tx") {
+        uint256 hash;
+        key >> hash;
+        CWalletTx wtx;
+        value >> wtx;
+
+        vTxHash.push_back(hash);
+        vWtx.push_back(wtx);
+    }
+    return true;
+}
+
 bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CWalletScanState& wss, string& strType, string& strErr)
 {
     try {
@@ -469,32 +642,10 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
         } else if (strType == "tx") {
             uint256 hash;
             ssKey >> hash;
-            CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            // only the summary of an archived one is kept in memory
+            if (!pwallet->IsArchived(hash) && !ReadWalletTx(pwallet, hash, ssValue, wss, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
-                if (!ssValue.empty()) {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                        wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                } else {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true);
+            wss.vTxInDb.push_back(hash);
         } else if (strType == "acentry") {
             string strAccount;
             ssKey >> strAccount;
@@ -503,12 +654,13 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             if (nNumber > nAccountingEntryNumber)
                 nAccountingEntryNumber = nNumber;
 
-            if (!wss.fAnyUnordered) {
-                CAccountingEntry acentry;
-                ssValue >> acentry;
-                if (acentry.nOrderPos == -1)
-                    wss.fAnyUnordered = true;
-            }
+            CAccountingEntry acentry;
+            ssValue >> acentry;
+            acentry.strAccount = strAccount;
+            acentry.nEntryNo = nNumber;
+            if (acentry.nOrderPos == -1)
+                wss.fAnyUnordered = true;
+            pwallet->LoadAccountingEntry(acentry);
         } else if (strType == "watchs") {
             CScript script;
             ssKey >> script;
@@ -751,6 +903,38 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // The summaries of archived transactions come first, so that their records are skipped
+        unsigned int fFlags = DB_SET_RANGE;
+        while (true) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            if (fFlags == DB_SET_RANGE)
+                ssKey << std::string("txsum");
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+            fFlags = DB_NEXT;
+            if (ret == DB_NOTFOUND)
+                break;
+            else if (ret != 0) {
+                LogPrintf("Error reading next record from wallet database\n");
+                return DB_CORRUPT;
+            }
+            string strType;
+            ssKey >> strType;
+            if (strType != "txsum")
+                break;
+            uint256 hash;
+            CWalletTxSummary summary;
+            ssKey >> hash;
+            ssValue >> summary;
+            pwallet->LoadArchived(hash, summary);
+        }
+        pcursor->close();
+        pcursor = GetCursor();
+        if (!pcursor) {
+            LogPrintf("Error getting wallet database cursor\n");
+            return DB_CORRUPT;
+        }
+
         while (true) {
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -782,6 +966,21 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        CWalletLog* plog = GetWalletLog(strFile);
+        if (IsWalletLogUnreadable(strFile, plog)) {
+            LogPrintf("Error opening wallet log of %s\n", strFile);
+            return DB_CORRUPT;
+        }
+        if (plog && !plog->Load(boost::bind(ReadLogRecord, pwallet, boost::ref(wss), boost::ref(fNoncriticalErrors), _1, _2))) {
+            LogPrintf("Error reading wallet log %s\n", plog->GetPath().string());
+            return DB_CORRUPT;
+        }
+        if (plog && plog->IsDamaged()) {
+            // the transactions after the damage are gone from the log, find them in the chain again
+            fNoncriticalErrors = true;
+            SoftSetBoolArg("-rescan", true);
+        }
     } catch (boost::thread_interrupted) {
         throw;
     } catch (...) {
@@ -805,6 +1004,32 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if ((wss.nKeys + wss.nCKeys) != wss.nKeyMeta)
         pwallet->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
+    // Move the transactions to where -walletlog says they are kept
+    CWalletLog* plog = GetWalletLog(strFile);
+    if (plog && GetBoolArg("-walletlog", DEFAULT_WALLETLOG) && !wss.vTxInDb.empty()) {
+        BOOST_FOREACH (const uint256& hash, wss.vTxInDb) {
+            const CWalletTx* pwtx = pwallet->GetWalletTx(hash);
+            if (!pwtx || !plog->Write(std::make_pair(std::string("tx"), hash), *pwtx))
+                return DB_LOAD_FAIL;
+        }
+        if (!plog->Flush() || !TxnBegin())
+            return DB_LOAD_FAIL;
+        BOOST_FOREACH (const uint256& hash, wss.vTxInDb)
+            Erase(std::make_pair(std::string("tx"), hash));
+        if (!TxnCommit())
+            return DB_LOAD_FAIL;
+        LogPrintf("Moved %u transactions from %s to %s\n", wss.vTxInDb.size(), strFile, plog->GetPath().string());
+    } else if (plog && !GetBoolArg("-walletlog", DEFAULT_WALLETLOG)) {
+        // archived ones are read back from the log, so no transaction around these writes
+        BOOST_FOREACH (const uint256& hash, wss.vTxInLog) {
+            const CWalletTx* pwtx = pwallet->GetWalletTx(hash);
+            if (!pwtx || !Write(std::make_pair(std::string("tx"), hash), *pwtx))
+                return DB_LOAD_FAIL;
+        }
+        LogPrintf("Moved %u transactions from %s back to %s\n", wss.vTxInLog.size(), plog->GetPath().string(), strFile);
+        RemoveWalletLog(strFile);
+    }
+
     BOOST_FOREACH (uint256 hash, wss.vWalletUpgrade)
         WriteTx(hash, pwallet->mapWallet[hash]);
 
@@ -869,6 +1094,12 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
             }
         }
         pcursor->close();
+
+        CWalletLog* plog = GetWalletLog(strFile);
+        if (IsWalletLogUnreadable(strFile, plog))
+            return DB_CORRUPT;
+        if (plog && !plog->Load(boost::bind(FindLogTx, boost::ref(vTxHash), boost::ref(vWtx), _1, _2)))
+            return DB_CORRUPT;
     } catch (boost::thread_interrupted) {
         throw;
     } catch (...) {
@@ -889,9 +1120,9 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
     if (err != DB_LOAD_OK)
         return err;
 
-    // erase each wallet TX
+    // erase each wallet TX, and what is left of the archived ones
     BOOST_FOREACH (uint256& hash, vTxHash) {
-        if (!EraseTx(hash))
+        if (!EraseTx(hash) || !EraseTxSummary(hash))
             return DB_CORRUPT;
     }
 
@@ -922,6 +1153,9 @@ void ThreadFlushWalletDB(const string& strFile)
         }
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2) {
+            // the log takes no part in the database environment, it is flushed even while wallet.dat is in use
+            FlushWalletLog(strFile, false);
+
             TRY_LOCK(bitdb.cs_db, lockDb);
             if (lockDb) {
                 // Don't do this if any databases are in use
@@ -981,6 +1215,13 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
                     dst << src.rdbuf();
 #endif
                     LogPrintf("copied wallet.dat to %s\n", pathDest.string());
+
+                    // and the transactions kept out of it
+                    CWalletLog* plog = GetWalletLog(wallet.strWalletFile);
+                    if (plog && !plog->CopyTo(pathDest.string() + ".log")) {
+                        LogPrintf("error copying %s to %s.log\n", plog->GetPath().string(), pathDest.string());
+                        return false;
+                    }
                     return true;
                 } catch (const filesystem::filesystem_error& e) {
                     LogPrintf("error copying wallet.dat to %s - %s\n", pathDest.string(), e.what());
@@ -27,6 +27,7 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class CWalletTxSummary;
 class CTokenInfo;
 class CTokenTx;
 class uint160;
@@ -118,9 +119,13 @@ public:
     bool WritePurpose(const std::string& strAddress, const std::string& purpose);
     bool ErasePurpose(const std::string& strAddress);
 
+    bool ReadTx(uint256 hash, CWalletTx& wtx);
     bool WriteTx(uint256 hash, const CWalletTx& wtx);
     bool EraseTx(uint256 hash);
 
+    bool WriteTxSummary(uint256 hash, const CWalletTxSummary& summary);
+    bool EraseTxSummary(uint256 hash);
+
     bool WriteToken(const CTokenInfo& wtoken);
     bool EraseToken(uint256 hash);
 
@@ -196,6 +201,12 @@ private:
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
 
+class CWalletLog;
+/** The log that keeps the transactions of strFile with -walletlog, or NULL */
+CWalletLog* GetWalletLog(const std::string& strFile);
+/** Get the log of strFile to disk, compacting it if it is due, and close it on shutdown */
+void FlushWalletLog(const std::string& strFile, bool fShutdown);
+
 void MaybeFlushWalletDB();
 
 void ThreadFlushWalletDB(const std::string& strFile);
@@ -0,0 +1,446 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "walletlog.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace
+{
+const char LOG_MAGIC[8] = {'L', 'U', 'X', 'W', 'L', 'O', 'G', '1'};
+const size_t HEADER_SIZE = 12;
+const uint32_t ERASED = 0xFFFFFFFF;
+const uint32_t MAX_KEY_SIZE = 1 << 16;
+const uint32_t MAX_VALUE_SIZE = 1 << 28;
+//! Logs smaller than this are not worth compacting
+const uint64_t MIN_COMPACT_SIZE = 1 << 20;
+
+/** Record header: key size, value size (ERASED for a tombstone) and a checksum of all of it */
+void MakeHeader(unsigned char header[HEADER_SIZE], const char* pKey, uint32_t nKeySize, const char* pValue, uint32_t nValueSize)
+{
+    WriteLE32(header, nKeySize);
+    WriteLE32(header + 4, nValueSize);
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256 hasher;
+    hasher.Write(header, 8).Write((const unsigned char*)pKey, nKeySize);
+    if (nValueSize != ERASED)
+        hasher.Write((const unsigned char*)pValue, nValueSize);
+    hasher.Finalize(hash);
+    memcpy(header + 8, hash, 4);
+}
+
+/**
+ * Whether a whole record with a matching checksum starts anywhere from nPos on.
+ * Tries every offset, which only a log that already failed to read pays for.
+ */
+bool HasRecordFrom(const char* pBase, uint64_t nPos, uint64_t nSize)
+{
+    for (; nPos + HEADER_SIZE <= nSize; nPos++) {
+        const unsigned char* pHeader = (const unsigned char*)pBase + nPos;
+        uint32_t nKeySize = ReadLE32(pHeader);
+        uint32_t nValueSize = ReadLE32(pHeader + 4);
+        bool fErase = nValueSize == ERASED;
+        if (nKeySize == 0 || nKeySize > MAX_KEY_SIZE || (!fErase && nValueSize > MAX_VALUE_SIZE))
+            continue;
+        if (nPos + HEADER_SIZE + nKeySize + (fErase ? 0 : nValueSize) > nSize)
+            continue;
+        const char* pKey = pBase + nPos + HEADER_SIZE;
+        unsigned char header[HEADER_SIZE];
+        MakeHeader(header, pKey, nKeySize, pKey + nKeySize, nValueSize);
+        if (memcmp(header, pHeader, HEADER_SIZE) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool IsZero(const char* p, uint64_t nSize)
+{
+    for (uint64_t i = 0; i < nSize; i++) {
+        if (p[i])
+            return false;
+    }
+    return true;
+}
+
+bool WriteAll(FILE* file, const void* p, size_t nSize)
+{
+    return nSize == 0 || fwrite(p, 1, nSize, file) == nSize;
+}
+
+struct CompareOrder {
+    bool operator()(const std::pair<const std::vector<char>*, uint64_t>& a, const std::pair<const std::vector<char>*, uint64_t>& b) const
+    {
+        return a.second < b.second;
+    }
+};
+}
+
+CWalletLog::CWalletLog(const boost::filesystem::path& pathIn)
+    : path(pathIn), file(NULL), nFileSize(0), nLiveBytes(0), nNextOrder(0), fDirty(false), fDamaged(false)
+{
+}
+
+CWalletLog::~CWalletLog()
+{
+    Close();
+}
+
+bool CWalletLog::Open()
+{
+    LOCK(cs);
+    if (file)
+        return true;
+    mapLive.clear();
+    nLiveBytes = 0;
+    nNextOrder = 0;
+    fDirty = false;
+    fDamaged = false;
+
+    uint64_t nValid = 0;
+    if (boost::filesystem::exists(path) && boost::filesystem::file_size(path) > 0) {
+        try {
+            boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+            boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+            const char* pBase = (const char*)region.get_address();
+            const uint64_t nSize = region.get_size();
+            if (nSize < sizeof(LOG_MAGIC) || memcmp(pBase, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0)
+                return error("%s : %s is not a wallet log", __func__, path.string());
+
+            // a write torn by a crash is a record cut short or not matching its checksum at the very end
+            uint64_t nPos = sizeof(LOG_MAGIC);
+            bool fTorn = true;
+            while (nPos + HEADER_SIZE <= nSize) {
+                const unsigned char* pHeader = (const unsigned char*)pBase + nPos;
+                uint32_t nKeySize = ReadLE32(pHeader);
+                uint32_t nValueSize = ReadLE32(pHeader + 4);
+                bool fErase = nValueSize == ERASED;
+                uint64_t nRecordSize = HEADER_SIZE + nKeySize + (fErase ? 0 : nValueSize);
+                if (nKeySize > MAX_KEY_SIZE || (!fErase && nValueSize > MAX_VALUE_SIZE)) {
+                    fTorn = false;
+                    break;
+                }
+                if (nPos + nRecordSize > nSize) {
+                    // a length damaged in the middle can point past the end as well, good records follow it then
+                    fTorn = !HasRecordFrom(pBase, nPos + 1, nSize);
+                    break;
+                }
+                const char* pKey = pBase + nPos + HEADER_SIZE;
+                unsigned char header[HEADER_SIZE];
+                MakeHeader(header, pKey, nKeySize, pKey + nKeySize, nValueSize);
+                if (memcmp(header, pHeader, HEADER_SIZE) != 0) {
+                    fTorn = nPos + nRecordSize == nSize;
+                    break;
+                }
+
+                std::vector<char> vchKey(pKey, pKey + nKeySize);
+                std::map<std::vector<char>, Record>::iterator it = mapLive.find(vchKey);
+                if (it != mapLive.end()) {
+                    nLiveBytes -= HEADER_SIZE + nKeySize + it->second.nSize;
+                    mapLive.erase(it);
+                }
+                if (!fErase) {
+                    Record record;
+                    record.nPos = nPos + HEADER_SIZE + nKeySize;
+                    record.nSize = nValueSize;
+                    record.nOrder = nNextOrder++;
+                    mapLive.insert(std::make_pair(vchKey, record));
+                    nLiveBytes += nRecordSize;
+                }
+                nPos += nRecordSize;
+            }
+            nValid = nPos;
+            if (nValid < nSize && (fTorn || IsZero(pBase + nValid, nSize - nValid))) {
+                LogPrintf("%s : dropping %u bytes of an unfinished write at the end of %s\n", __func__, nSize - nValid, path.string());
+            } else if (nValid < nSize) {
+                // the records after damage inside the file cannot be found again, the file is kept as it is for recovery
+                boost::filesystem::path pathCopy = path.string() + strprintf(".%d.bad", GetTime());
+                boost::filesystem::copy_file(path, pathCopy);
+                LogPrintf("%s : %s is damaged at byte %u of %u, kept it as %s and dropped the records from there\n",
+                    __func__, path.string(), nValid, nSize, pathCopy.string());
+                fDamaged = true;
+            }
+        } catch (const boost::interprocess::interprocess_exception& e) {
+            return error("%s : cannot map %s: %s", __func__, path.string(), e.what());
+        } catch (const boost::filesystem::filesystem_error& e) {
+            return error("%s : cannot keep a copy of the damaged %s: %s", __func__, path.string(), e.what());
+        }
+    }
+
+    try {
+        if (nValid == 0) {
+            FILE* fileNew = fopen(path.string().c_str(), "wb");
+            if (!fileNew)
+                return error("%s : cannot create %s", __func__, path.string());
+            bool fWritten = WriteAll(fileNew, LOG_MAGIC, sizeof(LOG_MAGIC));
+            FileCommit(fileNew);
+            fclose(fileNew);
+            if (!fWritten)
+                return error("%s : cannot write %s", __func__, path.string());
+            nValid = sizeof(LOG_MAGIC);
+        } else if (nValid < boost::filesystem::file_size(path)) {
+            boost::filesystem::resize_file(path, nValid);
+        }
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("%s : %s", __func__, e.what());
+    }
+
+    file = fopen(path.string().c_str(), "ab");
+    if (!file)
+        return error("%s : cannot open %s", __func__, path.string());
+    nFileSize = nValid;
+    return true;
+}
+
+void CWalletLog::Close()
+{
+    LOCK(cs);
+    if (!file)
+        return;
+    FileCommit(file);
+    fclose(file);
+    file = NULL;
+    fDirty = false;
+}
+
+bool CWalletLog::Load(const LoadFunction& fn)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (mapLive.empty())
+        return true;
+    fflush(file);
+
+    std::vector<std::pair<const std::vector<char>*, uint64_t> > vOrder;
+    vOrder.reserve(mapLive.size());
+    for (std::map<std::vector<char>, Record>::const_iterator it = mapLive.begin(); it != mapLive.end(); ++it)
+        vOrder.push_back(std::make_pair(&it->first, it->second.nOrder));
+    std::sort(vOrder.begin(), vOrder.end(), CompareOrder());
+
+    try {
+        boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+        const char* pBase = (const char*)region.get_address();
+        for (size_t i = 0; i < vOrder.size(); i++) {
+            const std::vector<char>& vchKey = *vOrder[i].first;
+            const Record& record = mapLive[vchKey];
+            CLogRecordReader key(vchKey.data(), vchKey.data() + vchKey.size(), SER_DISK, CLIENT_VERSION);
+            CLogRecordReader value(pBase + record.nPos, pBase + record.nPos + record.nSize, SER_DISK, CLIENT_VERSION);
+            if (!fn(key, value))
+                return false;
+        }
+    } catch (const boost::interprocess::interprocess_exception& e) {
+        return error("%s : cannot map %s: %s", __func__, path.string(), e.what());
+    }
+    return true;
+}
+
+bool CWalletLog::ReadValue(const std::vector<char>& vchKey, CDataStream& ssValue)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    std::map<std::vector<char>, Record>::const_iterator it = mapLive.find(vchKey);
+    if (it == mapLive.end())
+        return false;
+    fflush(file);
+
+    FILE* fileIn = fopen(path.string().c_str(), "rb");
+    if (!fileIn)
+        return error("%s : cannot open %s", __func__, path.string());
+    ssValue.resize(it->second.nSize);
+    bool fRead = fseek(fileIn, it->second.nPos, SEEK_SET) == 0 &&
+                 (it->second.nSize == 0 || fread(&ssValue[0], 1, it->second.nSize, fileIn) == it->second.nSize);
+    fclose(fileIn);
+    if (!fRead)
+        return error("%s : cannot read %s", __func__, path.string());
+    return true;
+}
+
+bool CWalletLog::Append(const std::vector<char>& vchKey, const char* pValue, size_t nValueSize, bool fErase)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (vchKey.size() > MAX_KEY_SIZE || nValueSize > MAX_VALUE_SIZE)
+        return error("%s : record too large", __func__);
+
+    std::map<std::vector<char>, Record>::iterator it = mapLive.find(vchKey);
+    if (fErase && it == mapLive.end())
+        return true;
+
+    unsigned char header[HEADER_SIZE];
+    MakeHeader(header, vchKey.data(), vchKey.size(), pValue, fErase ? ERASED : nValueSize);
+    if (!WriteAll(file, header, HEADER_SIZE) || !WriteAll(file, vchKey.data(), vchKey.size()) ||
+        (!fErase && !WriteAll(file, pValue, nValueSize)) || fflush(file) != 0) {
+        // a torn record is cut off when the log is opened again, as long as nothing follows it
+        Close();
+        return error("%s : cannot write to %s", __func__, path.string());
+    }
+
+    if (it != mapLive.end()) {
+        nLiveBytes -= HEADER_SIZE + vchKey.size() + it->second.nSize;
+        mapLive.erase(it);
+    }
+    uint64_t nRecordSize = HEADER_SIZE + vchKey.size() + (fErase ? 0 : nValueSize);
+    if (!fErase) {
+        Record record;
+        record.nPos = nFileSize + HEADER_SIZE + vchKey.size();
+        record.nSize = nValueSize;
+        record.nOrder = nNextOrder++;
+        mapLive.insert(std::make_pair(vchKey, record));
+        nLiveBytes += nRecordSize;
+    }
+    nFileSize += nRecordSize;
+    fDirty = true;
+    return true;
+}
+
+bool CWalletLog::Flush()
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (fDirty) {
+        FileCommit(file);
+        fDirty = false;
+    }
+    return true;
+}
+
+bool CWalletLog::NeedsCompaction() const
+{
+    LOCK(cs);
+    return file && nFileSize > MIN_COMPACT_SIZE && nFileSize > 2 * (nLiveBytes + sizeof(LOG_MAGIC));
+}
+
+bool CWalletLog::WriteRecords(FILE* fileOut, const char* pBase, std::map<std::vector<char>, Record>& mapOut, uint64_t& nSizeOut)
+{
+    AssertLockHeld(cs);
+    std::vector<std::pair<const std::vector<char>*, uint64_t> > vOrder;
+    vOrder.reserve(mapLive.size());
+    for (std::map<std::vector<char>, Record>::const_iterator it = mapLive.begin(); it != mapLive.end(); ++it)
+        vOrder.push_back(std::make_pair(&it->first, it->second.nOrder));
+    std::sort(vOrder.begin(), vOrder.end(), CompareOrder());
+
+    mapOut.clear();
+    nSizeOut = sizeof(LOG_MAGIC);
+    if (!WriteAll(fileOut, LOG_MAGIC, sizeof(LOG_MAGIC)))
+        return false;
+    for (size_t i = 0; i < vOrder.size(); i++) {
+        const std::vector<char>& vchKey = *vOrder[i].first;
+        const Record& record = mapLive[vchKey];
+        unsigned char header[HEADER_SIZE];
+        MakeHeader(header, vchKey.data(), vchKey.size(), pBase + record.nPos, record.nSize);
+        if (!WriteAll(fileOut, header, HEADER_SIZE) || !WriteAll(fileOut, vchKey.data(), vchKey.size()) ||
+            !WriteAll(fileOut, pBase + record.nPos, record.nSize))
+            return false;
+        Record recordOut;
+        recordOut.nPos = nSizeOut + HEADER_SIZE + vchKey.size();
+        recordOut.nSize = record.nSize;
+        recordOut.nOrder = i;
+        mapOut.insert(std::make_pair(vchKey, recordOut));
+        nSizeOut += HEADER_SIZE + vchKey.size() + record.nSize;
+    }
+    FileCommit(fileOut);
+    return true;
+}
+
+bool CWalletLog::Compact()
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    int64_t nStart = GetTimeMillis();
+    uint64_t nOldSize = nFileSize;
+    boost::filesystem::path pathNew(path.string() + ".new");
+
+    std::map<std::vector<char>, Record> mapNew;
+    uint64_t nNewSize = 0;
+    {
+        FILE* fileNew = fopen(pathNew.string().c_str(), "wb");
+        if (!fileNew)
+            return error("%s : cannot create %s", __func__, pathNew.string());
+        fflush(file);
+        bool fWritten = false;
+        try {
+            boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+            boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+            fWritten = WriteRecords(fileNew, (const char*)region.get_address(), mapNew, nNewSize);
+        } catch (const boost::interprocess::interprocess_exception& e) {
+            LogPrintf("%s : cannot map %s: %s\n", __func__, path.string(), e.what());
+        }
+        fclose(fileNew);
+        if (!fWritten) {
+            boost::filesystem::remove(pathNew);
+            return error("%s : cannot write %s", __func__, pathNew.string());
+        }
+    }
+
+    // the new file is on disk before it takes the place of the old one
+    FileCommit(file);
+    fclose(file);
+    file = NULL;
+    if (!RenameOver(pathNew, path)) {
+        boost::filesystem::remove(pathNew);
+        file = fopen(path.string().c_str(), "ab");
+        return error("%s : cannot rename %s", __func__, pathNew.string());
+    }
+    file = fopen(path.string().c_str(), "ab");
+    if (!file)
+        return error("%s : cannot open %s", __func__, path.string());
+
+    mapLive.swap(mapNew);
+    nNextOrder = mapLive.size();
+    nFileSize = nNewSize;
+    nLiveBytes = nNewSize - sizeof(LOG_MAGIC);
+    fDirty = false;
+    LogPrint("db", "%s : %s from %u to %u bytes in %dms\n", __func__, path.filename().string(), nOldSize, nNewSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CWalletLog::CopyTo(const boost::filesystem::path& pathDest)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    FILE* fileOut = fopen(pathDest.string().c_str(), "wb");
+    if (!fileOut)
+        return error("%s : cannot create %s", __func__, pathDest.string());
+    fflush(file);
+    bool fWritten = false;
+    std::map<std::vector<char>, Record> mapOut;
+    uint64_t nSize = 0;
+    try {
+        boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+        fWritten = WriteRecords(fileOut, (const char*)region.get_address(), mapOut, nSize);
+    } catch (const boost::interprocess::interprocess_exception& e) {
+        LogPrintf("%s : cannot map %s: %s\n", __func__, path.string(), e.what());
+    }
+    fclose(fileOut);
+    if (!fWritten)
+        return error("%s : cannot write %s", __func__, pathDest.string());
+    return true;
+}
+
+size_t CWalletLog::GetCount() const
+{
+    LOCK(cs);
+    return mapLive.size();
+}
+
+uint64_t CWalletLog::GetFileSize() const
+{
+    LOCK(cs);
+    return nFileSize;
+}
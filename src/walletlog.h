@@ -0,0 +1,170 @@
+// Copyright (c) 2018 The Luxcore developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLETLOG_H
+#define BITCOIN_WALLETLOG_H
+
+#include "clientversion.h"
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+
+static const bool DEFAULT_WALLETLOG = false;
+
+/** Reads serialized objects straight out of a record of a mapped log, without copying it first */
+class CLogRecordReader
+{
+private:
+    const char* pbegin;
+    const char* pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CLogRecordReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn)
+        : pbegin(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    bool empty() const { return pbegin == pend; }
+    size_t size() const { return pend - pbegin; }
+    const char* data() const { return pbegin; }
+
+    CLogRecordReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CLogRecordReader::read() : end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CLogRecordReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/**
+ * An append-only file of key/value records. A write appends the new value of
+ * a key, an erase appends a tombstone; the last record of a key wins. Opening
+ * maps the file, checks each record and cuts off a torn write at the end;
+ * damage anywhere else is cut off too, but only after a copy of the file is
+ * kept, and IsDamaged tells the wallet to find its transactions again.
+ * Loading hands out the live records straight from the mapping. Once most of
+ * the file is records that were written over, Compact copies the live ones to
+ * a new file that takes its place.
+ */
+class CWalletLog
+{
+public:
+    typedef boost::function<bool(CLogRecordReader& key, CLogRecordReader& value)> LoadFunction;
+
+    explicit CWalletLog(const boost::filesystem::path& pathIn);
+    ~CWalletLog();
+
+    /** Open the log, creating it if it is missing */
+    bool Open();
+    void Close();
+
+    /** Call fn with every live record, in the order they were written; fn must not write to the log */
+    bool Load(const LoadFunction& fn);
+
+    template <typename K, typename T>
+    bool Write(const K& key, const T& value)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(64);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(10000);
+        ssValue << value;
+        return Append(std::vector<char>(ssKey.begin(), ssKey.end()), ssValue.empty() ? NULL : &ssValue[0], ssValue.size(), false);
+    }
+
+    template <typename K>
+    bool Erase(const K& key)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(64);
+        ssKey << key;
+        return Append(std::vector<char>(ssKey.begin(), ssKey.end()), NULL, 0, true);
+    }
+
+    template <typename K, typename T>
+    bool Read(const K& key, T& value)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(64);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (!ReadValue(std::vector<char>(ssKey.begin(), ssKey.end()), ssValue))
+            return false;
+        try {
+            ssValue >> value;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    template <typename K>
+    bool Exists(const K& key)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        LOCK(cs);
+        return mapLive.count(std::vector<char>(ssKey.begin(), ssKey.end())) != 0;
+    }
+
+    /** Get what was appended to the disk */
+    bool Flush();
+
+    /** Whether Compact would give back most of the file */
+    bool NeedsCompaction() const;
+    /** Rewrite the log with only its live records */
+    bool Compact();
+    /** Copy the live records to a log at pathDest */
+    bool CopyTo(const boost::filesystem::path& pathDest);
+
+    const boost::filesystem::path& GetPath() const { return path; }
+    /** Whether Open found damage before the end of the file, kept a copy of it and cut the log there */
+    bool IsDamaged() const { return fDamaged; }
+    size_t GetCount() const;
+    uint64_t GetFileSize() const;
+
+private:
+    struct Record {
+        uint64_t nPos;   //!< where the value starts in the file
+        uint32_t nSize;  //!< size of the value
+        uint64_t nOrder; //!< when it was written, to load records in that order
+    };
+
+    mutable CCriticalSection cs;
+    boost::filesystem::path path;
+    FILE* file;
+    uint64_t nFileSize;
+    uint64_t nLiveBytes;
+    uint64_t nNextOrder;
+    bool fDirty;
+    bool fDamaged;
+    std::map<std::vector<char>, Record> mapLive;
+
+    bool ReadValue(const std::vector<char>& vchKey, CDataStream& ssValue);
+    bool Append(const std::vector<char>& vchKey, const char* pValue, size_t nValueSize, bool fErase);
+    bool WriteRecords(FILE* fileOut, const char* pBase, std::map<std::vector<char>, Record>& mapOut, uint64_t& nSizeOut);
+};
+
+#endif // BITCOIN_WALLETLOG_H